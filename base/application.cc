@@ -1,7 +1,11 @@
 #include "base/application.h"
+#include "base/metrics.h"
+#include "base/progress_monitor.h"
 
 #include <boost/lexical_cast.hpp>
+#include <fcntl.h>
 #include <libgen.h>
+#include <limits.h>
 #include <linux/limits.h>
 #include <string.h>
 #include <stdlib.h>
@@ -47,7 +51,7 @@ application::run(int argc, char **argv)
 {
 	string cmd = get_basename(argv[0]);
 
-	if (cmd == string("pdata_tools")) {
+	if (cmd == name_) {
 		argc--;
 		argv++;
 
@@ -59,10 +63,23 @@ application::run(int argc, char **argv)
 		cmd = argv[0];
 	}
 
-	std::list<command::ptr>::const_iterator it;
-	for (it = cmds_.begin(); it != cmds_.end(); ++it) {
-		if (cmd == (*it)->get_name())
-			return (*it)->run(argc, argv);
+	command::ptr c = find_cmd(cmd);
+	if (c) {
+		if (!parse_stats_option(cmd, argc, argv)) {
+			std::cerr << "--stats needs an open file descriptor\n";
+			return 1;
+		}
+
+		if (!parse_progress_option(cmd, argc, argv)) {
+			std::cerr << "--progress needs an open file descriptor\n";
+			return 1;
+		}
+
+		int r = c->run(argc, argv);
+		if (!r)
+			complete_walk_progress();
+
+		return r;
 	}
 
 	std::cerr << "Unknown command '" << cmd << "'\n";
@@ -70,10 +87,22 @@ application::run(int argc, char **argv)
 	return 1;
 }
 
+command::ptr
+application::find_cmd(string const &name) const
+{
+	std::list<command::ptr>::const_iterator it;
+	for (it = cmds_.begin(); it != cmds_.end(); ++it) {
+		if (name == (*it)->get_name())
+			return *it;
+	}
+
+	return command::ptr();
+}
+
 void
 application::usage()
 {
-	std::cerr << "Usage: <command> <args>\n"
+	std::cerr << "Usage: <command> [--stats <fd>] [--progress <fd>] <args>\n"
 		  << "commands:\n";
 
 	std::list<command::ptr>::const_iterator it;
@@ -94,3 +123,48 @@ application::get_basename(std::string const &path) const
 }
 
 //----------------------------------------------------------------
+
+bool
+base::strip_fd_option(char const *name, int &argc, char **argv, int &fd)
+{
+	string const opt = string("--") + name;
+	string const opt_eq = opt + "=";
+
+	int out = 0;
+	char const *fd_str = NULL;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--")) {
+			while (i < argc)
+				argv[out++] = argv[i++];
+			break;
+		}
+
+		if (opt == argv[i]) {
+			if (i + 1 == argc)
+				return false;
+			fd_str = argv[++i];
+
+		} else if (!strncmp(argv[i], opt_eq.c_str(), opt_eq.length()))
+			fd_str = argv[i] + opt_eq.length();
+
+		else
+			argv[out++] = argv[i];
+	}
+
+	argv[out] = NULL;
+	argc = out;
+
+	if (!fd_str)
+		return true;
+
+	char *end;
+	long n = strtol(fd_str, &end, 10);
+	if (!*fd_str || *end || n < 0 || n > INT_MAX || ::fcntl(n, F_GETFD) < 0)
+		return false;
+
+	fd = n;
+	return true;
+}
+
+//----------------------------------------------------------------
@@ -53,18 +53,33 @@ namespace base {
 
 	class application {
 	public:
+		// |name| is the name of the multiplexing binary, which
+		// takes the command name as its first argument.
+		application(std::string const &name = "pdata_tools")
+			: name_(name) {
+		}
+
 		void add_cmd(command::ptr c) {
 			cmds_.push_back(c);
 		}
 
 		int run(int argc, char **argv);
 
+		// Returns a null pointer if there's no such command.
+		command::ptr find_cmd(std::string const &name) const;
+
 	private:
 		void usage();
 		std::string get_basename(std::string const &path) const;
 
+		std::string name_;
 		std::list<command::ptr> cmds_;
 	};
+
+	// Removes "--<name> <fd>" or "--<name>=<fd>" from the arguments,
+	// stopping at any "--".  |fd| is left alone if the option isn't
+	// given.  Returns false if it's malformed, or the fd isn't open.
+	bool strip_fd_option(char const *name, int &argc, char **argv, int &fd);
 }
 
 //----------------------------------------------------------------
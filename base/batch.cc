@@ -0,0 +1,530 @@
+#include "base/batch.h"
+
+#include "base/error_string.h"
+#include "block-cache/block_cache.h"
+#include "version.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <linux/limits.h>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace base;
+using namespace batch_detail;
+using namespace std;
+
+//----------------------------------------------------------------
+
+bool
+batch_detail::parse_job(string const &line, job &j)
+{
+	istringstream in(line);
+	string word;
+
+	j.args.clear();
+	while (in >> word)
+		j.args.push_back(word);
+
+	if (j.args.empty() || j.args.front()[0] == '#')
+		return false;
+
+	if (j.args.size() < 2)
+		throw runtime_error("no device given for batch job '" + line + "'");
+
+	return true;
+}
+
+//----------------------------------------------------------------
+
+namespace {
+	string dev_name(dev_t dev) {
+		ostringstream out;
+		out << major(dev) << ":" << minor(dev);
+		return out.str();
+	}
+
+	bool exists(string const &path) {
+		struct stat info;
+		return !::stat(path.c_str(), &info);
+	}
+
+	string real_path(string const &path) {
+		char buffer[PATH_MAX + 1];
+		if (!::realpath(path.c_str(), buffer))
+			return "";
+
+		return buffer;
+	}
+
+	vector<string> list_dir(string const &path) {
+		vector<string> entries;
+
+		DIR *dir = ::opendir(path.c_str());
+		if (!dir)
+			return entries;
+
+		struct dirent *de;
+		while ((de = ::readdir(dir))) {
+			string name(de->d_name);
+			if (name != "." && name != "..")
+				entries.push_back(name);
+		}
+
+		::closedir(dir);
+		return entries;
+	}
+
+	// dir is a device's directory in sysfs.  Device-mapper
+	// devices list the devices they sit on as slaves.
+	void find_disks(string dir, set<string> &disks, unsigned depth) {
+		if (exists(dir + "/partition"))
+			dir = dir.substr(0, dir.rfind('/'));
+
+		vector<string> slaves = list_dir(dir + "/slaves");
+		if (slaves.empty() || depth > 8) {
+			disks.insert(dir.substr(dir.rfind('/') + 1));
+			return;
+		}
+
+		vector<string>::const_iterator it;
+		for (it = slaves.begin(); it != slaves.end(); ++it) {
+			string slave = real_path(dir + "/slaves/" + *it);
+			if (!slave.empty())
+				find_disks(slave, disks, depth + 1);
+		}
+	}
+}
+
+set<string>
+batch_detail::underlying_disks(string const &path)
+{
+	set<string> disks;
+
+	// A missing device gets a disk of its own; the job will fail
+	// soon enough.
+	struct stat info;
+	if (::stat(path.c_str(), &info) < 0) {
+		disks.insert(path);
+		return disks;
+	}
+
+	dev_t dev = S_ISBLK(info.st_mode) ? info.st_rdev : info.st_dev;
+	string dir = real_path("/sys/dev/block/" + dev_name(dev));
+	if (dir.empty())
+		disks.insert(dev_name(dev));
+	else
+		find_disks(dir, disks, 0);
+
+	return disks;
+}
+
+//----------------------------------------------------------------
+
+scheduler::scheduler(unsigned max_jobs, unsigned jobs_per_disk)
+	: max_jobs_(max_jobs),
+	  jobs_per_disk_(jobs_per_disk),
+	  nr_running_(0),
+	  nr_finished_(0)
+{
+}
+
+unsigned
+scheduler::add_job(set<string> const &disks)
+{
+	disks_.push_back(disks);
+	states_.push_back(PENDING);
+	return states_.size() - 1;
+}
+
+boost::optional<unsigned>
+scheduler::next()
+{
+	if (nr_running_ >= max_jobs_)
+		return boost::optional<unsigned>();
+
+	for (unsigned j = 0; j < states_.size(); j++) {
+		if (states_[j] != PENDING || !runnable(j))
+			continue;
+
+		set<string>::const_iterator it;
+		for (it = disks_[j].begin(); it != disks_[j].end(); ++it)
+			busy_[*it]++;
+
+		states_[j] = RUNNING;
+		nr_running_++;
+		return j;
+	}
+
+	return boost::optional<unsigned>();
+}
+
+void
+scheduler::finished(unsigned j)
+{
+	if (states_.at(j) != RUNNING)
+		throw runtime_error("batch job finished without being started");
+
+	set<string>::const_iterator it;
+	for (it = disks_[j].begin(); it != disks_[j].end(); ++it)
+		busy_[*it]--;
+
+	states_[j] = FINISHED;
+	nr_running_--;
+	nr_finished_++;
+}
+
+bool
+scheduler::done() const
+{
+	return nr_finished_ == states_.size();
+}
+
+bool
+scheduler::runnable(unsigned j) const
+{
+	set<string>::const_iterator it;
+	for (it = disks_[j].begin(); it != disks_[j].end(); ++it) {
+		map<string, unsigned>::const_iterator b = busy_.find(*it);
+		if (b != busy_.end() && b->second >= jobs_per_disk_)
+			return false;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------
+
+namespace {
+	struct limits {
+		limits()
+			: max_jobs(4),
+			  jobs_per_disk(1),
+			  io_depth(64),
+			  mem(256ull * 1024 * 1024) {
+		}
+
+		unsigned max_jobs;
+		unsigned jobs_per_disk;
+		unsigned io_depth;
+		uint64_t mem;
+	};
+
+	struct result {
+		result()
+			: log(NULL),
+			  status(0),
+			  start(0.0),
+			  seconds(0.0) {
+		}
+
+		FILE *log;
+		int status;
+		double start;
+		double seconds;
+	};
+
+	double now() {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec / 1000000.0;
+	}
+
+	vector<job> read_jobs(string const &path) {
+		ifstream file;
+		if (path != "-") {
+			file.open(path.c_str());
+			if (!file)
+				throw runtime_error("couldn't open batch list " + path);
+		}
+
+		istream &in = (path == "-") ? cin : file;
+
+		vector<job> jobs;
+		string line;
+		while (getline(in, line)) {
+			job j;
+			if (parse_job(line, j))
+				jobs.push_back(j);
+		}
+
+		return jobs;
+	}
+
+	// The commands weren't written to share a process: they parse
+	// their options with getopt, and some exit() on error.  So each
+	// job runs in a child of the batch process, with its output
+	// going to a temporary file.
+	void run_job(command::ptr cmd, job const &j, FILE *log,
+		     size_t mem, unsigned io_depth) {
+		int null = ::open("/dev/null", O_RDONLY);
+		if (null >= 0)
+			::dup2(null, 0);
+
+		::dup2(fileno(log), 1);
+		::dup2(fileno(log), 2);
+
+		bcache::block_cache::set_limits(mem, io_depth);
+
+		vector<char *> argv;
+		vector<string>::const_iterator it;
+		for (it = j.args.begin(); it != j.args.end(); ++it)
+			argv.push_back(const_cast<char *>(it->c_str()));
+		argv.push_back(NULL);
+
+		// The batch command has already used getopt.
+		optind = 0;
+
+		int r;
+		try {
+			r = cmd->run(argv.size() - 1, &argv[0]);
+
+		} catch (std::exception &e) {
+			cerr << e.what() << endl;
+			r = 1;
+		}
+
+		cout.flush();
+		cerr.flush();
+		fflush(NULL);
+		::_exit(r);
+	}
+
+	void report_output(job const &j, FILE *log) {
+		rewind(log);
+
+		char buffer[4096];
+		while (fgets(buffer, sizeof(buffer), log))
+			cerr << j.get_device() << ": " << buffer;
+	}
+
+	bool passed(result const &r) {
+		return WIFEXITED(r.status) && !WEXITSTATUS(r.status);
+	}
+
+	void print_summary(vector<job> const &jobs, vector<result> const &results) {
+		for (unsigned i = 0; i < jobs.size(); i++) {
+			result const &r = results[i];
+
+			cout << jobs[i].get_device() << "\t" << jobs[i].get_cmd() << "\t";
+
+			if (WIFEXITED(r.status))
+				cout << (passed(r) ? "pass" : "fail") << "\t" << WEXITSTATUS(r.status);
+			else
+				cout << "killed\t" << (WIFSIGNALED(r.status) ? WTERMSIG(r.status) : 0);
+
+			cout << "\t" << fixed << setprecision(2) << r.seconds << endl;
+		}
+	}
+
+	int run_batch(application const &app, vector<job> const &jobs,
+		      limits const &ls, bool quiet) {
+		vector<command::ptr> cmds;
+		scheduler s(ls.max_jobs, ls.jobs_per_disk);
+		for (unsigned i = 0; i < jobs.size(); i++) {
+			command::ptr cmd = app.find_cmd(jobs[i].get_cmd());
+			if (!cmd || jobs[i].get_cmd() == "pdata_batch")
+				throw runtime_error("unknown command '" + jobs[i].get_cmd() + "' in batch list");
+
+			cmds.push_back(cmd);
+			s.add_job(underlying_disks(jobs[i].get_device()));
+		}
+
+		// Share the memory between the jobs running at once, and
+		// each disk's io depth between the jobs on it.
+		size_t job_mem = ls.mem / ls.max_jobs;
+		unsigned job_io = max(1u, ls.io_depth / ls.jobs_per_disk);
+
+		vector<result> results(jobs.size());
+		map<pid_t, unsigned> running;
+
+		// Don't let anything buffered be written twice.
+		cout.flush();
+		cerr.flush();
+		fflush(NULL);
+
+		while (!s.done()) {
+			boost::optional<unsigned> j;
+			while ((j = s.next())) {
+				result &r = results[*j];
+				r.start = now();
+				r.log = tmpfile();
+
+				pid_t pid = r.log ? ::fork() : -1;
+				if (!pid)
+					run_job(cmds[*j], jobs[*j], r.log, job_mem, job_io);
+
+				if (pid < 0) {
+					cerr << jobs[*j].get_device() << ": couldn't start "
+					     << jobs[*j].get_cmd() << ": " << error_string(errno) << endl;
+					r.status = 1 << 8;
+					s.finished(*j);
+					continue;
+				}
+
+				running[pid] = *j;
+			}
+
+			if (running.empty())
+				continue;
+
+			int status;
+			pid_t pid = ::waitpid(-1, &status, 0);
+			if (pid < 0) {
+				if (errno == EINTR)
+					continue;
+
+				throw runtime_error("waitpid failed: " + error_string(errno));
+			}
+
+			map<pid_t, unsigned>::iterator it = running.find(pid);
+			if (it == running.end())
+				continue;
+
+			unsigned done = it->second;
+			running.erase(it);
+
+			result &r = results[done];
+			r.status = status;
+			r.seconds = now() - r.start;
+
+			if (!quiet)
+				report_output(jobs[done], r.log);
+
+			fclose(r.log);
+			r.log = NULL;
+			s.finished(done);
+		}
+
+		print_summary(jobs, results);
+
+		for (unsigned i = 0; i < results.size(); i++)
+			if (!passed(results[i]))
+				return 1;
+
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+batch_cmd::batch_cmd(application const &app)
+	: command("pdata_batch"),
+	  app_(app)
+{
+}
+
+void
+batch_cmd::usage(std::ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options] {job list|-}" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-j|--jobs} <nr jobs>" << endl
+	    << "  {--jobs-per-disk} <nr jobs>" << endl
+	    << "  {--io-depth} <nr ios>" << endl
+	    << "  {--memory} <MiB>" << endl
+	    << "  {-q|--quiet}" << endl
+	    << "  {-V|--version}" << endl;
+}
+
+int
+batch_cmd::run(int argc, char **argv)
+{
+	int c;
+	char *end;
+	limits ls;
+	bool quiet = false;
+
+	char const shortopts[] = "hj:qV";
+	option const longopts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "jobs", required_argument, NULL, 'j'},
+		{ "quiet", no_argument, NULL, 'q'},
+		{ "version", no_argument, NULL, 'V'},
+		{ "jobs-per-disk", required_argument, NULL, 1},
+		{ "io-depth", required_argument, NULL, 2},
+		{ "memory", required_argument, NULL, 3},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 'j':
+			ls.max_jobs = strtoul(optarg, &end, 10);
+			if (*end || !ls.max_jobs) {
+				cerr << "invalid number of jobs: " << optarg << endl;
+				return 1;
+			}
+			break;
+
+		case 'q':
+			quiet = true;
+			break;
+
+		case 'V':
+			cout << THIN_PROVISIONING_TOOLS_VERSION << endl;
+			return 0;
+
+		case 1:
+			ls.jobs_per_disk = strtoul(optarg, &end, 10);
+			if (*end || !ls.jobs_per_disk) {
+				cerr << "invalid number of jobs per disk: " << optarg << endl;
+				return 1;
+			}
+			break;
+
+		case 2:
+			ls.io_depth = strtoul(optarg, &end, 10);
+			if (*end || !ls.io_depth) {
+				cerr << "invalid io depth: " << optarg << endl;
+				return 1;
+			}
+			break;
+
+		case 3:
+			ls.mem = strtoull(optarg, &end, 10) * 1024 * 1024;
+			if (*end || !ls.mem) {
+				cerr << "invalid memory size: " << optarg << endl;
+				return 1;
+			}
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (argc == optind) {
+		cerr << "No job list provided." << endl;
+		usage(cerr);
+		return 1;
+	}
+
+	try {
+		vector<job> jobs = read_jobs(argv[optind]);
+		return run_batch(app_, jobs, ls, quiet);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
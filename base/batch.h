@@ -0,0 +1,95 @@
+#ifndef BASE_BATCH_H
+#define BASE_BATCH_H
+
+#include "base/application.h"
+
+#include <boost/optional.hpp>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace base {
+	namespace batch_detail {
+		// One line of a batch list: a command, its options, and the
+		// metadata device last.
+		struct job {
+			std::vector<std::string> args;
+
+			std::string const &get_cmd() const {
+				return args.front();
+			}
+
+			std::string const &get_device() const {
+				return args.back();
+			}
+		};
+
+		// Returns false for blank lines and comments.  Throws if
+		// there's no device.
+		bool parse_job(std::string const &line, job &j);
+
+		// The whole disks a device or file lives on, looking through
+		// partitions and device-mapper devices (such as LVM volumes)
+		// via sysfs.  If sysfs can't say, the device number stands
+		// in for the disk.
+		std::set<std::string> underlying_disks(std::string const &path);
+
+		// Decides which job may start next.  No more than max_jobs
+		// run at once, and no more than jobs_per_disk of them may
+		// touch any one disk.  Jobs start in the order they were
+		// added, except that a job waiting for a busy disk doesn't
+		// hold up the ones behind it.
+		class scheduler {
+		public:
+			scheduler(unsigned max_jobs, unsigned jobs_per_disk);
+
+			unsigned add_job(std::set<std::string> const &disks);
+
+			// Marks the job returned as running.
+			boost::optional<unsigned> next();
+			void finished(unsigned j);
+
+			bool done() const;
+
+		private:
+			enum state {
+				PENDING,
+				RUNNING,
+				FINISHED
+			};
+
+			bool runnable(unsigned j) const;
+
+			unsigned max_jobs_;
+			unsigned jobs_per_disk_;
+
+			std::vector<std::set<std::string> > disks_;
+			std::vector<state> states_;
+			std::map<std::string, unsigned> busy_;
+			unsigned nr_running_;
+			unsigned nr_finished_;
+		};
+	}
+
+	// Runs the commands in a list concurrently, such as every
+	// thin_check and cache_check needed at boot, within a shared
+	// memory budget and io depth per disk.  A summary line is
+	// printed for each one.
+	class batch_cmd : public command {
+	public:
+		batch_cmd(application const &app);
+
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+
+	private:
+		application const &app_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
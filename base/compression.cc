@@ -0,0 +1,377 @@
+#include "base/compression.h"
+#include "base/mutex_lock.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+
+using namespace base;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	size_t const BUFFER_SIZE = 1024 * 1024;
+
+	// windowBits of 15 + 16 selects the gzip wrapper.
+	int const GZIP_WINDOW_BITS = 15 + 16;
+
+	void zlib_error(char const *what, int r, z_stream const &zs) {
+		ostringstream out;
+		out << what << " failed (" << r << ")";
+		if (zs.msg)
+			out << ": " << zs.msg;
+		throw runtime_error(out.str());
+	}
+}
+
+//----------------------------------------------------------------
+
+bool
+base::is_compressed_file(string const &path)
+{
+	unsigned char magic[2];
+	ifstream in(path.c_str(), ifstream::in | ifstream::binary);
+
+	in.read(reinterpret_cast<char *>(magic), sizeof(magic));
+	return in.gcount() == sizeof(magic) &&
+		magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+//----------------------------------------------------------------
+
+compressor_buf::compressor_buf(ostream &out, int level)
+	: out_(out),
+	  closed_(false),
+	  fill_(BUFFER_SIZE),
+	  work_(BUFFER_SIZE),
+	  deflated_(BUFFER_SIZE),
+	  work_len_(0),
+	  work_ready_(false),
+	  busy_(false),
+	  finishing_(false)
+{
+	memset(&zs_, 0, sizeof(zs_));
+	int r = deflateInit2(&zs_, level, Z_DEFLATED, GZIP_WINDOW_BITS,
+			     8, Z_DEFAULT_STRATEGY);
+	if (r != Z_OK)
+		zlib_error("deflateInit2", r, zs_);
+
+	pthread_mutex_init(&lock_, NULL);
+	pthread_cond_init(&cond_, NULL);
+
+	if (pthread_create(&thread_, NULL, worker_, this)) {
+		deflateEnd(&zs_);
+		pthread_cond_destroy(&cond_);
+		pthread_mutex_destroy(&lock_);
+		throw runtime_error("couldn't create compression thread");
+	}
+
+	setp(&fill_[0], &fill_[0] + fill_.size());
+}
+
+compressor_buf::~compressor_buf()
+{
+	try {
+		close();
+
+	} catch (...) {
+	}
+
+	deflateEnd(&zs_);
+	pthread_cond_destroy(&cond_);
+	pthread_mutex_destroy(&lock_);
+}
+
+void
+compressor_buf::close()
+{
+	if (closed_)
+		return;
+
+	closed_ = true;
+	hand_over();
+
+	{
+		mutex_lock l(lock_);
+		finishing_ = true;
+		pthread_cond_broadcast(&cond_);
+	}
+
+	pthread_join(thread_, NULL);
+	check_error();
+
+	deflate_buffer(NULL, 0, Z_FINISH);
+	out_.flush();
+}
+
+compressor_buf::int_type
+compressor_buf::overflow(int_type c)
+{
+	if (closed_)
+		return traits_type::eof();
+
+	try {
+		hand_over();
+
+	} catch (...) {
+		return traits_type::eof();
+	}
+
+	if (!traits_type::eq_int_type(c, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+
+	return traits_type::not_eof(c);
+}
+
+// The emitters flush the stream when they finish, there's no
+// point doing a zlib flush at that point, it just costs ratio.  We
+// make sure the data's on its way though.
+int
+compressor_buf::sync()
+{
+	if (closed_)
+		return 0;
+
+	try {
+		hand_over();
+
+	} catch (...) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Waits for the worker to be idle, then swaps the full buffer for
+// the one it last compressed.
+void
+compressor_buf::hand_over()
+{
+	size_t len = pptr() - pbase();
+
+	{
+		mutex_lock l(lock_);
+		while (work_ready_ || busy_)
+			pthread_cond_wait(&cond_, &lock_);
+	}
+
+	check_error();
+
+	if (len) {
+		mutex_lock l(lock_);
+		fill_.swap(work_);
+		work_len_ = len;
+		work_ready_ = true;
+		pthread_cond_broadcast(&cond_);
+	}
+
+	setp(&fill_[0], &fill_[0] + fill_.size());
+}
+
+void *
+compressor_buf::worker_(void *context)
+{
+	static_cast<compressor_buf *>(context)->worker();
+	return NULL;
+}
+
+void
+compressor_buf::worker()
+{
+	for (;;) {
+		{
+			mutex_lock l(lock_);
+			while (!work_ready_ && !finishing_)
+				pthread_cond_wait(&cond_, &lock_);
+
+			if (!work_ready_)
+				break;
+
+			work_ready_ = false;
+			busy_ = true;
+		}
+
+		string error;
+		try {
+			deflate_buffer(&work_[0], work_len_, Z_NO_FLUSH);
+
+		} catch (std::exception &e) {
+			error = e.what();
+		}
+
+		{
+			mutex_lock l(lock_);
+			busy_ = false;
+			if (!error.empty() && error_.empty())
+				error_ = error;
+			pthread_cond_broadcast(&cond_);
+		}
+	}
+}
+
+void
+compressor_buf::check_error()
+{
+	mutex_lock l(lock_);
+	if (!error_.empty())
+		throw runtime_error(error_);
+}
+
+void
+compressor_buf::deflate_buffer(char const *data, size_t len, int flush)
+{
+	zs_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	zs_.avail_in = len;
+
+	for (;;) {
+		zs_.next_out = reinterpret_cast<Bytef *>(&deflated_[0]);
+		zs_.avail_out = deflated_.size();
+
+		int r = deflate(&zs_, flush);
+		if (r == Z_STREAM_ERROR)
+			zlib_error("deflate", r, zs_);
+
+		size_t produced = deflated_.size() - zs_.avail_out;
+		if (produced) {
+			out_.write(&deflated_[0], produced);
+			if (!out_)
+				throw runtime_error("couldn't write compressed output");
+		}
+
+		if (flush == Z_FINISH ? r == Z_STREAM_END : zs_.avail_out != 0)
+			break;
+	}
+}
+
+//----------------------------------------------------------------
+
+compressing_ostream::compressing_ostream(ostream &out, int level)
+	: std::ostream(NULL),
+	  buf_(out, level)
+{
+	rdbuf(&buf_);
+}
+
+void
+compressing_ostream::close()
+{
+	buf_.close();
+}
+
+//----------------------------------------------------------------
+
+decompressor_buf::decompressor_buf(istream &in)
+	: in_(in),
+	  eof_(false),
+	  in_member_(false),
+	  in_buf_(BUFFER_SIZE),
+	  out_buf_(BUFFER_SIZE)
+{
+	memset(&zs_, 0, sizeof(zs_));
+	int r = inflateInit2(&zs_, GZIP_WINDOW_BITS);
+	if (r != Z_OK)
+		zlib_error("inflateInit2", r, zs_);
+
+	setg(&out_buf_[0], &out_buf_[0], &out_buf_[0]);
+}
+
+decompressor_buf::~decompressor_buf()
+{
+	inflateEnd(&zs_);
+}
+
+bool
+decompressor_buf::fill_input()
+{
+	if (eof_)
+		return false;
+
+	in_.read(&in_buf_[0], in_buf_.size());
+	size_t len = in_.gcount();
+	if (!len) {
+		eof_ = true;
+		return false;
+	}
+
+	zs_.next_in = reinterpret_cast<Bytef *>(&in_buf_[0]);
+	zs_.avail_in = len;
+	return true;
+}
+
+decompressor_buf::int_type
+decompressor_buf::underflow()
+{
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+
+	zs_.next_out = reinterpret_cast<Bytef *>(&out_buf_[0]);
+	zs_.avail_out = out_buf_.size();
+
+	while (zs_.avail_out == out_buf_.size()) {
+		if (!zs_.avail_in && !fill_input()) {
+			if (in_member_)
+				throw runtime_error("truncated compressed input");
+			break;
+		}
+
+		in_member_ = true;
+		int r = inflate(&zs_, Z_NO_FLUSH);
+		if (r == Z_STREAM_END) {
+			in_member_ = false;
+
+			// Another member may follow.
+			if (!zs_.avail_in && !fill_input())
+				break;
+
+			r = inflateReset(&zs_);
+		}
+
+		if (r != Z_OK && r != Z_BUF_ERROR)
+			zlib_error("inflate", r, zs_);
+	}
+
+	size_t produced = out_buf_.size() - zs_.avail_out;
+	setg(&out_buf_[0], &out_buf_[0], &out_buf_[0] + produced);
+
+	if (!produced)
+		return traits_type::eof();
+
+	return traits_type::to_int_type(*gptr());
+}
+
+//----------------------------------------------------------------
+
+// Errors from the decompressor are thrown from underflow(), the
+// stream would otherwise swallow them and just set badbit.
+decompressing_istream::decompressing_istream(istream &in)
+	: std::istream(NULL),
+	  buf_(in)
+{
+	rdbuf(&buf_);
+	exceptions(ios_base::badbit);
+}
+
+//----------------------------------------------------------------
+
+file_offset_monitor::file_offset_monitor(progress_monitor &monitor,
+					 istream &file, size_t file_length)
+	: monitor_(monitor),
+	  file_(file),
+	  file_length_(file_length)
+{
+}
+
+void
+file_offset_monitor::update_percent(unsigned)
+{
+	streamoff pos = file_.tellg();
+
+	if (pos >= 0 && file_length_)
+		monitor_.update_percent(static_cast<uint64_t>(pos) * 100 / file_length_);
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,132 @@
+#ifndef BASE_COMPRESSION_H
+#define BASE_COMPRESSION_H
+
+#include "base/progress_monitor.h"
+
+#include <boost/noncopyable.hpp>
+#include <istream>
+#include <ostream>
+#include <pthread.h>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+//----------------------------------------------------------------
+
+namespace base {
+	// Checks for the gzip magic bytes.
+	bool is_compressed_file(std::string const &path);
+
+	//--------------------------------
+
+	// Gzip compresses everything written to it onto another stream.
+	// The deflate runs on its own thread, so it overlaps with whatever
+	// is producing the data (eg, walking the metadata btrees).  Data
+	// is handed over a buffer at a time; the producer only blocks if
+	// it fills a second buffer before the first has been compressed.
+	class compressor_buf : public std::streambuf, private boost::noncopyable {
+	public:
+		compressor_buf(std::ostream &out, int level);
+		~compressor_buf();
+
+		// Flushes everything, and writes the gzip trailer.  Throws
+		// if anything went wrong on the compression thread.
+		void close();
+
+	protected:
+		int_type overflow(int_type c);
+		int sync();
+
+	private:
+		static void *worker_(void *context);
+
+		void worker();
+		void hand_over();
+		void deflate_buffer(char const *data, size_t len, int flush);
+		void check_error();
+
+		std::ostream &out_;
+		z_stream zs_;
+		bool closed_;
+
+		std::vector<char> fill_;
+		std::vector<char> work_;
+		std::vector<char> deflated_;
+		size_t work_len_;
+
+		pthread_t thread_;
+		pthread_mutex_t lock_;
+		pthread_cond_t cond_;
+		bool work_ready_;
+		bool busy_;
+		bool finishing_;
+		std::string error_;
+	};
+
+	class compressing_ostream : public std::ostream {
+	public:
+		compressing_ostream(std::ostream &out,
+				    int level = Z_DEFAULT_COMPRESSION);
+
+		void close();
+
+	private:
+		compressor_buf buf_;
+	};
+
+	//--------------------------------
+
+	// Decompresses gzip data read from another stream.  Concatenated
+	// gzip members are read as a single stream, as gunzip does.
+	class decompressor_buf : public std::streambuf, private boost::noncopyable {
+	public:
+		decompressor_buf(std::istream &in);
+		~decompressor_buf();
+
+	protected:
+		int_type underflow();
+
+	private:
+		bool fill_input();
+
+		std::istream &in_;
+		z_stream zs_;
+		bool eof_;
+		bool in_member_;
+
+		std::vector<char> in_buf_;
+		std::vector<char> out_buf_;
+	};
+
+	class decompressing_istream : public std::istream {
+	public:
+		decompressing_istream(std::istream &in);
+
+	private:
+		decompressor_buf buf_;
+	};
+
+	//--------------------------------
+
+	// When reading compressed input, the amount of data consumed says
+	// little about how far through the file we are.  This reports
+	// progress from the read offset of the underlying file instead,
+	// ignoring the percentage it's given.
+	class file_offset_monitor : public progress_monitor {
+	public:
+		file_offset_monitor(progress_monitor &monitor, std::istream &file,
+				    size_t file_length);
+
+		void update_percent(unsigned);
+
+	private:
+		progress_monitor &monitor_;
+		std::istream &file_;
+		size_t file_length_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
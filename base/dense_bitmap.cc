@@ -0,0 +1,131 @@
+#include "base/dense_bitmap.h"
+
+#include "base/endian_utils.h"
+
+#include <ostream>
+
+using namespace base;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	unsigned const BITS_PER_WORD = 64;
+
+	// The bits of a word that are at, or above, bit.
+	uint64_t from_mask(unsigned bit) {
+		return ~0ull << bit;
+	}
+}
+
+//----------------------------------------------------------------
+
+dense_bitmap::dense_bitmap(uint64_t nr_bits)
+	: nr_bits_(nr_bits),
+	  words_((nr_bits + BITS_PER_WORD - 1) / BITS_PER_WORD, 0)
+{
+}
+
+void
+dense_bitmap::set_range(uint64_t b, uint64_t e)
+{
+	if (b > e || e > nr_bits_)
+		throw runtime_error("dense_bitmap range out of bounds");
+
+	while (b != e) {
+		uint64_t w = b / BITS_PER_WORD;
+		unsigned lo = b % BITS_PER_WORD;
+		uint64_t word_end = (w + 1) * BITS_PER_WORD;
+
+		if (e >= word_end) {
+			words_[w] |= from_mask(lo);
+			b = word_end;
+		} else {
+			words_[w] |= from_mask(lo) & ~from_mask(e % BITS_PER_WORD);
+			b = e;
+		}
+	}
+}
+
+void
+dense_bitmap::or_word(uint64_t word_index, uint64_t w)
+{
+	if (word_index >= words_.size())
+		return;
+
+	if (word_index == words_.size() - 1 && nr_bits_ % BITS_PER_WORD)
+		w &= ~from_mask(nr_bits_ % BITS_PER_WORD);
+
+	words_[word_index] |= w;
+}
+
+uint64_t
+dense_bitmap::count() const
+{
+	uint64_t total = 0;
+	for (size_t w = 0; w < words_.size(); w++)
+		total += __builtin_popcountll(words_[w]);
+
+	return total;
+}
+
+bool
+dense_bitmap::next_run(uint64_t from, uint64_t &begin, uint64_t &end) const
+{
+	begin = find_set(from);
+	if (begin >= nr_bits_)
+		return false;
+
+	end = find_clear(begin);
+	return true;
+}
+
+void
+dense_bitmap::write(ostream &out) const
+{
+	vector<le64> disk(words_.size());
+	for (size_t w = 0; w < words_.size(); w++)
+		disk[w] = to_disk<le64>(words_[w]);
+
+	if (disk.size())
+		out.write(reinterpret_cast<char const *>(&disk[0]),
+			  disk.size() * sizeof(le64));
+}
+
+// The unused bits of the last word are always zero, so it's safe to
+// search them for set bits.
+uint64_t
+dense_bitmap::find_set(uint64_t from) const
+{
+	uint64_t w = from / BITS_PER_WORD;
+	if (w >= words_.size())
+		return nr_bits_;
+
+	uint64_t word = words_[w] & from_mask(from % BITS_PER_WORD);
+	while (!word) {
+		if (++w == words_.size())
+			return nr_bits_;
+		word = words_[w];
+	}
+
+	return w * BITS_PER_WORD + __builtin_ctzll(word);
+}
+
+uint64_t
+dense_bitmap::find_clear(uint64_t from) const
+{
+	uint64_t w = from / BITS_PER_WORD;
+	if (w >= words_.size())
+		return nr_bits_;
+
+	uint64_t word = ~words_[w] & from_mask(from % BITS_PER_WORD);
+	while (!word) {
+		if (++w == words_.size())
+			return nr_bits_;
+		word = ~words_[w];
+	}
+
+	return min<uint64_t>(nr_bits_, w * BITS_PER_WORD + __builtin_ctzll(word));
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,68 @@
+#ifndef BASE_DENSE_BITMAP_H
+#define BASE_DENSE_BITMAP_H
+
+#include <iosfwd>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace base {
+	// A fixed size bitmap held in memory.  A bit per block is far
+	// smaller than a std::set of block numbers once more than a
+	// few percent of the blocks are present, and runs can be found
+	// a word at a time.
+	class dense_bitmap {
+	public:
+		dense_bitmap(uint64_t nr_bits);
+
+		uint64_t get_nr_bits() const {
+			return nr_bits_;
+		}
+
+		bool test(uint64_t b) const {
+			check_bounds(b);
+			return words_[b / 64] & (1ull << (b % 64));
+		}
+
+		void set(uint64_t b) {
+			check_bounds(b);
+			words_[b / 64] |= 1ull << (b % 64);
+		}
+
+		// Sets the bits [b, e).
+		void set_range(uint64_t b, uint64_t e);
+
+		// ORs in a whole word.  Bits past the end of the bitmap
+		// are dropped.
+		void or_word(uint64_t word_index, uint64_t w);
+
+		uint64_t count() const;
+
+		// Finds the first run of set bits at or after 'from'.
+		// Returns false if there isn't one.
+		bool next_run(uint64_t from, uint64_t &begin, uint64_t &end) const;
+
+		// Writes the bitmap as little endian 64 bit words.  Bit
+		// n is bit (n % 64) of word (n / 64), and the unused bits
+		// of the last word are zero.
+		void write(std::ostream &out) const;
+
+	private:
+		void check_bounds(uint64_t b) const {
+			if (b >= nr_bits_)
+				throw std::runtime_error("dense_bitmap index out of bounds");
+		}
+
+		uint64_t find_set(uint64_t from) const;
+		uint64_t find_clear(uint64_t from) const;
+
+		uint64_t nr_bits_;
+		std::vector<uint64_t> words_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -1,11 +1,16 @@
 #ifndef BASE_INDENTED_STREAM_H
 #define BASE_INDENTED_STREAM_H
 
+#include "base/output_buffer.h"
+
 #include <iostream>
 
 //----------------------------------------------------------------
 
 namespace {
+	// Output goes through a base::output_buffer, so nothing reaches
+	// the underlying stream until the indented_stream is destroyed,
+	// or its buffer fills.
 	class indented_stream {
 	public:
 		indented_stream(std::ostream &out)
@@ -14,8 +19,7 @@ namespace {
 		}
 
 		void indent() {
-			for (unsigned i = 0; i < indent_ * 2; i++)
-				out_ << ' ';
+			out_.spaces(indent_ * 2);
 		}
 
 		void inc() {
@@ -26,6 +30,10 @@ namespace {
 			indent_--;
 		}
 
+		void flush() {
+			out_.flush();
+		}
+
 		template <typename T>
 		indented_stream &operator <<(T const &t) {
 			out_ << t;
@@ -38,7 +46,7 @@ namespace {
 		}
 
 	private:
-		std::ostream &out_;
+		base::output_buffer out_;
 		unsigned indent_;
 	};
 }
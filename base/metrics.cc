@@ -0,0 +1,287 @@
+#include "base/metrics.h"
+#include "base/application.h"
+#include "base/mutex_lock.h"
+
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace base;
+using namespace std;
+
+//----------------------------------------------------------------
+
+bool base::metrics_enabled_ = false;
+
+namespace {
+	unsigned bit_length(uint64_t v) {
+		return v ? 64 - __builtin_clzll(v) : 0;
+	}
+
+	void write_string(ostream &out, string const &str) {
+		out << '"';
+		for (string::const_iterator it = str.begin(); it != str.end(); ++it) {
+			unsigned char c = *it;
+
+			if (c == '"' || c == '\\')
+				out << '\\' << c;
+
+			else if (c < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out << buf;
+
+			} else
+				out << c;
+		}
+		out << '"';
+	}
+
+	//--------------------------------
+
+	// Set by --stats.
+	int stats_fd_ = -1;
+	string stats_cmd_;
+	uint64_t stats_start_;
+
+	void write_all(int fd, string const &str) {
+		char const *p = str.data();
+		size_t len = str.length();
+
+		while (len) {
+			ssize_t n = ::write(fd, p, len);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+
+				cerr << "couldn't write stats: " << strerror(errno) << endl;
+				return;
+			}
+
+			p += n;
+			len -= n;
+		}
+	}
+
+	void write_stats() {
+		ostringstream out;
+		out << "{\n  \"command\": ";
+		write_string(out, stats_cmd_);
+		out << ",\n  \"elapsed_seconds\": " << fixed << setprecision(6)
+		    << (monotonic_ns() - stats_start_) / 1000000000.0 << ",\n";
+		out.unsetf(ios_base::floatfield);
+
+		get_metrics().write_json(out);
+		out << "}\n";
+
+		write_all(stats_fd_, out.str());
+	}
+}
+
+//----------------------------------------------------------------
+
+histogram::histogram(string const &unit)
+	: unit_(unit),
+	  count_(0),
+	  sum_(0),
+	  max_(0)
+{
+	memset(buckets_, 0, sizeof(buckets_));
+}
+
+void
+histogram::record(uint64_t v)
+{
+	__sync_fetch_and_add(&count_, 1);
+	__sync_fetch_and_add(&sum_, v);
+	__sync_fetch_and_add(&buckets_[bit_length(v)], 1);
+
+	uint64_t old = max_;
+	while (v > old) {
+		uint64_t prev = __sync_val_compare_and_swap(&max_, old, v);
+		if (prev == old)
+			break;
+		old = prev;
+	}
+}
+
+//----------------------------------------------------------------
+
+metrics_registry::metrics_registry()
+{
+	pthread_mutex_init(&lock_, NULL);
+}
+
+metrics_registry::~metrics_registry()
+{
+	pthread_mutex_destroy(&lock_);
+}
+
+counter &
+metrics_registry::get_counter(string const &name)
+{
+	mutex_lock l(lock_);
+
+	boost::shared_ptr<counter> &c = counters_[name];
+	if (!c)
+		c.reset(new counter());
+
+	return *c;
+}
+
+histogram &
+metrics_registry::get_histogram(string const &name, string const &unit)
+{
+	mutex_lock l(lock_);
+
+	boost::shared_ptr<histogram> &h = histograms_[name];
+	if (!h)
+		h.reset(new histogram(unit));
+
+	return *h;
+}
+
+void
+metrics_registry::add_phase(string const &name, double seconds)
+{
+	mutex_lock l(lock_);
+
+	vector<phase>::iterator it;
+	for (it = phases_.begin(); it != phases_.end(); ++it) {
+		if (it->name == name) {
+			it->seconds += seconds;
+			it->count++;
+			return;
+		}
+	}
+
+	phase p;
+	p.name = name;
+	p.seconds = seconds;
+	p.count = 1;
+	phases_.push_back(p);
+}
+
+void
+metrics_registry::write_json(ostream &out) const
+{
+	mutex_lock l(lock_);
+
+	out << "  \"phases\": [";
+	for (unsigned i = 0; i < phases_.size(); i++) {
+		phase const &p = phases_[i];
+
+		out << (i ? ",\n    " : "\n    ") << "{\"name\": ";
+		write_string(out, p.name);
+		out << ", \"seconds\": " << fixed << setprecision(6) << p.seconds
+		    << ", \"count\": " << p.count << "}";
+		out.unsetf(ios_base::floatfield);
+	}
+	out << (phases_.empty() ? "],\n" : "\n  ],\n");
+
+	out << "  \"counters\": {";
+	map<string, boost::shared_ptr<counter> >::const_iterator cit;
+	for (cit = counters_.begin(); cit != counters_.end(); ++cit) {
+		out << (cit == counters_.begin() ? "\n    " : ",\n    ");
+		write_string(out, cit->first);
+		out << ": " << cit->second->get();
+	}
+	out << (counters_.empty() ? "},\n" : "\n  },\n");
+
+	out << "  \"histograms\": {";
+	map<string, boost::shared_ptr<histogram> >::const_iterator hit;
+	for (hit = histograms_.begin(); hit != histograms_.end(); ++hit) {
+		histogram const &h = *hit->second;
+
+		out << (hit == histograms_.begin() ? "\n    " : ",\n    ");
+		write_string(out, hit->first);
+		out << ": {\"unit\": ";
+		write_string(out, h.get_unit());
+		out << ", \"count\": " << h.get_count()
+		    << ", \"sum\": " << h.get_sum()
+		    << ", \"max\": " << h.get_max()
+		    << ", \"buckets\": [";
+
+		bool first = true;
+		for (unsigned i = 0; i < histogram::NR_BUCKETS; i++) {
+			if (!h.get_bucket(i))
+				continue;
+
+			uint64_t lo = i ? (1ull << (i - 1)) : 0;
+			out << (first ? "" : ", ")
+			    << "{\"ge\": " << lo << ", \"count\": " << h.get_bucket(i) << "}";
+			first = false;
+		}
+		out << "]}";
+	}
+	out << (histograms_.empty() ? "}\n" : "\n  }\n");
+}
+
+//----------------------------------------------------------------
+
+void
+base::enable_metrics()
+{
+	metrics_enabled_ = true;
+}
+
+metrics_registry &
+base::get_metrics()
+{
+	static metrics_registry registry;
+	return registry;
+}
+
+uint64_t
+base::monotonic_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+//----------------------------------------------------------------
+
+scoped_phase::scoped_phase(char const *name)
+	: name_(name),
+	  start_(metrics_enabled() ? monotonic_ns() : 0)
+{
+}
+
+scoped_phase::~scoped_phase()
+{
+	if (metrics_enabled())
+		get_metrics().add_phase(name_, (monotonic_ns() - start_) / 1000000000.0);
+}
+
+//----------------------------------------------------------------
+
+bool
+base::parse_stats_option(string const &cmd, int &argc, char **argv)
+{
+	int fd = -1;
+	if (!strip_fd_option("stats", argc, argv, fd))
+		return false;
+
+	if (fd < 0)
+		return true;
+
+	// Look the registry up now, so it's constructed before the
+	// atexit handler is registered and so outlives it.
+	get_metrics();
+
+	stats_fd_ = fd;
+	stats_cmd_ = cmd;
+	stats_start_ = monotonic_ns();
+	enable_metrics();
+	atexit(write_stats);
+
+	return true;
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,146 @@
+#ifndef BASE_METRICS_H
+#define BASE_METRICS_H
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <iosfwd>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace base {
+	// Counts may be added from any thread.
+	class counter : private boost::noncopyable {
+	public:
+		counter()
+			: value_(0) {
+		}
+
+		void add(uint64_t n) {
+			__sync_fetch_and_add(&value_, n);
+		}
+
+		void inc() {
+			add(1);
+		}
+
+		uint64_t get() const {
+			return value_;
+		}
+
+	private:
+		uint64_t value_;
+	};
+
+	// Values are bucketed by their bit length, so bucket i holds
+	// [2^(i-1), 2^i), and bucket 0 holds zero.
+	class histogram : private boost::noncopyable {
+	public:
+		enum {
+			NR_BUCKETS = 65
+		};
+
+		histogram(std::string const &unit);
+
+		void record(uint64_t v);
+
+		std::string const &get_unit() const {
+			return unit_;
+		}
+
+		uint64_t get_count() const {
+			return count_;
+		}
+
+		uint64_t get_sum() const {
+			return sum_;
+		}
+
+		uint64_t get_max() const {
+			return max_;
+		}
+
+		uint64_t get_bucket(unsigned i) const {
+			return buckets_[i];
+		}
+
+	private:
+		std::string unit_;
+		uint64_t count_;
+		uint64_t sum_;
+		uint64_t max_;
+		uint64_t buckets_[NR_BUCKETS];
+	};
+
+	// The process wide set of named counters, histograms and phase
+	// times, which the --stats option writes out as JSON.  Names
+	// are dotted, with the component first, eg,
+	// "block_cache.read_hits".
+	class metrics_registry : private boost::noncopyable {
+	public:
+		metrics_registry();
+		~metrics_registry();
+
+		// The references stay valid for the life of the process,
+		// so hot paths should look them up once.
+		counter &get_counter(std::string const &name);
+		histogram &get_histogram(std::string const &name, std::string const &unit);
+
+		// Phases are listed in the order they first ran.  A
+		// phase that runs more than once accumulates.
+		void add_phase(std::string const &name, double seconds);
+
+		void write_json(std::ostream &out) const;
+
+	private:
+		struct phase {
+			std::string name;
+			double seconds;
+			unsigned count;
+		};
+
+		mutable pthread_mutex_t lock_;
+		std::map<std::string, boost::shared_ptr<counter> > counters_;
+		std::map<std::string, boost::shared_ptr<histogram> > histograms_;
+		std::vector<phase> phases_;
+	};
+
+	extern bool metrics_enabled_;
+
+	// Nothing should be published unless this is true, so the
+	// instrumentation costs a test of a flag the rest of the time.
+	inline bool metrics_enabled() {
+		return metrics_enabled_;
+	}
+
+	void enable_metrics();
+	metrics_registry &get_metrics();
+
+	uint64_t monotonic_ns();
+
+	// Adds the time it's in scope to a phase.
+	class scoped_phase : private boost::noncopyable {
+	public:
+		scoped_phase(char const *name);
+		~scoped_phase();
+
+	private:
+		char const *name_;
+		uint64_t start_;
+	};
+
+	// Pulls "--stats <fd>" out of the arguments, wherever it is, so
+	// every command takes it without having to parse it itself.
+	// The JSON is written to the fd when the process exits.
+	// Returns false if the option is malformed.
+	bool parse_stats_option(std::string const &cmd, int &argc, char **argv);
+}
+
+//----------------------------------------------------------------
+
+#endif
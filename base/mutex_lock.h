@@ -0,0 +1,29 @@
+#ifndef BASE_MUTEX_LOCK_H
+#define BASE_MUTEX_LOCK_H
+
+#include <boost/noncopyable.hpp>
+#include <pthread.h>
+
+//----------------------------------------------------------------
+
+namespace base {
+	// Holds a mutex for the lifetime of the object.
+	class mutex_lock : private boost::noncopyable {
+	public:
+		mutex_lock(pthread_mutex_t &m)
+			: m_(m) {
+			pthread_mutex_lock(&m_);
+		}
+
+		~mutex_lock() {
+			pthread_mutex_unlock(&m_);
+		}
+
+	private:
+		pthread_mutex_t &m_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
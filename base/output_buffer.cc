@@ -0,0 +1,158 @@
+#include "base/output_buffer.h"
+
+#include "base/metrics.h"
+
+using namespace base;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	char const digit_pairs[] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+
+	char const blank_line[] =
+		"                                                                "
+		"                                                                ";
+
+	typedef ostream &(*manipulator)(ostream &);
+
+	void count_write(size_t len) {
+		if (metrics_enabled()) {
+			static counter &bytes = get_metrics().get_counter("output.bytes_written");
+			static counter &writes = get_metrics().get_counter("output.writes");
+
+			bytes.add(len);
+			writes.inc();
+		}
+	}
+}
+
+//----------------------------------------------------------------
+
+output_buffer::output_buffer(ostream &out, size_t size)
+	: out_(out),
+	  buffer_(size)
+{
+	begin_ = &buffer_[0];
+	pos_ = begin_;
+	end_ = begin_ + size;
+}
+
+output_buffer::~output_buffer()
+{
+	try {
+		flush_buffer();
+		out_.flush();
+
+	} catch (...) {
+	}
+}
+
+void
+output_buffer::flush()
+{
+	flush_buffer();
+	out_.flush();
+}
+
+void
+output_buffer::spaces(unsigned count)
+{
+	unsigned const max = sizeof(blank_line) - 1;
+
+	while (count > max) {
+		write(blank_line, max);
+		count -= max;
+	}
+
+	write(blank_line, count);
+}
+
+// Digits are produced two at a time from the pairs table, working
+// backwards from the least significant end.
+void
+output_buffer::put_uint(uint64_t v)
+{
+	char tmp[MAX_UINT_DIGITS];
+	char *end = tmp + sizeof(tmp);
+	char *p = end;
+
+	while (v >= 100) {
+		unsigned i = static_cast<unsigned>(v % 100) * 2;
+		v /= 100;
+		p -= 2;
+		p[0] = digit_pairs[i];
+		p[1] = digit_pairs[i + 1];
+	}
+
+	if (v >= 10) {
+		unsigned i = static_cast<unsigned>(v) * 2;
+		p -= 2;
+		p[0] = digit_pairs[i];
+		p[1] = digit_pairs[i + 1];
+	} else
+		*--p = static_cast<char>('0' + v);
+
+	write(p, end - p);
+}
+
+void
+output_buffer::put_int(int64_t v)
+{
+	if (v < 0) {
+		put('-');
+		put_uint(-static_cast<uint64_t>(v));
+	} else
+		put_uint(v);
+}
+
+output_buffer &
+output_buffer::operator <<(manipulator fp)
+{
+	if (fp == static_cast<manipulator>(std::endl))
+		put('\n');
+
+	else {
+		flush_buffer();
+		fp(out_);
+	}
+
+	return *this;
+}
+
+void
+output_buffer::flush_buffer()
+{
+	if (pos_ != begin_) {
+		count_write(pos_ - begin_);
+		out_.write(begin_, pos_ - begin_);
+		pos_ = begin_;
+	}
+}
+
+void
+output_buffer::write_slow(char const *str, size_t len)
+{
+	flush_buffer();
+
+	if (len > static_cast<size_t>(end_ - pos_)) {
+		count_write(len);
+		out_.write(str, len);
+
+	} else {
+		memcpy(pos_, str, len);
+		pos_ += len;
+	}
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,142 @@
+#ifndef BASE_OUTPUT_BUFFER_H
+#define BASE_OUTPUT_BUFFER_H
+
+#include <boost/noncopyable.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+//----------------------------------------------------------------
+
+namespace base {
+	// The dump tools emit hundreds of millions of tiny lines, so going
+	// through the ostream formatting machinery (sentries, locale aware
+	// integer conversion, a flush on every endl) for each field
+	// dominates.  output_buffer formats strings and integers into a
+	// large private buffer, and hands it to the underlying stream in
+	// big blocks, which libstdc++ passes straight through to write(2).
+	//
+	// endl just emits a newline, the data isn't flushed until the
+	// buffer fills, flush() is called, or the buffer is destroyed.
+	// Types it doesn't know how to format are passed on to the
+	// underlying stream (after flushing), so output is always identical
+	// to writing to the stream directly.
+	class output_buffer : private boost::noncopyable {
+	public:
+		output_buffer(std::ostream &out, size_t size = DEFAULT_SIZE);
+		~output_buffer();
+
+		void flush();
+
+		void put(char c) {
+			if (pos_ == end_)
+				flush_buffer();
+
+			*pos_++ = c;
+		}
+
+		void write(char const *str, size_t len) {
+			if (static_cast<size_t>(end_ - pos_) < len) {
+				write_slow(str, len);
+				return;
+			}
+
+			memcpy(pos_, str, len);
+			pos_ += len;
+		}
+
+		void spaces(unsigned count);
+		void put_uint(uint64_t v);
+		void put_int(int64_t v);
+
+		output_buffer &operator <<(char c) {
+			put(c);
+			return *this;
+		}
+
+		output_buffer &operator <<(char const *str) {
+			write(str, strlen(str));
+			return *this;
+		}
+
+		output_buffer &operator <<(std::string const &str) {
+			write(str.data(), str.length());
+			return *this;
+		}
+
+		output_buffer &operator <<(bool b) {
+			put(b ? '1' : '0');
+			return *this;
+		}
+
+		output_buffer &operator <<(unsigned short v) {
+			put_uint(v);
+			return *this;
+		}
+
+		output_buffer &operator <<(unsigned v) {
+			put_uint(v);
+			return *this;
+		}
+
+		output_buffer &operator <<(unsigned long v) {
+			put_uint(v);
+			return *this;
+		}
+
+		output_buffer &operator <<(unsigned long long v) {
+			put_uint(v);
+			return *this;
+		}
+
+		output_buffer &operator <<(short v) {
+			put_int(v);
+			return *this;
+		}
+
+		output_buffer &operator <<(int v) {
+			put_int(v);
+			return *this;
+		}
+
+		output_buffer &operator <<(long v) {
+			put_int(v);
+			return *this;
+		}
+
+		output_buffer &operator <<(long long v) {
+			put_int(v);
+			return *this;
+		}
+
+		output_buffer &operator <<(std::ostream &(*fp)(std::ostream &));
+
+		template <typename T>
+		output_buffer &operator <<(T const &t) {
+			flush_buffer();
+			out_ << t;
+			return *this;
+		}
+
+	private:
+		enum {
+			DEFAULT_SIZE = 1024 * 1024,
+			MAX_UINT_DIGITS = 20
+		};
+
+		void flush_buffer();
+		void write_slow(char const *str, size_t len);
+
+		std::ostream &out_;
+		std::vector<char> buffer_;
+		char *begin_;
+		char *pos_;
+		char *end_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -1,6 +1,13 @@
 #include "base/progress_monitor.h"
 
+#include "base/application.h"
+#include "base/metrics.h"
+
+#include <errno.h>
 #include <iostream>
+#include <pthread.h>
+#include <sstream>
+#include <unistd.h>
 
 //----------------------------------------------------------------
 
@@ -59,6 +66,41 @@ namespace {
 		}
 	};
 
+	class fd_progress : public base::progress_monitor {
+	public:
+		fd_progress(int fd, string const &title)
+			: fd_(fd),
+			  title_(title) {
+		}
+
+		void update_percent(unsigned p) {
+			ostringstream out;
+			out << title_ << ": " << p << "%\n";
+			string const line = out.str();
+
+			// A failed write just loses an update.
+			while (::write(fd_, line.data(), line.length()) < 0 && errno == EINTR)
+				;
+		}
+
+	private:
+		int fd_;
+		string title_;
+	};
+
+	//--------------------------------
+
+	// The clock is only read once per this many nodes.
+	unsigned const CLOCK_INTERVAL = 256;
+
+	auto_ptr<base::progress_monitor> walk_monitor_;
+	uint64_t walk_interval_ns_;
+	uint64_t walk_total_;
+	uint64_t nr_walked_;
+	uint64_t next_update_ns_;
+	unsigned last_percent_;
+	pthread_mutex_t walk_lock_ = PTHREAD_MUTEX_INITIALIZER;
+
 }
 
 //----------------------------------------------------------------
@@ -76,3 +118,93 @@ base::create_quiet_progress_monitor()
 }
 
 //----------------------------------------------------------------
+
+std::auto_ptr<base::progress_monitor>
+base::create_fd_progress_monitor(int fd, std::string const &title)
+{
+	return auto_ptr<progress_monitor>(new fd_progress(fd, title));
+}
+
+//----------------------------------------------------------------
+
+bool base::walk_progress_enabled_ = false;
+
+void
+base::enable_walk_progress(std::auto_ptr<progress_monitor> monitor, uint64_t interval_ns)
+{
+	walk_monitor_ = monitor;
+	walk_interval_ns_ = interval_ns;
+	walk_total_ = 0;
+	nr_walked_ = 0;
+	next_update_ns_ = 0;
+	last_percent_ = 0;
+	walk_progress_enabled_ = true;
+}
+
+void
+base::disable_walk_progress()
+{
+	walk_progress_enabled_ = false;
+	walk_monitor_.reset();
+}
+
+void
+base::set_walk_progress_total(uint64_t nr_nodes)
+{
+	walk_total_ = nr_nodes;
+}
+
+void
+base::complete_walk_progress()
+{
+	if (!walk_progress_enabled_ || !walk_total_)
+		return;
+
+	pthread_mutex_lock(&walk_lock_);
+	if (last_percent_ < 100) {
+		walk_monitor_->update_percent(100);
+		last_percent_ = 100;
+	}
+	pthread_mutex_unlock(&walk_lock_);
+}
+
+void
+base::walk_progress_tick()
+{
+	uint64_t n = __sync_add_and_fetch(&nr_walked_, 1);
+	if (n % CLOCK_INTERVAL)
+		return;
+
+	// The walk may be spread over several threads; whichever
+	// gets the lock reports for all of them.
+	if (pthread_mutex_trylock(&walk_lock_))
+		return;
+
+	uint64_t now = monotonic_ns();
+	if (walk_total_ && now >= next_update_ns_) {
+		unsigned percent = min<uint64_t>(n * 100 / walk_total_, 99);
+		if (percent > last_percent_) {
+			walk_monitor_->update_percent(percent);
+			last_percent_ = percent;
+		}
+
+		next_update_ns_ = now + walk_interval_ns_;
+	}
+
+	pthread_mutex_unlock(&walk_lock_);
+}
+
+bool
+base::parse_progress_option(std::string const &cmd, int &argc, char **argv)
+{
+	int fd = -1;
+	if (!strip_fd_option("progress", argc, argv, fd))
+		return false;
+
+	if (fd >= 0)
+		enable_walk_progress(create_fd_progress_monitor(fd, cmd));
+
+	return true;
+}
+
+//----------------------------------------------------------------
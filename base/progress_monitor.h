@@ -4,6 +4,7 @@
 #include <boost/shared_ptr.hpp>
 #include <memory>
 #include <string>
+#include <stdint.h>
 
 //----------------------------------------------------------------
 
@@ -17,6 +18,51 @@ namespace base {
 
 	std::auto_ptr<progress_monitor> create_progress_bar(std::string const &title);
 	std::auto_ptr<progress_monitor> create_quiet_progress_monitor();
+
+	// Writes a "<title>: <percent>%" line to the fd for each
+	// update, for whatever is driving the tool rather than a
+	// terminal.
+	std::auto_ptr<progress_monitor> create_fd_progress_monitor(int fd, std::string const &title);
+
+	//--------------------------------
+
+	// Long metadata walks have no natural measure of how far
+	// through they are, so they estimate it from the number of
+	// btree and array nodes they've visited, against the number of
+	// metadata blocks allocated.  The walkers call
+	// walk_progress_node() for every node they read; updates go to
+	// the monitor no more than once per interval.
+	extern bool walk_progress_enabled_;
+
+	inline bool walk_progress_enabled() {
+		return walk_progress_enabled_;
+	}
+
+	void enable_walk_progress(std::auto_ptr<progress_monitor> monitor,
+				  uint64_t interval_ns = 1000000000ull);
+	void disable_walk_progress();
+
+	// |nr_nodes| is the number of nodes the tool expects to read,
+	// ie, the allocated metadata blocks times the number of passes
+	// it makes over them.  The estimate is capped at 99%, since the
+	// walks might not visit every block, or might visit some more
+	// than once; complete_walk_progress() reports the 100%.
+	void set_walk_progress_total(uint64_t nr_nodes);
+
+	// Called once the tool has finished successfully.
+	void complete_walk_progress();
+
+	void walk_progress_tick();
+
+	inline void walk_progress_node() {
+		if (walk_progress_enabled())
+			walk_progress_tick();
+	}
+
+	// Pulls "--progress <fd>" out of the arguments, in the same way
+	// as parse_stats_option().  Returns false if the option is
+	// malformed.
+	bool parse_progress_option(std::string const &cmd, int &argc, char **argv);
 }
 
 //----------------------------------------------------------------
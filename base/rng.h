@@ -0,0 +1,43 @@
+#ifndef BASE_RNG_H
+#define BASE_RNG_H
+
+#include <stdint.h>
+
+//----------------------------------------------------------------
+
+namespace base {
+	// xorshift64*.  Small, fast, and gives the same sequence
+	// everywhere for a given seed, which rand() doesn't.
+	class rng {
+	public:
+		rng(uint64_t seed)
+			: state_(seed ^ 0x9e3779b97f4a7c15ULL) {
+			// An all zero state never changes.
+			if (!state_)
+				state_ = 1;
+		}
+
+		uint64_t next() {
+			state_ ^= state_ >> 12;
+			state_ ^= state_ << 25;
+			state_ ^= state_ >> 27;
+			return state_ * 2685821657736338717ULL;
+		}
+
+		// Slightly biased, which doesn't matter for test data.
+		uint64_t below(uint64_t n) {
+			return next() % n;
+		}
+
+		bool percent(unsigned p) {
+			return below(100) < p;
+		}
+
+	private:
+		uint64_t state_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -1,31 +1,54 @@
 #include "xml_utils.h"
 
+#include "base/compression.h"
 #include "persistent-data/file_utils.h"
 #include <fstream>
 #include <iostream>
+#include <string.h>
 
 using namespace xml_utils;
 
 //----------------------------------------------------------------
 
+namespace {
+	// The input is fed to expat in large chunks, read directly into
+	// the parser's own buffer.
+	size_t const CHUNK_SIZE = 1024 * 1024;
+}
+
 void
 xml_parser::parse(std::string const &backup_file, bool quiet)
 {
 	persistent_data::check_file_exists(backup_file);
-	ifstream in(backup_file.c_str(), ifstream::in);
+	ifstream in(backup_file.c_str(), ifstream::in | ifstream::binary);
+	size_t len = get_file_length(backup_file);
 
 	std::auto_ptr<base::progress_monitor> monitor = create_monitor(quiet);
 
+	if (base::is_compressed_file(backup_file)) {
+		base::decompressing_istream zin(in);
+		base::file_offset_monitor zmonitor(*monitor, in, len);
+		parse(zin, len, zmonitor);
+	} else
+		parse(in, len, *monitor);
+}
+
+void
+xml_parser::parse(std::istream &in, size_t input_length,
+		  base::progress_monitor &monitor)
+{
 	size_t total = 0;
-	size_t input_length = get_file_length(backup_file);
 
 	while (!in.eof()) {
-		char buffer[4096];
-		in.read(buffer, sizeof(buffer));
+		void *buffer = XML_GetBuffer(parser_, CHUNK_SIZE);
+		if (!buffer)
+			throw runtime_error("couldn't allocate xml parse buffer");
+
+		in.read(static_cast<char *>(buffer), CHUNK_SIZE);
 		size_t len = in.gcount();
 		int done = in.eof();
 
-		if (!XML_Parse(parser_, buffer, len, done)) {
+		if (!XML_ParseBuffer(parser_, len, done)) {
 			ostringstream out;
 			out << "Parse error at line "
 			    << XML_GetCurrentLineNumber(parser_)
@@ -36,7 +59,8 @@ xml_parser::parse(std::string const &backup_file, bool quiet)
 		}
 
 		total += len;
-		monitor->update_percent(total * 100 / input_length);
+		if (input_length)
+			monitor.update_percent(total * 100 / input_length);
 	}
 }
 
@@ -84,3 +108,98 @@ xml_utils::build_attributes(attributes &a, char const **attr)
 }
 
 //----------------------------------------------------------------
+
+namespace {
+	void bad_uint(char const *str, char const *key) {
+		ostringstream out;
+		out << "couldn't parse attribute " << key << ": '" << str << "'";
+		throw runtime_error(out.str());
+	}
+}
+
+uint64_t
+xml_utils::parse_uint64(char const *str, char const *key)
+{
+	uint64_t const max_div = std::numeric_limits<uint64_t>::max() / 10;
+	uint64_t const max_mod = std::numeric_limits<uint64_t>::max() % 10;
+	uint64_t r = 0;
+
+	if (!*str)
+		bad_uint(str, key);
+
+	for (char const *p = str; *p; p++) {
+		unsigned d = static_cast<unsigned char>(*p) - '0';
+		if (d > 9)
+			bad_uint(str, key);
+
+		if (r >= max_div && (r > max_div || d > max_mod))
+			bad_uint(str, key);
+
+		r = r * 10 + d;
+	}
+
+	return r;
+}
+
+attribute_slots::attribute_slots(char const * const *keys, unsigned nr_keys,
+				 char const **attr)
+	: keys_(keys),
+	  nr_keys_(nr_keys)
+{
+	if (nr_keys > MAX_SLOTS)
+		throw runtime_error("too many attribute slots");
+
+	for (unsigned i = 0; i < nr_keys; i++)
+		values_[i] = NULL;
+
+	while (*attr) {
+		char const *key = *attr++;
+
+		if (!*attr) {
+			ostringstream out;
+			out << "No value given for xml attribute: " << key;
+			throw runtime_error(out.str());
+		}
+
+		for (unsigned i = 0; i < nr_keys; i++)
+			if (!strcmp(key, keys[i])) {
+				values_[i] = *attr;
+				break;
+			}
+
+		attr++;
+	}
+}
+
+bool
+attribute_slots::get_bool(unsigned slot) const
+{
+	char const *v = get(slot);
+
+	if (!strcmp(v, "true"))
+		return true;
+
+	else if (!strcmp(v, "false"))
+		return false;
+
+	throw runtime_error("bad boolean value");
+}
+
+void
+attribute_slots::missing_attr(unsigned slot) const
+{
+	ostringstream out;
+	out << "could not find attribute: " << keys_[slot];
+	throw runtime_error(out.str());
+}
+
+void
+attribute_slots::out_of_range(unsigned slot) const
+{
+	ostringstream out;
+	out << "attribute out of range: " << keys_[slot]
+	    << "='" << values_[slot] << "'";
+	throw runtime_error(out.str());
+}
+
+//----------------------------------------------------------------
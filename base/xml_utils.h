@@ -6,8 +6,10 @@
 #include <boost/optional.hpp>
 #include <expat.h>
 #include <iosfwd>
+#include <limits>
 #include <map>
 #include <stdexcept>
+#include <stdint.h>
 
 using namespace std;
 
@@ -34,6 +36,8 @@ namespace xml_utils {
 		}
 
 		void parse(std::string const &backup_file, bool quiet);
+		void parse(std::istream &in, size_t input_length,
+			   base::progress_monitor &monitor);
 
 	private:
 		size_t get_file_length(string const &file) const;
@@ -67,6 +71,58 @@ namespace xml_utils {
 
 		return rtype(boost::lexical_cast<T>(it->second));
 	}
+
+	//--------------------------------
+
+	// Hand rolled decimal parser, lexical_cast is far too slow for
+	// the mapping elements.  Throws if |str| isn't a plain unsigned
+	// decimal, or doesn't fit in 64 bits.
+	uint64_t parse_uint64(char const *str, char const *key);
+
+	// Fast path for the elements that make up the bulk of a dump.
+	// Rather than building an attributes map, the expat attribute
+	// array is scanned once and the values of the |keys| we're
+	// interested in are dropped into fixed slots.  Nothing is
+	// allocated.
+	class attribute_slots {
+	public:
+		attribute_slots(char const * const *keys, unsigned nr_keys,
+				char const **attr);
+
+		char const *get(unsigned slot) const {
+			if (!values_[slot])
+				missing_attr(slot);
+
+			return values_[slot];
+		}
+
+		bool present(unsigned slot) const {
+			return values_[slot] != NULL;
+		}
+
+		template <typename T>
+		T get_uint(unsigned slot) const {
+			uint64_t v = parse_uint64(get(slot), keys_[slot]);
+			if (v > std::numeric_limits<T>::max())
+				out_of_range(slot);
+
+			return static_cast<T>(v);
+		}
+
+		bool get_bool(unsigned slot) const;
+
+	private:
+		enum {
+			MAX_SLOTS = 8
+		};
+
+		void missing_attr(unsigned slot) const;
+		void out_of_range(unsigned slot) const;
+
+		char const * const *keys_;
+		unsigned nr_keys_;
+		char const *values_[MAX_SLOTS];
+	};
 }
 
 //----------------------------------------------------------------
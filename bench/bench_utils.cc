@@ -0,0 +1,91 @@
+#include "bench/bench_utils.h"
+
+#include "thin-provisioning/metadata.h"
+#include "thin-provisioning/restore_emitter.h"
+
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+using namespace bench;
+using namespace persistent_data;
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	uint64_t const CHUNK = 64;
+}
+
+//----------------------------------------------------------------
+
+void
+bench::report_throughput(ostream &out, string const &name,
+			 uint64_t nr_bytes, double seconds)
+{
+	double mb = static_cast<double>(nr_bytes) / (1024.0 * 1024.0);
+
+	out << name << ": "
+	    << fixed << setprecision(1) << mb << " MiB in "
+	    << setprecision(3) << seconds << "s, "
+	    << setprecision(1) << (seconds > 0.0 ? mb / seconds : 0.0) << " MB/s"
+	    << endl;
+}
+
+void
+bench::report_rate(ostream &out, string const &name,
+		   uint64_t nr_ops, double seconds)
+{
+	out << name << ": "
+	    << nr_ops << " in "
+	    << fixed << setprecision(3) << seconds << "s, "
+	    << setprecision(0) << (seconds > 0.0 ? nr_ops / seconds : 0.0) << "/s"
+	    << endl;
+}
+
+uint64_t
+bench::get_file_size(string const &path)
+{
+	struct stat info;
+
+	if (::stat(path.c_str(), &info))
+		throw runtime_error("couldn't stat " + path);
+
+	return info.st_size;
+}
+
+//----------------------------------------------------------------
+
+void
+bench::generate_thin_metadata(string const &path, unsigned nr_devs, uint64_t nr_blocks)
+{
+	uint64_t nr_data_blocks = nr_blocks + nr_devs * (nr_blocks / 16 + CHUNK);
+	block_address nr_metadata_blocks = nr_devs * nr_blocks / 64 + 4096;
+
+	block_manager<>::ptr bm(new block_manager<>(path, nr_metadata_blocks, 16,
+						    block_manager<>::CREATE));
+	metadata::ptr md(new metadata(bm, metadata::CREATE, 128, 0));
+	emitter::ptr e = create_restore_emitter(md);
+
+	e->begin_superblock("", 1, 1, 128, nr_data_blocks, boost::optional<uint64_t>());
+
+	uint64_t next_free = nr_blocks;
+	for (unsigned dev = 0; dev < nr_devs; dev++) {
+		e->begin_device(dev, nr_blocks, 1, 0, 0);
+		for (uint64_t b = 0; b < nr_blocks; b += CHUNK) {
+			uint64_t len = min<uint64_t>(CHUNK, nr_blocks - b);
+			if (dev && (b / CHUNK) % 16 == dev % 16) {
+				e->range_map(b, next_free, 1, len);
+				next_free += len;
+			} else
+				e->range_map(b, b, 0, len);
+		}
+		e->end_device();
+	}
+
+	e->end_superblock();
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,105 @@
+// Copyright (C) 2016 Red Hat, Inc. All rights reserved.
+//
+// This file is part of the thin-provisioning-tools source.
+//
+// thin-provisioning-tools is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// thin-provisioning-tools is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with thin-provisioning-tools.  If not, see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include "thin-provisioning/emitter.h"
+
+#include <iosfwd>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+
+//----------------------------------------------------------------
+
+namespace bench {
+	class timer {
+	public:
+		timer() {
+			reset();
+		}
+
+		void reset() {
+			clock_gettime(CLOCK_MONOTONIC, &start_);
+		}
+
+		double elapsed_seconds() const {
+			timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			return (now.tv_sec - start_.tv_sec) +
+				(now.tv_nsec - start_.tv_nsec) / 1000000000.0;
+		}
+
+	private:
+		timespec start_;
+	};
+
+	// Counts the mappings it's sent, so a parse can't be optimised
+	// away.
+	class thin_counting_emitter : public thin_provisioning::emitter {
+	public:
+		thin_counting_emitter()
+			: nr_mappings_(0) {
+		}
+
+		void begin_superblock(std::string const &uuid, uint64_t time,
+				      uint64_t trans_id, uint32_t data_block_size,
+				      uint64_t nr_data_blocks,
+				      boost::optional<uint64_t> metadata_snap) {}
+		void end_superblock() {}
+		void begin_device(uint32_t dev_id, uint64_t mapped_blocks,
+				  uint64_t trans_id, uint64_t creation_time,
+				  uint64_t snap_time) {}
+		void end_device() {}
+		void begin_named_mapping(std::string const &name) {}
+		void end_named_mapping() {}
+		void identifier(std::string const &name) {}
+
+		void range_map(uint64_t origin_begin, uint64_t data_begin,
+			       uint32_t time, uint64_t len) {
+			nr_mappings_ += len;
+		}
+
+		void single_map(uint64_t origin_block, uint64_t data_block,
+				uint32_t time) {
+			nr_mappings_++;
+		}
+
+		uint64_t nr_mappings_;
+	};
+
+	// Prints a one line summary of a throughput measurement.
+	void report_throughput(std::ostream &out, std::string const &name,
+			       uint64_t nr_bytes, double seconds);
+
+	// As above, but for a count of operations.
+	void report_rate(std::ostream &out, std::string const &name,
+			 uint64_t nr_ops, double seconds);
+
+	uint64_t get_file_size(std::string const &path);
+
+	// Writes thin metadata to |path|.  Device 0 is an origin of
+	// |nr_blocks| mapped blocks; the rest are snapshots of it that
+	// have each had every 16th chunk overwritten.
+	void generate_thin_metadata(std::string const &path, unsigned nr_devs, uint64_t nr_blocks);
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -0,0 +1,241 @@
+#include "bench/bench_utils.h"
+#include "bench/commands.h"
+
+#include "persistent-data/data-structures/bloom_filter.h"
+#include "persistent-data/space-maps/core.h"
+
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace bench;
+using namespace persistent_data;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	// Keys are spread over this many times as many blocks as are
+	// inserted, roughly what an era sees between two snapshots.
+	uint64_t const KEY_SPACE_MULTIPLIER = 64;
+
+	unsigned next_power(uint64_t n) {
+		unsigned r = 1;
+		while (r < n)
+			r <<= 1;
+
+		return r;
+	}
+
+	// A simple LCG, so both layouts see exactly the same keys.
+	// Inserted keys are even and looked up keys odd, so every
+	// positive lookup is a false positive.
+	class key_generator {
+	public:
+		key_generator(uint64_t seed, uint64_t max, bool odd)
+			: state_(seed),
+			  max_(max),
+			  odd_(odd) {
+		}
+
+		uint64_t next() {
+			state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+			return ((state_ >> 16) % max_) * 2 + (odd_ ? 1 : 0);
+		}
+
+	private:
+		uint64_t state_;
+		uint64_t max_;
+		bool odd_;
+	};
+
+	struct results {
+		double insert_seconds;
+		double test_seconds;
+		uint64_t nr_positives;
+	};
+
+	template <typename Filter>
+	void run_inserts(Filter &f, uint64_t nr_keys, uint64_t key_space) {
+		key_generator inserts(1, key_space, false);
+		for (uint64_t i = 0; i < nr_keys; i++)
+			f.set(inserts.next());
+	}
+
+	template <typename Filter>
+	results bench_filter(Filter &f, uint64_t nr_keys, uint64_t nr_lookups,
+			     uint64_t key_space) {
+		results r;
+
+		timer t;
+		run_inserts(f, nr_keys, key_space);
+		r.insert_seconds = t.elapsed_seconds();
+
+		key_generator lookups(2, key_space, true);
+		r.nr_positives = 0;
+		t.reset();
+		for (uint64_t i = 0; i < nr_lookups; i++)
+			if (f.test(lookups.next()))
+				r.nr_positives++;
+		r.test_seconds = t.elapsed_seconds();
+
+		return r;
+	}
+
+	results bench_batched(blocked_bloom_filter &f, uint64_t nr_lookups,
+			      uint64_t key_space, unsigned batch_size) {
+		results r;
+		r.insert_seconds = 0.0;
+		r.nr_positives = 0;
+
+		key_generator lookups(2, key_space, true);
+		vector<uint64_t> keys;
+		vector<bool> found;
+
+		timer t;
+		for (uint64_t done = 0; done < nr_lookups; done += keys.size()) {
+			keys.clear();
+			for (unsigned i = 0; i < batch_size && done + i < nr_lookups; i++)
+				keys.push_back(lookups.next());
+
+			f.test_many(keys, found);
+			for (unsigned i = 0; i < found.size(); i++)
+				if (found[i])
+					r.nr_positives++;
+		}
+		r.test_seconds = t.elapsed_seconds();
+
+		return r;
+	}
+
+	void report(string const &name, results const &r,
+		    uint64_t nr_keys, uint64_t nr_lookups) {
+		if (r.insert_seconds > 0.0)
+			report_rate(cout, name + " inserts", nr_keys, r.insert_seconds);
+		report_rate(cout, name + " lookups", nr_lookups, r.test_seconds);
+		cout << "  " << r.nr_positives << " false positives, "
+		     << setprecision(4)
+		     << (100.0 * r.nr_positives) / static_cast<double>(nr_lookups)
+		     << "%" << endl;
+	}
+
+	int bench_bloom(uint64_t nr_keys, uint64_t nr_lookups,
+			unsigned nr_probes, unsigned bits_per_key) {
+		unsigned nr_bits = next_power(nr_keys * bits_per_key);
+		uint64_t key_space = nr_keys * KEY_SPACE_MULTIPLIER;
+
+		// room for both filters, plus their btrees
+		block_address nr_blocks = 4 * (nr_bits / (8 * 4096)) + 1024;
+		string const path("./bloom_bench.data");
+
+		block_manager<>::ptr bm(new block_manager<>(path, nr_blocks, 16,
+							    block_manager<>::CREATE));
+		space_map::ptr sm(new core_map(nr_blocks));
+		sm->inc(0);
+		transaction_manager tm(bm, sm);
+
+		cout << nr_keys << " keys, " << nr_bits << " bits, "
+		     << nr_probes << " probes" << endl;
+
+		{
+			bloom_filter f(tm, nr_bits, nr_probes);
+			report("bloom_filter", bench_filter(f, nr_keys, nr_lookups, key_space),
+			       nr_keys, nr_lookups);
+		}
+
+		{
+			blocked_bloom_filter f(tm, nr_bits, nr_probes);
+			report("blocked_bloom_filter",
+			       bench_filter(f, nr_keys, nr_lookups, key_space),
+			       nr_keys, nr_lookups);
+			report("blocked_bloom_filter test_many",
+			       bench_batched(f, nr_lookups, key_space, 4096),
+			       nr_keys, nr_lookups);
+		}
+
+		::unlink(path.c_str());
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+bloom_cmd::bloom_cmd()
+	: command("bloom")
+{
+}
+
+void
+bloom_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-n|--nr-keys} <keys to insert>" << endl
+	    << "  {-l|--nr-lookups} <lookups to time>" << endl
+	    << "  {-k|--nr-probes} <probes per key>" << endl
+	    << "  {-b|--bits-per-key} <bits per key, before rounding>" << endl;
+}
+
+int
+bloom_cmd::run(int argc, char **argv)
+{
+	int c;
+	char const *short_opts = "hn:l:k:b:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "nr-keys", required_argument, NULL, 'n'},
+		{ "nr-lookups", required_argument, NULL, 'l'},
+		{ "nr-probes", required_argument, NULL, 'k'},
+		{ "bits-per-key", required_argument, NULL, 'b'},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	uint64_t nr_keys = 1000000;
+	uint64_t nr_lookups = 4000000;
+	uint64_t nr_probes = 6;
+	uint64_t bits_per_key = 12;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 'n':
+			nr_keys = parse_uint64(optarg, "nr keys");
+			break;
+
+		case 'l':
+			nr_lookups = parse_uint64(optarg, "nr lookups");
+			break;
+
+		case 'k':
+			nr_probes = parse_uint64(optarg, "nr probes");
+			break;
+
+		case 'b':
+			bits_per_key = parse_uint64(optarg, "bits per key");
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (!nr_keys || !nr_lookups || !bits_per_key)
+		die("counts must be greater than zero");
+
+	try {
+		return bench_bloom(nr_keys, nr_lookups, nr_probes, bits_per_key);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
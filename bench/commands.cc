@@ -0,0 +1,24 @@
+#include "bench/commands.h"
+
+using namespace base;
+using namespace bench;
+
+//----------------------------------------------------------------
+
+void
+bench::register_bench_commands(application &app)
+{
+	app.add_cmd(command::ptr(new xml_emit_cmd));
+	app.add_cmd(command::ptr(new xml_parse_cmd));
+	app.add_cmd(command::ptr(new bloom_cmd));
+	app.add_cmd(command::ptr(new era_query_cmd));
+	app.add_cmd(command::ptr(new oblock_tracker_cmd));
+	app.add_cmd(command::ptr(new session_cmd));
+	app.add_cmd(command::ptr(new walk_progress_cmd));
+	app.add_cmd(command::ptr(new micro_cmd));
+	app.add_cmd(command::ptr(new thin_generate_cmd));
+	app.add_cmd(command::ptr(new cache_generate_cmd));
+	app.add_cmd(command::ptr(new era_generate_cmd));
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,91 @@
+#ifndef BENCH_COMMANDS_H
+#define BENCH_COMMANDS_H
+
+#include "base/application.h"
+
+//----------------------------------------------------------------
+
+namespace bench {
+	class xml_emit_cmd : public base::command {
+	public:
+		xml_emit_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class xml_parse_cmd : public base::command {
+	public:
+		xml_parse_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class bloom_cmd : public base::command {
+	public:
+		bloom_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class era_query_cmd : public base::command {
+	public:
+		era_query_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class oblock_tracker_cmd : public base::command {
+	public:
+		oblock_tracker_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class session_cmd : public base::command {
+	public:
+		session_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class micro_cmd : public base::command {
+	public:
+		micro_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class walk_progress_cmd : public base::command {
+	public:
+		walk_progress_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class thin_generate_cmd : public base::command {
+	public:
+		thin_generate_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class cache_generate_cmd : public base::command {
+	public:
+		cache_generate_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	class era_generate_cmd : public base::command {
+	public:
+		era_generate_cmd();
+		virtual void usage(std::ostream &out) const;
+		virtual int run(int argc, char **argv);
+	};
+
+	void register_bench_commands(base::application &app);
+}
+
+//----------------------------------------------------------------
+
+#endif
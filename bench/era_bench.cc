@@ -0,0 +1,180 @@
+#include "bench/bench_utils.h"
+#include "bench/commands.h"
+
+#include "era/era_index.h"
+#include "era/invalidate.h"
+#include "era/metadata.h"
+#include "era/restore_emitter.h"
+#include "persistent-data/file_utils.h"
+
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace base;
+using namespace bench;
+using namespace era;
+using namespace persistent_data;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	uint32_t const CURRENT_ERA = 1000;
+	uint32_t const HOT_REGION_SIZE = 16 * 1024;
+
+	// Most of the origin was written long ago.  A few hot regions
+	// have been written recently, which is what a backup tool
+	// asking for recent changes sees.
+	uint32_t block_era(uint32_t b) {
+		uint32_t region = b / HOT_REGION_SIZE;
+		if (region % 37 == 0)
+			return CURRENT_ERA - 1 - (b % 64);
+
+		return (b / 4096) % (CURRENT_ERA / 2);
+	}
+
+	void generate_metadata(string const &path, uint32_t nr_blocks) {
+		block_address nr_metadata_blocks = nr_blocks / 512 + 4096;
+		block_manager<>::ptr bm(new block_manager<>(path, nr_metadata_blocks, 16,
+							    block_manager<>::CREATE));
+		metadata::ptr md(new metadata(bm, metadata::CREATE));
+		emitter::ptr e = create_restore_emitter(*md);
+
+		e->begin_superblock("", 128, nr_blocks, CURRENT_ERA);
+
+		// a couple of undigested writesets
+		for (uint32_t era = CURRENT_ERA - 2; era < CURRENT_ERA; era++) {
+			e->begin_writeset(era, nr_blocks);
+			for (uint32_t b = era; b < nr_blocks; b += 100003)
+				e->writeset_bit(b, true);
+			e->end_writeset();
+		}
+
+		e->begin_era_array();
+		for (uint32_t b = 0; b < nr_blocks; b++)
+			e->era(b, block_era(b));
+		e->end_era_array();
+
+		e->end_superblock();
+	}
+
+	double time_query(metadata const &md, uint32_t threshold,
+			  era_index const *index, unsigned nr_queries,
+			  uint64_t &nr_marked) {
+		timer t;
+		for (unsigned i = 0; i < nr_queries; i++) {
+			dense_bitmap blocks(md.sb_.nr_blocks);
+			mark_blocks_since(md, threshold, blocks, index);
+			nr_marked = blocks.count();
+		}
+
+		return t.elapsed_seconds() / nr_queries;
+	}
+
+	int bench_era(uint32_t nr_blocks, unsigned nr_queries) {
+		string const path("./era_bench.data");
+
+		timer t;
+		generate_metadata(path, nr_blocks);
+		cout << "generated " << nr_blocks << " blocks of era metadata in "
+		     << fixed << setprecision(3) << t.elapsed_seconds() << "s" << endl;
+
+		block_manager<>::ptr bm = open_bm(path, block_manager<>::READ_ONLY);
+		metadata::ptr md(new metadata(bm, metadata::OPEN));
+
+		t.reset();
+		era_index index(era_index_key(md->sb_, false));
+		index.build(*md->era_array_);
+		cout << "built index in " << t.elapsed_seconds() << "s" << endl;
+
+		uint32_t const thresholds[] = {
+			CURRENT_ERA - 1, CURRENT_ERA - 10, CURRENT_ERA - 100, CURRENT_ERA / 2, 0
+		};
+
+		for (unsigned i = 0; i < sizeof(thresholds) / sizeof(*thresholds); i++) {
+			uint64_t marked_plain, marked_indexed;
+			double plain = time_query(*md, thresholds[i], NULL, nr_queries, marked_plain);
+			double indexed = time_query(*md, thresholds[i], &index, nr_queries, marked_indexed);
+
+			if (marked_plain != marked_indexed)
+				throw runtime_error("indexed query gave a different answer");
+
+			cout << "written since " << thresholds[i] << ": "
+			     << marked_plain << " blocks, "
+			     << setprecision(2) << plain * 1000.0 << "ms without index, "
+			     << indexed * 1000.0 << "ms with index" << endl;
+		}
+
+		::unlink(path.c_str());
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+era_query_cmd::era_query_cmd()
+	: command("era_query")
+{
+}
+
+void
+era_query_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-b|--nr-blocks} <origin blocks>" << endl
+	    << "  {-q|--nr-queries} <queries per threshold>" << endl;
+}
+
+int
+era_query_cmd::run(int argc, char **argv)
+{
+	int c;
+	char const *short_opts = "hb:q:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "nr-blocks", required_argument, NULL, 'b'},
+		{ "nr-queries", required_argument, NULL, 'q'},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	uint64_t nr_blocks = 4 * 1024 * 1024;
+	uint64_t nr_queries = 5;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 'b':
+			nr_blocks = parse_uint64(optarg, "nr blocks");
+			break;
+
+		case 'q':
+			nr_queries = parse_uint64(optarg, "nr queries");
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (!nr_blocks || !nr_queries)
+		die("counts must be greater than zero");
+
+	try {
+		return bench_era(nr_blocks, nr_queries);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,456 @@
+#include "bench/bench_utils.h"
+#include "bench/commands.h"
+
+#include "caching/metadata_generator.h"
+#include "caching/restore_emitter.h"
+#include "caching/xml_format.h"
+#include "era/metadata_generator.h"
+#include "era/restore_emitter.h"
+#include "era/xml_format.h"
+#include "thin-provisioning/metadata.h"
+#include "thin-provisioning/metadata_generator.h"
+#include "thin-provisioning/restore_emitter.h"
+#include "thin-provisioning/xml_format.h"
+
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+
+using namespace bench;
+using namespace persistent_data;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	// Big enough to keep the leaves a snapshot shares resident
+	// until it's built, so generation never reads back.
+	size_t const CACHE_MEM = 256 * 1024 * 1024;
+
+	// Options every generator takes.
+	struct output_flags {
+		output_flags()
+			: xml(false),
+			  metadata_size(0) {
+		}
+
+		string output;
+		bool xml;
+
+		// Zero means the generator's own estimate.
+		block_address metadata_size;
+	};
+
+	enum {
+		XML = 1000,
+		METADATA_SIZE,
+		SEED,
+		RUN_LENGTH,
+		DATA_BLOCK_SIZE
+	};
+
+	// Returns true if the option was one of the common ones.
+	bool parse_common(base::command &cmd, int c, output_flags &fs,
+			  uint64_t &seed, unsigned &run_length, uint32_t &data_block_size) {
+		switch (c) {
+		case 'o':
+			fs.output = optarg;
+			return true;
+
+		case XML:
+			fs.xml = true;
+			return true;
+
+		case METADATA_SIZE:
+			fs.metadata_size = cmd.parse_uint64(optarg, "metadata size");
+			return true;
+
+		case SEED:
+			seed = cmd.parse_uint64(optarg, "seed");
+			return true;
+
+		case RUN_LENGTH:
+			run_length = cmd.parse_uint64(optarg, "run length");
+			return true;
+
+		case DATA_BLOCK_SIZE:
+			data_block_size = cmd.parse_uint64(optarg, "data block size");
+			return true;
+		}
+
+		return false;
+	}
+
+	void common_usage(ostream &out) {
+		out << "  {-h|--help}" << endl
+		    << "  {-o|--output} <output file>" << endl
+		    << "  {--xml}" << endl
+		    << "  {--metadata-size} <4k blocks>" << endl
+		    << "  {--seed} <seed>" << endl
+		    << "  {--run-length} <mean blocks>" << endl
+		    << "  {--data-block-size} <sectors>" << endl;
+	}
+
+	block_manager<>::ptr create_output(output_flags const &fs, block_address estimate) {
+		block_address nr_blocks = fs.metadata_size ? fs.metadata_size : estimate;
+		return block_manager<>::ptr(
+			new block_manager<>(fs.output, nr_blocks, 16,
+					    block_manager<>::CREATE, true, CACHE_MEM));
+	}
+
+	void report(output_flags const &fs, double seconds) {
+		report_throughput(cout, fs.output, get_file_size(fs.output), seconds);
+	}
+
+	//--------------------------------
+
+	int generate_thin(output_flags const &fs, thin_provisioning::generator_params const &p) {
+		using namespace thin_provisioning;
+
+		timer t;
+		if (fs.xml) {
+			ofstream out(fs.output.c_str());
+			generate_metadata(p, create_xml_emitter(out));
+		} else {
+			block_manager<>::ptr bm = create_output(fs, estimate_metadata_size(p));
+			metadata::ptr md(new metadata(bm, metadata::CREATE, p.data_block_size, 0));
+			generate_metadata(p, create_restore_emitter(md));
+		}
+		report(fs, t.elapsed_seconds());
+
+		return 0;
+	}
+
+	int generate_cache(output_flags const &fs, caching::generator_params const &p) {
+		using namespace caching;
+
+		timer t;
+		if (fs.xml) {
+			ofstream out(fs.output.c_str());
+			generate_metadata(p, create_xml_emitter(out));
+		} else {
+			block_manager<>::ptr bm = create_output(fs, estimate_metadata_size(p));
+			metadata::ptr md(new metadata(bm, metadata::CREATE));
+			generate_metadata(p, create_restore_emitter(md));
+		}
+		report(fs, t.elapsed_seconds());
+
+		return 0;
+	}
+
+	int generate_era(output_flags const &fs, era::generator_params const &p) {
+		using namespace era;
+
+		timer t;
+		if (fs.xml) {
+			ofstream out(fs.output.c_str());
+			generate_metadata(p, create_xml_emitter(out));
+		} else {
+			block_manager<>::ptr bm = create_output(fs, estimate_metadata_size(p));
+			metadata::ptr md(new metadata(bm, metadata::CREATE));
+			generate_metadata(p, create_restore_emitter(*md));
+		}
+		report(fs, t.elapsed_seconds());
+
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+thin_generate_cmd::thin_generate_cmd()
+	: command("thin_generate_metadata")
+{
+}
+
+void
+thin_generate_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options] -o <output file>" << endl
+	    << "Options:" << endl;
+	common_usage(out);
+	out << "  {--nr-thins} <origins>" << endl
+	    << "  {--snap-depth} <snapshots of each origin>" << endl
+	    << "  {--nr-mappings} <blocks per device>" << endl
+	    << "  {--sharing} <percent of leaves>" << endl
+	    << "  {--nr-data-blocks} <blocks>" << endl;
+}
+
+int
+thin_generate_cmd::run(int argc, char **argv)
+{
+	enum {
+		NR_THINS = 2000,
+		SNAP_DEPTH,
+		NR_MAPPINGS,
+		SHARING,
+		NR_DATA_BLOCKS
+	};
+
+	int c;
+	char const *short_opts = "ho:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "output", required_argument, NULL, 'o'},
+		{ "xml", no_argument, NULL, XML},
+		{ "metadata-size", required_argument, NULL, METADATA_SIZE},
+		{ "seed", required_argument, NULL, SEED},
+		{ "run-length", required_argument, NULL, RUN_LENGTH},
+		{ "data-block-size", required_argument, NULL, DATA_BLOCK_SIZE},
+		{ "nr-thins", required_argument, NULL, NR_THINS},
+		{ "snap-depth", required_argument, NULL, SNAP_DEPTH},
+		{ "nr-mappings", required_argument, NULL, NR_MAPPINGS},
+		{ "sharing", required_argument, NULL, SHARING},
+		{ "nr-data-blocks", required_argument, NULL, NR_DATA_BLOCKS},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	output_flags fs;
+	thin_provisioning::generator_params p;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		if (parse_common(*this, c, fs, p.seed, p.run_length, p.data_block_size))
+			continue;
+
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case NR_THINS:
+			p.nr_thins = parse_uint64(optarg, "nr thins");
+			break;
+
+		case SNAP_DEPTH:
+			p.snap_depth = parse_uint64(optarg, "snap depth");
+			break;
+
+		case NR_MAPPINGS:
+			p.nr_mappings = parse_uint64(optarg, "nr mappings");
+			break;
+
+		case SHARING:
+			p.sharing = parse_uint64(optarg, "sharing");
+			break;
+
+		case NR_DATA_BLOCKS:
+			p.nr_data_blocks = parse_uint64(optarg, "nr data blocks");
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (fs.output.empty())
+		die("no output file provided");
+
+	try {
+		return generate_thin(fs, p);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
+
+cache_generate_cmd::cache_generate_cmd()
+	: command("cache_generate_metadata")
+{
+}
+
+void
+cache_generate_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options] -o <output file>" << endl
+	    << "Options:" << endl;
+	common_usage(out);
+	out << "  {--nr-cache-blocks} <blocks>" << endl
+	    << "  {--nr-origin-blocks} <blocks>" << endl
+	    << "  {--mapped} <percent of cache blocks>" << endl
+	    << "  {--dirty} <percent of mapped blocks>" << endl
+	    << "  {--policy} <name>" << endl
+	    << "  {--hint-width} <bytes>" << endl;
+}
+
+int
+cache_generate_cmd::run(int argc, char **argv)
+{
+	enum {
+		NR_CACHE_BLOCKS = 2000,
+		NR_ORIGIN_BLOCKS,
+		MAPPED,
+		DIRTY,
+		POLICY,
+		HINT_WIDTH
+	};
+
+	int c;
+	char const *short_opts = "ho:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "output", required_argument, NULL, 'o'},
+		{ "xml", no_argument, NULL, XML},
+		{ "metadata-size", required_argument, NULL, METADATA_SIZE},
+		{ "seed", required_argument, NULL, SEED},
+		{ "run-length", required_argument, NULL, RUN_LENGTH},
+		{ "data-block-size", required_argument, NULL, DATA_BLOCK_SIZE},
+		{ "nr-cache-blocks", required_argument, NULL, NR_CACHE_BLOCKS},
+		{ "nr-origin-blocks", required_argument, NULL, NR_ORIGIN_BLOCKS},
+		{ "mapped", required_argument, NULL, MAPPED},
+		{ "dirty", required_argument, NULL, DIRTY},
+		{ "policy", required_argument, NULL, POLICY},
+		{ "hint-width", required_argument, NULL, HINT_WIDTH},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	output_flags fs;
+	caching::generator_params p;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		if (parse_common(*this, c, fs, p.seed, p.run_length, p.data_block_size))
+			continue;
+
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case NR_CACHE_BLOCKS:
+			p.nr_cache_blocks = parse_uint64(optarg, "nr cache blocks");
+			break;
+
+		case NR_ORIGIN_BLOCKS:
+			p.nr_origin_blocks = parse_uint64(optarg, "nr origin blocks");
+			break;
+
+		case MAPPED:
+			p.mapped = parse_uint64(optarg, "mapped");
+			break;
+
+		case DIRTY:
+			p.dirty = parse_uint64(optarg, "dirty");
+			break;
+
+		case POLICY:
+			p.policy = optarg;
+			break;
+
+		case HINT_WIDTH:
+			p.hint_width = parse_uint64(optarg, "hint width");
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (fs.output.empty())
+		die("no output file provided");
+
+	try {
+		return generate_cache(fs, p);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
+
+era_generate_cmd::era_generate_cmd()
+	: command("era_generate_metadata")
+{
+}
+
+void
+era_generate_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options] -o <output file>" << endl
+	    << "Options:" << endl;
+	common_usage(out);
+	out << "  {--nr-blocks} <blocks>" << endl
+	    << "  {--current-era} <era>" << endl
+	    << "  {--nr-writesets} <undigested eras>" << endl
+	    << "  {--written} <percent of blocks per writeset>" << endl;
+}
+
+int
+era_generate_cmd::run(int argc, char **argv)
+{
+	enum {
+		NR_BLOCKS = 2000,
+		CURRENT_ERA,
+		NR_WRITESETS,
+		WRITTEN
+	};
+
+	int c;
+	char const *short_opts = "ho:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "output", required_argument, NULL, 'o'},
+		{ "xml", no_argument, NULL, XML},
+		{ "metadata-size", required_argument, NULL, METADATA_SIZE},
+		{ "seed", required_argument, NULL, SEED},
+		{ "run-length", required_argument, NULL, RUN_LENGTH},
+		{ "data-block-size", required_argument, NULL, DATA_BLOCK_SIZE},
+		{ "nr-blocks", required_argument, NULL, NR_BLOCKS},
+		{ "current-era", required_argument, NULL, CURRENT_ERA},
+		{ "nr-writesets", required_argument, NULL, NR_WRITESETS},
+		{ "written", required_argument, NULL, WRITTEN},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	output_flags fs;
+	era::generator_params p;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		if (parse_common(*this, c, fs, p.seed, p.run_length, p.data_block_size))
+			continue;
+
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case NR_BLOCKS:
+			p.nr_blocks = parse_uint64(optarg, "nr blocks");
+			break;
+
+		case CURRENT_ERA:
+			p.current_era = parse_uint64(optarg, "current era");
+			break;
+
+		case NR_WRITESETS:
+			p.nr_writesets = parse_uint64(optarg, "nr writesets");
+			break;
+
+		case WRITTEN:
+			p.written = parse_uint64(optarg, "written");
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (fs.output.empty())
+		die("no output file provided");
+
+	try {
+		return generate_era(fs, p);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,17 @@
+#include "base/application.h"
+#include "bench/commands.h"
+
+//----------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+	using namespace base;
+
+	application app("pdata_bench");
+
+	bench::register_bench_commands(app);
+
+	return app.run(argc, argv);
+}
+
+//----------------------------------------------------------------
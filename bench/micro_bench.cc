@@ -0,0 +1,511 @@
+#include "bench/bench_utils.h"
+#include "bench/commands.h"
+
+#include "persistent-data/checksum.h"
+#include "persistent-data/data-structures/array.h"
+#include "persistent-data/data-structures/bitset.h"
+#include "persistent-data/data-structures/bloom_filter.h"
+#include "persistent-data/data-structures/btree.h"
+#include "persistent-data/data-structures/simple_traits.h"
+#include "persistent-data/space-maps/core.h"
+#include "persistent-data/space-maps/disk.h"
+#include "thin-provisioning/xml_format.h"
+
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace bench;
+using namespace persistent_data;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	string const DATA_PATH("./micro_bench.data");
+
+	// Enough for the largest btree, with room for shadowing.
+	block_address const NR_BLOCKS = 64 * 1024;
+
+	// The data structures are timed with everything in the cache;
+	// the block_cache benchmarks cover the misses.
+	size_t const CACHE_MEM = 128 * 1024 * 1024;
+
+	// Keeps results from being optimised away.
+	volatile uint64_t sink_;
+
+	// A simple LCG, so every run sees the same keys.
+	class key_generator {
+	public:
+		key_generator(uint64_t seed, uint64_t max)
+			: state_(seed),
+			  max_(max) {
+		}
+
+		uint64_t next() {
+			state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+			return (state_ >> 16) % max_;
+		}
+
+	private:
+		uint64_t state_;
+		uint64_t max_;
+	};
+
+	struct result {
+		string name;
+		uint64_t nr_ops;
+		double seconds;
+	};
+
+	class suite {
+	public:
+		suite(string const &filter, unsigned scale)
+			: filter_(filter),
+			  scale_(scale) {
+		}
+
+		// Names are "<group>.<benchmark>", and the filter is a
+		// prefix of them.
+		bool wanted(string const &group) const {
+			return is_prefix(filter_, group) || is_prefix(group, filter_);
+		}
+
+		bool wanted_result(string const &name) const {
+			return is_prefix(filter_, name);
+		}
+
+		uint64_t ops(uint64_t n) const {
+			return n * scale_;
+		}
+
+		void add(string const &name, uint64_t nr_ops, double seconds) {
+			if (!wanted_result(name))
+				return;
+
+			result r;
+			r.name = name;
+			r.nr_ops = nr_ops;
+			r.seconds = seconds;
+			results_.push_back(r);
+
+			cerr << name << ": " << fixed << setprecision(1)
+			     << ns_per_op(r) << " ns/op" << endl;
+		}
+
+		// One benchmark per line, so results from two commits
+		// can be compared with diff as well as a JSON reader.
+		void write_json(ostream &out) const {
+			out << "{\n  \"benchmarks\": [";
+			for (unsigned i = 0; i < results_.size(); i++) {
+				result const &r = results_[i];
+				out << (i ? ",\n    " : "\n    ")
+				    << "{\"name\": \"" << r.name << "\", \"ops\": " << r.nr_ops
+				    << fixed << setprecision(6) << ", \"seconds\": " << r.seconds
+				    << setprecision(2) << ", \"ns_per_op\": " << ns_per_op(r) << "}";
+			}
+			out << (results_.empty() ? "]\n}\n" : "\n  ]\n}\n");
+		}
+
+	private:
+		static bool is_prefix(string const &prefix, string const &str) {
+			return !str.compare(0, prefix.length(), prefix);
+		}
+
+		static double ns_per_op(result const &r) {
+			return r.nr_ops ? r.seconds * 1000000000.0 / r.nr_ops : 0.0;
+		}
+
+		string filter_;
+		unsigned scale_;
+		vector<result> results_;
+	};
+
+	block_manager<>::ptr create_bm(block_address nr_blocks, size_t cache_mem = CACHE_MEM) {
+		::unlink(DATA_PATH.c_str());
+		return block_manager<>::ptr(new block_manager<>(DATA_PATH, nr_blocks, 16,
+								block_manager<>::CREATE,
+								true, cache_mem));
+	}
+
+	transaction_manager::ptr create_tm(block_manager<>::ptr bm) {
+		space_map::ptr sm(new core_map(bm->get_nr_blocks()));
+		sm->inc(0);
+		return transaction_manager::ptr(new transaction_manager(bm, sm));
+	}
+
+	//--------------------------------
+
+	// The cache holds 1024 blocks; hits cycle over a few of them,
+	// misses stream through sixteen times as many.
+	void bench_block_cache(suite &s) {
+		size_t const CACHE_BLOCKS = 1024;
+		block_address const NR_MISS_BLOCKS = CACHE_BLOCKS * 16;
+
+		block_manager<>::ptr bm = create_bm(NR_MISS_BLOCKS, CACHE_BLOCKS * MD_BLOCK_SIZE);
+		for (block_address b = 0; b < NR_MISS_BLOCKS; b++)
+			bm->write_lock_zero(b);
+		bm->flush();
+
+		uint64_t n = s.ops(1000000);
+		timer t;
+		for (uint64_t i = 0; i < n; i++) {
+			block_manager<>::read_ref rr = bm->read_lock(i % 64);
+			sink_ += *static_cast<unsigned char const *>(rr.data());
+		}
+		s.add("block_cache.read_hit", n, t.elapsed_seconds());
+
+		n = s.ops(1000000);
+		t.reset();
+		for (uint64_t i = 0; i < n; i++) {
+			block_manager<>::write_ref wr = bm->write_lock(i % 64);
+			static_cast<unsigned char *>(wr.data())[0] = i;
+		}
+		s.add("block_cache.write_hit", n, t.elapsed_seconds());
+		bm->flush();
+
+		n = s.ops(NR_MISS_BLOCKS * 2);
+		t.reset();
+		for (uint64_t i = 0; i < n; i++) {
+			block_manager<>::read_ref rr = bm->read_lock(i % NR_MISS_BLOCKS);
+			sink_ += *static_cast<unsigned char const *>(rr.data());
+		}
+		s.add("block_cache.read_miss", n, t.elapsed_seconds());
+	}
+
+	void bench_crc32c(suite &s) {
+		vector<unsigned char> buffer(MD_BLOCK_SIZE);
+		for (unsigned i = 0; i < buffer.size(); i++)
+			buffer[i] = i * 7;
+
+		uint64_t n = s.ops(200000);
+		timer t;
+		for (uint64_t i = 0; i < n; i++) {
+			base::crc32c sum(0);
+			sum.append(&buffer[0], buffer.size());
+			sink_ += sum.get_sum();
+		}
+		s.add("crc32c.4k", n, t.elapsed_seconds());
+	}
+
+	//--------------------------------
+
+	class key_counter : public btree<1, uint64_traits>::visitor {
+	public:
+		key_counter()
+			: nr_keys_(0) {
+		}
+
+		bool visit_internal(node_location const &l, btree<1, uint64_traits>::internal_node const &n) {
+			return true;
+		}
+
+		bool visit_internal_leaf(node_location const &l, btree<1, uint64_traits>::internal_node const &n) {
+			return true;
+		}
+
+		bool visit_leaf(node_location const &l, btree<1, uint64_traits>::leaf_node const &n) {
+			nr_keys_ += n.get_nr_entries();
+			return true;
+		}
+
+		uint64_t nr_keys_;
+	};
+
+	void bench_btree(suite &s, uint64_t nr_keys) {
+		ostringstream size;
+		size << "/" << nr_keys;
+
+		block_manager<>::ptr bm = create_bm(NR_BLOCKS);
+		transaction_manager::ptr tm = create_tm(bm);
+		uint64_traits::ref_counter rc;
+		btree<1, uint64_traits> tree(*tm, rc);
+
+		// Keys are inserted in a scattered order, as they would be
+		// by a thin device that's written to randomly.
+		key_generator keys(1, ~0ull >> 16);
+		timer t;
+		for (uint64_t i = 0; i < nr_keys; i++) {
+			uint64_t key[1] = {keys.next()};
+			tree.insert(key, i);
+		}
+		s.add("btree.insert" + size.str(), nr_keys, t.elapsed_seconds());
+
+		uint64_t n = s.ops(200000);
+		key_generator lookups(1, ~0ull >> 16);
+		t.reset();
+		for (uint64_t i = 0; i < n; i++) {
+			if (i % nr_keys == 0)
+				lookups = key_generator(1, ~0ull >> 16);
+
+			uint64_t key[1] = {lookups.next()};
+			btree<1, uint64_traits>::maybe_value v = tree.lookup(key);
+			sink_ += v ? *v : 0;
+		}
+		s.add("btree.lookup" + size.str(), n, t.elapsed_seconds());
+
+		unsigned nr_walks = max<uint64_t>(s.ops(1000000) / nr_keys, 1);
+		t.reset();
+		for (unsigned i = 0; i < nr_walks; i++) {
+			key_counter v;
+			tree.visit_depth_first(v);
+			sink_ += v.nr_keys_;
+		}
+		s.add("btree.visit" + size.str(), nr_walks * nr_keys, t.elapsed_seconds());
+	}
+
+	//--------------------------------
+
+	void bench_space_map(suite &s) {
+		block_address const NR_DATA_BLOCKS = 1024 * 1024;
+
+		block_manager<>::ptr bm = create_bm(NR_BLOCKS);
+		transaction_manager::ptr tm = create_tm(bm);
+		checked_space_map::ptr sm = create_disk_sm(*tm, NR_DATA_BLOCKS);
+
+		uint64_t n = s.ops(500000);
+		timer t;
+		for (uint64_t i = 0; i < n; i++)
+			sm->inc(i % NR_DATA_BLOCKS);
+		s.add("space_map.inc", n, t.elapsed_seconds());
+
+		t.reset();
+		for (uint64_t i = 0; i < n; i++)
+			sm->dec(i % NR_DATA_BLOCKS);
+		s.add("space_map.dec", n, t.elapsed_seconds());
+
+		// Allocating in order means each search starts from
+		// a well populated bitmap.
+		uint64_t nr_allocs = min<uint64_t>(n, NR_DATA_BLOCKS);
+		t.reset();
+		for (uint64_t i = 0; i < nr_allocs; i++) {
+			space_map::maybe_block b = sm->new_block();
+			sink_ += b ? *b : 0;
+		}
+		s.add("space_map.new_block", nr_allocs, t.elapsed_seconds());
+	}
+
+	void bench_array(suite &s) {
+		unsigned const NR_ENTRIES = 1024 * 1024;
+
+		block_manager<>::ptr bm = create_bm(NR_BLOCKS);
+		transaction_manager::ptr tm = create_tm(bm);
+		uint64_traits::ref_counter rc;
+		persistent_data::array<uint64_traits> a(*tm, rc);
+		a.grow(NR_ENTRIES, 0);
+
+		uint64_t n = s.ops(500000);
+		key_generator indexes(1, NR_ENTRIES);
+		timer t;
+		for (uint64_t i = 0; i < n; i++)
+			a.set(indexes.next(), i);
+		s.add("array.set", n, t.elapsed_seconds());
+
+		indexes = key_generator(2, NR_ENTRIES);
+		t.reset();
+		for (uint64_t i = 0; i < n; i++)
+			sink_ += a.get(indexes.next());
+		s.add("array.get", n, t.elapsed_seconds());
+	}
+
+	void bench_bitset(suite &s) {
+		unsigned const NR_BITS = 8 * 1024 * 1024;
+
+		block_manager<>::ptr bm = create_bm(NR_BLOCKS);
+		transaction_manager::ptr tm = create_tm(bm);
+		persistent_data::bitset bits(*tm);
+		bits.grow(NR_BITS, false);
+
+		uint64_t n = s.ops(1000000);
+		key_generator indexes(1, NR_BITS);
+		timer t;
+		for (uint64_t i = 0; i < n; i++)
+			bits.set(indexes.next(), true);
+		bits.flush();
+		s.add("bitset.set", n, t.elapsed_seconds());
+
+		indexes = key_generator(2, NR_BITS);
+		t.reset();
+		for (uint64_t i = 0; i < n; i++)
+			sink_ += bits.get(indexes.next());
+		s.add("bitset.get", n, t.elapsed_seconds());
+	}
+
+	void bench_bloom_filter(suite &s) {
+		unsigned const NR_BITS = 8 * 1024 * 1024;
+		unsigned const NR_PROBES = 6;
+
+		block_manager<>::ptr bm = create_bm(NR_BLOCKS);
+		transaction_manager::ptr tm = create_tm(bm);
+		bloom_filter f(*tm, NR_BITS, NR_PROBES);
+
+		uint64_t n = s.ops(500000);
+		key_generator keys(1, ~0ull >> 16);
+		timer t;
+		for (uint64_t i = 0; i < n; i++)
+			f.set(keys.next());
+		f.flush();
+		s.add("bloom_filter.set", n, t.elapsed_seconds());
+
+		keys = key_generator(2, ~0ull >> 16);
+		t.reset();
+		for (uint64_t i = 0; i < n; i++)
+			sink_ += f.test(keys.next());
+		s.add("bloom_filter.test", n, t.elapsed_seconds());
+	}
+
+	//--------------------------------
+
+	// Short runs interleaved with single mappings, as in the
+	// xml_emit bench.
+	void bench_xml(suite &s) {
+		string const xml_path("./micro_bench.xml");
+		uint64_t nr_mappings = s.ops(400000);
+
+		timer t;
+		{
+			ofstream out(xml_path.c_str());
+			thin_provisioning::emitter::ptr e = thin_provisioning::create_xml_emitter(out);
+
+			e->begin_superblock("", 1, 1, 128, nr_mappings * 2, boost::optional<uint64_t>());
+			e->begin_device(0, nr_mappings, 1, 0, 0);
+			for (uint64_t b = 0; b < nr_mappings; b += 8) {
+				e->range_map(b, b * 2, 1, 7);
+				e->single_map(b + 7, b * 2 + 1000, 1);
+			}
+			e->end_device();
+			e->end_superblock();
+		}
+		s.add("xml.emit", nr_mappings, t.elapsed_seconds());
+
+		boost::shared_ptr<thin_counting_emitter> e(new thin_counting_emitter);
+		t.reset();
+		thin_provisioning::parse_xml(xml_path, e, true);
+		s.add("xml.parse", e->nr_mappings_, t.elapsed_seconds());
+
+		::unlink(xml_path.c_str());
+	}
+
+	//--------------------------------
+
+	int bench_micro(string const &filter, unsigned scale, string const &output) {
+		suite s(filter, scale);
+
+		if (s.wanted("block_cache"))
+			bench_block_cache(s);
+
+		if (s.wanted("crc32c"))
+			bench_crc32c(s);
+
+		if (s.wanted("btree")) {
+			bench_btree(s, 1024);
+			bench_btree(s, 64 * 1024);
+			bench_btree(s, 1024 * 1024);
+		}
+
+		if (s.wanted("space_map"))
+			bench_space_map(s);
+
+		if (s.wanted("array"))
+			bench_array(s);
+
+		if (s.wanted("bitset"))
+			bench_bitset(s);
+
+		if (s.wanted("bloom_filter"))
+			bench_bloom_filter(s);
+
+		if (s.wanted("xml"))
+			bench_xml(s);
+
+		::unlink(DATA_PATH.c_str());
+
+		if (output.empty())
+			s.write_json(cout);
+		else {
+			ofstream out(output.c_str());
+			s.write_json(out);
+			if (!out)
+				throw runtime_error("couldn't write " + output);
+		}
+
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+micro_cmd::micro_cmd()
+	: command("micro")
+{
+}
+
+void
+micro_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-f|--filter} <only run benchmarks whose names start with this>" << endl
+	    << "  {-s|--scale} <multiply the op counts by this>" << endl
+	    << "  {-o|--output} <json file>" << endl;
+}
+
+int
+micro_cmd::run(int argc, char **argv)
+{
+	int c;
+	char const *short_opts = "hf:s:o:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "filter", required_argument, NULL, 'f'},
+		{ "scale", required_argument, NULL, 's'},
+		{ "output", required_argument, NULL, 'o'},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	string filter;
+	uint64_t scale = 1;
+	string output;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 'f':
+			filter = optarg;
+			break;
+
+		case 's':
+			scale = parse_uint64(optarg, "scale");
+			break;
+
+		case 'o':
+			output = optarg;
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (!scale)
+		die("scale must be greater than zero");
+
+	try {
+		return bench_micro(filter, scale, output);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
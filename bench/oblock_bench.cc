@@ -0,0 +1,221 @@
+#include "bench/bench_utils.h"
+#include "bench/commands.h"
+
+#include "caching/oblock_tracker.h"
+
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace bench;
+using namespace caching;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	// A large prime, so consecutive cache blocks map to origin
+	// blocks scattered across the origin, with no repeats.
+	uint64_t const SCATTER = 2654435761ull;
+
+	uint64_t oblock(uint64_t cblock, uint64_t nr_origin_blocks) {
+		return (cblock * SCATTER) % nr_origin_blocks;
+	}
+
+	uint64_t run_set(uint64_t nr_cache_blocks, uint64_t nr_origin_blocks) {
+		set<uint64_t> seen;
+		uint64_t nr_dups = 0;
+
+		for (uint64_t b = 0; b < nr_cache_blocks; b++) {
+			uint64_t ob = oblock(b, nr_origin_blocks);
+			if (seen.find(ob) != seen.end())
+				nr_dups++;
+			else
+				seen.insert(ob);
+		}
+
+		return nr_dups;
+	}
+
+	uint64_t run_tracker(uint64_t nr_cache_blocks, uint64_t nr_origin_blocks,
+			     uint64_t nr_dense_blocks) {
+		oblock_tracker seen(nr_dense_blocks);
+		uint64_t nr_dups = 0;
+
+		for (uint64_t b = 0; b < nr_cache_blocks; b++)
+			if (seen.test_and_set(oblock(b, nr_origin_blocks)))
+				nr_dups++;
+
+		return nr_dups;
+	}
+
+	enum detector {
+		STD_SET,
+		DENSE,
+		SPARSE
+	};
+
+	char const *detector_name(detector d) {
+		switch (d) {
+		case STD_SET:
+			return "std::set";
+
+		case DENSE:
+			return "oblock_tracker (origin size known)";
+
+		case SPARSE:
+			return "oblock_tracker (origin size unknown)";
+		}
+
+		return "?";
+	}
+
+	// Each run is in its own process, so the peak resident size
+	// belongs to that detector alone.
+	void bench_detector(detector d, uint64_t nr_cache_blocks, uint64_t nr_origin_blocks) {
+		cout << detector_name(d) << ", " << nr_cache_blocks << " cache blocks: " << flush;
+
+		pid_t pid = fork();
+		if (pid < 0)
+			throw runtime_error("fork failed");
+
+		if (!pid) {
+			timer t;
+			uint64_t nr_dups;
+
+			switch (d) {
+			case STD_SET:
+				nr_dups = run_set(nr_cache_blocks, nr_origin_blocks);
+				break;
+
+			case DENSE:
+				nr_dups = run_tracker(nr_cache_blocks, nr_origin_blocks, nr_origin_blocks);
+				break;
+
+			default:
+				nr_dups = run_tracker(nr_cache_blocks, nr_origin_blocks, 0);
+				break;
+			}
+
+			double secs = t.elapsed_seconds();
+			cout << fixed << setprecision(2) << secs << "s, "
+			     << (nr_cache_blocks / secs) / 1000000.0 << "M blocks/s, "
+			     << nr_dups << " duplicates, " << flush;
+			_exit(0);
+		}
+
+		int status;
+		struct rusage usage;
+		if (wait4(pid, &status, 0, &usage) < 0)
+			throw runtime_error("wait4 failed");
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			cout << "failed (out of memory?)" << endl;
+		else
+			cout << "peak rss " << usage.ru_maxrss / 1024 << "MB" << endl;
+	}
+
+	int bench_oblocks(vector<uint64_t> const &sizes, uint64_t origin_factor,
+			  bool include_set) {
+		for (vector<uint64_t>::const_iterator it = sizes.begin(); it != sizes.end(); ++it) {
+			uint64_t nr_origin_blocks = *it * origin_factor;
+
+			if (include_set)
+				bench_detector(STD_SET, *it, nr_origin_blocks);
+			bench_detector(DENSE, *it, nr_origin_blocks);
+			bench_detector(SPARSE, *it, nr_origin_blocks);
+		}
+
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+oblock_tracker_cmd::oblock_tracker_cmd()
+	: command("oblock_tracker")
+{
+}
+
+void
+oblock_tracker_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-n|--nr-cache-blocks} <cache blocks> (may be repeated)" << endl
+	    << "  {-f|--origin-factor} <origin size, as a multiple of the cache>" << endl
+	    << "  {--no-set}" << endl;
+}
+
+int
+oblock_tracker_cmd::run(int argc, char **argv)
+{
+	int c;
+	char const *short_opts = "hn:f:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "nr-cache-blocks", required_argument, NULL, 'n'},
+		{ "origin-factor", required_argument, NULL, 'f'},
+		{ "no-set", no_argument, NULL, 1},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	vector<uint64_t> sizes;
+	uint64_t origin_factor = 10;
+	bool include_set = true;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 'n':
+			sizes.push_back(parse_uint64(optarg, "nr cache blocks"));
+			break;
+
+		case 'f':
+			origin_factor = parse_uint64(optarg, "origin factor");
+			break;
+
+		case 1:
+			include_set = false;
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (sizes.empty()) {
+		sizes.push_back(10000000);
+		sizes.push_back(50000000);
+		sizes.push_back(100000000);
+	}
+
+	for (vector<uint64_t>::const_iterator it = sizes.begin(); it != sizes.end(); ++it)
+		if (!*it)
+			die("counts must be greater than zero");
+
+	if (!origin_factor)
+		die("origin factor must be greater than zero");
+
+	try {
+		return bench_oblocks(sizes, origin_factor, include_set);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,260 @@
+#include "bench/bench_utils.h"
+#include "bench/commands.h"
+
+#include "persistent-data/file_utils.h"
+#include "thin-provisioning/libthin_metadata.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace bench;
+using namespace persistent_data;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	// Runs a tool the way a daemon would, output discarded.
+	void run_tool(vector<string> const &args) {
+		pid_t pid = fork();
+		if (pid < 0)
+			throw runtime_error("fork failed");
+
+		if (!pid) {
+			int null = ::open("/dev/null", O_WRONLY);
+			::dup2(null, 1);
+			::dup2(null, 2);
+
+			vector<char *> argv;
+			for (unsigned i = 0; i < args.size(); i++)
+				argv.push_back(const_cast<char *>(args[i].c_str()));
+			argv.push_back(NULL);
+
+			::execv(argv[0], &argv[0]);
+			::_exit(127);
+		}
+
+		int status;
+		if (::waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			throw runtime_error("couldn't run " + args[0]);
+	}
+
+	vector<string> tool_args(string const &tools, string const &name) {
+		vector<string> args;
+		args.push_back(tools);
+		args.push_back(name);
+		return args;
+	}
+
+	//--------------------------------
+
+	int count_mappings(void *context, uint64_t, uint64_t, uint64_t len) {
+		*static_cast<uint64_t *>(context) += len;
+		return 0;
+	}
+
+	int count_differences(void *context, thin_md_delta_type t,
+			      uint64_t, uint64_t, uint64_t, uint64_t len) {
+		if (t != THIN_MD_SAME)
+			*static_cast<uint64_t *>(context) += len;
+		return 0;
+	}
+
+	void check(thin_md_session *s, int r) {
+		if (r < 0)
+			throw runtime_error(thin_md_error(s));
+	}
+
+	struct query {
+		string name;
+		vector<string> args;
+		double process;
+		double session;
+	};
+
+	void report(query const &q, unsigned nr_queries) {
+		cout << q.name << ": "
+		     << fixed << setprecision(2)
+		     << q.process * 1000.0 / nr_queries << "ms per process, "
+		     << q.session * 1000.0 / nr_queries << "ms per session query, "
+		     << setprecision(1) << (q.session > 0.0 ? q.process / q.session : 0.0)
+		     << "x" << endl;
+	}
+
+	int bench_session(string const &tools, unsigned nr_devs, uint64_t nr_blocks,
+			  unsigned nr_queries) {
+		string const path("./session_bench.data");
+
+		timer t;
+		generate_thin_metadata(path, nr_devs, nr_blocks);
+		cout << "generated " << nr_devs << " devices of " << nr_blocks
+		     << " blocks in " << fixed << setprecision(3) << t.elapsed_seconds()
+		     << "s" << endl;
+
+		vector<query> queries(4);
+		queries[0].name = "list devices";
+		queries[0].args = tool_args(tools, "thin_ls");
+		queries[0].args.push_back("--format=DEV,MAPPED_BLOCKS");
+
+		queries[1].name = "exclusive blocks";
+		queries[1].args = tool_args(tools, "thin_ls");
+		queries[1].args.push_back("--format=DEV,EXCLUSIVE_BLOCKS");
+
+		queries[2].name = "delta";
+		queries[2].args = tool_args(tools, "thin_delta");
+		queries[2].args.push_back("--snap1=0");
+		queries[2].args.push_back("--snap2=1");
+
+		// thin_dump can't be restricted to one device.
+		queries[3].name = "range lookup";
+		queries[3].args = tool_args(tools, "thin_dump");
+
+		for (unsigned i = 0; i < queries.size(); i++) {
+			queries[i].args.push_back(path);
+
+			t.reset();
+			for (unsigned n = 0; n < nr_queries; n++)
+				run_tool(queries[i].args);
+			queries[i].process = t.elapsed_seconds();
+		}
+
+		// The session is opened inside the timing, once.
+		t.reset();
+		char *err;
+		thin_md_session *s = thin_md_open(path.c_str(), 0, 0, &err);
+		if (!s) {
+			string msg(err);
+			free(err);
+			throw runtime_error(msg);
+		}
+		double open_time = t.elapsed_seconds();
+
+		vector<thin_md_device> devs(nr_devs);
+		for (unsigned i = 0; i < queries.size(); i++) {
+			t.reset();
+			for (unsigned n = 0; n < nr_queries; n++) {
+				uint64_t total = 0;
+
+				switch (i) {
+				case 0:
+					check(s, thin_md_list_devices(s, &devs[0], devs.size()));
+					break;
+
+				case 1:
+					for (unsigned d = 0; d < nr_devs; d++)
+						check(s, thin_md_exclusive_blocks(s, d, &total));
+					break;
+
+				case 2:
+					check(s, thin_md_delta(s, 0, 1, count_differences, &total));
+					break;
+
+				case 3:
+					check(s, thin_md_lookup_range(s, 1, 0, nr_blocks, count_mappings, &total));
+					if (total != nr_blocks)
+						throw runtime_error("range lookup missed mappings");
+					break;
+				}
+			}
+			queries[i].session = t.elapsed_seconds();
+		}
+		queries[0].session += open_time;
+
+		thin_md_close(s);
+
+		cout << nr_queries << " of each query, session open " << setprecision(2)
+		     << open_time * 1000.0 << "ms (counted in the first):" << endl;
+		for (unsigned i = 0; i < queries.size(); i++)
+			report(queries[i], nr_queries);
+
+		::unlink(path.c_str());
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+session_cmd::session_cmd()
+	: command("thin_session")
+{
+}
+
+void
+session_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-b|--nr-blocks} <blocks per device>" << endl
+	    << "  {-d|--nr-devices} <thin devices>" << endl
+	    << "  {-q|--nr-queries} <queries of each kind>" << endl
+	    << "  {-t|--pdata-tools} <path to pdata_tools>" << endl;
+}
+
+int
+session_cmd::run(int argc, char **argv)
+{
+	int c;
+	char const *short_opts = "hb:d:q:t:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "nr-blocks", required_argument, NULL, 'b'},
+		{ "nr-devices", required_argument, NULL, 'd'},
+		{ "nr-queries", required_argument, NULL, 'q'},
+		{ "pdata-tools", required_argument, NULL, 't'},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	uint64_t nr_blocks = 256 * 1024;
+	uint64_t nr_devs = 8;
+	uint64_t nr_queries = 20;
+	string tools = "bin/pdata_tools";
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 'b':
+			nr_blocks = parse_uint64(optarg, "nr blocks");
+			break;
+
+		case 'd':
+			nr_devs = parse_uint64(optarg, "nr devices");
+			break;
+
+		case 'q':
+			nr_queries = parse_uint64(optarg, "nr queries");
+			break;
+
+		case 't':
+			tools = optarg;
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (!nr_blocks || nr_devs < 2 || !nr_queries)
+		die("counts must be greater than zero, with at least two devices");
+
+	try {
+		return bench_session(tools, nr_devs, nr_blocks, nr_queries);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,185 @@
+#include "bench/bench_utils.h"
+#include "bench/commands.h"
+
+#include "base/progress_monitor.h"
+#include "persistent-data/file_utils.h"
+#include "persistent-data/space-maps/disk.h"
+#include "thin-provisioning/metadata.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <unistd.h>
+
+using namespace bench;
+using namespace persistent_data;
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	// Does as little as a walk can, so the cost of the progress
+	// estimate isn't hidden behind the visitor's.
+	class node_counter : public mapping_tree::visitor {
+	public:
+		node_counter()
+			: nr_nodes_(0) {
+		}
+
+		bool visit_internal(node_location const &l, mapping_tree::internal_node const &n) {
+			nr_nodes_++;
+			return true;
+		}
+
+		bool visit_internal_leaf(node_location const &l, mapping_tree::internal_node const &n) {
+			nr_nodes_++;
+			return true;
+		}
+
+		bool visit_leaf(node_location const &l, mapping_tree::leaf_node const &n) {
+			nr_nodes_++;
+			return true;
+		}
+
+		uint64_t get_nr_nodes() const {
+			return nr_nodes_;
+		}
+
+	private:
+		uint64_t nr_nodes_;
+	};
+
+	double time_walk(metadata &md, uint64_t &nr_nodes) {
+		node_counter v;
+
+		timer t;
+		md.mappings_->visit_depth_first(v);
+		double seconds = t.elapsed_seconds();
+
+		nr_nodes = v.get_nr_nodes();
+		return seconds;
+	}
+
+	// The walks alternate, so both see the same cache and the same
+	// background noise.  The best of each is compared.
+	int bench_walk(unsigned nr_devs, uint64_t nr_blocks, unsigned nr_walks) {
+		string const path("./walk_bench.data");
+
+		generate_thin_metadata(path, nr_devs, nr_blocks);
+
+		block_manager<>::ptr bm = open_bm(path, block_manager<>::READ_ONLY);
+		metadata md(bm);
+
+		int null = ::open("/dev/null", O_WRONLY);
+		if (null < 0)
+			throw runtime_error("couldn't open /dev/null");
+
+		uint64_t nr_nodes = 0;
+		double best_without = 0.0, best_with = 0.0;
+
+		time_walk(md, nr_nodes);
+		for (unsigned i = 0; i < nr_walks; i++) {
+			double without = time_walk(md, nr_nodes);
+
+			// A zero interval updates on every clock read,
+			// the worst case.
+			base::enable_walk_progress(base::create_fd_progress_monitor(null, "walk"), 0);
+			base::set_walk_progress_total(get_nr_allocated(md.sb_.metadata_space_map_root_));
+			double with = time_walk(md, nr_nodes);
+			base::disable_walk_progress();
+
+			if (!i || without < best_without)
+				best_without = without;
+
+			if (!i || with < best_with)
+				best_with = with;
+		}
+
+		::close(null);
+
+		cout << nr_nodes << " nodes, best of " << nr_walks << " walks" << endl;
+		report_rate(cout, "without progress", nr_nodes, best_without);
+		report_rate(cout, "with progress", nr_nodes, best_with);
+		cout << "overhead: " << fixed << setprecision(2)
+		     << (best_without > 0.0 ? 100.0 * (best_with - best_without) / best_without : 0.0)
+		     << "%" << endl;
+
+		::unlink(path.c_str());
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+walk_progress_cmd::walk_progress_cmd()
+	: command("walk_progress")
+{
+}
+
+void
+walk_progress_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-b|--nr-blocks} <blocks per device>" << endl
+	    << "  {-d|--nr-devices} <thin devices>" << endl
+	    << "  {-w|--nr-walks} <walks of each kind>" << endl;
+}
+
+int
+walk_progress_cmd::run(int argc, char **argv)
+{
+	int c;
+	char const *short_opts = "hb:d:w:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "nr-blocks", required_argument, NULL, 'b'},
+		{ "nr-devices", required_argument, NULL, 'd'},
+		{ "nr-walks", required_argument, NULL, 'w'},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	uint64_t nr_blocks = 1024 * 1024;
+	uint64_t nr_devs = 8;
+	uint64_t nr_walks = 10;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 'b':
+			nr_blocks = parse_uint64(optarg, "nr blocks");
+			break;
+
+		case 'd':
+			nr_devs = parse_uint64(optarg, "nr devices");
+			break;
+
+		case 'w':
+			nr_walks = parse_uint64(optarg, "nr walks");
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (!nr_blocks || !nr_devs || !nr_walks)
+		die("counts must be greater than zero");
+
+	try {
+		return bench_walk(nr_devs, nr_blocks, nr_walks);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
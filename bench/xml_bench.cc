@@ -0,0 +1,291 @@
+#include "bench/bench_utils.h"
+#include "bench/commands.h"
+
+#include "base/progress_monitor.h"
+#include "caching/xml_format.h"
+#include "thin-provisioning/xml_format.h"
+
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace bench;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	class cache_counting_emitter : public caching::emitter {
+	public:
+		cache_counting_emitter()
+			: nr_mappings_(0) {
+		}
+
+		void begin_superblock(string const &uuid,
+				      persistent_data::block_address block_size,
+				      persistent_data::block_address nr_cache_blocks,
+				      string const &policy,
+				      size_t hint_width) {}
+		void end_superblock() {}
+		void begin_mappings() {}
+		void end_mappings() {}
+
+		void mapping(persistent_data::block_address cblock,
+			     persistent_data::block_address oblock,
+			     bool dirty) {
+			nr_mappings_++;
+		}
+
+		void begin_hints() {}
+		void end_hints() {}
+		void hint(persistent_data::block_address cblock,
+			  vector<unsigned char> const &data) {}
+		void begin_discards() {}
+		void end_discards() {}
+		void discard(persistent_data::block_address dblock_begin,
+			     persistent_data::block_address dblock_end) {}
+
+		uint64_t nr_mappings_;
+	};
+
+	//--------------------------------
+
+	uint64_t const MAPPINGS_PER_DEVICE = 1024 * 1024;
+
+	// A fragmented pool: short runs interleaved with single
+	// mappings, which is the worst case for the parser.  The emitters
+	// buffer their output, so the size is only approximate.
+	void generate_thin_xml(string const &path, uint64_t target_bytes) {
+		ofstream out(path.c_str());
+		thin_provisioning::emitter::ptr e =
+			thin_provisioning::create_xml_emitter(out);
+
+		// Each mapping takes at least 8 bytes of xml, so this is
+		// plenty of data blocks, even allowing for the overshoot.
+		uint64_t nr_data_blocks = target_bytes / 8 + 2 * MAPPINGS_PER_DEVICE;
+		e->begin_superblock("", 1, 1, 128, nr_data_blocks,
+				    boost::optional<uint64_t>());
+
+		uint64_t data_block = 0;
+		for (uint32_t dev = 0; static_cast<uint64_t>(out.tellp()) < target_bytes; dev++) {
+			e->begin_device(dev, MAPPINGS_PER_DEVICE, 1, 0, 0);
+			for (uint64_t b = 0; b < MAPPINGS_PER_DEVICE; b += 8) {
+				e->range_map(b, data_block, dev % 5, 7);
+				e->single_map(b + 7, data_block + 1000, dev % 5);
+				data_block += 8;
+			}
+			e->end_device();
+		}
+
+		e->end_superblock();
+	}
+
+	// Every cache block is mapped.  A mapping line is roughly 64
+	// bytes, which gives us the size of the cache.
+	void generate_cache_xml(string const &path, uint64_t target_bytes) {
+		ofstream out(path.c_str());
+		caching::emitter::ptr e = caching::create_xml_emitter(out);
+		uint64_t nr_cache_blocks = max<uint64_t>(target_bytes / 64, 1024);
+
+		e->begin_superblock("", 128, nr_cache_blocks, "smq", 4);
+		e->begin_mappings();
+
+		for (uint64_t cblock = 0; cblock < nr_cache_blocks; cblock++)
+			e->mapping(cblock, cblock * 3, cblock % 3 == 0);
+
+		e->end_mappings();
+		e->end_superblock();
+	}
+
+	int parse_thin(string const &path) {
+		boost::shared_ptr<thin_counting_emitter> e(new thin_counting_emitter);
+
+		timer t;
+		thin_provisioning::parse_xml(path, e, true);
+		double elapsed = t.elapsed_seconds();
+
+		report_throughput(cout, "thin xml parse", get_file_size(path), elapsed);
+		cout << "  " << e->nr_mappings_ << " mappings" << endl;
+		return 0;
+	}
+
+	int parse_cache(string const &path) {
+		boost::shared_ptr<cache_counting_emitter> e(new cache_counting_emitter);
+		auto_ptr<base::progress_monitor> monitor = base::create_quiet_progress_monitor();
+		ifstream in(path.c_str());
+
+		timer t;
+		caching::parse_xml(in, e, get_file_size(path), *monitor);
+		double elapsed = t.elapsed_seconds();
+
+		report_throughput(cout, "cache xml parse", get_file_size(path), elapsed);
+		cout << "  " << e->nr_mappings_ << " mappings" << endl;
+		return 0;
+	}
+}
+
+//----------------------------------------------------------------
+
+xml_emit_cmd::xml_emit_cmd()
+	: command("xml_emit")
+{
+}
+
+void
+xml_emit_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options] [output xml file]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-t|--type} {thin|cache}" << endl
+	    << "  {-s|--size} <MiB of xml to generate>" << endl;
+}
+
+int
+xml_emit_cmd::run(int argc, char **argv)
+{
+	int c;
+	char const *short_opts = "ht:s:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "type", required_argument, NULL, 't'},
+		{ "size", required_argument, NULL, 's'},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	string type = "thin";
+	uint64_t size_mb = 1024;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 't':
+			type = optarg;
+			break;
+
+		case 's':
+			size_mb = parse_uint64(optarg, "size");
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (type != "thin" && type != "cache")
+		die("unknown type '" + type + "'");
+
+	try {
+		string path = (optind < argc) ? argv[optind] : "./xml_emit_bench.xml";
+
+		timer t;
+		if (type == "thin")
+			generate_thin_xml(path, size_mb * 1024 * 1024);
+		else
+			generate_cache_xml(path, size_mb * 1024 * 1024);
+		double elapsed = t.elapsed_seconds();
+
+		report_throughput(cout, type + " xml emit", get_file_size(path), elapsed);
+
+		if (optind == argc)
+			::unlink(path.c_str());
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+//----------------------------------------------------------------
+
+xml_parse_cmd::xml_parse_cmd()
+	: command("xml_parse")
+{
+}
+
+void
+xml_parse_cmd::usage(ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options] [input xml file]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {-t|--type} {thin|cache}" << endl
+	    << "  {-s|--size} <MiB of xml to generate if no input is given>" << endl;
+}
+
+int
+xml_parse_cmd::run(int argc, char **argv)
+{
+	int c;
+	char const *short_opts = "ht:s:";
+	option const long_opts[] = {
+		{ "help", no_argument, NULL, 'h'},
+		{ "type", required_argument, NULL, 't'},
+		{ "size", required_argument, NULL, 's'},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	string type = "thin";
+	uint64_t size_mb = 1024;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 't':
+			type = optarg;
+			break;
+
+		case 's':
+			size_mb = parse_uint64(optarg, "size");
+			break;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (type != "thin" && type != "cache")
+		die("unknown type '" + type + "'");
+
+	try {
+		string path;
+		bool generated = false;
+
+		if (optind < argc)
+			path = argv[optind];
+
+		else {
+			path = "./xml_parse_bench.xml";
+			if (type == "thin")
+				generate_thin_xml(path, size_mb * 1024 * 1024);
+			else
+				generate_cache_xml(path, size_mb * 1024 * 1024);
+			generated = true;
+		}
+
+		int r = (type == "thin") ? parse_thin(path) : parse_cache(path);
+
+		if (generated)
+			::unlink(path.c_str());
+
+		return r;
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
@@ -1,5 +1,8 @@
 #include "block-cache/block_cache.h"
 
+#include "base/metrics.h"
+#include "base/mutex_lock.h"
+
 #include <assert.h>
 #include <libaio.h>
 #include <errno.h>
@@ -9,6 +12,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <sstream>
@@ -22,12 +26,22 @@ using namespace bcache;
 #define PAGE_SIZE 4096
 
 #define MIN_BLOCKS 16
+#define MAX_IO_EVENTS 4096
 #define WRITEBACK_LOW_THRESHOLD_PERCENT 33
 #define WRITEBACK_HIGH_THRESHOLD_PERCENT 66
 
 //----------------------------------------------------------------
 
 namespace {
+	// See block_cache::set_limits().  The limits are shared by
+	// every cache in the process, so these track how much of them
+	// the live caches hold.
+	pthread_mutex_t limits_lock_ = PTHREAD_MUTEX_INITIALIZER;
+	size_t mem_limit_ = 0;
+	size_t mem_in_use_ = 0;
+	unsigned io_limit_ = 0;
+	unsigned io_in_use_ = 0;
+
 	void *alloc_aligned(size_t len, size_t alignment)
 	{
 		void *result = NULL;
@@ -155,10 +169,21 @@ block_cache::issue_low_level(block &b, enum io_iocb_cmd opcode, const char *desc
 	iocb *control_blocks[1];
 
 	assert(!b.test_flags(BF_IO_PENDING));
+
+	// A large cache may have more blocks than the aio context
+	// has room for.
+	while (nr_io_pending_ >= events_.size())
+		wait_io();
+
 	b.set_flags(BF_IO_PENDING);
 	nr_io_pending_++;
 	list_move_tail(&b.list_, &io_pending_);
 
+	if (queue_depth_) {
+		queue_depth_->record(nr_io_pending_);
+		b.issue_time_ = base::monotonic_ns();
+	}
+
 	b.control_block_.aio_lio_opcode = opcode;
 	control_blocks[0] = &b.control_block_;
 	r = io_submit(aio_context_, 1, control_blocks);
@@ -199,7 +224,7 @@ block_cache::wait_io()
 	unsigned i;
 
 	// FIXME: use a timeout to prevent hanging
-	r = io_getevents(aio_context_, 1, nr_cache_blocks_, &events_[0], NULL);
+	r = io_getevents(aio_context_, 1, events_.size(), &events_[0], NULL);
 	if (r < 0) {
 		std::ostringstream out;
 		out << "io_getevents failed: " << r;
@@ -210,6 +235,12 @@ block_cache::wait_io()
 		io_event const &e = events_[i];
 		block *b = container_of(e.obj, block, control_block_);
 
+		if (read_latency_) {
+			base::histogram *h = (b->control_block_.aio_lio_opcode == IO_CMD_PREAD) ?
+				read_latency_ : write_latency_;
+			h->record((base::monotonic_ns() - b->issue_time_) / 1000);
+		}
+
 		if (e.res == block_size_ << SECTOR_SHIFT)
 			complete_io(*b, 0);
 
@@ -451,38 +482,109 @@ block_cache::block_cache(int fd, sector_t block_size, uint64_t on_disk_blocks, s
 	  write_hits_(0),
 	  write_misses_(0),
 	  prefetches_(0),
-	  noop_validator_(new noop_validator())
+	  read_latency_(NULL),
+	  write_latency_(NULL),
+	  queue_depth_(NULL),
+	  noop_validator_(new noop_validator()),
+	  mem_reserved_(0),
+	  io_reserved_(0)
 {
 	int r;
-	unsigned nr_cache_blocks = calc_nr_cache_blocks(mem, block_size);
-	unsigned nr_buckets = calc_nr_buckets(nr_cache_blocks);
 
-	buckets_.resize(nr_buckets);
+	if (base::metrics_enabled()) {
+		base::metrics_registry &m = base::get_metrics();
+		read_latency_ = &m.get_histogram("block_cache.read_latency", "us");
+		write_latency_ = &m.get_histogram("block_cache.write_latency", "us");
+		queue_depth_ = &m.get_histogram("block_cache.queue_depth", "ios");
+	}
 
-	fd_ = fd;
-	block_size_ = block_size;
-	nr_data_blocks_ = on_disk_blocks;
-	nr_cache_blocks_ = nr_cache_blocks;
+	unsigned nr_cache_blocks, nr_events;
+	{
+		// A cache always gets its minimum, even if that takes
+		// the process a little over the limits.
+		base::mutex_lock l(limits_lock_);
 
-	events_.resize(nr_cache_blocks);
+		if (mem_limit_)
+			mem = std::min(mem, mem_limit_ - std::min(mem_limit_, mem_in_use_));
 
-	aio_context_ = 0; /* needed or io_setup will fail */
-	r = io_setup(nr_cache_blocks, &aio_context_);
-	if (r < 0) {
-		perror("io_setup failed");
-		throw std::runtime_error("io_setup failed");
+		nr_cache_blocks = calc_nr_cache_blocks(mem, block_size);
+
+		unsigned max_io = MAX_IO_EVENTS;
+		if (io_limit_)
+			max_io = std::min<unsigned>(max_io, std::max(1u, io_limit_ - std::min(io_limit_, io_in_use_)));
+
+		nr_events = std::min<unsigned>(nr_cache_blocks, max_io);
+
+		mem_reserved_ = nr_cache_blocks * ((block_size << SECTOR_SHIFT) + sizeof(block));
+		io_reserved_ = nr_events;
+		mem_in_use_ += mem_reserved_;
+		io_in_use_ += io_reserved_;
 	}
 
-	hash_init(nr_buckets);
-	INIT_LIST_HEAD(&free_);
-	INIT_LIST_HEAD(&errored_);
-	INIT_LIST_HEAD(&dirty_);
-	INIT_LIST_HEAD(&clean_);
-	INIT_LIST_HEAD(&io_pending_);
+	try {
+		unsigned nr_buckets = calc_nr_buckets(nr_cache_blocks);
+
+		buckets_.resize(nr_buckets);
+
+		fd_ = fd;
+		block_size_ = block_size;
+		nr_data_blocks_ = on_disk_blocks;
+		nr_cache_blocks_ = nr_cache_blocks;
+
+		events_.resize(nr_events);
+
+		aio_context_ = 0; /* needed or io_setup will fail */
+		r = io_setup(events_.size(), &aio_context_);
+		if (r < 0) {
+			perror("io_setup failed");
+			throw std::runtime_error("io_setup failed");
+		}
+
+		hash_init(nr_buckets);
+		INIT_LIST_HEAD(&free_);
+		INIT_LIST_HEAD(&errored_);
+		INIT_LIST_HEAD(&dirty_);
+		INIT_LIST_HEAD(&clean_);
+		INIT_LIST_HEAD(&io_pending_);
 
-	r = init_free_list(nr_cache_blocks);
-	if (r)
-		throw std::runtime_error("couldn't allocate blocks");
+		r = init_free_list(nr_cache_blocks);
+		if (r)
+			throw std::runtime_error("couldn't allocate blocks");
+
+	} catch (...) {
+		release_limits();
+		throw;
+	}
+}
+
+void
+block_cache::set_limits(size_t max_mem, unsigned max_io)
+{
+	base::mutex_lock l(limits_lock_);
+	mem_limit_ = max_mem;
+	io_limit_ = max_io;
+}
+
+size_t
+block_cache::get_mem_in_use()
+{
+	base::mutex_lock l(limits_lock_);
+	return mem_in_use_;
+}
+
+unsigned
+block_cache::get_io_in_use()
+{
+	base::mutex_lock l(limits_lock_);
+	return io_in_use_;
+}
+
+void
+block_cache::release_limits()
+{
+	base::mutex_lock l(limits_lock_);
+	mem_in_use_ -= mem_reserved_;
+	io_in_use_ -= io_reserved_;
 }
 
 block_cache::~block_cache()
@@ -497,17 +599,23 @@ block_cache::~block_cache()
 		io_destroy(aio_context_);
 
 	::close(fd_);
+	release_limits();
+
+	if (base::metrics_enabled())
+		publish_metrics();
+}
+
+void
+block_cache::publish_metrics() const
+{
+	base::metrics_registry &m = base::get_metrics();
 
-#if 0
-	std::cerr << "\nblock cache stats\n"
-		  << "=================\n"
-		  << "prefetches:\t" << prefetches_ << "\n"
-		  << "read hits:\t" << read_hits_ << "\n"
-		  << "read misses:\t" << read_misses_ << "\n"
-		  << "write hits:\t" << write_hits_ << "\n"
-		  << "write misses:\t" << write_misses_ << "\n"
-		  << "write zeroes:\t" << write_zeroes_ << std::endl;
-#endif
+	m.get_counter("block_cache.prefetches").add(prefetches_);
+	m.get_counter("block_cache.read_hits").add(read_hits_);
+	m.get_counter("block_cache.read_misses").add(read_misses_);
+	m.get_counter("block_cache.write_hits").add(write_hits_);
+	m.get_counter("block_cache.write_misses").add(write_misses_);
+	m.get_counter("block_cache.write_zeroes").add(write_zeroes_);
 }
 
 uint64_t
@@ -676,6 +784,21 @@ block_cache::flush()
 	return list_empty(&errored_) ? 0 : -EIO;
 }
 
+void
+block_cache::preload(block_address index, void const *data)
+{
+	check_index(index);
+
+	if (hash_lookup(index))
+		return;
+
+	block *b = new_block(index);
+	if (b) {
+		memcpy(b->data_, data, block_size_ << SECTOR_SHIFT);
+		list_add_tail(&b->list_, &clean_);
+	}
+}
+
 void
 block_cache::prefetch(block_address index)
 {
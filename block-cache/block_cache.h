@@ -15,6 +15,10 @@
 
 //----------------------------------------------------------------
 
+namespace base {
+	class histogram;
+}
+
 namespace bcache {
 	typedef uint64_t block_address;
 	typedef uint64_t sector_t;
@@ -109,6 +113,7 @@ namespace bcache {
 			unsigned flags_;
 
 			iocb control_block_;
+			uint64_t issue_time_;
 			validator::ptr v_;
 		};
 
@@ -118,6 +123,17 @@ namespace bcache {
 			    uint64_t max_nr_blocks, size_t mem);
 		~block_cache();
 
+		// Caps the memory and the number of ios in flight of all
+		// the caches created afterwards in this process, together.
+		// Each new cache gets what the live ones have left.  Zero
+		// means no cap.  Used when several tools share a machine's
+		// memory and disks.
+		static void set_limits(size_t max_mem, unsigned max_io);
+
+		// How much of the limits the live caches hold.
+		static size_t get_mem_in_use();
+		static unsigned get_io_in_use();
+
 		uint64_t get_nr_blocks() const;
 		uint64_t get_nr_locked() const;
 
@@ -136,6 +152,12 @@ namespace bcache {
 		int flush();
 		void prefetch(block_address index);
 
+		// Puts a copy of a block that's been read by other means
+		// into the cache, as if it had just been read with a noop
+		// validator.  The real validator is run when the block is
+		// next got.
+		void preload(block_address index, void const *data);
+
 	private:
 		int init_free_list(unsigned count);
 		void exit_free_list();
@@ -170,6 +192,8 @@ namespace bcache {
 
 		void inc_hit_counter(unsigned flags);
 		void inc_miss_counter(unsigned flags);
+		void publish_metrics() const;
+		void release_limits();
 
 		//--------------------------------
 
@@ -215,7 +239,16 @@ namespace bcache {
 		unsigned write_misses_;
 		unsigned prefetches_;
 
+		// Null unless metrics are enabled.
+		base::histogram *read_latency_;
+		base::histogram *write_latency_;
+		base::histogram *queue_depth_;
+
 		validator::ptr noop_validator_;
+
+		// Our share of the process wide limits.
+		size_t mem_reserved_;
+		unsigned io_reserved_;
 	};
 }
 
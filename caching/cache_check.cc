@@ -1,12 +1,16 @@
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <stdexcept>
+#include <vector>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -14,13 +18,16 @@
 
 #include "base/error_state.h"
 #include "base/error_string.h"
+#include "base/metrics.h"
 #include "base/nested_output.h"
+#include "base/progress_monitor.h"
 #include "caching/commands.h"
 #include "caching/metadata.h"
 #include "persistent-data/block.h"
 #include "persistent-data/file_utils.h"
 #include "persistent-data/space_map.h"
 #include "persistent-data/space-maps/core.h"
+#include "persistent-data/space-maps/disk.h"
 #include "version.h"
 
 using namespace boost;
@@ -142,13 +149,13 @@ namespace {
 		using reporter_base::get_error;
 	};
 
-	class discard_reporter : public bitset_detail::bitset_visitor, reporter_base {
+	class discard_reporter : public bitset_detail::bitset_run_visitor, reporter_base {
 	public:
 		discard_reporter(nested_output &o)
 		: reporter_base(o) {
 		}
 
-		virtual void visit(uint32_t index, bool value) {
+		virtual void visit_run(uint32_t begin, uint32_t end) {
 			// no op
 		}
 
@@ -198,6 +205,43 @@ namespace {
 		bool clear_needs_check_on_success_;
 	};
 
+	// The origin size isn't recorded, but the discard bitset is
+	// sized to cover the origin.  None of the superblock has been
+	// checked yet though, so the estimate is only used if it's
+	// plausible: the dense bitmap may take at most as much memory
+	// as the mapping array takes on disk.  Otherwise every block is
+	// tracked sparsely, which costs nothing up front.
+	block_address estimate_origin_blocks(superblock const &sb,
+					     block_address nr_metadata_blocks) {
+		// Over 1.5% of the origin is cached, as a rule.
+		block_address const MAX_ORIGIN_BLOCKS_PER_CACHE_BLOCK =
+			sizeof(mapping_traits::disk_type) * 8;
+
+		// Always cheap enough to allocate.
+		block_address const MIN_ESTIMATE = 1ull << 24;
+
+		if (!sb.data_block_size || !sb.discard_block_size)
+			return 0;
+
+		if (sb.discard_nr_blocks > numeric_limits<uint64_t>::max() / sb.discard_block_size)
+			return 0;
+
+		block_address nr_sectors = sb.discard_nr_blocks * sb.discard_block_size;
+		block_address nr_blocks = nr_sectors / sb.data_block_size +
+			(nr_sectors % sb.data_block_size ? 1 : 0);
+
+		// The mapping array can't hold more entries than fit
+		// in the metadata device.
+		block_address max_cache_blocks =
+			nr_metadata_blocks * (MD_BLOCK_SIZE / sizeof(mapping_traits::disk_type));
+		block_address nr_cache_blocks = min<block_address>(sb.cache_blocks, max_cache_blocks);
+
+		block_address max_estimate = max<block_address>(
+			MIN_ESTIMATE, nr_cache_blocks * MAX_ORIGIN_BLOCKS_PER_CACHE_BLOCK);
+
+		return nr_blocks <= max_estimate ? nr_blocks : 0;
+	}
+
 	struct stat guarded_stat(string const &path) {
 		struct stat info;
 
@@ -219,71 +263,226 @@ namespace {
 		write_superblock(bm, sb);
 	}
 
-	error_state metadata_check(string const &path, flags const &fs) {
-		block_manager<>::ptr bm = open_bm(path, block_manager<>::READ_ONLY);
+	//--------------------------------
 
-		nested_output out(cerr, 2);
-		if (fs.quiet_)
-			out.disable();
+	// The mapping array, hint array and discard bitset are
+	// independent, so each is checked on its own thread.  The block
+	// cache isn't thread safe, so every stage opens the metadata
+	// with its own block manager.  Output is buffered, and printed
+	// in the usual order once the stages have finished, so it's the
+	// same as a serial check would give.
+	class check_stage : private boost::noncopyable {
+	public:
+		check_stage(string const &path, superblock const &sb, bool quiet)
+			: path_(path),
+			  sb_(sb),
+			  out_(buffer_, 2),
+			  err_(NO_ERROR),
+			  started_(false) {
+			if (quiet)
+				out_.disable();
+		}
 
-		superblock_reporter sb_rep(out);
-		mapping_reporter mapping_rep(out);
-		hint_reporter hint_rep(out);
-		discard_reporter discard_rep(out);
+		virtual ~check_stage() {}
 
-		out << "examining superblock" << end_message();
-		{
-			nested_output::nest _ = out.push();
-			check_superblock(bm, bm->get_nr_blocks(), sb_rep);
+		void start() {
+			int r = pthread_create(&thread_, NULL, worker_, this);
+			if (r)
+				throw runtime_error("couldn't create check thread");
+
+			started_ = true;
 		}
 
-		if (sb_rep.get_error() == FATAL)
-			return FATAL;
+		void join() {
+			if (started_) {
+				pthread_join(thread_, NULL);
+				started_ = false;
+			}
+		}
 
-		superblock sb = read_superblock(bm);
-		transaction_manager::ptr tm = open_tm(bm);
+		// Copies the output of a finished stage.  Throws if the
+		// stage did.
+		error_state report(ostream &out) {
+			out << buffer_.str();
+
+			if (!exception_.empty())
+				throw runtime_error(exception_);
+
+			return err_;
+		}
+
+	protected:
+		virtual error_state check(transaction_manager &tm, nested_output &out) = 0;
+
+		superblock const &sb() const {
+			return sb_;
+		}
+
+	private:
+		static void *worker_(void *context) {
+			static_cast<check_stage *>(context)->worker();
+			return NULL;
+		}
+
+		void worker() {
+			try {
+				block_manager<>::ptr bm = open_bm(path_, block_manager<>::READ_ONLY, false);
+				transaction_manager::ptr tm = open_tm(bm);
+				err_ = check(*tm, out_);
+
+			} catch (std::exception &e) {
+				exception_ = e.what();
+			}
+		}
+
+		string path_;
+		superblock sb_;
+		ostringstream buffer_;
+		nested_output out_;
+		error_state err_;
+		string exception_;
+
+		pthread_t thread_;
+		bool started_;
+	};
+
+	class mapping_stage : public check_stage {
+	public:
+		mapping_stage(string const &path, superblock const &sb, bool quiet)
+			: check_stage(path, sb, quiet) {
+		}
+
+	protected:
+		virtual error_state check(transaction_manager &tm, nested_output &out) {
+			mapping_reporter mapping_rep(out);
 
-		if (fs.check_mappings_) {
 			out << "examining mapping array" << end_message();
 			{
 				nested_output::nest _ = out.push();
-				mapping_array ma(*tm, mapping_array::ref_counter(), sb.mapping_root, sb.cache_blocks);
-				check_mapping_array(ma, mapping_rep);
+				base::scoped_phase phase("mapping array");
+				mapping_array ma(tm, mapping_array::ref_counter(), sb().mapping_root, sb().cache_blocks);
+				check_mapping_array(ma, mapping_rep,
+						    estimate_origin_blocks(sb(), tm.get_bm()->get_nr_blocks()));
 			}
+
+			return mapping_rep.get_error();
 		}
+	};
+
+	class hint_stage : public check_stage {
+	public:
+		hint_stage(string const &path, superblock const &sb, bool quiet)
+			: check_stage(path, sb, quiet) {
+		}
+
+	protected:
+		virtual error_state check(transaction_manager &tm, nested_output &out) {
+			hint_reporter hint_rep(out);
 
-		if (fs.check_hints_) {
-			if (!sb.hint_root)
+			if (!sb().hint_root)
 				out << "no hint array present" << end_message();
 
 			else {
 				out << "examining hint array" << end_message();
 				{
 					nested_output::nest _ = out.push();
-					hint_array ha(*tm, sb.policy_hint_size, sb.hint_root, sb.cache_blocks);
+					base::scoped_phase phase("hint array");
+					hint_array ha(tm, sb().policy_hint_size, sb().hint_root, sb().cache_blocks);
 					ha.check(hint_rep);
 				}
 			}
+
+			return hint_rep.get_error();
+		}
+	};
+
+	class discard_stage : public check_stage {
+	public:
+		discard_stage(string const &path, superblock const &sb, bool quiet)
+			: check_stage(path, sb, quiet) {
 		}
 
-		if (fs.check_discards_) {
-			if (!sb.discard_root)
+	protected:
+		virtual error_state check(transaction_manager &tm, nested_output &out) {
+			discard_reporter discard_rep(out);
+
+			if (!sb().discard_root)
 				out << "no discard bitset present" << end_message();
 
 			else {
 				out << "examining discard bitset" << end_message();
 				{
 					nested_output::nest _ = out.push();
-					persistent_data::bitset discards(*tm, sb.discard_root, sb.discard_nr_blocks);
+					base::scoped_phase phase("discard bitset");
+					persistent_data::bitset discards(tm, sb().discard_root, sb().discard_nr_blocks);
+					discards.walk_set_runs(discard_rep);
 				}
 			}
+
+			return discard_rep.get_error();
 		}
+	};
+
+	typedef vector<boost::shared_ptr<check_stage> > stage_list;
+
+	void join_stages(stage_list &stages) {
+		for (size_t i = 0; i < stages.size(); i++)
+			stages[i]->join();
+	}
+
+	//--------------------------------
+
+	error_state metadata_check(string const &path, flags const &fs) {
+		block_manager<>::ptr bm = open_bm(path, block_manager<>::READ_ONLY);
+
+		nested_output out(cerr, 2);
+		if (fs.quiet_)
+			out.disable();
+
+		superblock_reporter sb_rep(out);
+
+		out << "examining superblock" << end_message();
+		{
+			nested_output::nest _ = out.push();
+			base::scoped_phase phase("superblock");
+			check_superblock(bm, bm->get_nr_blocks(), sb_rep);
+		}
+
+		if (sb_rep.get_error() == FATAL)
+			return FATAL;
+
+		superblock sb = read_superblock(bm);
+
+		// The stages run at the same time, but between them
+		// read each allocated block once.
+		base::set_walk_progress_total(get_nr_allocated(sb.metadata_space_map_root));
+
+		stage_list stages;
+		if (fs.check_mappings_)
+			stages.push_back(boost::shared_ptr<check_stage>(new mapping_stage(path, sb, fs.quiet_)));
+
+		if (fs.check_hints_)
+			stages.push_back(boost::shared_ptr<check_stage>(new hint_stage(path, sb, fs.quiet_)));
+
+		if (fs.check_discards_)
+			stages.push_back(boost::shared_ptr<check_stage>(new discard_stage(path, sb, fs.quiet_)));
+
+		try {
+			for (size_t i = 0; i < stages.size(); i++)
+				stages[i]->start();
+
+		} catch (...) {
+			join_stages(stages);
+			throw;
+		}
+		join_stages(stages);
 
 		// FIXME: make an error class that's an instance of mplus
-		return combine_errors(sb_rep.get_error(),
-				      combine_errors(mapping_rep.get_error(),
-						     combine_errors(hint_rep.get_error(),
-								    discard_rep.get_error())));
+		error_state err = sb_rep.get_error();
+		for (size_t i = 0; i < stages.size(); i++)
+			err = combine_errors(err, stages[i]->report(cerr));
+
+		return err;
 	}
 
 	int check(string const &path, flags const &fs) {
@@ -4,12 +4,15 @@
 #include <iostream>
 
 #include "version.h"
+#include "base/compression.h"
+#include "base/progress_monitor.h"
 #include "caching/commands.h"
 #include "caching/mapping_array.h"
 #include "caching/metadata.h"
 #include "caching/metadata_dump.h"
 #include "caching/xml_format.h"
 #include "persistent-data/file_utils.h"
+#include "persistent-data/space-maps/disk.h"
 
 using namespace std;
 using namespace caching;
@@ -19,10 +22,12 @@ using namespace caching;
 namespace {
 	struct flags {
 		flags()
-			: repair_(false) {
+			: repair_(false),
+			  compress_(false) {
 		}
 
 		bool repair_;
+		bool compress_;
 	};
 
 	//--------------------------------
@@ -33,18 +38,31 @@ namespace {
 		return output == STDOUT_PATH;
 	}
 
+	void emit(metadata::ptr md, ostream &out, flags const &fs) {
+		emitter::ptr e = create_xml_emitter(out);
+		metadata_dump(md, e, fs.repair_);
+	}
+
+	void dump_to(metadata::ptr md, ostream &out, flags const &fs) {
+		if (fs.compress_) {
+			base::compressing_ostream zout(out);
+			emit(md, zout, fs);
+			zout.close();
+		} else
+			emit(md, out, fs);
+	}
+
 	int dump(string const &dev, string const &output, flags const &fs) {
 		try {
 			block_manager<>::ptr bm = open_bm(dev, block_manager<>::READ_ONLY);
 			metadata::ptr md(new metadata(bm, metadata::OPEN));
+			base::set_walk_progress_total(persistent_data::get_nr_allocated(md->sb_.metadata_space_map_root));
 
-			if (want_stdout(output)) {
-				emitter::ptr e = create_xml_emitter(cout);
-				metadata_dump(md, e, fs.repair_);
-			} else {
+			if (want_stdout(output))
+				dump_to(md, cout, fs);
+			else {
 				ofstream out(output.c_str());
-				emitter::ptr e = create_xml_emitter(out);
-				metadata_dump(md, e, fs.repair_);
+				dump_to(md, out, fs);
 			}
 
 		} catch (std::exception &e) {
@@ -71,6 +89,7 @@ cache_dump_cmd::usage(std::ostream &out) const
 	    << "  {-h|--help}" << endl
 	    << "  {-o <xml file>}" << endl
 	    << "  {-V|--version}" << endl
+	    << "  {-z|--compress}" << endl
 	    << "  {--repair}" << endl;
 }
 
@@ -80,12 +99,13 @@ cache_dump_cmd::run(int argc, char **argv)
 	int c;
 	flags fs;
 	string output("-");
-	char const shortopts[] = "ho:V";
+	char const shortopts[] = "ho:Vz";
 
 	option const longopts[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "output", required_argument, NULL, 'o' },
 		{ "version", no_argument, NULL, 'V' },
+		{ "compress", no_argument, NULL, 'z' },
 		{ "repair", no_argument, NULL, 1 },
 		{ NULL, no_argument, NULL, 0 }
 	};
@@ -108,6 +128,10 @@ cache_dump_cmd::run(int argc, char **argv)
 			cout << THIN_PROVISIONING_TOOLS_VERSION << endl;
 			return 0;
 
+		case 'z':
+			fs.compress_ = true;
+			break;
+
 		default:
 			usage(cerr);
 			return 1;
@@ -1,5 +1,6 @@
 #include "version.h"
 
+#include "base/compression.h"
 #include "caching/commands.h"
 #include "caching/metadata.h"
 #include "caching/restore_emitter.h"
@@ -68,10 +69,17 @@ namespace {
 			}
 
 			check_file_exists(*fs.input);
-			ifstream in(fs.input->c_str(), ifstream::in);
+			ifstream in(fs.input->c_str(), ifstream::in | ifstream::binary);
+			size_t len = get_file_length(*fs.input);
 
 			auto_ptr<progress_monitor> monitor = create_monitor(fs.quiet);
-			parse_xml(in, restorer, get_file_length(*fs.input), *monitor);
+
+			if (base::is_compressed_file(*fs.input)) {
+				base::decompressing_istream zin(in);
+				base::file_offset_monitor zmonitor(*monitor, in, len);
+				parse_xml(zin, restorer, len, zmonitor);
+			} else
+				parse_xml(in, restorer, len, *monitor);
 
 		} catch (std::exception &e) {
 			cerr << e.what() << endl;
@@ -0,0 +1,561 @@
+#include "base/progress_monitor.h"
+#include "caching/commands.h"
+#include "caching/mapping_array.h"
+#include "caching/metadata.h"
+#include "persistent-data/file_utils.h"
+#include "version.h"
+
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <iostream>
+#include <libaio.h>
+#include <linux/fs.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace base;
+using namespace caching;
+using namespace persistent_data;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	// Adjacent dirty blocks are merged into ios up to this size.
+	uint64_t const MAX_IO_BYTES = 4 * 1024 * 1024;
+
+	// Don't queue more than this many copies, however big the
+	// buffer.
+	unsigned const MAX_QUEUE_DEPTH = 256;
+
+	//--------------------------------
+
+	// A run of dirty blocks that's contiguous on both the fast
+	// device and the origin, so can be copied with one read and one
+	// write.
+	struct copy_op {
+		copy_op(block_address cblock, block_address oblock)
+			: cbegin(cblock),
+			  cend(cblock + 1),
+			  obegin(oblock) {
+		}
+
+		block_address nr_blocks() const {
+			return cend - cbegin;
+		}
+
+		block_address cbegin;
+		block_address cend;
+		block_address obegin;
+	};
+
+	bool operator <(copy_op const &lhs, copy_op const &rhs) {
+		return lhs.cbegin < rhs.cbegin;
+	}
+
+	ostream &operator <<(ostream &out, copy_op const &op) {
+		return out << "cache blocks [" << op.cbegin << ", " << op.cend
+			   << ") -> origin blocks [" << op.obegin << ", "
+			   << op.obegin + op.nr_blocks() << ")";
+	}
+
+	// If the cache wasn't shut down cleanly the dirty bits can't
+	// be trusted, and every mapped block has to be treated as
+	// dirty, as the kernel does.
+	class dirty_collector : public mapping_visitor {
+	public:
+		dirty_collector(block_address max_run_blocks, bool all_dirty)
+			: max_run_blocks_(max_run_blocks),
+			  all_dirty_(all_dirty),
+			  nr_blocks_(0) {
+		}
+
+		virtual void visit(block_address cblock, mapping const &m) {
+			if (!(m.flags_ & M_VALID))
+				return;
+
+			if (!all_dirty_ && !(m.flags_ & M_DIRTY))
+				return;
+
+			nr_blocks_++;
+
+			if (!ops_.empty()) {
+				copy_op &last = ops_.back();
+				if (cblock == last.cend &&
+				    m.oblock_ == last.obegin + last.nr_blocks() &&
+				    last.nr_blocks() < max_run_blocks_) {
+					last.cend++;
+					return;
+				}
+			}
+
+			ops_.push_back(copy_op(cblock, m.oblock_));
+		}
+
+		vector<copy_op> const &get_ops() const {
+			return ops_;
+		}
+
+		block_address get_nr_blocks() const {
+			return nr_blocks_;
+		}
+
+	private:
+		block_address max_run_blocks_;
+		bool all_dirty_;
+		block_address nr_blocks_;
+		vector<copy_op> ops_;
+	};
+
+	class fatal_mapping_damage : public mapping_array_damage::damage_visitor {
+	public:
+		virtual void visit(mapping_array_damage::missing_mappings const &d) {
+			raise();
+		}
+
+		virtual void visit(mapping_array_damage::invalid_mapping const &d) {
+			raise();
+		}
+
+	private:
+		void raise() {
+			throw runtime_error("metadata contains errors (run cache_check for details)");
+		}
+	};
+
+	//--------------------------------
+
+	int open_dev(string const &path, bool writeable) {
+		int fd = ::open(path.c_str(), (writeable ? O_RDWR : O_RDONLY) | O_DIRECT);
+		if (fd < 0) {
+			ostringstream out;
+			out << "couldn't open '" << path << "': " << strerror(errno);
+			throw runtime_error(out.str());
+		}
+
+		return fd;
+	}
+
+	uint64_t get_dev_size(int fd) {
+		struct stat info;
+		if (fstat(fd, &info))
+			throw runtime_error("couldn't stat device");
+
+		if (!S_ISBLK(info.st_mode))
+			return info.st_size;
+
+		uint64_t size;
+		if (ioctl(fd, BLKGETSIZE64, &size))
+			throw runtime_error("couldn't get device size");
+
+		return size;
+	}
+
+	// Copies runs of blocks from the fast device to the origin,
+	// keeping a queue of them in flight.  Each copy is a read into
+	// its own buffer, followed by a write from it.
+	class copier : private boost::noncopyable {
+	public:
+		copier(string const &fast_dev, string const &origin_dev,
+		       uint64_t block_bytes, uint64_t max_run_blocks,
+		       uint64_t buffer_bytes)
+			: fast_fd_(open_dev(fast_dev, false)),
+			  origin_fd_(-1),
+			  block_bytes_(block_bytes),
+			  slot_bytes_(block_bytes * max_run_blocks),
+			  aio_context_(0),
+			  buffer_(NULL) {
+			try {
+				origin_fd_ = open_dev(origin_dev, true);
+				fast_size_ = get_dev_size(fast_fd_);
+				origin_size_ = get_dev_size(origin_fd_);
+
+				unsigned nr_slots = min<uint64_t>(MAX_QUEUE_DEPTH,
+								  max<uint64_t>(1, buffer_bytes / slot_bytes_));
+				slots_.resize(nr_slots);
+
+				if (posix_memalign(&buffer_, 4096, nr_slots * slot_bytes_))
+					throw runtime_error("couldn't allocate copy buffer");
+
+				for (unsigned i = 0; i < nr_slots; i++) {
+					slots_[i].buffer = static_cast<unsigned char *>(buffer_) + i * slot_bytes_;
+					free_slots_.push_back(&slots_[i]);
+				}
+
+				int r = io_setup(nr_slots, &aio_context_);
+				if (r < 0)
+					throw runtime_error("io_setup failed");
+
+			} catch (...) {
+				release();
+				throw;
+			}
+		}
+
+		~copier() {
+			release();
+		}
+
+		unsigned get_queue_depth() const {
+			return slots_.size();
+		}
+
+		// Copies every op, and flushes the origin.  Ops that
+		// couldn't be copied are added to failed.
+		void copy(vector<copy_op> const &ops, progress_monitor &monitor,
+			  vector<copy_op> &failed) {
+			vector<io_event> events(slots_.size());
+			vector<iocb *> pending;
+			size_t next = 0;
+			unsigned nr_in_flight = 0;
+			unsigned last_percent = 0;
+
+			while (next < ops.size() || nr_in_flight) {
+				while (next < ops.size() && !free_slots_.empty()) {
+					copy_op const &op = ops[next++];
+
+					if (!in_bounds(op)) {
+						failed.push_back(op);
+						continue;
+					}
+
+					slot *s = free_slots_.back();
+					free_slots_.pop_back();
+
+					s->op = &op;
+					s->writing = false;
+					io_prep_pread(&s->cb, fast_fd_, s->buffer, op_bytes(op),
+						      op.cbegin * block_bytes_);
+					s->cb.data = s;
+					pending.push_back(&s->cb);
+					nr_in_flight++;
+				}
+
+				submit(pending);
+
+				if (!nr_in_flight)
+					break;
+
+				int r = io_getevents(aio_context_, 1, events.size(), &events[0], NULL);
+				if (r == -EINTR)
+					continue;
+
+				if (r < 0)
+					throw runtime_error("io_getevents failed");
+
+				for (int i = 0; i < r; i++) {
+					slot *s = static_cast<slot *>(events[i].data);
+					copy_op const &op = *s->op;
+					bool ok = static_cast<long>(events[i].res) == static_cast<long>(op_bytes(op));
+
+					if (ok && !s->writing) {
+						s->writing = true;
+						io_prep_pwrite(&s->cb, origin_fd_, s->buffer, op_bytes(op),
+							       op.obegin * block_bytes_);
+						s->cb.data = s;
+						pending.push_back(&s->cb);
+						continue;
+					}
+
+					if (!ok)
+						failed.push_back(op);
+
+					free_slots_.push_back(s);
+					nr_in_flight--;
+				}
+
+				submit(pending);
+
+				unsigned percent = ops.empty() ? 100 : (next - nr_in_flight) * 100 / ops.size();
+				if (percent != last_percent) {
+					monitor.update_percent(percent);
+					last_percent = percent;
+				}
+			}
+
+			if (fsync(origin_fd_))
+				throw runtime_error("couldn't flush the origin device");
+
+			monitor.update_percent(100);
+		}
+
+	private:
+		struct slot {
+			iocb cb;
+			unsigned char *buffer;
+			copy_op const *op;
+			bool writing;
+		};
+
+		uint64_t op_bytes(copy_op const &op) const {
+			return op.nr_blocks() * block_bytes_;
+		}
+
+		bool in_bounds(copy_op const &op) const {
+			return op.cend * block_bytes_ <= fast_size_ &&
+				(op.obegin + op.nr_blocks()) * block_bytes_ <= origin_size_;
+		}
+
+		void submit(vector<iocb *> &pending) {
+			size_t done = 0;
+
+			while (done < pending.size()) {
+				int r = io_submit(aio_context_, pending.size() - done, &pending[done]);
+				if (r == -EAGAIN || r == -EINTR)
+					continue;
+
+				if (r <= 0)
+					throw runtime_error("io_submit failed");
+
+				done += r;
+			}
+
+			pending.clear();
+		}
+
+		void release() {
+			if (aio_context_)
+				io_destroy(aio_context_);
+
+			free(buffer_);
+
+			if (origin_fd_ >= 0)
+				::close(origin_fd_);
+
+			::close(fast_fd_);
+		}
+
+		int fast_fd_;
+		int origin_fd_;
+		uint64_t fast_size_;
+		uint64_t origin_size_;
+		uint64_t block_bytes_;
+		uint64_t slot_bytes_;
+
+		io_context_t aio_context_;
+		void *buffer_;
+		vector<slot> slots_;
+		vector<slot *> free_slots_;
+	};
+
+	//--------------------------------
+
+	struct flags {
+		flags()
+			: buffer_size_meg(128),
+			  update_metadata(true),
+			  list_failed_blocks(false),
+			  quiet(false) {
+		}
+
+		boost::optional<string> metadata_dev;
+		boost::optional<string> origin_dev;
+		boost::optional<string> fast_dev;
+		uint64_t buffer_size_meg;
+		bool update_metadata;
+		bool list_failed_blocks;
+		bool quiet;
+	};
+
+	auto_ptr<progress_monitor> create_monitor(bool quiet) {
+		if (!quiet && isatty(fileno(stdout)))
+			return create_progress_bar("Copying data");
+		else
+			return create_quiet_progress_monitor();
+	}
+
+	// Clears the dirty flag of every block that was copied.  Both
+	// lists must be in cache block order.
+	void clear_dirty_flags(metadata &md, vector<copy_op> const &ops,
+			       vector<copy_op> const &failed) {
+		vector<copy_op>::const_iterator f = failed.begin();
+		vector<mapping> mappings;
+
+		for (vector<copy_op>::const_iterator op = ops.begin(); op != ops.end(); ++op) {
+			if (f != failed.end() && f->cbegin == op->cbegin) {
+				++f;
+				continue;
+			}
+
+			md.mappings_->get_range(op->cbegin, op->cend, mappings);
+			for (size_t i = 0; i < mappings.size(); i++)
+				mappings[i].flags_ &= ~M_DIRTY;
+			md.mappings_->set_range(op->cbegin, mappings);
+		}
+	}
+
+	int writeback(flags const &fs) {
+		block_manager<>::ptr bm = open_bm(*fs.metadata_dev,
+						  fs.update_metadata ? block_manager<>::READ_WRITE :
+						  block_manager<>::READ_ONLY);
+		metadata md(bm, fs.update_metadata ? metadata::UPDATE : metadata::OPEN);
+
+		bool clean_shutdown = md.sb_.flags.get_flag(superblock_flags::CLEAN_SHUTDOWN);
+		uint64_t block_bytes = static_cast<uint64_t>(md.sb_.data_block_size) << SECTOR_SHIFT;
+		if (!block_bytes)
+			throw runtime_error("superblock has a zero data block size");
+
+		uint64_t max_run_blocks = max<uint64_t>(1, MAX_IO_BYTES / block_bytes);
+
+		dirty_collector collector(max_run_blocks, !clean_shutdown);
+		fatal_mapping_damage dv;
+		walk_mapping_array(*md.mappings_, collector, dv);
+
+		vector<copy_op> const &ops = collector.get_ops();
+		vector<copy_op> failed;
+		{
+			copier c(*fs.fast_dev, *fs.origin_dev, block_bytes, max_run_blocks,
+				 fs.buffer_size_meg * 1024 * 1024);
+			auto_ptr<progress_monitor> monitor = create_monitor(fs.quiet);
+			c.copy(ops, *monitor, failed);
+		}
+
+		// failures are gathered in completion order
+		sort(failed.begin(), failed.end());
+
+		if (!fs.quiet) {
+			if (!clean_shutdown)
+				cout << "cache was not shut down cleanly, so every mapped block was copied" << endl;
+
+			cout << "copied " << collector.get_nr_blocks() << " blocks in "
+			     << ops.size() << " ios, " << failed.size() << " ios failed" << endl;
+		}
+
+		if (fs.list_failed_blocks)
+			for (size_t i = 0; i < failed.size(); i++)
+				cerr << "failed to copy " << failed[i] << endl;
+
+		// After an unclean shutdown the kernel treats every block
+		// as dirty, whatever its flag says.  So the flags are only
+		// worth clearing if the cache can then be marked clean,
+		// which needs every copy to have worked.
+		if (fs.update_metadata) {
+			if (clean_shutdown || failed.empty()) {
+				clear_dirty_flags(md, ops, failed);
+				md.commit(true);
+
+			} else if (!fs.quiet)
+				cout << "metadata left unchanged, the cache is still marked as not shut down cleanly" << endl;
+		}
+
+		return failed.empty() ? 0 : 1;
+	}
+}
+
+//----------------------------------------------------------------
+
+cache_writeback_cmd::cache_writeback_cmd()
+	: command("cache_writeback")
+{
+}
+
+void
+cache_writeback_cmd::usage(std::ostream &out) const
+{
+	out << "Usage: " << get_name() << " [options]" << endl
+	    << "Options:" << endl
+	    << "  {-h|--help}" << endl
+	    << "  {--metadata-device} <cache metadata device>" << endl
+	    << "  {--origin-device} <slow device>" << endl
+	    << "  {--fast-device} <fast device>" << endl
+	    << "  {--buffer-size-meg} <size of the copy buffer>" << endl
+	    << "  {--list-failed-blocks}" << endl
+	    << "  {--no-metadata-update}" << endl
+	    << "  {-q|--quiet}" << endl
+	    << "  {-V|--version}" << endl;
+}
+
+int
+cache_writeback_cmd::run(int argc, char **argv)
+{
+	int c;
+	flags fs;
+	char const *short_opts = "hqV";
+	option const long_opts[] = {
+		{ "metadata-device", required_argument, NULL, 0 },
+		{ "origin-device", required_argument, NULL, 1 },
+		{ "fast-device", required_argument, NULL, 2 },
+		{ "buffer-size-meg", required_argument, NULL, 3 },
+		{ "list-failed-blocks", no_argument, NULL, 4 },
+		{ "no-metadata-update", no_argument, NULL, 5 },
+		{ "help", no_argument, NULL, 'h'},
+		{ "quiet", no_argument, NULL, 'q'},
+		{ "version", no_argument, NULL, 'V'},
+		{ NULL, no_argument, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch(c) {
+		case 0:
+			fs.metadata_dev = optarg;
+			break;
+
+		case 1:
+			fs.origin_dev = optarg;
+			break;
+
+		case 2:
+			fs.fast_dev = optarg;
+			break;
+
+		case 3:
+			fs.buffer_size_meg = parse_uint64(optarg, "buffer size");
+			break;
+
+		case 4:
+			fs.list_failed_blocks = true;
+			break;
+
+		case 5:
+			fs.update_metadata = false;
+			break;
+
+		case 'h':
+			usage(cout);
+			return 0;
+
+		case 'q':
+			fs.quiet = true;
+			break;
+
+		case 'V':
+			cout << THIN_PROVISIONING_TOOLS_VERSION << endl;
+			return 0;
+
+		default:
+			usage(cerr);
+			return 1;
+		}
+	}
+
+	if (!fs.metadata_dev || !fs.origin_dev || !fs.fast_dev) {
+		cerr << "the metadata, origin and fast devices must all be given" << endl;
+		usage(cerr);
+		return 1;
+	}
+
+	if (!fs.buffer_size_meg) {
+		cerr << "buffer size must be greater than zero" << endl;
+		return 1;
+	}
+
+	try {
+		return writeback(fs);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
+
+//----------------------------------------------------------------
@@ -139,6 +139,27 @@ namespace {
 
 	//--------------------------------
 
+	template <uint32_t WIDTH>
+	void set_hints(boost::shared_ptr<array_base> base, unsigned begin,
+		       unsigned char const *data, unsigned nr_hints) {
+		typedef hint_traits<WIDTH> traits;
+		typedef persistent_data::array<traits> ha;
+
+		boost::shared_ptr<ha> a = downcast_array<ha>(base);
+		a->set_disk_range(begin, reinterpret_cast<typename traits::disk_type const *>(data), nr_hints);
+	}
+
+	void set_hints_(uint32_t width, boost::shared_ptr<array_base> base,
+			unsigned begin, unsigned char const *data, unsigned nr_hints) {
+		switch (width) {
+#define xx(n) case n: return set_hints<n>(base, begin, data, nr_hints)
+		all_widths
+#undef xx
+		}
+	}
+
+	//--------------------------------
+
 	template <uint32_t WIDTH>
 	void grow(boost::shared_ptr<array_base> base, unsigned new_nr_entries, vector<unsigned char> const &value) {
 		typedef hint_traits<WIDTH> traits;
@@ -160,14 +181,15 @@ namespace {
 
 	//--------------------------------
 
+	template <uint32_t WIDTH>
 	class value_adapter {
 	public:
 		value_adapter(hint_visitor &v)
 		: v_(v) {
 		}
 
-		virtual void visit(uint32_t index, std::vector<unsigned char> const &v) {
-			v_.visit(static_cast<block_address>(index), v);
+		void visit(uint32_t index, typename hint_traits<WIDTH>::disk_type const &v) {
+			v_.visit(static_cast<block_address>(index), v, WIDTH);
 		}
 
 	private:
@@ -175,7 +197,7 @@ namespace {
 	};
 
 	struct no_op_visitor : public hint_visitor {
-		virtual void visit(block_address cblock, std::vector<unsigned char> const &v) {
+		virtual void visit(block_address cblock, unsigned char const *data, unsigned len) {
 		}
 	};
 
@@ -199,9 +221,9 @@ namespace {
 		typedef persistent_data::array<traits> ha;
 
 		boost::shared_ptr<ha> a = downcast_array<ha>(base);
-		value_adapter vv(hv);
+		value_adapter<WIDTH> vv(hv);
 		ll_damage_visitor ll(dv);
-		a->visit_values(vv, ll);
+		a->visit_disk_values(vv, ll);
 	}
 
 	void walk_hints_(uint32_t width, boost::shared_ptr<array_base> base,
@@ -261,6 +283,12 @@ hint_array::set_hint(unsigned index, vector<unsigned char> const &data)
 	set_hint_(width_, impl_, index, data);
 }
 
+void
+hint_array::set_hints(unsigned begin, unsigned char const *data, unsigned nr_hints)
+{
+	set_hints_(width_, impl_, begin, data, nr_hints);
+}
+
 void
 hint_array::grow(unsigned new_nr_entries, vector<unsigned char> const &value)
 {
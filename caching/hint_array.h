@@ -50,7 +50,10 @@ namespace caching {
 	class hint_visitor {
 	public:
 		virtual ~hint_visitor() {}
-		virtual void visit(block_address cblock, std::vector<unsigned char> const &data) = 0;
+
+		// data points into the locked array block, and is only
+		// valid for the duration of the call.
+		virtual void visit(block_address cblock, unsigned char const *data, unsigned len) = 0;
 	};
 
 	class hint_array {
@@ -69,6 +72,10 @@ namespace caching {
 		void get_hint(unsigned index, vector<unsigned char> &data) const;
 		void set_hint(unsigned index, vector<unsigned char> const &data);
 
+		// Sets nr_hints consecutive hints, starting at begin.
+		// data holds the packed hints, width bytes each.
+		void set_hints(unsigned begin, unsigned char const *data, unsigned nr_hints);
+
 		void grow(unsigned new_nr_entries, vector<unsigned char> const &value);
 		void walk(hint_visitor &hv, hint_array_damage::damage_visitor &dv);
 		void check(hint_array_damage::damage_visitor &visitor);
@@ -1,7 +1,6 @@
 #include "base/endian_utils.h"
 #include "caching/mapping_array.h"
-
-#include <set>
+#include "caching/oblock_tracker.h"
 
 using namespace caching;
 using namespace caching::mapping_array_damage;
@@ -60,18 +59,18 @@ invalid_mapping::visit(damage_visitor &v) const
 namespace {
 	class check_mapping_visitor : public mapping_visitor {
 	public:
-		check_mapping_visitor(damage_visitor &visitor)
-		: visitor_(visitor) {
+		check_mapping_visitor(damage_visitor &visitor,
+				      block_address nr_origin_blocks)
+		: visitor_(visitor),
+		  seen_oblocks_(nr_origin_blocks) {
 		}
 
 		virtual void visit(block_address cblock, mapping const &m) {
 			if (!valid_mapping(m))
 				return;
 
-			if (seen_oblock(m))
+			if (seen_oblocks_.test_and_set(m.oblock_))
 				visitor_.visit(invalid_mapping("origin block already mapped", cblock, m));
-			else
-				record_oblock(m);
 
 			if (unknown_flags(m))
 				visitor_.visit(invalid_mapping("unknown flags in mapping", cblock, m));
@@ -82,20 +81,12 @@ namespace {
 			return !!(m.flags_ & M_VALID);
 		}
 
-		bool seen_oblock(mapping const &m) const {
-			return seen_oblocks_.find(m.oblock_) != seen_oblocks_.end();
-		}
-
-		void record_oblock(mapping const &m) {
-			seen_oblocks_.insert(m.oblock_);
-		}
-
 		static bool unknown_flags(mapping const &m) {
 			return (m.flags_ & ~(M_VALID | M_DIRTY));
 		}
 
 		damage_visitor &visitor_;
-		set<block_address> seen_oblocks_;
+		oblock_tracker seen_oblocks_;
 	};
 
 	class ll_damage_visitor {
@@ -123,9 +114,10 @@ caching::walk_mapping_array(mapping_array const &array,
 }
 
 void
-caching::check_mapping_array(mapping_array const &array, damage_visitor &visitor)
+caching::check_mapping_array(mapping_array const &array, damage_visitor &visitor,
+			     block_address nr_origin_blocks)
 {
-	check_mapping_visitor mv(visitor);
+	check_mapping_visitor mv(visitor, nr_origin_blocks);
 	walk_mapping_array(array, mv, visitor);
 }
 
@@ -90,8 +90,11 @@ namespace caching {
 				mapping_visitor &mv,
 				mapping_array_damage::damage_visitor &dv);
 
+	// nr_origin_blocks is a guess at the origin size, used to size
+	// the duplicate mapping detector.  Pass 0 if it's unknown.
 	void check_mapping_array(mapping_array const &array,
-				 mapping_array_damage::damage_visitor &visitor);
+				 mapping_array_damage::damage_visitor &visitor,
+				 block_address nr_origin_blocks = 0);
 }
 
 //----------------------------------------------------------------
@@ -38,7 +38,11 @@ metadata::metadata(block_manager<>::ptr bm, open_type ot)
 		break;
 
 	case OPEN:
-		open_metadata(bm);
+		open_metadata(bm, false);
+		break;
+
+	case UPDATE:
+		open_metadata(bm, true);
 		break;
 
 	default:
@@ -83,11 +87,18 @@ metadata::create_metadata(block_manager<>::ptr bm)
 }
 
 void
-metadata::open_metadata(block_manager<>::ptr bm)
+metadata::open_metadata(block_manager<>::ptr bm, bool for_update)
 {
 	tm_ = open_tm(bm);
 	sb_ = read_superblock(tm_->get_bm());
 
+	// The arrays take their reference counts from the space map
+	// that's in place when they're created.
+	if (for_update) {
+		metadata_sm_ = open_metadata_sm(*tm_, &sb_.metadata_space_map_root);
+		tm_->set_sm(metadata_sm_);
+	}
+
 	mappings_ = mapping_array::ptr(
 		new mapping_array(*tm_,
 				  mapping_array::ref_counter(),
@@ -120,13 +131,15 @@ metadata::commit_mappings()
 void
 metadata::commit_hints()
 {
-	sb_.hint_root = hints_->get_root();
+	if (hints_)
+		sb_.hint_root = hints_->get_root();
 }
 
 void
 metadata::commit_discard_bits()
 {
-	sb_.discard_root = discard_bits_->get_root();
+	if (discard_bits_)
+		sb_.discard_root = discard_bits_->get_root();
 }
 
 void
@@ -20,7 +20,11 @@ namespace caching {
 	public:
 		enum open_type {
 			CREATE,
-			OPEN
+			OPEN,
+
+			// As OPEN, but the metadata space map is
+			// opened too, so changes can be committed.
+			UPDATE
 		};
 
 		typedef block_manager<>::read_ref read_ref;
@@ -45,7 +49,7 @@ namespace caching {
 		void init_superblock();
 
 		void create_metadata(block_manager<>::ptr bm);
-		void open_metadata(block_manager<>::ptr bm);
+		void open_metadata(block_manager<>::ptr bm, bool for_update);
 
 		void commit_space_map();
 		void commit_mappings();
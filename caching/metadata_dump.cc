@@ -69,9 +69,13 @@ namespace {
 			  valid_blocks_(valid_blocks) {
 		}
 
-		virtual void visit(block_address cblock, std::vector<unsigned char> const &data) {
-			if (valid(cblock))
-				e_->hint(cblock, data);
+		virtual void visit(block_address cblock, unsigned char const *data, unsigned len) {
+			if (valid(cblock)) {
+				// reuses the buffer, rather than allocating
+				// one per hint
+				buffer_.assign(data, data + len);
+				e_->hint(cblock, buffer_);
+			}
 		}
 
 	private:
@@ -81,6 +85,7 @@ namespace {
 
 		emitter::ptr e_;
 		set<block_address> &valid_blocks_;
+		vector<unsigned char> buffer_;
 	};
 
 	struct ignore_hint_damage : public hint_array_damage::damage_visitor {
@@ -0,0 +1,150 @@
+#include "caching/metadata_generator.h"
+
+#include "base/rng.h"
+#include "persistent-data/math_utils.h"
+
+#include <stdexcept>
+#include <vector>
+
+using namespace base;
+using namespace caching;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	class generator {
+	public:
+		generator(generator_params const &p, emitter::ptr e)
+			: p_(p),
+			  e_(e),
+			  rng_(p.seed),
+			  max_run_(2 * p.run_length - 1),
+			  nr_slots_(p.nr_origin_blocks / max_run_),
+			  stride_(pick_stride()),
+			  offset_(nr_slots_ ? rng_.below(nr_slots_) : 0),
+			  next_slot_(0) {
+		}
+
+		void generate() {
+			e_->begin_superblock("", p_.data_block_size, p_.nr_cache_blocks,
+					     p_.policy, p_.hint_width);
+
+			vector<pd::block_address> mapped;
+
+			e_->begin_mappings();
+			for (pd::block_address cblock = 0; cblock < p_.nr_cache_blocks;) {
+				pd::block_address len = min<pd::block_address>(1 + rng_.below(max_run_),
+									       p_.nr_cache_blocks - cblock);
+
+				if (rng_.percent(p_.mapped)) {
+					pd::block_address oblock = next_run() * max_run_;
+					for (pd::block_address i = 0; i < len; i++) {
+						e_->mapping(cblock + i, oblock + i, rng_.percent(p_.dirty));
+						mapped.push_back(cblock + i);
+					}
+				}
+
+				cblock += len;
+			}
+			e_->end_mappings();
+
+			e_->begin_hints();
+			vector<unsigned char> hint(p_.hint_width);
+			for (size_t i = 0; i < mapped.size(); i++) {
+				for (unsigned j = 0; j < p_.hint_width; j++)
+					hint[j] = rng_.next();
+				e_->hint(mapped[i], hint);
+			}
+			e_->end_hints();
+
+			e_->end_superblock();
+		}
+
+	private:
+		// Origin space is cut into slots the size of the
+		// longest run, which are visited in a scrambled order.
+		// An odd stride that shares no factor with the number of
+		// slots visits every slot exactly once.
+		pd::block_address pick_stride() {
+			if (nr_slots_ < 2)
+				return 1;
+
+			for (;;) {
+				pd::block_address s = rng_.below(nr_slots_) | 1;
+				if (gcd(s, nr_slots_) == 1)
+					return s;
+			}
+		}
+
+		pd::block_address next_run() {
+			if (next_slot_ >= nr_slots_)
+				throw runtime_error("origin too small for the cache, more origin blocks are needed");
+
+			return (offset_ + next_slot_++ * stride_) % nr_slots_;
+		}
+
+		static pd::block_address gcd(pd::block_address a, pd::block_address b) {
+			while (b) {
+				pd::block_address t = a % b;
+				a = b;
+				b = t;
+			}
+
+			return a;
+		}
+
+		generator_params const &p_;
+		emitter::ptr e_;
+		rng rng_;
+		pd::block_address max_run_;
+		pd::block_address nr_slots_;
+		pd::block_address stride_;
+		pd::block_address offset_;
+		pd::block_address next_slot_;
+	};
+}
+
+//----------------------------------------------------------------
+
+generator_params::generator_params()
+	: nr_cache_blocks(1024 * 1024),
+	  nr_origin_blocks(16 * 1024 * 1024),
+	  mapped(100),
+	  dirty(10),
+	  run_length(16),
+	  data_block_size(128),
+	  policy("smq"),
+	  hint_width(4),
+	  seed(0)
+{
+}
+
+// Sized as cache_metadata_size would.
+pd::block_address
+caching::estimate_metadata_size(generator_params const &p)
+{
+	uint64_t const TRANSACTION_OVERHEAD = 4 * 1024 * 1024;
+	uint64_t const BYTES_PER_BLOCK = 16;
+	uint64_t const HINT_OVERHEAD_PER_BLOCK = 8;
+
+	uint64_t bytes = TRANSACTION_OVERHEAD +
+		p.nr_cache_blocks * (BYTES_PER_BLOCK + p.hint_width + HINT_OVERHEAD_PER_BLOCK);
+
+	return div_up<uint64_t>(bytes, pd::MD_BLOCK_SIZE);
+}
+
+void
+caching::generate_metadata(generator_params const &p, emitter::ptr e)
+{
+	if (!p.run_length)
+		throw runtime_error("run length must be at least one");
+
+	if (p.mapped > 100 || p.dirty > 100)
+		throw runtime_error("mapped and dirty are percentages");
+
+	generator g(p, e);
+	g.generate();
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,43 @@
+#ifndef CACHE_METADATA_GENERATOR_H
+#define CACHE_METADATA_GENERATOR_H
+
+#include "caching/emitter.h"
+
+//----------------------------------------------------------------
+
+namespace caching {
+	// Describes the synthetic metadata generate_metadata() makes.
+	// Cache blocks are filled in runs, each holding a run of
+	// consecutive origin blocks, and origin blocks are never
+	// cached twice.
+	struct generator_params {
+		generator_params();
+
+		pd::block_address nr_cache_blocks;
+		pd::block_address nr_origin_blocks;
+
+		// Percentages of the cache blocks that are mapped, and
+		// of the mapped blocks that are dirty.
+		unsigned mapped;
+		unsigned dirty;
+
+		// Mean length of a run of cache blocks.
+		unsigned run_length;
+
+		uint32_t data_block_size;
+		std::string policy;
+		unsigned hint_width;
+
+		uint64_t seed;
+	};
+
+	// A metadata device size with room for the generated metadata.
+	pd::block_address estimate_metadata_size(generator_params const &p);
+
+	// The same params always give the same metadata.
+	void generate_metadata(generator_params const &p, emitter::ptr e);
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -0,0 +1,85 @@
+#include "caching/oblock_tracker.h"
+
+using namespace caching;
+using namespace persistent_data;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	unsigned const BITS_PER_WORD = 64;
+	unsigned const WORDS_PER_PAGE = 512;
+	uint64_t const BITS_PER_PAGE = BITS_PER_WORD * WORDS_PER_PAGE;
+
+	// 2^35 blocks.  Past this the directory itself would get big.
+	uint64_t const MAX_DIRECTORY_PAGES = 1ull << 20;
+
+	// std::map node overhead.
+	unsigned const NODE_OVERHEAD = 64;
+}
+
+//----------------------------------------------------------------
+
+oblock_tracker::oblock_tracker(block_address nr_dense_blocks)
+	: dense_(nr_dense_blocks),
+	  nr_pages_(0),
+	  last_page_index_(0),
+	  last_page_(NULL)
+{
+}
+
+uint64_t
+oblock_tracker::get_memory_usage() const
+{
+	uint64_t dense_bytes = (dense_.get_nr_bits() + BITS_PER_WORD - 1) / BITS_PER_WORD * 8;
+	uint64_t directory_bytes = directory_.capacity() * sizeof(page);
+	uint64_t map_bytes = distant_.size() * NODE_OVERHEAD;
+
+	return dense_bytes + directory_bytes + map_bytes + nr_pages_ * WORDS_PER_PAGE * 8;
+}
+
+bool
+oblock_tracker::sparse_test_and_set(block_address oblock)
+{
+	uint64_t index = oblock / BITS_PER_PAGE;
+
+	// Mappings are usually clustered, so the page used last time
+	// is the likely one.
+	if (!last_page_ || index != last_page_index_) {
+		last_page_index_ = index;
+		last_page_ = &get_page(index);
+	}
+
+	uint64_t bit = oblock % BITS_PER_PAGE;
+	uint64_t &word = (*last_page_)[bit / BITS_PER_WORD];
+	uint64_t mask = 1ull << (bit % BITS_PER_WORD);
+
+	if (word & mask)
+		return true;
+
+	word |= mask;
+	return false;
+}
+
+oblock_tracker::page &
+oblock_tracker::get_page(uint64_t index)
+{
+	page *p;
+
+	if (index < MAX_DIRECTORY_PAGES) {
+		if (index >= directory_.size())
+			directory_.resize(index + 1);
+
+		p = &directory_[index];
+	} else
+		p = &distant_[index];
+
+	if (p->empty()) {
+		p->resize(WORDS_PER_PAGE, 0);
+		nr_pages_++;
+	}
+
+	return *p;
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,65 @@
+#ifndef CACHE_OBLOCK_TRACKER_H
+#define CACHE_OBLOCK_TRACKER_H
+
+#include "base/dense_bitmap.h"
+#include "persistent-data/block.h"
+
+#include <boost/noncopyable.hpp>
+#include <map>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace caching {
+	// Remembers which origin blocks have been mapped, so a second
+	// mapping of the same block can be spotted.
+	//
+	// The metadata doesn't record the size of the origin, so the
+	// caller gives an estimate.  Blocks below it are held in a
+	// dense bitmap.  Any above it (a small origin estimate, or a
+	// corrupt mapping) go into a sparse bitmap, allocated a page at
+	// a time.  Pages are found through a flat directory, or a map
+	// for the few blocks too far out for the directory to cover.
+	// Either way it's a bit, rather than a tree node, per mapped
+	// block.
+	class oblock_tracker : private boost::noncopyable {
+	public:
+		oblock_tracker(persistent_data::block_address nr_dense_blocks);
+
+		// Records the block.  Returns true if it had already
+		// been recorded.
+		bool test_and_set(persistent_data::block_address oblock) {
+			if (oblock < dense_.get_nr_bits()) {
+				if (dense_.test(oblock))
+					return true;
+
+				dense_.set(oblock);
+				return false;
+			}
+
+			return sparse_test_and_set(oblock);
+		}
+
+		// Bytes of heap in use, roughly.
+		uint64_t get_memory_usage() const;
+
+	private:
+		typedef std::vector<uint64_t> page;
+		typedef std::map<uint64_t, page> page_map;
+
+		bool sparse_test_and_set(persistent_data::block_address oblock);
+		page &get_page(uint64_t index);
+
+		base::dense_bitmap dense_;
+		std::vector<page> directory_;
+		page_map distant_;
+		uint64_t nr_pages_;
+
+		uint64_t last_page_index_;
+		page *last_page_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
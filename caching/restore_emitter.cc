@@ -9,12 +9,18 @@ using namespace superblock_damage;
 //----------------------------------------------------------------
 
 namespace {
+	// Hints are gathered up, and consecutive ones written to the
+	// array together.
+	unsigned const MAX_PENDING_HINTS = 4096;
+
 	class restorer : public emitter {
 	public:
 		restorer(metadata::ptr md, bool clean_shutdown)
 			: in_superblock_(false),
 			  md_(md),
-			  clean_shutdown_(clean_shutdown) {
+			  clean_shutdown_(clean_shutdown),
+			  hint_width_(0),
+			  pending_begin_(0) {
 		}
 
 		virtual void begin_superblock(std::string const &uuid,
@@ -28,6 +34,7 @@ namespace {
 			memset(sb.policy_version, 0, sizeof(sb.policy_version)); // FIXME: should come from xml
 			sb.policy_hint_size = hint_width;
 			md_->setup_hint_array(hint_width);
+			hint_width_ = hint_width;
 
 			sb.data_block_size = block_size;
 			sb.cache_blocks = nr_cache_blocks;
@@ -42,6 +49,7 @@ namespace {
 		}
 
 		virtual void end_superblock() {
+			flush_hints();
 			md_->commit(clean_shutdown_);
 		}
 
@@ -71,12 +79,24 @@ namespace {
 		}
 
 		virtual void end_hints() {
-			// noop
+			flush_hints();
 		}
 
 		virtual void hint(pd::block_address cblock,
 				  vector<unsigned char> const &data) {
-			md_->hints_->set_hint(cblock, data);
+			if (data.size() < hint_width_)
+				throw runtime_error("hint data is shorter than the hint width");
+
+			if (nr_pending_hints() && cblock != pending_begin_ + nr_pending_hints())
+				flush_hints();
+
+			if (!nr_pending_hints())
+				pending_begin_ = cblock;
+
+			pending_hints_.insert(pending_hints_.end(), data.begin(), data.begin() + hint_width_);
+
+			if (nr_pending_hints() == MAX_PENDING_HINTS)
+				flush_hints();
 		}
 
 		virtual void begin_discards() {
@@ -88,16 +108,29 @@ namespace {
 		}
 
 		virtual void discard(block_address dblock, block_address dblock_e) {
-			while (dblock != dblock_e) {
-				md_->discard_bits_->set(dblock, true);
-				dblock++;
-			}
+			md_->discard_bits_->set_range(dblock, dblock_e);
 		}
 
 	private:
+		unsigned nr_pending_hints() const {
+			return hint_width_ ? pending_hints_.size() / hint_width_ : 0;
+		}
+
+		void flush_hints() {
+			if (!nr_pending_hints())
+				return;
+
+			md_->hints_->set_hints(pending_begin_, &pending_hints_[0], nr_pending_hints());
+			pending_hints_.clear();
+		}
+
 		bool in_superblock_;
 		metadata::ptr md_;
 		bool clean_shutdown_;
+
+		size_t hint_width_;
+		pd::block_address pending_begin_;
+		vector<unsigned char> pending_hints_;
 	};
 }
 
@@ -126,27 +126,42 @@ namespace {
 				    get_attr<size_t>(attr, "hint_width"));
 	}
 
-	bool to_bool(string const &str) {
-		if (str == "true")
-			return true;
+	// The mappings, hints and discards take the attribute_slots fast
+	// path rather than building an attributes map.
+	char const * const mapping_keys[] = {
+		"cache_block", "origin_block", "dirty"
+	};
 
-		else if (str == "false")
-			return false;
+	enum mapping_slot {
+		M_CACHE_BLOCK,
+		M_ORIGIN_BLOCK,
+		M_DIRTY,
+		M_NR_SLOTS
+	};
 
-		throw runtime_error("bad boolean value");
+	void parse_mapping(emitter *e, char const **attr) {
+		attribute_slots a(mapping_keys, M_NR_SLOTS, attr);
+		e->mapping(a.get_uint<uint64_t>(M_CACHE_BLOCK),
+			   a.get_uint<uint64_t>(M_ORIGIN_BLOCK),
+			   a.get_bool(M_DIRTY));
 	}
 
-	void parse_mapping(emitter *e, attributes const &attr) {
-		e->mapping(get_attr<uint64_t>(attr, "cache_block"),
-			   get_attr<uint64_t>(attr, "origin_block"),
-			   to_bool(get_attr<string>(attr, "dirty")));
-	}
+	char const * const hint_keys[] = {
+		"cache_block", "data"
+	};
 
-	void parse_hint(emitter *e, attributes const &attr) {
+	enum hint_slot {
+		H_CACHE_BLOCK,
+		H_DATA,
+		H_NR_SLOTS
+	};
+
+	void parse_hint(emitter *e, char const **attr) {
 		using namespace base;
 
-		block_address cblock = get_attr<uint64_t>(attr, "cache_block");
-		decoded_or_error doe = base64_decode(get_attr<string>(attr, "data"));
+		attribute_slots a(hint_keys, H_NR_SLOTS, attr);
+		block_address cblock = a.get_uint<uint64_t>(H_CACHE_BLOCK);
+		decoded_or_error doe = base64_decode(a.get(H_DATA));
 		if (!boost::get<vector<unsigned char> >(&doe)) {
 			ostringstream msg;
 			msg << "invalid base64 encoding of hint for cache block "
@@ -157,39 +172,50 @@ namespace {
 		e->hint(cblock, boost::get<vector<unsigned char> >(doe));
 	}
 
+	char const * const discard_keys[] = {
+		"dbegin", "dend"
+	};
+
+	enum discard_slot {
+		D_BEGIN,
+		D_END,
+		D_NR_SLOTS
+	};
+
 	// FIXME: why passing e by ptr?
-	void parse_discard(emitter *e, attributes const &attr) {
-		e->discard(get_attr<uint64_t>(attr, "dbegin"),
-			   get_attr<uint64_t>(attr, "dend"));
+	void parse_discard(emitter *e, char const **attr) {
+		attribute_slots a(discard_keys, D_NR_SLOTS, attr);
+		e->discard(a.get_uint<uint64_t>(D_BEGIN),
+			   a.get_uint<uint64_t>(D_END));
 	}
 
 	void start_tag(void *data, char const *el, char const **attr) {
 		emitter *e = static_cast<emitter *>(data);
-		attributes a;
 
-		build_attributes(a, attr);
+		if (!strcmp(el, "mapping"))
+			parse_mapping(e, attr);
 
-		if (!strcmp(el, "superblock"))
+		else if (!strcmp(el, "hint"))
+			parse_hint(e, attr);
+
+		else if (!strcmp(el, "discard"))
+			parse_discard(e, attr);
+
+		else if (!strcmp(el, "superblock")) {
+			attributes a;
+
+			build_attributes(a, attr);
 			parse_superblock(e, a);
 
-		else if (!strcmp(el, "mappings"))
+		} else if (!strcmp(el, "mappings"))
 			e->begin_mappings();
 
-		else if (!strcmp(el, "mapping"))
-			parse_mapping(e, a);
-
 		else if (!strcmp(el, "hints"))
 			e->begin_hints();
 
-		else if (!strcmp(el, "hint"))
-			parse_hint(e, a);
-
 		else if (!strcmp(el, "discards"))
 			e->begin_discards();
 
-		else if (!strcmp(el, "discard"))
-			parse_discard(e, a);
-
 		else
 			throw runtime_error("unknown tag type");
 	}
@@ -244,27 +270,7 @@ caching::parse_xml(istream &in, emitter::ptr e,
 	XML_SetUserData(p.get_parser(), e.get());
 	XML_SetElementHandler(p.get_parser(), start_tag, end_tag);
 
-	size_t total = 0;
-
-	while (!in.eof()) {
-		char buffer[4096];
-		in.read(buffer, sizeof(buffer));
-		size_t len = in.gcount();
-		int done = in.eof();
-
-		if (!XML_Parse(p.get_parser(), buffer, len, done)) {
-			ostringstream out;
-			out << "Parse error at line "
-			    << XML_GetCurrentLineNumber(p.get_parser())
-			    << ":\n"
-			    << XML_ErrorString(XML_GetErrorCode(p.get_parser()))
-			    << endl;
-			throw runtime_error(out.str());
-		}
-
-		total += len;
-		monitor.update_percent(total * 100 / input_length);
-	}
+	p.parse(in, input_length, monitor);
 }
 
 //----------------------------------------------------------------
@@ -14,7 +14,9 @@
 
 #include "base/error_state.h"
 #include "base/error_string.h"
+#include "base/metrics.h"
 #include "base/nested_output.h"
+#include "base/progress_monitor.h"
 #include "era/commands.h"
 #include "era/writeset_tree.h"
 #include "era/era_array.h"
@@ -23,6 +25,7 @@
 #include "persistent-data/file_utils.h"
 #include "persistent-data/space_map.h"
 #include "persistent-data/space-maps/core.h"
+#include "persistent-data/space-maps/disk.h"
 #include "persistent-data/transaction_manager.h"
 #include "version.h"
 
@@ -204,6 +207,7 @@ namespace {
 		out << "examining superblock" << end_message();
 		{
 			nested_output::nest _ = out.push();
+			scoped_phase phase("superblock");
 			check_superblock(bm, bm->get_nr_blocks(), sb_rep);
 		}
 
@@ -212,9 +216,11 @@ namespace {
 
 		superblock sb = read_superblock(bm);
 		transaction_manager::ptr tm = open_tm(bm);
+		set_walk_progress_total(get_nr_allocated(sb.metadata_space_map_root));
 
 		writeset_tree_reporter wt_rep(out);
 		{
+			scoped_phase phase("writeset tree");
 			era_detail_traits::ref_counter rc(tm);
 			writeset_tree wt(*tm, sb.writeset_tree_root, rc);
 			check_writeset_tree(tm, wt, wt_rep);
@@ -222,6 +228,7 @@ namespace {
 
 		era_array_reporter ea_rep(out);
 		{
+			scoped_phase phase("era array");
 			uint32_traits::ref_counter rc;
 			era_array ea(*tm, rc, sb.era_array_root, sb.nr_blocks);
 			check_era_array(ea, sb.current_era, ea_rep);
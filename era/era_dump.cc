@@ -4,6 +4,8 @@
 #include <iostream>
 
 #include "version.h"
+#include "base/compression.h"
+#include "base/progress_monitor.h"
 #include "era/commands.h"
 #include "era/era_array.h"
 #include "era/writeset_tree.h"
@@ -11,6 +13,7 @@
 #include "era/metadata_dump.h"
 #include "era/xml_format.h"
 #include "persistent-data/file_utils.h"
+#include "persistent-data/space-maps/disk.h"
 
 using namespace era;
 using namespace std;
@@ -21,11 +24,13 @@ namespace {
 	struct flags {
 		flags()
 			: repair_(false),
-			  logical_(false) {
+			  logical_(false),
+			  compress_(false) {
 		}
 
 		bool repair_;
 		bool logical_;
+		bool compress_;
 	};
 
 	//--------------------------------
@@ -36,18 +41,31 @@ namespace {
 		return output == STDOUT_PATH;
 	}
 
+	void emit(metadata::ptr md, ostream &out, flags const &fs) {
+		emitter::ptr e = create_xml_emitter(out);
+		metadata_dump(md, e, fs.repair_, fs.logical_);
+	}
+
+	void dump_to(metadata::ptr md, ostream &out, flags const &fs) {
+		if (fs.compress_) {
+			base::compressing_ostream zout(out);
+			emit(md, zout, fs);
+			zout.close();
+		} else
+			emit(md, out, fs);
+	}
+
 	int dump(string const &dev, string const &output, flags const &fs) {
 		try {
 			block_manager<>::ptr bm = open_bm(dev, block_manager<>::READ_ONLY);
 			metadata::ptr md(new metadata(bm, metadata::OPEN));
+			base::set_walk_progress_total(persistent_data::get_nr_allocated(md->sb_.metadata_space_map_root));
 
-			if (want_stdout(output)) {
-				emitter::ptr e = create_xml_emitter(cout);
-				metadata_dump(md, e, fs.repair_, fs.logical_);
-			} else {
+			if (want_stdout(output))
+				dump_to(md, cout, fs);
+			else {
 				ofstream out(output.c_str());
-				emitter::ptr e = create_xml_emitter(out);
-				metadata_dump(md, e, fs.repair_, fs.logical_);
+				dump_to(md, out, fs);
 			}
 
 		} catch (std::exception &e) {
@@ -74,6 +92,7 @@ era_dump_cmd::usage(std::ostream &out) const
 	    << "  {-h|--help}" << endl
 	    << "  {-o <xml file>}" << endl
 	    << "  {-V|--version}" << endl
+	    << "  {-z|--compress}" << endl
 	    << "  {--repair}" << endl
 	    << "  {--logical}" << endl;
 }
@@ -84,12 +103,13 @@ era_dump_cmd::run(int argc, char **argv)
 	int c;
 	flags fs;
 	string output("-");
-	char const shortopts[] = "ho:V";
+	char const shortopts[] = "ho:Vz";
 
 	option const longopts[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "output", required_argument, NULL, 'o' },
 		{ "version", no_argument, NULL, 'V' },
+		{ "compress", no_argument, NULL, 'z' },
 		{ "repair", no_argument, NULL, 1 },
 		{ "logical", no_argument, NULL, 2 },
 		{ NULL, no_argument, NULL, 0 }
@@ -117,6 +137,10 @@ era_dump_cmd::run(int argc, char **argv)
 			cout << THIN_PROVISIONING_TOOLS_VERSION << endl;
 			return 0;
 
+		case 'z':
+			fs.compress_ = true;
+			break;
+
 		default:
 			usage(cerr);
 			return 1;
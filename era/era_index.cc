@@ -0,0 +1,225 @@
+#include "era/era_index.h"
+
+#include "base/endian_utils.h"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+using namespace base;
+using namespace era;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	uint64_t const INDEX_MAGIC = 0x78646e69617265ULL; // "eraindx"
+	uint32_t const INDEX_VERSION = 1;
+
+	void write_u32(ostream &out, uint32_t v) {
+		le32 d = to_disk<le32>(v);
+		out.write(reinterpret_cast<char const *>(&d), sizeof(d));
+	}
+
+	void write_u64(ostream &out, uint64_t v) {
+		le64 d = to_disk<le64>(v);
+		out.write(reinterpret_cast<char const *>(&d), sizeof(d));
+	}
+
+	uint32_t read_u32(istream &in) {
+		le32 d;
+		if (!in.read(reinterpret_cast<char *>(&d), sizeof(d)))
+			throw runtime_error("era index truncated");
+		return to_cpu<uint32_t>(d);
+	}
+
+	uint64_t read_u64(istream &in) {
+		le64 d;
+		if (!in.read(reinterpret_cast<char *>(&d), sizeof(d)))
+			throw runtime_error("era index truncated");
+		return to_cpu<uint64_t>(d);
+	}
+
+	void write_key(ostream &out, era_index_key const &key) {
+		write_u32(out, key.nr_blocks);
+		write_u32(out, key.current_era);
+		write_u64(out, key.current_writeset_root);
+		write_u64(out, key.writeset_tree_root);
+		write_u64(out, key.era_array_root);
+		write_u32(out, key.from_snapshot ? 1 : 0);
+	}
+
+	era_index_key read_key(istream &in) {
+		era_index_key key;
+
+		key.nr_blocks = read_u32(in);
+		key.current_era = read_u32(in);
+		key.current_writeset_root = read_u64(in);
+		key.writeset_tree_root = read_u64(in);
+		key.era_array_root = read_u64(in);
+		key.from_snapshot = read_u32(in);
+
+		return key;
+	}
+}
+
+//----------------------------------------------------------------
+
+era_index_key::era_index_key()
+	: nr_blocks(0),
+	  current_era(0),
+	  current_writeset_root(0),
+	  writeset_tree_root(0),
+	  era_array_root(0),
+	  from_snapshot(false)
+{
+}
+
+era_index_key::era_index_key(superblock const &sb, bool from_snapshot_)
+	: nr_blocks(sb.nr_blocks),
+	  current_era(sb.current_era),
+	  current_writeset_root(sb.current_detail.writeset_root),
+	  writeset_tree_root(sb.writeset_tree_root),
+	  era_array_root(sb.era_array_root),
+	  from_snapshot(from_snapshot_)
+{
+}
+
+bool
+era_index_key::operator ==(era_index_key const &rhs) const
+{
+	return nr_blocks == rhs.nr_blocks &&
+		current_era == rhs.current_era &&
+		current_writeset_root == rhs.current_writeset_root &&
+		writeset_tree_root == rhs.writeset_tree_root &&
+		era_array_root == rhs.era_array_root &&
+		from_snapshot == rhs.from_snapshot;
+}
+
+//----------------------------------------------------------------
+
+era_index::era_index(era_index_key const &key, uint32_t chunk_size)
+	: key_(key),
+	  chunk_size_(chunk_size)
+{
+	if (!chunk_size_)
+		throw runtime_error("era index chunk size must be greater than zero");
+}
+
+void
+era_index::build(era_array const &array)
+{
+	vector<uint32_t> eras;
+
+	chunk_max_eras_.clear();
+	era_counts_.clear();
+
+	for (uint32_t b = 0; b < key_.nr_blocks; b += chunk_size_) {
+		uint32_t e = min<uint32_t>(key_.nr_blocks, b + chunk_size_);
+		array.get_range(b, e, eras);
+
+		uint32_t max_era = 0;
+		for (uint32_t i = 0; i < eras.size(); i++) {
+			max_era = max<uint32_t>(max_era, eras[i]);
+			era_counts_[eras[i]]++;
+		}
+
+		chunk_max_eras_.push_back(max_era);
+	}
+}
+
+uint32_t
+era_index::get_chunk_max_era(uint32_t chunk) const
+{
+	if (chunk >= chunk_max_eras_.size())
+		throw runtime_error("era index chunk out of bounds");
+
+	return chunk_max_eras_[chunk];
+}
+
+uint64_t
+era_index::count_blocks_since(uint32_t threshold) const
+{
+	uint64_t total = 0;
+
+	map<uint32_t, uint64_t>::const_iterator it;
+	for (it = era_counts_.lower_bound(threshold); it != era_counts_.end(); ++it)
+		total += it->second;
+
+	return total;
+}
+
+void
+era_index::write(string const &path) const
+{
+	// Write to a temporary file, so a reader never sees half an
+	// index.
+	string tmp = path + ".tmp";
+
+	{
+		ofstream out(tmp.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+
+		write_u64(out, INDEX_MAGIC);
+		write_u32(out, INDEX_VERSION);
+		write_key(out, key_);
+		write_u32(out, chunk_size_);
+
+		write_u32(out, era_counts_.size());
+		map<uint32_t, uint64_t>::const_iterator it;
+		for (it = era_counts_.begin(); it != era_counts_.end(); ++it) {
+			write_u32(out, it->first);
+			write_u64(out, it->second);
+		}
+
+		write_u32(out, chunk_max_eras_.size());
+		for (size_t i = 0; i < chunk_max_eras_.size(); i++)
+			write_u32(out, chunk_max_eras_[i]);
+
+		out.flush();
+		if (!out)
+			throw runtime_error("couldn't write era index " + tmp);
+	}
+
+	if (::rename(tmp.c_str(), path.c_str()))
+		throw runtime_error("couldn't rename era index to " + path);
+}
+
+era_index::ptr
+era_index::read(string const &path, era_index_key const &key)
+{
+	ifstream in(path.c_str(), ios_base::in | ios_base::binary);
+	if (!in)
+		return ptr();
+
+	try {
+		if (read_u64(in) != INDEX_MAGIC || read_u32(in) != INDEX_VERSION)
+			return ptr();
+
+		if (read_key(in) != key)
+			return ptr();
+
+		ptr index(new era_index(key, read_u32(in)));
+
+		uint32_t nr_eras = read_u32(in);
+		for (uint32_t i = 0; i < nr_eras; i++) {
+			uint32_t era = read_u32(in);
+			index->era_counts_[era] = read_u64(in);
+		}
+
+		uint32_t nr_chunks = read_u32(in);
+		uint32_t expected = (key.nr_blocks + index->chunk_size_ - 1) / index->chunk_size_;
+		if (nr_chunks != expected)
+			return ptr();
+
+		index->chunk_max_eras_.resize(nr_chunks);
+		for (uint32_t i = 0; i < nr_chunks; i++)
+			index->chunk_max_eras_[i] = read_u32(in);
+
+		return index;
+
+	} catch (std::exception &e) {
+		return ptr();
+	}
+}
+
+//----------------------------------------------------------------
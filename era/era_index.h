@@ -0,0 +1,84 @@
+#ifndef ERA_ERA_INDEX_H
+#define ERA_ERA_INDEX_H
+
+#include "era/era_array.h"
+#include "era/superblock.h"
+
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace era {
+	// Identifies the metadata an index was built from.  Era
+	// metadata has no transaction id, but every commit that changes
+	// the era array or the writesets moves at least one of these
+	// roots.
+	struct era_index_key {
+		era_index_key();
+		era_index_key(superblock const &sb, bool from_snapshot);
+
+		bool operator ==(era_index_key const &rhs) const;
+		bool operator !=(era_index_key const &rhs) const {
+			return !(*this == rhs);
+		}
+
+		uint32_t nr_blocks;
+		uint32_t current_era;
+		uint64_t current_writeset_root;
+		uint64_t writeset_tree_root;
+		uint64_t era_array_root;
+		bool from_snapshot;
+	};
+
+	// A summary of the era array, built in one walk and kept in a
+	// sidecar file, so repeated threshold queries can skip the
+	// parts of the array that are too old to matter.
+	class era_index {
+	public:
+		typedef boost::shared_ptr<era_index> ptr;
+
+		static uint32_t const DEFAULT_CHUNK_SIZE = 4096;
+
+		era_index(era_index_key const &key,
+			  uint32_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+		void build(era_array const &array);
+
+		era_index_key const &get_key() const {
+			return key_;
+		}
+
+		uint32_t get_chunk_size() const {
+			return chunk_size_;
+		}
+
+		uint32_t get_nr_chunks() const {
+			return chunk_max_eras_.size();
+		}
+
+		// The highest era of any block in the chunk.
+		uint32_t get_chunk_max_era(uint32_t chunk) const;
+
+		// How many array entries hold an era >= threshold.
+		uint64_t count_blocks_since(uint32_t threshold) const;
+
+		void write(std::string const &path) const;
+
+		// Returns a null pointer if the file is missing, unreadable,
+		// or was built from different metadata.
+		static ptr read(std::string const &path, era_index_key const &key);
+
+	private:
+		era_index_key key_;
+		uint32_t chunk_size_;
+		std::vector<uint32_t> chunk_max_eras_;
+		std::map<uint32_t, uint64_t> era_counts_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
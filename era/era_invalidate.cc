@@ -4,13 +4,16 @@
 #include <iostream>
 
 #include "version.h"
+#include "base/dense_bitmap.h"
 #include "base/indented_stream.h"
+#include "base/progress_monitor.h"
 #include "era/commands.h"
-#include "era/era_array.h"
-#include "era/writeset_tree.h"
+#include "era/era_index.h"
+#include "era/invalidate.h"
 #include "era/metadata.h"
 #include "era/xml_format.h"
 #include "persistent-data/file_utils.h"
+#include "persistent-data/space-maps/disk.h"
 
 #include <boost/lexical_cast.hpp>
 
@@ -23,98 +26,19 @@ using namespace std;
 namespace {
 	struct flags {
 		flags()
-			: metadata_snapshot_(false) {
+			: metadata_snapshot_(false),
+			  bitmap_(false) {
 		}
 
 		bool metadata_snapshot_;
+		bool bitmap_;
 		optional<uint32_t> era_threshold_;
+		optional<string> index_path_;
 	};
 
 	//--------------------------------
 
-	void walk_array(era_array const &array, uint32_t nr_blocks,
-			uint32_t threshold, set<uint32_t> &blocks) {
-		for (uint32_t b = 0; b < nr_blocks; b++) {
-			uint32_t era = array.get(b);
-			if (era >= threshold)
-				blocks.insert(b);
-		}
-	}
-
-	class writesets_marked_since : public writeset_tree_detail::writeset_visitor {
-	public:
-		writesets_marked_since(uint32_t threshold, set<uint32_t> &blocks)
-			: current_era_(0),
-			  threshold_(threshold),
-			  blocks_(blocks) {
-		}
-
-		void writeset_begin(uint32_t era, uint32_t nr_bits) {
-			current_era_ = era;
-		}
-
-		void bit(uint32_t index, bool value) {
-			if (value && current_era_ >= threshold_)
-				blocks_.insert(index);
-		}
-
-		void writeset_end() {
-		}
-
-	private:
-		uint32_t current_era_;
-		uint32_t threshold_;
-		set<uint32_t> &blocks_;
-	};
-
-	void raise_metadata_damage() {
-		throw std::runtime_error("metadata contains errors (run era_check for details).");
-	}
-
-	struct fatal_writeset_tree_damage : public writeset_tree_detail::damage_visitor {
-		void visit(writeset_tree_detail::missing_eras const &d) {
-			raise_metadata_damage();
-		}
-
-		void visit(writeset_tree_detail::damaged_writeset const &d) {
-			raise_metadata_damage();
-		}
-	};
-
-	void walk_writesets(metadata const &md, uint32_t threshold, set<uint32_t> &result) {
-		writesets_marked_since v(threshold, result);
-		fatal_writeset_tree_damage dv;
-
-		walk_writeset_tree(md.tm_, *md.writeset_tree_, v, dv);
-	}
-
-	void mark_blocks_since(metadata const &md, optional<uint32_t> const &threshold, set<uint32_t> &result) {
-		if (!threshold)
-			// Can't get here, just putting in to pacify the compiler
-			throw std::runtime_error("threshold not set");
-		else {
-			walk_array(*md.era_array_, md.sb_.nr_blocks, *threshold, result);
-			walk_writesets(md, *threshold, result);
-		}
-	}
-
-	//--------------------------------
-
-	template <typename Iterator>
-	pair<uint32_t, uint32_t> next_run(Iterator &it, Iterator end) {
-		uint32_t b, e;
-
-		b = *it++;
-		e = b + 1;
-		while (it != end && *it == e) {
-			e++;
-			it++;
-		}
-
-		return make_pair(b, e);
-	}
-
-	void emit_blocks(ostream &out, set<uint32_t> const &blocks) {
+	void emit_blocks(ostream &out, dense_bitmap const &blocks) {
 		indented_stream o(out);
 
 		o.indent();
@@ -122,17 +46,16 @@ namespace {
 
 		o.inc();
 		{
-			set<uint32_t>::const_iterator it = blocks.begin();
-			while (it != blocks.end()) {
+			uint64_t b, e;
+			for (uint64_t from = 0; blocks.next_run(from, b, e); from = e) {
 				o.indent();
 
-				pair<uint32_t, uint32_t> range = next_run(it, blocks.end());
-				if (range.second - range.first == 1)
-					o << "<block block=\"" << range.first << "\"/>" << endl;
+				if (e - b == 1)
+					o << "<block block=\"" << b << "\"/>" << endl;
 
 				else
-					o << "<range begin=\"" << range.first
-					  << "\" end = \"" << range.second << "\"/>" << endl;
+					o << "<range begin=\"" << b
+					  << "\" end = \"" << e << "\"/>" << endl;
 			}
 		}
 		o.dec();
@@ -149,30 +72,55 @@ namespace {
 		return output == STDOUT_PATH;
 	}
 
+	void emit(ostream &out, dense_bitmap const &blocks, flags const &fs) {
+		if (fs.bitmap_)
+			blocks.write(out);
+		else
+			emit_blocks(out, blocks);
+
+		if (!out)
+			throw runtime_error("couldn't write output");
+	}
+
 	int invalidate(string const &dev, string const &output, flags const &fs) {
 		try {
-			set<uint32_t> blocks;
 			block_manager<>::ptr bm = open_bm(dev, block_manager<>::READ_ONLY, !fs.metadata_snapshot_);
+			metadata::ptr md;
 
 			if (fs.metadata_snapshot_) {
 				superblock sb = read_superblock(bm);
 				if (!sb.metadata_snap)
 					throw runtime_error("no metadata snapshot taken.");
 
-				metadata::ptr md(new metadata(bm, *sb.metadata_snap));
-				mark_blocks_since(*md, fs.era_threshold_, blocks);
+				md.reset(new metadata(bm, *sb.metadata_snap));
+
+			} else
+				md.reset(new metadata(bm, metadata::OPEN));
+
+			base::set_walk_progress_total(persistent_data::get_nr_allocated(md->sb_.metadata_space_map_root));
 
-			} else {
-				metadata::ptr md(new metadata(bm, metadata::OPEN));
-				mark_blocks_since(*md, fs.era_threshold_, blocks);
+			// The index is rebuilt whenever the metadata has
+			// changed since it was written.
+			era_index::ptr index;
+			if (fs.index_path_) {
+				era_index_key key(md->sb_, fs.metadata_snapshot_);
+				index = era_index::read(*fs.index_path_, key);
+				if (!index) {
+					index.reset(new era_index(key));
+					index->build(*md->era_array_);
+					index->write(*fs.index_path_);
+				}
 			}
 
+			dense_bitmap blocks(md->sb_.nr_blocks);
+			mark_blocks_since(*md, *fs.era_threshold_, blocks, index.get());
+
 			if (want_stdout(output))
-				emit_blocks(cout, blocks);
+				emit(cout, blocks, fs);
 
 			else {
-				ofstream out(output.c_str());
-				emit_blocks(out, blocks);
+				ofstream out(output.c_str(), ios_base::out | ios_base::binary);
+				emit(out, blocks, fs);
 			}
 
 		} catch (std::exception &e) {
@@ -198,6 +146,8 @@ era_invalidate_cmd::usage(std::ostream &out) const
 	    << "Options:\n"
 	    << "  {-h|--help}\n"
 	    << "  {-o <xml file>}\n"
+	    << "  {--bitmap}\n"
+	    << "  {--index <index file>}\n"
 	    << "  {--metadata-snapshot}\n"
 	    << "  {-V|--version}" << endl;
 }
@@ -216,6 +166,8 @@ era_invalidate_cmd::run(int argc, char **argv)
 		{ "version", no_argument, NULL, 'V' },
 		{ "metadata-snapshot", no_argument, NULL, 1},
 		{ "written-since", required_argument, NULL, 2},
+		{ "bitmap", no_argument, NULL, 3},
+		{ "index", required_argument, NULL, 4},
 		{ NULL, no_argument, NULL, 0 }
 	};
 
@@ -229,6 +181,14 @@ era_invalidate_cmd::run(int argc, char **argv)
 			fs.era_threshold_ = lexical_cast<uint32_t>(optarg);
 			break;
 
+		case 3:
+			fs.bitmap_ = true;
+			break;
+
+		case 4:
+			fs.index_path_ = string(optarg);
+			break;
+
 		case 'h':
 			usage(cout);
 			return 0;
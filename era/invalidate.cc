@@ -0,0 +1,115 @@
+#include "era/invalidate.h"
+
+#include "era/writeset_tree.h"
+
+using namespace base;
+using namespace era;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	// The number of eras read from the array at a time.
+	uint32_t const ERA_CHUNK = 64 * 1024;
+
+	void mark_range(era_array const &array, uint32_t b, uint32_t e,
+			uint32_t threshold, dense_bitmap &blocks,
+			vector<uint32_t> &eras) {
+		array.get_range(b, e, eras);
+
+		for (uint32_t i = 0; i < eras.size(); i++)
+			if (eras[i] >= threshold)
+				blocks.set(b + i);
+	}
+
+	void walk_array(era_array const &array, uint32_t nr_blocks,
+			uint32_t threshold, dense_bitmap &blocks) {
+		vector<uint32_t> eras;
+
+		for (uint32_t b = 0; b < nr_blocks; b += ERA_CHUNK)
+			mark_range(array, b, min<uint32_t>(nr_blocks, b + ERA_CHUNK),
+				   threshold, blocks, eras);
+	}
+
+	void walk_array(era_array const &array, era_index const &index,
+			uint32_t threshold, dense_bitmap &blocks) {
+		if (!index.count_blocks_since(threshold))
+			return;
+
+		vector<uint32_t> eras;
+		uint32_t nr_blocks = index.get_key().nr_blocks;
+		uint32_t chunk_size = index.get_chunk_size();
+
+		for (uint32_t c = 0; c < index.get_nr_chunks(); c++) {
+			if (index.get_chunk_max_era(c) < threshold)
+				continue;
+
+			uint32_t b = c * chunk_size;
+			mark_range(array, b, min<uint32_t>(nr_blocks, b + chunk_size),
+				   threshold, blocks, eras);
+		}
+	}
+
+	class writesets_marked_since : public writeset_tree_detail::writeset_word_visitor {
+	public:
+		writesets_marked_since(uint32_t threshold, dense_bitmap &blocks)
+			: threshold_(threshold),
+			  blocks_(blocks) {
+		}
+
+		bool writeset_begin(uint32_t era, uint32_t nr_bits) {
+			return era >= threshold_;
+		}
+
+		void word(uint32_t word_index, uint64_t bits) {
+			blocks_.or_word(word_index, bits);
+		}
+
+		void writeset_end() {
+		}
+
+	private:
+		uint32_t threshold_;
+		dense_bitmap &blocks_;
+	};
+
+	void raise_metadata_damage() {
+		throw std::runtime_error("metadata contains errors (run era_check for details).");
+	}
+
+	struct fatal_writeset_tree_damage : public writeset_tree_detail::damage_visitor {
+		void visit(writeset_tree_detail::missing_eras const &d) {
+			raise_metadata_damage();
+		}
+
+		void visit(writeset_tree_detail::damaged_writeset const &d) {
+			raise_metadata_damage();
+		}
+	};
+
+	void walk_writesets(metadata const &md, uint32_t threshold, dense_bitmap &result) {
+		writesets_marked_since v(threshold, result);
+		fatal_writeset_tree_damage dv;
+
+		walk_writeset_tree(md.tm_, *md.writeset_tree_, v, dv);
+	}
+}
+
+//----------------------------------------------------------------
+
+void
+era::mark_blocks_since(metadata const &md, uint32_t threshold,
+		       dense_bitmap &result, era_index const *index)
+{
+	if (index) {
+		if (index->get_key() != era_index_key(md.sb_, index->get_key().from_snapshot))
+			throw runtime_error("era index doesn't match the metadata");
+
+		walk_array(*md.era_array_, *index, threshold, result);
+	} else
+		walk_array(*md.era_array_, md.sb_.nr_blocks, threshold, result);
+
+	walk_writesets(md, threshold, result);
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,22 @@
+#ifndef ERA_INVALIDATE_H
+#define ERA_INVALIDATE_H
+
+#include "base/dense_bitmap.h"
+#include "era/era_index.h"
+#include "era/metadata.h"
+
+//----------------------------------------------------------------
+
+namespace era {
+	// Marks every block that may have been written in, or after,
+	// the threshold era.  If an index built from this metadata is
+	// given, parts of the era array that are too old are skipped.
+	// Throws if the metadata is damaged.
+	void mark_blocks_since(metadata const &md, uint32_t threshold,
+			       base::dense_bitmap &result,
+			       era_index const *index = NULL);
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -39,7 +39,7 @@ namespace {
 		emitter::ptr e_;
 	};
 
-	class writeset_tree_collator : public writeset_tree_detail::writeset_visitor {
+	class writeset_tree_collator : public writeset_tree_detail::writeset_run_visitor {
 	public:
 		writeset_tree_collator(map<uint32_t, uint32_t> &exceptions)
 			: exceptions_(exceptions),
@@ -50,11 +50,13 @@ namespace {
 			current_era_ = era;
 		}
 
-		virtual void bit(uint32_t bit, bool value) {
-			if (value) {
-				map<uint32_t, uint32_t>::const_iterator it = exceptions_.find(bit);
-				if (it == exceptions_.end() || it->second < current_era_)
+		virtual void marked_run(uint32_t begin, uint32_t end) {
+			for (uint32_t bit = begin; bit != end; bit++) {
+				map<uint32_t, uint32_t>::iterator it = exceptions_.find(bit);
+				if (it == exceptions_.end())
 					exceptions_.insert(make_pair(bit, current_era_));
+				else if (it->second < current_era_)
+					it->second = current_era_;
 			}
 		}
 
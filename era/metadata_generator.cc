@@ -0,0 +1,107 @@
+#include "era/metadata_generator.h"
+
+#include "base/rng.h"
+#include "persistent-data/math_utils.h"
+
+#include <stdexcept>
+
+using namespace base;
+using namespace era;
+using namespace std;
+
+//----------------------------------------------------------------
+
+namespace {
+	class generator {
+	public:
+		generator(generator_params const &p, emitter::ptr e)
+			: p_(p),
+			  e_(e),
+			  rng_(p.seed),
+			  max_run_(2 * p.run_length - 1) {
+		}
+
+		void generate() {
+			e_->begin_superblock("", p_.data_block_size, p_.nr_blocks, p_.current_era);
+
+			for (uint32_t era = p_.current_era - p_.nr_writesets; era < p_.current_era; era++) {
+				e_->begin_writeset(era, p_.nr_blocks);
+				for (uint32_t b = 0; b < p_.nr_blocks;) {
+					uint32_t len = next_run(b);
+					if (rng_.percent(p_.written))
+						for (uint32_t i = 0; i < len; i++)
+							e_->writeset_bit(b + i, true);
+					b += len;
+				}
+				e_->end_writeset();
+			}
+
+			uint32_t nr_digested = p_.current_era - p_.nr_writesets;
+
+			e_->begin_era_array();
+			for (uint32_t b = 0; b < p_.nr_blocks;) {
+				uint32_t len = next_run(b);
+				uint32_t era = nr_digested ? rng_.below(nr_digested) : 0;
+				for (uint32_t i = 0; i < len; i++)
+					e_->era(b + i, era);
+				b += len;
+			}
+			e_->end_era_array();
+
+			e_->end_superblock();
+		}
+
+	private:
+		uint32_t next_run(uint32_t b) {
+			return min<uint64_t>(1 + rng_.below(max_run_), p_.nr_blocks - b);
+		}
+
+		generator_params const &p_;
+		emitter::ptr e_;
+		rng rng_;
+		uint64_t max_run_;
+	};
+}
+
+//----------------------------------------------------------------
+
+generator_params::generator_params()
+	: nr_blocks(1024 * 1024),
+	  current_era(1000),
+	  nr_writesets(2),
+	  written(1),
+	  run_length(16),
+	  data_block_size(128),
+	  seed(0)
+{
+}
+
+// The era array takes four bytes a block, and each writeset a bit.
+// Btree and space map overheads come to well under half as much again.
+pd::block_address
+era::estimate_metadata_size(generator_params const &p)
+{
+	uint64_t bytes = p.nr_blocks * 4 + p.nr_writesets * div_up<uint64_t>(p.nr_blocks, 8);
+	return div_up<uint64_t>(bytes * 3 / 2, pd::MD_BLOCK_SIZE) + 1024;
+}
+
+void
+era::generate_metadata(generator_params const &p, emitter::ptr e)
+{
+	if (!p.run_length)
+		throw runtime_error("run length must be at least one");
+
+	if (p.written > 100)
+		throw runtime_error("written is a percentage");
+
+	if (p.nr_blocks > 0xffffffffull)
+		throw runtime_error("too many blocks for era metadata");
+
+	if (p.nr_writesets > p.current_era)
+		throw runtime_error("there can't be more writesets than eras");
+
+	generator g(p, e);
+	g.generate();
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,39 @@
+#ifndef ERA_METADATA_GENERATOR_H
+#define ERA_METADATA_GENERATOR_H
+
+#include "era/emitter.h"
+
+//----------------------------------------------------------------
+
+namespace era {
+	// Describes the synthetic metadata generate_metadata() makes.
+	// The era array holds runs of blocks last written in the same,
+	// randomly chosen, era.  The most recent eras haven't been
+	// digested yet, so they're still writesets.
+	struct generator_params {
+		generator_params();
+
+		pd::block_address nr_blocks;
+		uint32_t current_era;
+		unsigned nr_writesets;
+
+		// Percentage of the blocks each writeset marks.
+		unsigned written;
+
+		// Mean length of a run of blocks.
+		unsigned run_length;
+
+		uint32_t data_block_size;
+		uint64_t seed;
+	};
+
+	// A metadata device size with room for the generated metadata.
+	pd::block_address estimate_metadata_size(generator_params const &p);
+
+	// The same params always give the same metadata.
+	void generate_metadata(generator_params const &p, emitter::ptr e);
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -14,6 +14,8 @@ namespace {
 			: md_(md),
 			  in_superblock_(false),
 			  in_writeset_(false),
+			  run_end_(0),
+			  set_end_(0),
 			  in_era_array_(false) {
 		}
 
@@ -54,15 +56,32 @@ namespace {
 
 			bits_.reset(new bitset(*md_.tm_));
 			bits_->grow(nr_bits, false);
+			set_end_ = 0;
 		}
 
+		// Set bits are gathered into runs, which are written a
+		// word at a time.  The bitset starts out clear, so unset
+		// bits only need writing if they were set earlier.
 		virtual void writeset_bit(uint32_t bit, bool value) {
-			bits_->set(bit, value);
+			if (value) {
+				if (run_begin_ && bit == run_end_)
+					run_end_++;
+				else {
+					flush_run();
+					run_begin_ = bit;
+					run_end_ = bit + 1;
+				}
+
+			} else if (bit < set_end_ || (run_begin_ && bit < run_end_)) {
+				flush_run();
+				bits_->set(bit, false);
+			}
 		}
 
 		virtual void end_writeset() {
 			in_writeset_ = false;
 
+			flush_run();
 			bits_->flush();
 
 			era_detail e;
@@ -92,6 +111,14 @@ namespace {
 		}
 
 	private:
+		void flush_run() {
+			if (run_begin_) {
+				bits_->set_range(*run_begin_, run_end_);
+				set_end_ = max<uint32_t>(set_end_, run_end_);
+				run_begin_ = boost::optional<uint32_t>();
+			}
+		}
+
 		metadata &md_;
 
 		bool in_superblock_;
@@ -99,6 +126,9 @@ namespace {
 		bool in_writeset_;
 		uint32_t era_;
 		pd::bitset::ptr bits_;
+		boost::optional<uint32_t> run_begin_;
+		uint32_t run_end_;
+		uint32_t set_end_;
 
 		bool in_era_array_;
 		uint32_t nr_blocks_;
@@ -75,6 +75,79 @@ namespace {
 		writeset_tree_detail::damage_visitor &dv_;
 	};
 
+	class ll_writeset_run_visitor : public bitset_detail::bitset_run_visitor {
+	public:
+		typedef persistent_data::transaction_manager::ptr tm_ptr;
+
+		ll_writeset_run_visitor(tm_ptr tm,
+					writeset_tree_detail::writeset_run_visitor &writeset_v,
+					writeset_tree_detail::damage_visitor &dv)
+			: tm_(tm),
+			  era_(0),
+			  writeset_v_(writeset_v),
+			  dv_(dv) {
+		}
+
+		void visit(btree_path const &path, era_detail const &era) {
+			era_ = path[0];
+			persistent_data::bitset bs(*tm_, era.writeset_root, era.nr_bits);
+			writeset_v_.writeset_begin(era_, era.nr_bits);
+			bs.walk_set_runs(*this);
+			writeset_v_.writeset_end();
+		}
+
+		void visit_run(uint32_t begin, uint32_t end) {
+			writeset_v_.marked_run(begin, end);
+		}
+
+		void visit(bitset_detail::missing_bits const &d) {
+			dv_.visit(writeset_tree_detail::damaged_writeset("missing bits", era_, d.keys_));
+		}
+
+	private:
+		tm_ptr tm_;
+		uint64_t era_;
+		writeset_tree_detail::writeset_run_visitor &writeset_v_;
+		writeset_tree_detail::damage_visitor &dv_;
+	};
+
+	class ll_writeset_word_visitor : public bitset_detail::bitset_word_visitor {
+	public:
+		typedef persistent_data::transaction_manager::ptr tm_ptr;
+
+		ll_writeset_word_visitor(tm_ptr tm,
+					 writeset_tree_detail::writeset_word_visitor &writeset_v,
+					 writeset_tree_detail::damage_visitor &dv)
+			: tm_(tm),
+			  era_(0),
+			  writeset_v_(writeset_v),
+			  dv_(dv) {
+		}
+
+		void visit(btree_path const &path, era_detail const &era) {
+			era_ = path[0];
+			if (writeset_v_.writeset_begin(era_, era.nr_bits)) {
+				persistent_data::bitset bs(*tm_, era.writeset_root, era.nr_bits);
+				bs.walk_words(*this);
+			}
+			writeset_v_.writeset_end();
+		}
+
+		void visit_word(uint32_t word_index, uint64_t word) {
+			writeset_v_.word(word_index, word);
+		}
+
+		void visit(bitset_detail::missing_bits const &d) {
+			dv_.visit(writeset_tree_detail::damaged_writeset("missing bits", era_, d.keys_));
+		}
+
+	private:
+		tm_ptr tm_;
+		uint64_t era_;
+		writeset_tree_detail::writeset_word_visitor &writeset_v_;
+		writeset_tree_detail::damage_visitor &dv_;
+	};
+
 	class ll_damage_visitor {
 	public:
 		ll_damage_visitor(damage_visitor &v)
@@ -108,13 +181,35 @@ era::walk_writeset_tree(persistent_data::transaction_manager::ptr tm,
 	btree_visit_values(tree, ll_bv, ll_dv);
 }
 
+void
+era::walk_writeset_tree(persistent_data::transaction_manager::ptr tm,
+			writeset_tree const &tree,
+			writeset_tree_detail::writeset_run_visitor &writeset_v,
+			writeset_tree_detail::damage_visitor &dv)
+{
+	ll_writeset_run_visitor ll_bv(tm, writeset_v, dv);
+	ll_damage_visitor ll_dv(dv);
+	btree_visit_values(tree, ll_bv, ll_dv);
+}
+
+void
+era::walk_writeset_tree(persistent_data::transaction_manager::ptr tm,
+			writeset_tree const &tree,
+			writeset_tree_detail::writeset_word_visitor &writeset_v,
+			writeset_tree_detail::damage_visitor &dv)
+{
+	ll_writeset_word_visitor ll_bv(tm, writeset_v, dv);
+	ll_damage_visitor ll_dv(dv);
+	btree_visit_values(tree, ll_bv, ll_dv);
+}
+
 namespace {
-	class noop_writeset_visitor : public writeset_tree_detail::writeset_visitor {
+	class noop_writeset_visitor : public writeset_tree_detail::writeset_run_visitor {
 	public:
 		void writeset_begin(uint32_t era, uint32_t nr_bits) {
 		}
 
-		void bit(uint32_t index, bool value) {
+		void marked_run(uint32_t begin, uint32_t end) {
 		}
 
 		void writeset_end() {
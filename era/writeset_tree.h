@@ -68,6 +68,32 @@ namespace era {
 			virtual void bit(uint32_t index, bool value) = 0;
 			virtual void writeset_end() = 0;
 		};
+
+		// Only sees the bits that are set, a run at a time.
+		class writeset_run_visitor {
+		public:
+			typedef boost::shared_ptr<writeset_run_visitor> ptr;
+
+			virtual ~writeset_run_visitor() {}
+
+			virtual void writeset_begin(uint32_t era, uint32_t nr_bits) = 0;
+			virtual void marked_run(uint32_t begin, uint32_t end) = 0;
+			virtual void writeset_end() = 0;
+		};
+
+		// Sees each writeset a 64 bit word at a time.  If
+		// writeset_begin() returns false the writeset's bits are
+		// not read.
+		class writeset_word_visitor {
+		public:
+			typedef boost::shared_ptr<writeset_word_visitor> ptr;
+
+			virtual ~writeset_word_visitor() {}
+
+			virtual bool writeset_begin(uint32_t era, uint32_t nr_bits) = 0;
+			virtual void word(uint32_t word_index, uint64_t bits) = 0;
+			virtual void writeset_end() = 0;
+		};
 	}
 
 	typedef persistent_data::btree<1, era_detail_traits> writeset_tree;
@@ -77,6 +103,16 @@ namespace era {
 				writeset_tree_detail::writeset_visitor &writeset_v,
 				writeset_tree_detail::damage_visitor &dv);
 
+	void walk_writeset_tree(persistent_data::transaction_manager::ptr tm,
+				writeset_tree const &tree,
+				writeset_tree_detail::writeset_run_visitor &writeset_v,
+				writeset_tree_detail::damage_visitor &dv);
+
+	void walk_writeset_tree(persistent_data::transaction_manager::ptr tm,
+				writeset_tree const &tree,
+				writeset_tree_detail::writeset_word_visitor &writeset_v,
+				writeset_tree_detail::damage_visitor &dv);
+
 	void check_writeset_tree(persistent_data::transaction_manager::ptr tm,
 				 writeset_tree const &tree,
 				 writeset_tree_detail::damage_visitor &dv);
@@ -85,48 +85,69 @@ namespace {
 	//--------------------------------
 	// Parser
 	//--------------------------------
-	void parse_bit(attributes const &a, emitter *e) {
-		bool value;
-
-		string txt = get_attr<string>(a, "value");
-		if (txt == "true")
-			value = true;
-		else if (txt == "false")
-			value = false;
-		else
-			throw runtime_error("invalid boolean");
+	// The writeset bits and era entries take the attribute_slots fast
+	// path rather than building an attributes map.
+	char const * const bit_keys[] = {
+		"block", "value"
+	};
+
+	enum bit_slot {
+		B_BLOCK,
+		B_VALUE,
+		B_NR_SLOTS
+	};
+
+	void parse_bit(char const **attr, emitter *e) {
+		attribute_slots a(bit_keys, B_NR_SLOTS, attr);
+		e->writeset_bit(a.get_uint<uint32_t>(B_BLOCK), a.get_bool(B_VALUE));
+	}
+
+	char const * const era_keys[] = {
+		"block", "era"
+	};
+
+	enum era_slot {
+		E_BLOCK,
+		E_ERA,
+		E_NR_SLOTS
+	};
 
-		e->writeset_bit(get_attr<uint32_t>(a, "block"), value);
+	void parse_era(char const **attr, emitter *e) {
+		attribute_slots a(era_keys, E_NR_SLOTS, attr);
+		e->era(a.get_uint<pd::block_address>(E_BLOCK),
+		       a.get_uint<uint32_t>(E_ERA));
 	}
 
 	void start_tag(void *data, char const *el, char const **attr) {
 		emitter *e = static_cast<emitter *>(data);
-		attributes a;
 
-		build_attributes(a, attr);
+		if (!strcmp(el, "bit"))
+			parse_bit(attr, e);
 
-		if (!strcmp(el, "superblock"))
-			e->begin_superblock(get_attr<string>(a, "uuid"),
-					    get_attr<uint32_t>(a, "block_size"),
-					    get_attr<pd::block_address>(a, "nr_blocks"),
-					    get_attr<uint32_t>(a, "current_era"));
+		else if (!strcmp(el, "era"))
+			parse_era(attr, e);
 
-		else if (!strcmp(el, "writeset"))
-			e->begin_writeset(get_attr<uint32_t>(a, "era"),
-					  get_attr<uint32_t>(a, "nr_bits"));
+		else {
+			attributes a;
 
-		else if (!strcmp(el, "bit"))
-			parse_bit(a, e);
+			build_attributes(a, attr);
 
-		else if (!strcmp(el, "era_array"))
-			e->begin_era_array();
+			if (!strcmp(el, "superblock"))
+				e->begin_superblock(get_attr<string>(a, "uuid"),
+						    get_attr<uint32_t>(a, "block_size"),
+						    get_attr<pd::block_address>(a, "nr_blocks"),
+						    get_attr<uint32_t>(a, "current_era"));
 
-		else if (!strcmp(el, "era"))
-			e->era(get_attr<pd::block_address>(a, "block"),
-			       get_attr<uint32_t>(a, "era"));
+			else if (!strcmp(el, "writeset"))
+				e->begin_writeset(get_attr<uint32_t>(a, "era"),
+						  get_attr<uint32_t>(a, "nr_bits"));
 
-		else
-			throw runtime_error("unknown tag type");
+			else if (!strcmp(el, "era_array"))
+				e->begin_era_array();
+
+			else
+				throw runtime_error("unknown tag type");
+		}
 	}
 
 	void end_tag(void *data, const char *el) {
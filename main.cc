@@ -1,6 +1,7 @@
 #include <iostream>
 
 #include "base/application.h"
+#include "base/batch.h"
 
 #include "caching/commands.h"
 #include "era/commands.h"
@@ -18,6 +19,8 @@ int main(int argc, char **argv)
 	era::register_era_commands(app);
 	thin_provisioning::register_thin_commands(app);
 
+	app.add_cmd(command::ptr(new batch_cmd(app)));
+
 	return app.run(argc, argv);
 }
 
@@ -37,6 +37,7 @@ namespace persistent_data {
 	using namespace bcache;
 
 	uint32_t const MD_BLOCK_SIZE = 4096;
+	size_t const DEFAULT_BLOCK_CACHE_MEM = 1024u * 1024u * 16;
 
 	template <uint32_t BlockSize = MD_BLOCK_SIZE>
 	class block_manager : private boost::noncopyable {
@@ -53,7 +54,8 @@ namespace persistent_data {
 			      block_address nr_blocks,
 			      unsigned max_concurrent_locks,
 			      mode m,
-			      bool excl = true);
+			      bool excl = true,
+			      size_t cache_mem = DEFAULT_BLOCK_CACHE_MEM);
 
 		class read_ref {
 		public:
@@ -127,6 +129,10 @@ namespace persistent_data {
 		block_address get_nr_blocks() const;
 
 		void prefetch(block_address b) const;
+
+		// Adds a block that's already been read to the cache,
+		// see block_cache::preload().
+		void preload(block_address b, void const *data) const;
 		void flush() const;
 
 
@@ -222,9 +222,10 @@ namespace persistent_data {
 						block_address nr_blocks,
 						unsigned max_concurrent_blocks,
 						mode m,
-						bool excl)
+						bool excl,
+						size_t cache_mem)
 		: fd_(open_or_create_block_file(path, nr_blocks * BlockSize, m, excl)),
-		  bc_(fd_, BlockSize >> SECTOR_SHIFT, nr_blocks, 1024u * 1024u * 16),
+		  bc_(fd_, BlockSize >> SECTOR_SHIFT, nr_blocks, cache_mem),
 		  superblock_ref_count_(0)
 	{
 	}
@@ -313,6 +314,13 @@ namespace persistent_data {
 		bc_.prefetch(b);
 	}
 
+	template <uint32_t BlockSize>
+	void
+	block_manager<BlockSize>::preload(block_address b, void const *data) const
+	{
+		bc_.preload(b, data);
+	}
+
 	template <uint32_t BlockSize>
 	void
 	block_manager<BlockSize>::flush() const
@@ -33,9 +33,8 @@ crc32c::crc32c(uint32_t xor_value)
 void
 crc32c::append(void const *buffer, unsigned len)
 {
-	uint32_t const powers = 0x1EDC6F41;
-
-	boost::crc_basic<32> crc(powers, 0xffffffff, 0, true, true);
+	// Table driven; crc_basic works a bit at a time.
+	boost::crc_optimal<32, 0x1EDC6F41, 0xffffffff, 0, true, true> crc;
 	crc.process_bytes(buffer, len);
 	sum_ = crc.checksum();
 }
@@ -19,6 +19,7 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
+#include "base/progress_monitor.h"
 #include "persistent-data/math_utils.h"
 #include "persistent-data/data-structures/btree.h"
 #include "persistent-data/data-structures/btree_counter.h"
@@ -167,12 +168,37 @@ namespace persistent_data {
 			unsigned highest_index_;
 		};
 
+		template <typename ValueVisitor>
+		struct disk_value_visitor {
+			disk_value_visitor(array<ValueTraits> const &a, ValueVisitor &vv)
+				: a_(a),
+				  vv_(vv),
+				  highest_index_() {
+			}
+
+			void visit(btree_path const &p,
+				   typename block_traits::value_type const &block) {
+				highest_index_ = max<unsigned>(highest_index_,
+							       a_.visit_array_block_disk(vv_, p, block));
+			}
+
+			unsigned get_highest_seen() const {
+				return highest_index_;
+			}
+
+		private:
+			array<ValueTraits> const &a_;
+			ValueVisitor &vv_;
+			unsigned highest_index_;
+		};
+
 		// Returns the highest index visited
 		template <typename ValueVisitor>
 		unsigned visit_array_block(ValueVisitor &vv,
 					   btree_path const &p,
 					   typename block_traits::value_type const &v) const {
 			rblock rb(tm_.read_lock(v, validator_), rc_);
+			base::walk_progress_node();
 
 			for (uint32_t i = 0; i < rb.nr_entries(); i++)
 				vv.visit(p[0] * rb.max_entries() + i, rb.get(i));
@@ -180,6 +206,19 @@ namespace persistent_data {
 			return p[0] * rb.max_entries() + (rb.nr_entries() - 1);
 		}
 
+		template <typename ValueVisitor>
+		unsigned visit_array_block_disk(ValueVisitor &vv,
+						btree_path const &p,
+						typename block_traits::value_type const &v) const {
+			rblock rb(tm_.read_lock(v, validator_), rc_);
+			base::walk_progress_node();
+
+			for (uint32_t i = 0; i < rb.nr_entries(); i++)
+				vv.visit(p[0] * rb.max_entries() + i, rb.get_disk(i));
+
+			return p[0] * rb.max_entries() + (rb.nr_entries() - 1);
+		}
+
 		template <typename DamageVisitor>
 		struct block_damage_visitor {
 			block_damage_visitor(DamageVisitor &dv, unsigned entries_per_block)
@@ -215,6 +254,7 @@ namespace persistent_data {
 
 		typedef boost::shared_ptr<array<ValueTraits> > ptr;
 		typedef typename ValueTraits::value_type value_type;
+		typedef typename ValueTraits::disk_type disk_type;
 		typedef typename ValueTraits::ref_counter ref_counter;
 
 		array(transaction_manager &tm, ref_counter rc)
@@ -224,7 +264,9 @@ namespace persistent_data {
 			  block_rc_(tm.get_sm(), *this),
 			  block_tree_(tm, block_rc_),
 			  rc_(rc),
-			  validator_(new array_detail::array_block_validator) {
+			  validator_(new array_detail::array_block_validator),
+			  directory_loaded_(false),
+			  directory_generation_(0) {
 		}
 
 		array(transaction_manager &tm, ref_counter rc,
@@ -236,7 +278,9 @@ namespace persistent_data {
 			  block_rc_(tm.get_sm(), *this),
 			  block_tree_(tm, root, block_rc_),
 			  rc_(rc),
-			  validator_(new array_detail::array_block_validator) {
+			  validator_(new array_detail::array_block_validator),
+			  directory_loaded_(false),
+			  directory_generation_(0) {
 		}
 
 		unsigned get_nr_entries() const {
@@ -246,6 +290,7 @@ namespace persistent_data {
 		// FIXME: why is this needed?
 		void set_root(block_address root) {
 			block_tree_.set_root(root);
+			directory_loaded_ = false;
 		}
 
 		block_address get_root() const {
@@ -271,10 +316,104 @@ namespace persistent_data {
 			b.set(index % entries_per_block_, value);
 		}
 
+		// Reads entries [begin, end), locking each array block once.
+		void get_range(unsigned begin, unsigned end,
+			       std::vector<value_type> &values) const {
+			check_range(begin, end);
+
+			values.clear();
+			values.reserve(end - begin);
+
+			while (begin != end) {
+				unsigned ablock_index = begin / entries_per_block_;
+				unsigned ablock_end = min<unsigned>(end, (ablock_index + 1) * entries_per_block_);
+
+				rblock b = get_ablock(ablock_index);
+				for (; begin != ablock_end; begin++)
+					values.push_back(b.get(begin % entries_per_block_));
+			}
+		}
+
+		// Writes values to consecutive entries starting at begin.
+		// Each array block is shadowed once, and the block tree is
+		// only updated for those that moved, after all the values
+		// have been written.
+		void set_range(unsigned begin, std::vector<value_type> const &values) {
+			unsigned end = begin + values.size();
+			check_range(begin, end);
+
+			std::vector<std::pair<unsigned, block_address> > moved;
+			typename std::vector<value_type>::const_iterator it = values.begin();
+
+			while (begin != end) {
+				unsigned ablock_index = begin / entries_per_block_;
+				unsigned ablock_end = min<unsigned>(end, (ablock_index + 1) * entries_per_block_);
+
+				block_address old_location = lookup_block_address(ablock_index);
+				wblock b = shadow_ablock_(old_location);
+				for (; begin != ablock_end; begin++, ++it)
+					b.set(begin % entries_per_block_, *it);
+
+				if (b.get_location() != old_location)
+					moved.push_back(std::make_pair(ablock_index, b.get_location()));
+			}
+
+			for (unsigned i = 0; i < moved.size(); i++)
+				update_block_address(moved[i].first, moved[i].second);
+		}
+
+		// Writes packed values straight into the array blocks,
+		// without reference counting.  Only for values that don't
+		// hold references.
+		void set_disk_range(unsigned begin, disk_type const *values, unsigned count) {
+			unsigned end = begin + count;
+			check_range(begin, end);
+
+			std::vector<std::pair<unsigned, block_address> > moved;
+
+			while (begin != end) {
+				unsigned ablock_index = begin / entries_per_block_;
+				unsigned ablock_end = min<unsigned>(end, (ablock_index + 1) * entries_per_block_);
+
+				block_address old_location = lookup_block_address(ablock_index);
+				wblock b = shadow_ablock_(old_location);
+				for (; begin != ablock_end; begin++, values++)
+					b.set_disk(begin % entries_per_block_, *values);
+
+				if (b.get_location() != old_location)
+					moved.push_back(std::make_pair(ablock_index, b.get_location()));
+			}
+
+			for (unsigned i = 0; i < moved.size(); i++)
+				update_block_address(moved[i].first, moved[i].second);
+		}
+
 		template <typename ValueVisitor, typename DamageVisitor>
 		void visit_values(ValueVisitor &value_visitor,
 				  DamageVisitor &damage_visitor) const {
 			block_value_visitor<ValueVisitor> bvisitor(*this, value_visitor);
+			visit_blocks(bvisitor, damage_visitor);
+		}
+
+		// As visit_values, but the visitor is passed a reference
+		// to each packed value within the locked array block.  The
+		// reference is only good for the duration of the visit.
+		template <typename ValueVisitor, typename DamageVisitor>
+		void visit_disk_values(ValueVisitor &value_visitor,
+				       DamageVisitor &damage_visitor) const {
+			disk_value_visitor<ValueVisitor> bvisitor(*this, value_visitor);
+			visit_blocks(bvisitor, damage_visitor);
+		}
+
+		void count_metadata_blocks(block_counter &bc) const {
+			block_address_counter vc(bc);
+			count_btree_blocks(block_tree_, bc, vc);
+		}
+
+	private:
+		template <typename BlockVisitor, typename DamageVisitor>
+		void visit_blocks(BlockVisitor &bvisitor,
+				  DamageVisitor &damage_visitor) const {
 			block_damage_visitor<DamageVisitor> dvisitor(damage_visitor, entries_per_block_);
 			btree_visit_values(block_tree_, bvisitor, dvisitor);
 
@@ -286,13 +425,6 @@ namespace persistent_data {
 			}
 		}
 
-		void count_metadata_blocks(block_counter &bc) const {
-			block_address_counter vc(bc);
-			count_btree_blocks(block_tree_, bc, vc);
-		}
-
-	private:
-
 		struct resizer {
 			resizer(array<ValueTraits> &a,
 				unsigned old_size,
@@ -362,26 +494,108 @@ namespace persistent_data {
 
 		//--------------------------------
 
+		// The locations of the array blocks are held in memory, so
+		// get() and set() don't have to look them up in the block
+		// tree each time.  The directory is read from the tree the
+		// first time it's needed, and again after a new transaction
+		// has begun.
+		typedef std::vector<boost::optional<block_address> > ablock_directory;
+
+		class directory_loader : public btree<1, block_traits>::visitor {
+		public:
+			typedef typename btree<1, block_traits>::visitor::node_location node_location;
+			typedef typename btree<1, block_traits>::internal_node internal_node;
+			typedef typename btree<1, block_traits>::leaf_node leaf_node;
+
+			directory_loader(ablock_directory &directory)
+				: directory_(directory) {
+			}
+
+			virtual bool visit_internal(node_location const &l,
+						    internal_node const &n) {
+				return true;
+			}
+
+			virtual bool visit_internal_leaf(node_location const &l,
+							 internal_node const &n) {
+				return true;
+			}
+
+			virtual bool visit_leaf(node_location const &l,
+						leaf_node const &n) {
+				for (unsigned i = 0; i < n.get_nr_entries(); i++) {
+					uint64_t index = n.key_at(i);
+					if (index >= directory_.size())
+						directory_.resize(index + 1);
+					directory_[index] = n.value_at(i);
+				}
+
+				return true;
+			}
+
+			// Unreadable parts of the tree are left as gaps, so
+			// only lookups that hit them fail.
+			virtual typename btree<1, block_traits>::visitor::error_outcome
+			error_accessing_node(node_location const &l, block_address b,
+					     std::string const &what) {
+				return btree<1, block_traits>::visitor::EXCEPTION_HANDLED;
+			}
+
+		private:
+			ablock_directory &directory_;
+		};
+
+		ablock_directory &get_directory() const {
+			if (!directory_loaded_ || directory_generation_ != tm_.get_generation()) {
+				directory_.clear();
+				directory_loader loader(directory_);
+				block_tree_.visit_depth_first(loader);
+
+				directory_loaded_ = true;
+				directory_generation_ = tm_.get_generation();
+			}
+
+			return directory_;
+		}
+
+		void check_range(unsigned begin, unsigned end) const {
+			if (begin > end || end > nr_entries_) {
+				std::ostringstream str;
+				str << "array range [" << begin << ", " << end
+				    << ") out of bounds";
+				throw runtime_error(str.str());
+			}
+		}
+
 		block_address lookup_block_address(unsigned array_index) const {
-			uint64_t key[1] = {array_index};
-			boost::optional<uint64_t> addr = block_tree_.lookup(key);
-			if (!addr) {
+			ablock_directory const &directory = get_directory();
+			if (array_index >= directory.size() || !directory[array_index]) {
 				std::ostringstream str;
 				str << "lookup of array block " << array_index << " failed";
 				throw runtime_error(str.str());
 			}
 
-			return *addr;
+			return *directory[array_index];
+		}
+
+		void update_block_address(unsigned array_index, block_address location) {
+			uint64_t key[1] = {array_index};
+			ablock_directory &directory = get_directory();
+
+			block_tree_.insert(key, location);
+
+			if (array_index >= directory.size())
+				directory.resize(array_index + 1);
+			directory[array_index] = location;
 		}
 
 		wblock new_ablock(unsigned ablock_index) {
-			uint64_t key[1] = {ablock_index};
 			write_ref b = tm_.new_block(validator_);
 			block_address location = b.get_location();
 
 			wblock wb(b, rc_);
 			wb.setup_empty();
-			block_tree_.insert(key, location);
+			update_block_address(ablock_index, location);
 			return wblock(b, rc_);
 		}
 
@@ -391,16 +605,23 @@ namespace persistent_data {
 		}
 
 		wblock shadow_ablock(unsigned ablock_index) {
-			uint64_t key[1] = {ablock_index};
 			block_address addr = lookup_block_address(ablock_index);
+			wblock wb = shadow_ablock_(addr);
+
+			// Blocks already shadowed in this transaction don't move.
+			if (wb.get_location() != addr)
+				update_block_address(ablock_index, wb.get_location());
+
+			return wb;
+		}
+
+		wblock shadow_ablock_(block_address addr) {
 			std::pair<write_ref, bool> p = tm_.shadow(addr, validator_);
 			wblock wb = wblock(p.first, rc_);
 
 			if (p.second)
 				wb.inc_all_entries();
 
-			block_tree_.insert(key, p.first.get_location());
-
 			return wb;
 		}
 
@@ -416,6 +637,10 @@ namespace persistent_data {
 		btree<1, block_traits> block_tree_;
 		typename ValueTraits::ref_counter rc_;
 		bcache::validator::ptr validator_;
+
+		mutable ablock_directory directory_;
+		mutable bool directory_loaded_;
+		mutable uint64_t directory_generation_;
 	};
 }
 
@@ -21,6 +21,8 @@
 
 #include "base/endian_utils.h"
 
+#include <string.h>
+
 //----------------------------------------------------------------
 
 namespace persistent_data {
@@ -115,6 +117,17 @@ namespace persistent_data {
 			rc_.dec(old_value);
 		}
 
+		// The packed value, in place.  No unpacking or copying,
+		// but no reference counting either; so only for values
+		// that don't hold references.
+		disk_type const &get_disk(unsigned index) const {
+			return element_at(index);
+		}
+
+		void set_disk(unsigned index, disk_type const &value) {
+			::memcpy(&element_at(index), &value, sizeof(disk_type));
+		}
+
 		void inc_all_entries() {
 			unsigned e = nr_entries();
 
@@ -133,6 +146,10 @@ namespace persistent_data {
 			return rc_;
 		}
 
+		block_address get_location() const {
+			return ref_.get_location();
+		}
+
 		static uint32_t calc_max_entries() {
 			return (RefType::BLOCK_SIZE - sizeof(array_block_disk)) /
 				sizeof(typename ValueTraits::disk_type);
@@ -28,6 +28,10 @@ namespace persistent_data {
 	namespace bitset_detail {
 		size_t BITS_PER_ULL = 64;
 
+		// The ranged operations read and write this many words
+		// at a time.
+		unsigned const WORDS_PER_CHUNK = 4096;
+
 		class bitset_impl {
 		public:
 			typedef boost::shared_ptr<bitset_impl> ptr;
@@ -81,13 +85,201 @@ namespace persistent_data {
 			void flush() {
 			}
 
+			void set_range(unsigned begin, unsigned end, bool value) {
+				check_range(begin, end);
+				if (begin == end)
+					return;
+
+				vector<uint64_t> words;
+				unsigned w_end = words_needed(end);
+				for (unsigned w_begin = word(begin); w_begin < w_end; w_begin += WORDS_PER_CHUNK) {
+					unsigned e = min<unsigned>(w_end, w_begin + WORDS_PER_CHUNK);
+
+					array_.get_range(w_begin, e, words);
+					for (unsigned w = w_begin; w < e; w++) {
+						uint64_t m = range_mask(w, begin, end);
+						uint64_t &v = words[w - w_begin];
+						v = value ? (v | m) : (v & ~m);
+					}
+					array_.set_range(w_begin, words);
+				}
+			}
+
+			enum combine_op {
+				OR,
+				AND
+			};
+
+			void combine(bitset_impl const &rhs, combine_op op) {
+				if (rhs.nr_bits_ != nr_bits_) {
+					std::ostringstream str;
+					str << "bitset sizes differ ("
+					    << nr_bits_ << " != " << rhs.nr_bits_ << ")";
+					throw runtime_error(str.str());
+				}
+
+				vector<uint64_t> words, rhs_words;
+				unsigned nr_words = words_needed(nr_bits_);
+				for (unsigned w_begin = 0; w_begin < nr_words; w_begin += WORDS_PER_CHUNK) {
+					unsigned e = min<unsigned>(nr_words, w_begin + WORDS_PER_CHUNK);
+
+					array_.get_range(w_begin, e, words);
+					rhs.array_.get_range(w_begin, e, rhs_words);
+					for (unsigned i = 0; i < words.size(); i++)
+						words[i] = (op == OR) ? (words[i] | rhs_words[i]) : (words[i] & rhs_words[i]);
+					array_.set_range(w_begin, words);
+				}
+			}
+
+			unsigned count() const {
+				unsigned total = 0;
+				vector<uint64_t> words;
+				unsigned nr_words = words_needed(nr_bits_);
+				for (unsigned w_begin = 0; w_begin < nr_words; w_begin += WORDS_PER_CHUNK) {
+					unsigned e = min<unsigned>(nr_words, w_begin + WORDS_PER_CHUNK);
+
+					array_.get_range(w_begin, e, words);
+					for (unsigned w = w_begin; w < e; w++)
+						total += __builtin_popcountll(words[w - w_begin] &
+									      range_mask(w, 0, nr_bits_));
+				}
+
+				return total;
+			}
+
 			void walk_bitset(bitset_visitor &v) const {
 				bit_visitor vv(v, nr_bits_);
 				damage_visitor dv(v);
 				array_.visit_values(vv, dv);
 			}
 
+			void walk_set_runs(bitset_run_visitor &v) const {
+				// an empty array would be reported as damaged
+				if (!nr_bits_)
+					return;
+
+				run_builder rb(v, nr_bits_);
+				run_damage_visitor dv(rb, v);
+				array_.visit_values(rb, dv);
+				rb.flush();
+			}
+
+			void walk_words(bitset_word_visitor &v) const {
+				if (!nr_bits_)
+					return;
+
+				word_visitor wv(v, nr_bits_);
+				word_damage_visitor dv(v);
+				array_.visit_values(wv, dv);
+			}
+
 		private:
+			class word_visitor {
+			public:
+				word_visitor(bitset_word_visitor &v, unsigned nr_bits)
+					: v_(v),
+					  nr_bits_(nr_bits) {
+				}
+
+				void visit(uint32_t word_index, uint64_t word) {
+					uint32_t base = word_index * 64;
+					if (base >= nr_bits_)
+						return;
+
+					if (nr_bits_ - base < 64)
+						word &= (1ull << (nr_bits_ - base)) - 1;
+
+					v_.visit_word(word_index, word);
+				}
+
+			private:
+				bitset_word_visitor &v_;
+				unsigned nr_bits_;
+			};
+
+			class word_damage_visitor {
+			public:
+				word_damage_visitor(bitset_word_visitor &v)
+					: v_(v) {
+				}
+
+				void visit(array_detail::damage const &d) {
+					v_.visit(missing_bits(lifted_run(d.lost_keys_)));
+				}
+
+			private:
+				bitset_word_visitor &v_;
+			};
+
+			class run_builder {
+			public:
+				run_builder(bitset_run_visitor &v, unsigned nr_bits)
+					: v_(v),
+					  nr_bits_(nr_bits) {
+				}
+
+				void visit(uint32_t word_index, uint64_t word) {
+					uint32_t base = word_index * 64;
+					if (base >= nr_bits_)
+						return;
+
+					if (nr_bits_ - base < 64)
+						word &= (1ull << (nr_bits_ - base)) - 1;
+
+					while (word) {
+						unsigned b = __builtin_ctzll(word);
+						uint64_t rest = ~(word >> b);
+						unsigned len = rest ? __builtin_ctzll(rest) : 64 - b;
+
+						add_run(base + b, base + b + len);
+
+						if (b + len >= 64)
+							break;
+						word &= ~0ull << (b + len);
+					}
+				}
+
+				void flush() {
+					if (begin_) {
+						v_.visit_run(*begin_, end_);
+						begin_ = boost::optional<uint32_t>();
+					}
+				}
+
+			private:
+				void add_run(uint32_t b, uint32_t e) {
+					if (begin_ && end_ == b)
+						end_ = e;
+					else {
+						flush();
+						begin_ = b;
+						end_ = e;
+					}
+				}
+
+				bitset_run_visitor &v_;
+				unsigned nr_bits_;
+				boost::optional<uint32_t> begin_;
+				uint32_t end_;
+			};
+
+			class run_damage_visitor {
+			public:
+				run_damage_visitor(run_builder &rb, bitset_run_visitor &v)
+					: rb_(rb),
+					  v_(v) {
+				}
+
+				void visit(array_detail::damage const &d) {
+					rb_.flush();
+					v_.visit(missing_bits(lifted_run(d.lost_keys_)));
+				}
+
+			private:
+				run_builder &rb_;
+				bitset_run_visitor &v_;
+			};
+
 			class bit_visitor {
 			public:
 				bit_visitor(bitset_visitor &v, unsigned nr_bits)
@@ -113,22 +305,26 @@ namespace persistent_data {
 				}
 
 				void visit(array_detail::damage const &d) {
-					run<uint32_t> bits(lifted_mult64(d.lost_keys_.begin_),
-							   lifted_mult64(d.lost_keys_.end_));
-					v_.visit(bits);
+					v_.visit(missing_bits(lifted_run(d.lost_keys_)));
 				}
 
 			private:
-				boost::optional<uint32_t> lifted_mult64(boost::optional<uint32_t> const &m) {
-					if (!m)
-						return m;
-
-					return boost::optional<uint32_t>(*m * 64);
-				}
-
 				bitset_visitor &v_;
 			};
 
+			// Converts a run of lost words to a run of lost bits.
+			static boost::optional<uint32_t> lifted_mult64(boost::optional<uint32_t> const &m) {
+				if (!m)
+					return m;
+
+				return boost::optional<uint32_t>(*m * 64);
+			}
+
+			static run<uint32_t> lifted_run(run<uint32_t> const &words) {
+				return run<uint32_t>(lifted_mult64(words.begin_),
+						     lifted_mult64(words.end_));
+			}
+
 			void pad_last_block(bool default_value) {
 				// Set defaults in the final word
 				if (bit(nr_bits_)) {
@@ -184,6 +380,19 @@ namespace persistent_data {
 				return bit % 64;
 			}
 
+			// The bits of word w that fall within [begin, end).
+			uint64_t range_mask(unsigned w, unsigned begin, unsigned end) const {
+				unsigned lo = max<unsigned>(begin, w * 64) - w * 64;
+				unsigned hi = min<unsigned>(end, (w + 1) * 64);
+
+				if (hi <= w * 64 + lo)
+					return 0;
+
+				hi -= w * 64;
+				uint64_t m = (hi == 64) ? ~0ull : ((1ull << hi) - 1);
+				return m & ~((1ull << lo) - 1);
+			}
+
 			// The last word may be only partially full, so we have to
 			// do our own bounds checking rather than relying on array
 			// to do it.
@@ -196,6 +405,15 @@ namespace persistent_data {
 				}
 			}
 
+			void check_range(unsigned begin, unsigned end) const {
+				if (begin > end || end > nr_bits_) {
+					std::ostringstream str;
+					str << "bitset range out of bounds ([" << begin
+					    << ", " << end << ") with " << nr_bits_ << " bits)";
+					throw runtime_error(str.str());
+				}
+			}
+
 			unsigned nr_bits_;
 			no_op_ref_counter<uint64_t> rc_;
 			array<bitset_traits> array_;
@@ -257,11 +475,53 @@ persistent_data::bitset::flush()
 	impl_->flush();
 }
 
+void
+persistent_data::bitset::set_range(unsigned begin, unsigned end)
+{
+	impl_->set_range(begin, end, true);
+}
+
+void
+persistent_data::bitset::clear_range(unsigned begin, unsigned end)
+{
+	impl_->set_range(begin, end, false);
+}
+
+void
+persistent_data::bitset::or_with(bitset const &rhs)
+{
+	impl_->combine(*rhs.impl_, bitset_impl::OR);
+}
+
+void
+persistent_data::bitset::and_with(bitset const &rhs)
+{
+	impl_->combine(*rhs.impl_, bitset_impl::AND);
+}
+
+unsigned
+persistent_data::bitset::count() const
+{
+	return impl_->count();
+}
+
 void
 persistent_data::bitset::walk_bitset(bitset_visitor &v) const
 {
 	impl_->walk_bitset(v);
 }
 
+void
+persistent_data::bitset::walk_set_runs(bitset_run_visitor &v) const
+{
+	impl_->walk_set_runs(v);
+}
+
+void
+persistent_data::bitset::walk_words(bitset_word_visitor &v) const
+{
+	impl_->walk_words(v);
+}
+
 //----------------------------------------------------------------
 
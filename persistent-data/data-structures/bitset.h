@@ -44,6 +44,27 @@ namespace persistent_data {
 			virtual void visit(uint32_t index, bool value) = 0;
 			virtual void visit(missing_bits const &d) = 0;
 		};
+
+		// Reports maximal runs of set bits, in order.
+		class bitset_run_visitor {
+		public:
+			typedef boost::shared_ptr<bitset_run_visitor> ptr;
+
+			virtual ~bitset_run_visitor() {}
+			virtual void visit_run(uint32_t begin, uint32_t end) = 0;
+			virtual void visit(missing_bits const &d) = 0;
+		};
+
+		// Sees the bitset a 64 bit word at a time.  Bits past
+		// the end of the bitset are always zero.
+		class bitset_word_visitor {
+		public:
+			typedef boost::shared_ptr<bitset_word_visitor> ptr;
+
+			virtual ~bitset_word_visitor() {}
+			virtual void visit_word(uint32_t word_index, uint64_t word) = 0;
+			virtual void visit(missing_bits const &d) = 0;
+		};
 	}
 
 	class bitset {
@@ -63,7 +84,20 @@ namespace persistent_data {
 		void set(unsigned n, bool value);
 		void flush();
 
+		// These work a word at a time on the bits [begin, end).
+		void set_range(unsigned begin, unsigned end);
+		void clear_range(unsigned begin, unsigned end);
+
+		// The other bitset must be the same size.
+		void or_with(bitset const &rhs);
+		void and_with(bitset const &rhs);
+
+		// Number of bits set.
+		unsigned count() const;
+
 		void walk_bitset(bitset_detail::bitset_visitor &v) const;
+		void walk_set_runs(bitset_detail::bitset_run_visitor &v) const;
+		void walk_words(bitset_detail::bitset_word_visitor &v) const;
 
 	private:
 		boost::shared_ptr<bitset_detail::bitset_impl> impl_;
@@ -1,5 +1,6 @@
 #include "persistent-data/data-structures/bloom_filter.h"
 
+#include <algorithm>
 #include <stdexcept>
 
 using namespace persistent_data;
@@ -30,6 +31,33 @@ namespace {
 		if (nr_bits & (nr_bits - 1))
 			throw std::runtime_error("bloom filter needs a power of two nr_bits");
 	}
+
+	void check_nr_probes(unsigned nr_probes, unsigned max) {
+		if (!nr_probes || nr_probes > max)
+			throw std::runtime_error("bloom filter has too many probes");
+	}
+
+	unsigned blocked_nr_lines(unsigned nr_bits) {
+		check_power_of_two(nr_bits);
+		if (nr_bits < blocked_bloom_filter::BITS_PER_LINE)
+			throw std::runtime_error("blocked bloom filter needs at least one line of bits");
+
+		return nr_bits / blocked_bloom_filter::BITS_PER_LINE;
+	}
+
+	unsigned blocked_words_per_ablock() {
+		return array_block<uint64_traits, block_manager<>::read_ref>::calc_max_entries();
+	}
+
+	unsigned blocked_nr_words(unsigned nr_bits) {
+		unsigned nr_lines = blocked_nr_lines(nr_bits);
+		unsigned words_per_ablock = blocked_words_per_ablock();
+		unsigned lines_per_ablock = words_per_ablock / blocked_bloom_filter::WORDS_PER_LINE;
+		unsigned last = nr_lines - 1;
+
+		return (last / lines_per_ablock) * words_per_ablock +
+			(last % lines_per_ablock + 1) * blocked_bloom_filter::WORDS_PER_LINE;
+	}
 }
 
 //----------------------------------------------------------------
@@ -42,6 +70,7 @@ bloom_filter::bloom_filter(transaction_manager &tm,
 	  mask_(nr_bits - 1)
 {
 	check_power_of_two(nr_bits);
+	check_nr_probes(nr_probes, MAX_PROBES);
 	bits_.grow(nr_bits, false);
 }
 
@@ -53,6 +82,7 @@ bloom_filter::bloom_filter(transaction_manager &tm, block_address root,
 	  mask_(nr_bits - 1)
 {
 	check_power_of_two(nr_bits);
+	check_nr_probes(nr_probes, MAX_PROBES);
 }
 
 block_address
@@ -64,7 +94,7 @@ bloom_filter::get_root() const
 bool
 bloom_filter::test(uint64_t b)
 {
-	vector<unsigned> probes(nr_probes_);
+	unsigned probes[MAX_PROBES];
 	fill_probes(b, probes);
 
 	for (unsigned p = 0; p < nr_probes_; p++)
@@ -77,7 +107,7 @@ bloom_filter::test(uint64_t b)
 void
 bloom_filter::set(uint64_t b)
 {
-	vector<unsigned> probes(nr_probes_);
+	unsigned probes[MAX_PROBES];
 	fill_probes(b, probes);
 
 	for (unsigned p = 0; p < nr_probes_; p++)
@@ -91,7 +121,7 @@ bloom_filter::flush()
 }
 
 void
-bloom_filter::fill_probes(block_address b, vector<unsigned> &probes) const
+bloom_filter::fill_probes(block_address b, unsigned *probes) const
 {
 	uint32_t h1 = hash1(b) & mask_;
 	uint32_t h2 = hash2(b) & mask_;
@@ -144,3 +174,132 @@ bloom_filter::print_residency(ostream &out)
 }
 
 //----------------------------------------------------------------
+
+blocked_bloom_filter::blocked_bloom_filter(transaction_manager &tm,
+					   unsigned nr_bits, unsigned nr_probes)
+	: nr_lines_(blocked_nr_lines(nr_bits)),
+	  nr_probes_(nr_probes),
+	  lines_per_ablock_(blocked_words_per_ablock() / WORDS_PER_LINE),
+	  words_per_ablock_(blocked_words_per_ablock()),
+	  words_(tm, rc_)
+{
+	check_nr_probes(nr_probes, MAX_PROBES);
+	words_.grow(blocked_nr_words(nr_bits), 0);
+}
+
+blocked_bloom_filter::blocked_bloom_filter(transaction_manager &tm, block_address root,
+					   unsigned nr_bits, unsigned nr_probes)
+	: nr_lines_(blocked_nr_lines(nr_bits)),
+	  nr_probes_(nr_probes),
+	  lines_per_ablock_(blocked_words_per_ablock() / WORDS_PER_LINE),
+	  words_per_ablock_(blocked_words_per_ablock()),
+	  words_(tm, rc_, root, blocked_nr_words(nr_bits))
+{
+	check_nr_probes(nr_probes, MAX_PROBES);
+}
+
+block_address
+blocked_bloom_filter::get_root() const
+{
+	return words_.get_root();
+}
+
+bool
+blocked_bloom_filter::test(uint64_t b)
+{
+	uint64_t mask[WORDS_PER_LINE];
+	fill_line_mask(b, mask);
+	read_line(line_index(b));
+
+	return line_matches(mask);
+}
+
+void
+blocked_bloom_filter::set(uint64_t b)
+{
+	uint64_t mask[WORDS_PER_LINE];
+	fill_line_mask(b, mask);
+
+	unsigned line = line_index(b);
+	read_line(line);
+	for (unsigned w = 0; w < WORDS_PER_LINE; w++)
+		line_[w] |= mask[w];
+
+	words_.set_range(line_word(line), line_);
+}
+
+void
+blocked_bloom_filter::test_many(vector<uint64_t> const &keys, vector<bool> &results)
+{
+	vector<pair<unsigned, unsigned> > order;
+	order.reserve(keys.size());
+	for (unsigned i = 0; i < keys.size(); i++)
+		order.push_back(make_pair(line_index(keys[i]), i));
+	sort(order.begin(), order.end());
+
+	results.assign(keys.size(), false);
+
+	uint64_t mask[WORDS_PER_LINE];
+	for (unsigned i = 0; i < order.size(); i++) {
+		if (!i || order[i].first != order[i - 1].first)
+			read_line(order[i].first);
+
+		fill_line_mask(keys[order[i].second], mask);
+		results[order[i].second] = line_matches(mask);
+	}
+}
+
+void
+blocked_bloom_filter::flush()
+{
+}
+
+unsigned
+blocked_bloom_filter::line_index(uint64_t b) const
+{
+	return hash1(b) & (nr_lines_ - 1);
+}
+
+unsigned
+blocked_bloom_filter::line_word(unsigned line) const
+{
+	return (line / lines_per_ablock_) * words_per_ablock_ +
+		(line % lines_per_ablock_) * WORDS_PER_LINE;
+}
+
+// The probes within a line are generated by double hashing.  The step
+// is odd, so no two probes for a key land on the same bit.
+void
+blocked_bloom_filter::fill_line_mask(uint64_t b, uint64_t *mask) const
+{
+	uint32_t h = hash2(b);
+	unsigned bit = h % BITS_PER_LINE;
+	unsigned step = (h / BITS_PER_LINE) | 1;
+
+	for (unsigned w = 0; w < WORDS_PER_LINE; w++)
+		mask[w] = 0;
+
+	for (unsigned p = 0; p < nr_probes_; p++) {
+		mask[bit / 64] |= 1ull << (bit % 64);
+		bit = (bit + step) % BITS_PER_LINE;
+	}
+}
+
+void
+blocked_bloom_filter::read_line(unsigned line)
+{
+	unsigned w = line_word(line);
+	words_.get_range(w, w + WORDS_PER_LINE, line_);
+}
+
+bool
+blocked_bloom_filter::line_matches(uint64_t const *mask) const
+{
+	for (unsigned w = 0; w < WORDS_PER_LINE; w++)
+		if ((line_[w] & mask[w]) != mask[w])
+			return false;
+
+	return true;
+}
+
+//----------------------------------------------------------------
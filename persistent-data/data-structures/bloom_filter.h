@@ -2,7 +2,9 @@
 #define PERSISTENT_DATA_DATA_STRUCTURES_BLOOM_FILTER_H
 
 #include "persistent-data/transaction_manager.h"
+#include "persistent-data/data-structures/array.h"
 #include "persistent-data/data-structures/bitset.h"
+#include "persistent-data/data-structures/simple_traits.h"
 
 #include <boost/shared_ptr.hpp>
 
@@ -13,6 +15,8 @@ namespace persistent_data {
 	public:
 		typedef boost::shared_ptr<bloom_filter> ptr;
 
+		static unsigned const MAX_PROBES = 32;
+
 		// nr_bits must be a power of two
 		bloom_filter(transaction_manager &tm,
 			     unsigned nr_bits, unsigned nr_probes);
@@ -31,13 +35,61 @@ namespace persistent_data {
 	private:
 		void print_residency(ostream &out);
 
-		void fill_probes(block_address b, vector<unsigned> &probes) const;
+		void fill_probes(block_address b, unsigned *probes) const;
 
 		transaction_manager &tm_;
 		persistent_data::bitset bits_;
 		unsigned nr_probes_;
 		uint64_t mask_;
 	};
+
+	// A different on disk layout, where all the probes for a key
+	// fall within a single 64 byte line.  Lines never straddle an
+	// array block, so a test or set touches just one metadata block.
+	// The price is a slightly higher false positive rate for a given
+	// number of bits.
+	class blocked_bloom_filter {
+	public:
+		typedef boost::shared_ptr<blocked_bloom_filter> ptr;
+
+		static unsigned const WORDS_PER_LINE = 8;
+		static unsigned const BITS_PER_LINE = WORDS_PER_LINE * 64;
+		static unsigned const MAX_PROBES = 32;
+
+		// nr_bits must be a power of two, and at least one line
+		blocked_bloom_filter(transaction_manager &tm,
+				     unsigned nr_bits, unsigned nr_probes);
+
+		blocked_bloom_filter(transaction_manager &tm, block_address root,
+				     unsigned nr_bits, unsigned nr_probes);
+
+		block_address get_root() const;
+
+		bool test(uint64_t b);
+		void set(uint64_t b);
+
+		// results[i] is set to test(keys[i]).  The keys are
+		// visited in line order, so each line is read once.
+		void test_many(vector<uint64_t> const &keys, vector<bool> &results);
+
+		void flush();
+
+	private:
+		unsigned line_index(uint64_t b) const;
+		unsigned line_word(unsigned line) const;
+		void fill_line_mask(uint64_t b, uint64_t *mask) const;
+		void read_line(unsigned line);
+		bool line_matches(uint64_t const *mask) const;
+
+		unsigned nr_lines_;
+		unsigned nr_probes_;
+		unsigned lines_per_ablock_;
+		unsigned words_per_ablock_;
+
+		no_op_ref_counter<uint64_t> rc_;
+		persistent_data::array<uint64_traits> words_;
+		vector<uint64_t> line_;
+	};
 }
 
 //----------------------------------------------------------------
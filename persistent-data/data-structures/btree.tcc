@@ -18,6 +18,8 @@
 
 #include "btree.h"
 
+#include "base/metrics.h"
+#include "base/progress_monitor.h"
 #include "persistent-data/errors.h"
 #include "persistent-data/checksum.h"
 #include "persistent-data/transaction_manager.h"
@@ -820,6 +822,13 @@ namespace persistent_data {
 		read_ref blk = tm_.read_lock(b, validator_);
 		internal_node o = to_node<block_traits>(blk);
 
+		if (base::metrics_enabled()) {
+			static base::counter &nodes = base::get_metrics().get_counter("btree.nodes_visited");
+			nodes.inc();
+		}
+
+		base::walk_progress_node();
+
 		// FIXME: use a switch statement
 		if (o.get_type() == INTERNAL) {
 			if (v.visit_internal(loc, o)) {
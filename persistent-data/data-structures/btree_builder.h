@@ -0,0 +1,458 @@
+// Copyright (C) 2011 Red Hat, Inc. All rights reserved.
+//
+// This file is part of the thin-provisioning-tools source.
+//
+// thin-provisioning-tools is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// thin-provisioning-tools is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with thin-provisioning-tools.  If not, see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef PERSISTENT_DATA_DATA_STRUCTURES_BTREE_BUILDER_H
+#define PERSISTENT_DATA_DATA_STRUCTURES_BTREE_BUILDER_H
+
+#include "persistent-data/data-structures/btree.h"
+
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace persistent_data {
+	namespace btree_builder_detail {
+		// Builders only look at the entries of the nodes they
+		// read, so they share a validator.  The block cache checks
+		// a block again whenever it's locked with a different one,
+		// which otherwise happens every time a builder reads a
+		// subtree written by another.
+		inline bcache::validator::ptr shared_validator() {
+			static bcache::validator::ptr v(create_btree_node_validator());
+			return v;
+		}
+	}
+
+	// Builds a single level btree bottom up, from entries supplied in
+	// ascending key order.  Nodes are written as they fill, so only a
+	// couple of nodes per level are ever held in memory.
+	//
+	// Existing subtrees may be spliced in with push_subtree(); the
+	// subtree's root gains a reference rather than being copied, which
+	// is how sharing between trees is recreated.  A subtree sits at
+	// its own height, so every leaf stays at the same depth.
+	//
+	// Every node apart from the root is kept at least a third full.
+	// If a run of entries between two subtrees is too short for that,
+	// the neighbouring subtree's root is broken up into its children
+	// (which stay shared).
+	//
+	// The builder never takes references on values pushed with
+	// push_value(); that's up to the caller.  Values it copies out of
+	// a shared leaf are incremented with the ref counter.
+	template <typename ValueTraits>
+	class btree_builder : private boost::noncopyable {
+	public:
+		typedef typename ValueTraits::value_type value_type;
+		typedef typename ValueTraits::ref_counter ref_counter;
+
+		btree_builder(transaction_manager &tm, ref_counter rc)
+			: tm_(tm),
+			  rc_(rc),
+			  validator_(btree_builder_detail::shared_validator()),
+			  leaf_max_(max_entries<ValueTraits>()),
+			  internal_max_(max_entries<block_traits>()) {
+		}
+
+		void push_value(uint64_t key, value_type const &v) {
+			expand_held_root();
+			check_order(key);
+			last_key_ = key;
+
+			leaves_.push_back(std::make_pair(key, v));
+			if (leaves_.size() >= leaf_max_ + leaf_max_ / 3)
+				write_front(0, leaf_max_);
+		}
+
+		// Adds a reference to an existing subtree, which must be a
+		// single level btree.  Empty subtrees are ignored.
+		void push_subtree(block_address root) {
+			subtree_info info = examine(root);
+			if (!info.nr_entries_)
+				return;
+
+			expand_held_root();
+			check_order(info.first_key_);
+
+			// A root may be underfull, but it only stays a root
+			// if nothing else is pushed.
+			if (info.nr_entries_ < min_entries(info.height_)) {
+				if (!last_key_) {
+					held_root_ = root;
+					last_key_ = info.last_key_;
+				} else
+					expand_into_pushes(root);
+				return;
+			}
+
+			if (!flush_below(info.height_ + 1)) {
+				// Splicing the subtree in here would leave an
+				// underfull node, so take its children instead.
+				expand_into_pushes(root);
+				return;
+			}
+
+			tm_.get_sm()->inc(root);
+			push_internal(info.height_ + 1, info.first_key_, root);
+			last_key_ = info.last_key_;
+		}
+
+		// The highest key pushed so far, including those in
+		// subtrees.
+		boost::optional<uint64_t> get_last_key() const {
+			return last_key_;
+		}
+
+		// Completes the tree.  The builder shouldn't be used
+		// afterwards.
+		block_address get_root() {
+			if (held_root_) {
+				tm_.get_sm()->inc(*held_root_);
+				return *held_root_;
+			}
+
+			for (unsigned level = 0;; level++) {
+				if (level >= nr_levels())
+					return empty_leaf();
+
+				unsigned size = pending_size(level);
+				if (!size)
+					continue;
+
+				if (level == highest_level()) {
+					if (level && size == 1) {
+						block_address root = internal_[level - 1].front().second;
+						internal_[level - 1].clear();
+						return root;
+					}
+
+					if (size <= max_entries(level)) {
+						write_all(level);
+						block_address root = internal_[level].front().second;
+						internal_[level].clear();
+						return root;
+					}
+
+				} else
+					while (pending_size(level) < min_entries(level))
+						borrow(level);
+
+				write_all(level);
+			}
+		}
+
+		// Drops a reference to a subtree, freeing any nodes (and
+		// dropping value references) that are no longer used.
+		void release_subtree(block_address root) {
+			using namespace btree_detail;
+
+			space_map::ptr sm = tm_.get_sm();
+			if (sm->get_count(root) == 1) {
+				read_ref rr = tm_.read_lock(root, validator_);
+				node_ref<block_traits> n = to_node<block_traits>(rr);
+
+				if (n.get_type() == INTERNAL) {
+					for (unsigned i = 0; i < n.get_nr_entries(); i++)
+						release_subtree(n.value_at(i));
+				} else {
+					node_ref<ValueTraits> leaf = to_node<ValueTraits>(rr);
+					for (unsigned i = 0; i < leaf.get_nr_entries(); i++)
+						rc_.dec(leaf.value_at(i));
+				}
+			}
+
+			sm->dec(root);
+		}
+
+	private:
+		typedef transaction_manager::read_ref read_ref;
+		typedef transaction_manager::write_ref write_ref;
+
+		typedef std::deque<std::pair<uint64_t, value_type> > leaf_entries;
+		typedef std::deque<std::pair<uint64_t, block_address> > internal_entries;
+
+		struct subtree_info {
+			unsigned height_;
+			unsigned nr_entries_;
+			uint64_t first_key_;
+			uint64_t last_key_;
+		};
+
+		template <typename Traits>
+		static unsigned max_entries() {
+			size_t elt_size = sizeof(uint64_t) + sizeof(typename Traits::disk_type);
+			unsigned total = (MD_BLOCK_SIZE - sizeof(btree_detail::node_header)) / elt_size;
+			return (total / 3) * 3;
+		}
+
+		unsigned max_entries(unsigned level) const {
+			return level ? internal_max_ : leaf_max_;
+		}
+
+		unsigned min_entries(unsigned level) const {
+			return max_entries(level) / 3;
+		}
+
+		// Level 0 holds values, level n holds pointers to nodes of
+		// height n - 1.
+		unsigned nr_levels() const {
+			return internal_.size() + 1;
+		}
+
+		unsigned pending_size(unsigned level) const {
+			return level ? internal_[level - 1].size() : leaves_.size();
+		}
+
+		unsigned highest_level() const {
+			for (unsigned level = nr_levels(); level > 0; level--)
+				if (pending_size(level - 1))
+					return level - 1;
+
+			return 0;
+		}
+
+		void check_order(uint64_t key) const {
+			if (last_key_ && key <= *last_key_)
+				throw std::runtime_error("btree_builder: keys must be pushed in ascending order");
+		}
+
+		subtree_info examine(block_address root) {
+			using namespace btree_detail;
+
+			subtree_info info;
+			info.height_ = 0;
+
+			block_address left = root, right = root;
+			for (;;) {
+				read_ref lr = tm_.read_lock(left, validator_);
+				node_ref<block_traits> ln = to_node<block_traits>(lr);
+				read_ref rr = tm_.read_lock(right, validator_);
+				node_ref<block_traits> rn = to_node<block_traits>(rr);
+
+				if (left == root)
+					info.nr_entries_ = ln.get_nr_entries();
+
+				if (!ln.get_nr_entries() || !rn.get_nr_entries()) {
+					if (left != root)
+						throw std::runtime_error("btree_builder: empty node in subtree");
+					return info;
+				}
+
+				if (ln.get_type() != INTERNAL) {
+					info.first_key_ = ln.key_at(0);
+					info.last_key_ = rn.key_at(rn.get_nr_entries() - 1);
+					return info;
+				}
+
+				left = ln.value_at(0);
+				right = rn.value_at(rn.get_nr_entries() - 1);
+				info.height_++;
+			}
+		}
+
+		void push_internal(unsigned level, uint64_t key, block_address b) {
+			while (nr_levels() <= level)
+				internal_.push_back(internal_entries());
+
+			internal_entries &entries = internal_[level - 1];
+			entries.push_back(std::make_pair(key, b));
+			if (entries.size() >= internal_max_ + internal_max_ / 3)
+				write_front(level, internal_max_);
+		}
+
+		// Writes a node from the front of a level, and adds it to
+		// the level above.
+		void write_front(unsigned level, unsigned count) {
+			uint64_t key;
+			block_address b;
+
+			if (level) {
+				internal_entries &entries = internal_[level - 1];
+				key = entries.front().first;
+				b = write_node<block_traits>(entries, count, btree_detail::INTERNAL);
+			} else {
+				key = leaves_.front().first;
+				b = write_node<ValueTraits>(leaves_, count, btree_detail::LEAF);
+			}
+
+			push_internal(level + 1, key, b);
+		}
+
+		template <typename Traits, typename Entries>
+		block_address write_node(Entries &entries, unsigned count,
+					 btree_detail::node_type type) {
+			using namespace btree_detail;
+
+			write_ref w = tm_.new_block(validator_);
+			node_ref<Traits> n = to_node<Traits>(w);
+			n.set_type(type);
+			n.set_max_entries();
+			n.set_value_size(sizeof(typename Traits::disk_type));
+			n.set_nr_entries(count);
+
+			for (unsigned i = 0; i < count; i++)
+				n.overwrite_at(i, entries[i].first, entries[i].second);
+
+			entries.erase(entries.begin(), entries.begin() + count);
+			return w.get_location();
+		}
+
+		// Writes everything pending at a level, spread evenly
+		// over as few nodes as possible.
+		void write_all(unsigned level) {
+			unsigned size = pending_size(level);
+			unsigned max = max_entries(level);
+			unsigned nr_nodes = (size + max - 1) / max;
+
+			for (unsigned i = 0; i < nr_nodes; i++) {
+				unsigned count = pending_size(level) / (nr_nodes - i);
+				write_front(level, count);
+			}
+		}
+
+		// Turns the entries pending beneath a level into nodes.
+		// Fails if that would leave an underfull node.
+		bool flush_below(unsigned top) {
+			for (unsigned level = 0; level < top && level < nr_levels(); level++) {
+				if (!pending_size(level))
+					continue;
+
+				while (pending_size(level) < min_entries(level))
+					if (!borrow(level))
+						return false;
+
+				write_all(level);
+			}
+
+			return true;
+		}
+
+		// Tops up a short level by replacing the closest preceding
+		// entry with its children.  Repeated calls work down
+		// the right edge of that subtree until the level itself
+		// gains entries.
+		bool borrow(unsigned level) {
+			unsigned l = level + 1;
+			while (l < nr_levels() && !pending_size(l))
+				l++;
+
+			if (l >= nr_levels())
+				return false;
+
+			internal_entries &parent = internal_[l - 1];
+			block_address b = parent.back().second;
+			parent.pop_back();
+
+			if (l - 1) {
+				space_map::ptr sm = tm_.get_sm();
+				expand<block_traits>(b, internal_[l - 2], sm);
+			} else
+				expand<ValueTraits>(b, leaves_, rc_);
+
+			return true;
+		}
+
+		// Replaces our reference to a node with references to its
+		// children, which are put in front of any entries already
+		// pending at their level.
+		template <typename Traits, typename Entries, typename RC>
+		void expand(block_address b, Entries &entries, RC &rc) {
+			using namespace btree_detail;
+
+			space_map::ptr sm = tm_.get_sm();
+			bool shared = sm->get_count(b) > 1;
+
+			{
+				read_ref rr = tm_.read_lock(b, validator_);
+				node_ref<Traits> n = to_node<Traits>(rr);
+
+				for (unsigned i = n.get_nr_entries(); i > 0; i--) {
+					typename Traits::value_type v = n.value_at(i - 1);
+					if (shared)
+						inc(rc, v);
+					entries.push_front(std::make_pair(n.key_at(i - 1), v));
+				}
+			}
+
+			sm->dec(b);
+		}
+
+		// An underfull subtree root that was pushed first is
+		// only kept as it is if it turns out to be the whole tree.
+		void expand_held_root() {
+			if (!held_root_)
+				return;
+
+			block_address root = *held_root_;
+			held_root_ = boost::optional<block_address>();
+			last_key_ = boost::optional<uint64_t>();
+			expand_into_pushes(root);
+		}
+
+		// Used when a subtree can't be spliced in whole.  We never
+		// took a reference to the subtree itself.
+		void expand_into_pushes(block_address root) {
+			using namespace btree_detail;
+
+			read_ref rr = tm_.read_lock(root, validator_);
+			node_ref<block_traits> n = to_node<block_traits>(rr);
+
+			if (n.get_type() == INTERNAL) {
+				for (unsigned i = 0; i < n.get_nr_entries(); i++)
+					push_subtree(n.value_at(i));
+			} else {
+				node_ref<ValueTraits> leaf = to_node<ValueTraits>(rr);
+				for (unsigned i = 0; i < leaf.get_nr_entries(); i++) {
+					value_type v = leaf.value_at(i);
+					rc_.inc(v);
+					push_value(leaf.key_at(i), v);
+				}
+			}
+		}
+
+		block_address empty_leaf() {
+			leaf_entries none;
+			return write_node<ValueTraits>(none, 0, btree_detail::LEAF);
+		}
+
+		static void inc(space_map::ptr sm, block_address b) {
+			sm->inc(b);
+		}
+
+		static void inc(ref_counter &rc, value_type const &v) {
+			rc.inc(v);
+		}
+
+		transaction_manager &tm_;
+		ref_counter rc_;
+		bcache::validator::ptr validator_;
+		unsigned leaf_max_;
+		unsigned internal_max_;
+
+		leaf_entries leaves_;
+		std::vector<internal_entries> internal_;
+		boost::optional<uint64_t> last_key_;
+		boost::optional<block_address> held_root_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
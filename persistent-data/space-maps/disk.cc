@@ -17,6 +17,7 @@
 // <http://www.gnu.org/licenses/>.
 
 #include "base/endian_utils.h"
+#include "base/metrics.h"
 
 #include "persistent-data/space-maps/disk.h"
 #include "persistent-data/space-maps/disk_structures.h"
@@ -87,11 +88,6 @@ namespace {
 		}
 	};
 
-	bcache::validator::ptr
-	index_validator() {
-		return bcache::validator::ptr(new index_block_validator());
-	}
-
 	//--------------------------------
 
 	class bitmap {
@@ -146,6 +142,49 @@ namespace {
 			}
 		}
 
+		// Increments the counts of [begin, end) under a single
+		// shadow.  Counts that need the ref count tree are left
+		// at 3, and returned in |overflows| with their old values.
+		// Returns the number of blocks that were free.
+		unsigned inc(unsigned begin, unsigned end,
+			     vector<pair<unsigned, ref_t> > &overflows) {
+			write_ref wr = tm_.shadow(ie_.blocknr_, validator_).first;
+			void *bits = bitmap_data(wr);
+			unsigned nr_allocated = 0;
+
+			for (unsigned b = begin; b < end; b++) {
+				ref_t old = test_bit_le(bits, b * 2 + 1) ? 1 : 0;
+				old |= test_bit_le(bits, b * 2) ? 2 : 0;
+
+				switch (old) {
+				case 0:
+					set_bit_le(bits, b * 2 + 1);
+					nr_allocated++;
+					ie_.nr_free_--;
+					if (b == ie_.none_free_before_)
+						ie_.none_free_before_++;
+					break;
+
+				case 1:
+					clear_bit_le(bits, b * 2 + 1);
+					set_bit_le(bits, b * 2);
+					break;
+
+				case 2:
+					set_bit_le(bits, b * 2 + 1);
+					overflows.push_back(make_pair(b, old));
+					break;
+
+				default:
+					overflows.push_back(make_pair(b, old));
+					break;
+				}
+			}
+
+			ie_.blocknr_ = wr.get_location();
+			return nr_allocated;
+		}
+
 		boost::optional<unsigned> find_free(unsigned begin, unsigned end) {
 			for (unsigned i = max(begin, ie_.none_free_before_); i < end; i++)
 				if (lookup(i) == 0)
@@ -249,7 +288,11 @@ namespace {
 			  indexes_(indexes),
 			  nr_blocks_(0),
 			  nr_allocated_(0),
-			  ref_counts_(tm_, ref_count_traits::ref_counter()) {
+			  ref_counts_(tm_, ref_count_traits::ref_counter()),
+			  nr_bitmap_lookups_(0),
+			  nr_ref_count_lookups_(0),
+			  nr_count_changes_(0),
+			  nr_find_frees_(0) {
 		}
 
 		sm_disk(index_store::ptr indexes,
@@ -260,7 +303,16 @@ namespace {
 			  indexes_(indexes),
 			  nr_blocks_(root.nr_blocks_),
 			  nr_allocated_(root.nr_allocated_),
-			  ref_counts_(tm_, root.ref_count_root_, ref_count_traits::ref_counter()) {
+			  ref_counts_(tm_, root.ref_count_root_, ref_count_traits::ref_counter()),
+			  nr_bitmap_lookups_(0),
+			  nr_ref_count_lookups_(0),
+			  nr_count_changes_(0),
+			  nr_find_frees_(0) {
+		}
+
+		~sm_disk() {
+			if (base::metrics_enabled())
+				publish_metrics();
 		}
 
 		block_address get_nr_blocks() const {
@@ -285,6 +337,8 @@ namespace {
 			if (c == old)
 				return;
 
+			nr_count_changes_++;
+
 			if (c > 2) {
 				if (old < 3)
 					insert_bitmap(b, 3);
@@ -316,9 +370,42 @@ namespace {
 			set_count(b, old - 1);
 		}
 
+		// Updates a bitmap at a time, rather than looking the
+		// bitmap up again for every block.
+		void inc_range(block_address begin, block_address end) {
+			if (begin >= end)
+				return;
+
+			check_block(end - 1);
+
+			vector<pair<unsigned, ref_t> > overflows;
+			while (begin < end) {
+				block_address index = begin / ENTRIES_PER_BLOCK;
+				block_address base = index * ENTRIES_PER_BLOCK;
+				block_address e = min<block_address>(end, base + ENTRIES_PER_BLOCK);
+
+				index_entry ie = indexes_->find_ie(index);
+				bitmap bm(tm_, ie, bitmap_validator_);
+				nr_allocated_ += bm.inc(begin - base, e - base, overflows);
+				indexes_->save_ie(index, bm.get_ie());
+				nr_count_changes_ += e - begin;
+
+				vector<pair<unsigned, ref_t> >::const_iterator it;
+				for (it = overflows.begin(); it != overflows.end(); ++it) {
+					block_address b = base + it->first;
+					insert_ref_count(b, it->second < 3 ? 3 : lookup_ref_count(b) + 1);
+				}
+				overflows.clear();
+
+				begin = e;
+			}
+		}
+
 		// FIXME: keep track of the lowest free block so we
 		// can start searching from a suitable place.
 		maybe_block find_free(span_iterator &it) {
+			nr_find_frees_++;
+
 			for (maybe_span ms = it.first(); ms; ms = it.next()) {
 				block_address begin = ms->first;
 				block_address end = ms->second;
@@ -401,7 +488,8 @@ namespace {
 			unsigned nr_indexes = div_up<block_address>(nr_blocks_, ENTRIES_PER_BLOCK);
 
 			for (unsigned i = 0; i < nr_indexes; i++) {
-				unsigned hi = (i == nr_indexes - 1) ? (nr_blocks_ % ENTRIES_PER_BLOCK) : ENTRIES_PER_BLOCK;
+				unsigned hi = (i == nr_indexes - 1) ?
+					(nr_blocks_ - i * ENTRIES_PER_BLOCK) : ENTRIES_PER_BLOCK;
 				index_entry ie = indexes_->find_ie(i);
 				bitmap bm(tm_, ie, bitmap_validator_);
 				bm.iterate(i * ENTRIES_PER_BLOCK, hi, wrapper);
@@ -474,6 +562,7 @@ namespace {
 
 		ref_t lookup_bitmap(block_address b) const {
 			check_block(b);
+			nr_bitmap_lookups_++;
 
 			index_entry ie = indexes_->find_ie(b / ENTRIES_PER_BLOCK);
 			bitmap bm(tm_, ie, bitmap_validator_);
@@ -493,6 +582,8 @@ namespace {
 		}
 
 		ref_t lookup_ref_count(block_address b) const {
+			nr_ref_count_lookups_++;
+
 			uint64_t key[1] = {b};
 			boost::optional<ref_t> mvalue = ref_counts_.lookup(key);
 			if (!mvalue)
@@ -510,6 +601,15 @@ namespace {
 			ref_counts_.remove(key);
 		}
 
+		void publish_metrics() const {
+			base::metrics_registry &m = base::get_metrics();
+
+			m.get_counter("space_map.bitmap_lookups").add(nr_bitmap_lookups_);
+			m.get_counter("space_map.ref_count_lookups").add(nr_ref_count_lookups_);
+			m.get_counter("space_map.count_changes").add(nr_count_changes_);
+			m.get_counter("space_map.find_frees").add(nr_find_frees_);
+		}
+
 		transaction_manager &tm_;
 		bcache::validator::ptr bitmap_validator_;
 		index_store::ptr indexes_;
@@ -517,6 +617,12 @@ namespace {
 		block_address nr_allocated_;
 
 		btree<1, ref_count_traits> ref_counts_;
+
+		// Published when the space map is destroyed.
+		mutable uint64_t nr_bitmap_lookups_;
+		mutable uint64_t nr_ref_count_lookups_;
+		uint64_t nr_count_changes_;
+		uint64_t nr_find_frees_;
 	};
 
 	//--------------------------------
@@ -773,4 +879,29 @@ persistent_data::open_metadata_sm(transaction_manager &tm, void *root)
 			checked_space_map::ptr(new sm_disk(store, tm, v))));
 }
 
+block_address
+persistent_data::get_nr_allocated(void const *root)
+{
+	sm_root_disk d;
+	sm_root v;
+
+	::memcpy(&d, root, sizeof(d));
+	sm_root_traits::unpack(d, v);
+	return v.nr_allocated_;
+}
+
+//----------------------------------------------------------------
+
+bcache::validator::ptr
+persistent_data::bitmap_validator()
+{
+	return bcache::validator::ptr(new bitmap_block_validator());
+}
+
+bcache::validator::ptr
+persistent_data::index_validator()
+{
+	return bcache::validator::ptr(new index_block_validator());
+}
+
 //----------------------------------------------------------------
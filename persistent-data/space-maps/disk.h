@@ -36,6 +36,14 @@ namespace persistent_data {
 
 	checked_space_map::ptr
 	open_metadata_sm(transaction_manager &tm, void *root);
+
+	// Reads the allocated block count straight out of a space map
+	// root, without opening the space map.
+	block_address get_nr_allocated(void const *root);
+
+	// For recognising space map blocks on their own.
+	bcache::validator::ptr bitmap_validator();
+	bcache::validator::ptr index_validator();
 }
 
 //----------------------------------------------------------------
@@ -100,6 +100,8 @@ namespace {
 				add_op(block_op(block_op::SET, b, c));
 			else {
 				recursing_lock lock(*this);
+				if (c)
+					reserve(b);
 				return sm_->set_count(b, c);
 			}
 		}
@@ -114,6 +116,7 @@ namespace {
 				add_op(block_op(block_op::INC, b));
 			else {
 				recursing_lock lock(*this);
+				reserve(b);
 				return sm_->inc(b);
 			}
 		}
@@ -214,31 +217,38 @@ namespace {
 		}
 
 	private:
+		// The ops are taken out of ops_ before they're applied, so
+		// get_count() doesn't see them twice.  Applying them can
+		// queue more, so keep going until there are none left.
 		void flush_ops_() {
-			op_map::const_iterator it, end = ops_.end();
-			for (it = ops_.begin(); it != end; ++it) {
-				recursing_lock lock(*this);
-
-				list<block_op> const &ops = it->second;
-				list<block_op>::const_iterator op_it, op_end = ops.end();
-				for (op_it = ops.begin(); op_it != op_end; ++op_it) {
-					switch (op_it->op_) {
-					case block_op::INC:
-						sm_->inc(op_it->b_);
-						break;
+			while (!ops_.empty()) {
+				op_map pending;
+				pending.swap(ops_);
+
+				op_map::const_iterator it, end = pending.end();
+				for (it = pending.begin(); it != end; ++it) {
+					recursing_lock lock(*this);
+
+					list<block_op> const &ops = it->second;
+					list<block_op>::const_iterator op_it, op_end = ops.end();
+					for (op_it = ops.begin(); op_it != op_end; ++op_it) {
+						switch (op_it->op_) {
+						case block_op::INC:
+							sm_->inc(op_it->b_);
+							break;
 
-					case block_op::DEC:
-						sm_->dec(op_it->b_);
-						break;
+						case block_op::DEC:
+							sm_->dec(op_it->b_);
+							break;
 
-					case block_op::SET:
-						sm_->set_count(op_it->b_, op_it->rc_);
-						break;
+						case block_op::SET:
+							sm_->set_count(op_it->b_, op_it->rc_);
+							break;
+						}
 					}
 				}
 			}
 
-			ops_.clear();
 			allocated_blocks_.clear();
 		}
 
@@ -249,6 +259,13 @@ namespace {
 				allocated_blocks_.add(op.b_, op.b_ + 1);
 		}
 
+		// Updating the count may shadow a bitmap, which allocates.
+		// The block isn't marked as in use until the update completes,
+		// so stop the nested allocation from handing it out again.
+		void reserve(block_address b) {
+			allocated_blocks_.add(b, b + 1);
+		}
+
 		void cant_recurse(string const &method) const {
 			if (depth_)
 				throw runtime_error("recursive '" + method + "' not supported");
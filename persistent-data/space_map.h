@@ -49,6 +49,12 @@ namespace persistent_data {
 		virtual void inc(block_address b) = 0;
 		virtual void dec(block_address b) = 0;
 
+		// Increments every block in [begin, end).
+		virtual void inc_range(block_address begin, block_address end) {
+			for (block_address b = begin; b < end; b++)
+				inc(b);
+		}
+
 		// FIXME: change these to return an optional, failure is
 		// not that rare if we're restricting the area that's
 		// searched.
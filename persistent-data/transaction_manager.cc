@@ -29,7 +29,8 @@ using namespace std;
 transaction_manager::transaction_manager(block_manager<>::ptr bm,
 					 space_map::ptr sm)
 	: bm_(bm),
-	  sm_(sm)
+	  sm_(sm),
+	  generation_(0)
 {
 }
 
@@ -42,6 +43,7 @@ transaction_manager::begin(block_address superblock, validator v)
 {
 	write_ref wr = bm_->superblock(superblock, v);
 	wipe_shadow_table();
+	generation_++;
 	return wr;
 }
 
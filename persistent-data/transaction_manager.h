@@ -66,6 +66,12 @@ namespace persistent_data {
 			return bm_;
 		}
 
+		// Incremented by begin(), so anything caching block
+		// locations can tell when a new transaction has started.
+		uint64_t get_generation() const {
+			return generation_;
+		}
+
 		void prefetch(block_address b) {
 			bm_->prefetch(b);
 		}
@@ -80,6 +86,7 @@ namespace persistent_data {
 		space_map::ptr sm_;
 
 		std::set<block_address> shadows_;
+		uint64_t generation_;
 	};
 }
 
@@ -0,0 +1,186 @@
+#include "thin-provisioning/device_accounting.h"
+
+#include "base/metrics.h"
+
+#include <stdexcept>
+
+using namespace persistent_data;
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	void raise_metadata_damage() {
+		throw std::runtime_error("metadata contains errors (run thin_check for details).");
+	}
+
+	class details_extractor : public device_tree_detail::device_visitor {
+	public:
+		void visit(block_address dev_id, device_tree_detail::device_details const &dd) {
+			dd_.insert(make_pair(dev_id, dd));
+		}
+
+		dd_map const &get_details() const {
+			return dd_;
+		}
+
+	private:
+		dd_map dd_;
+	};
+
+	struct fatal_details_damage : public device_tree_detail::damage_visitor {
+		void visit(device_tree_detail::missing_devices const &d) {
+			raise_metadata_damage();
+		}
+	};
+
+	class fatal_mapping_damage : public mapping_tree_detail::damage_visitor {
+	public:
+		virtual void visit(mapping_tree_detail::missing_devices const &d) {
+			raise_metadata_damage();
+		}
+
+		virtual void visit(mapping_tree_detail::missing_mappings const &d) {
+			raise_metadata_damage();
+		}
+	};
+
+	class mapping_pass1 : public mapping_tree_detail::mapping_visitor {
+	public:
+		mapping_pass1(mapping_set &mappings)
+		: mappings_(mappings) {
+		}
+
+		virtual void visit(btree_path const &path, mapping_tree_detail::block_time const &bt) {
+			mappings_.inc(bt.block_);
+		}
+
+	private:
+		mapping_set &mappings_;
+	};
+
+	class mapping_pass2 : public mapping_tree_detail::mapping_visitor {
+	public:
+		mapping_pass2(mapping_set const &mappings)
+		: mappings_(mappings),
+		  exclusives_(0) {
+		}
+
+		virtual void visit(btree_path const &path, mapping_tree_detail::block_time const &bt) {
+			if (mappings_.get_state(bt.block_) == mapping_set::EXCLUSIVE)
+				exclusives_++;
+		}
+
+		block_address get_exclusives() const {
+			return exclusives_;
+		}
+
+	private:
+		mapping_set const &mappings_;
+		block_address exclusives_;
+	};
+
+	void walk_device(metadata const &md, uint64_t dev_id,
+			 mapping_tree_detail::mapping_visitor &mv) {
+		dev_tree::key k = {dev_id};
+		boost::optional<uint64_t> dev_root = md.mappings_top_level_->lookup(k);
+
+		if (!dev_root)
+			throw runtime_error("couldn't find mapping tree root");
+
+		single_mapping_tree dev_mappings(*md.tm_, *dev_root,
+						 mapping_tree_detail::block_traits::ref_counter(md.tm_->get_sm()));
+
+		fatal_mapping_damage dv;
+		walk_mapping_tree(dev_mappings, mv, dv);
+	}
+}
+
+//----------------------------------------------------------------
+
+dd_map
+thin_provisioning::read_device_details(metadata const &md)
+{
+	base::scoped_phase phase("device tree");
+	details_extractor de;
+	fatal_details_damage dv;
+	walk_device_tree(*md.details_, de, dv);
+	return de.get_details();
+}
+
+//----------------------------------------------------------------
+
+mapping_set::mapping_set()
+	: bits_(10240, false)
+{
+}
+
+void
+mapping_set::inc(block_address b)
+{
+	if (get_bit(b * 2))
+		set_bit(b * 2 + 1, true); // shared
+	else
+		set_bit(b * 2, true); // exclusive
+}
+
+mapping_set::block_state
+mapping_set::get_state(block_address b) const
+{
+	if (get_bit(b * 2)) {
+		if (get_bit(b * 2 + 1))
+			return SHARED;
+		else
+			return EXCLUSIVE;
+	} else
+		return UNMAPPED;
+}
+
+void
+mapping_set::ensure_size(block_address bit) const
+{
+	if (bit >= bits_.size()) {
+		block_address new_size = bits_.size() * 2;
+		while (new_size <= bit)
+			new_size *= 2;
+
+		bits_.resize(new_size, false);
+	}
+}
+
+bool
+mapping_set::get_bit(block_address bit) const
+{
+	ensure_size(bit);
+	return bits_[bit];
+}
+
+void
+mapping_set::set_bit(block_address bit, bool v)
+{
+	ensure_size(bit);
+	bits_[bit] = v;
+}
+
+//----------------------------------------------------------------
+
+void
+thin_provisioning::add_mappings(metadata const &md, uint64_t dev_id, mapping_set &mappings)
+{
+	base::scoped_phase phase("mapping tree");
+	mapping_pass1 pass1(mappings);
+	walk_device(md, dev_id, pass1);
+}
+
+block_address
+thin_provisioning::count_exclusives(metadata const &md, mapping_set const &mappings,
+				    uint64_t dev_id)
+{
+	base::scoped_phase phase("exclusive counts");
+	mapping_pass2 pass2(mappings);
+	walk_device(md, dev_id, pass2);
+	return pass2.get_exclusives();
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,48 @@
+#ifndef THIN_DEVICE_ACCOUNTING_H
+#define THIN_DEVICE_ACCOUNTING_H
+
+#include "thin-provisioning/metadata.h"
+
+#include <map>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace thin_provisioning {
+	typedef std::map<block_address, device_tree_detail::device_details> dd_map;
+
+	// Throws if the devices tree is damaged.
+	dd_map read_device_details(metadata const &md);
+
+	// Records whether each data block is mapped by one thin device,
+	// or shared between several.
+	class mapping_set {
+	public:
+		mapping_set();
+
+		enum block_state {
+			UNMAPPED,
+			EXCLUSIVE,
+			SHARED
+		};
+
+		void inc(block_address b);
+		block_state get_state(block_address b) const;
+
+	private:
+		void ensure_size(block_address bit) const;
+		bool get_bit(block_address bit) const;
+		void set_bit(block_address bit, bool v);
+
+		mutable std::vector<bool> bits_;
+	};
+
+	// These throw if the device's mappings are damaged.
+	void add_mappings(metadata const &md, uint64_t dev_id, mapping_set &mappings);
+	block_address count_exclusives(metadata const &md, mapping_set const &mappings,
+				       uint64_t dev_id);
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -0,0 +1,293 @@
+#include "thin-provisioning/discard_engine.h"
+
+#include "base/error_string.h"
+#include "base/mutex_lock.h"
+
+#include <errno.h>
+#include <fstream>
+#include <linux/fs.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#ifndef BLKDISCARD
+#define BLKDISCARD _IO(0x12,119)
+#endif
+
+using namespace base;
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	uint64_t const SECTOR_SIZE = 512;
+
+	bool read_sysfs(string const &path, uint64_t &v) {
+		ifstream in(path.c_str());
+		return !!(in >> v);
+	}
+
+	// Partitions don't have a queue directory of their own; it's
+	// in the parent device's directory.
+	uint64_t read_queue_attr(string const &dev_dir, string const &attr) {
+		uint64_t v;
+
+		if (read_sysfs(dev_dir + "/queue/" + attr, v) ||
+		    read_sysfs(dev_dir + "/../queue/" + attr, v))
+			return v;
+
+		throw runtime_error("couldn't read " + attr + " for data device");
+	}
+
+	uint64_t round_up(uint64_t v, uint64_t n) {
+		return ((v + n - 1) / n) * n;
+	}
+
+	uint64_t round_down(uint64_t v, uint64_t n) {
+		return (v / n) * n;
+	}
+}
+
+//----------------------------------------------------------------
+
+discard_limits::discard_limits()
+	: granularity(SECTOR_SIZE),
+	  alignment(0),
+	  max_bytes(0)
+{
+}
+
+discard_limits
+thin_provisioning::get_discard_limits(int fd)
+{
+	struct stat info;
+	if (fstat(fd, &info))
+		throw runtime_error("couldn't stat data device");
+
+	if (!S_ISBLK(info.st_mode))
+		throw runtime_error("data device is not a block device");
+
+	ostringstream dev_dir;
+	dev_dir << "/sys/dev/block/" << major(info.st_rdev) << ":" << minor(info.st_rdev);
+
+	discard_limits limits;
+	limits.max_bytes = read_queue_attr(dev_dir.str(), "discard_max_bytes");
+	if (!limits.max_bytes)
+		throw runtime_error("data device doesn't support discard");
+
+	uint64_t granularity = read_queue_attr(dev_dir.str(), "discard_granularity");
+	if (granularity)
+		limits.granularity = granularity;
+
+	uint64_t alignment;
+	if (read_sysfs(dev_dir.str() + "/discard_alignment", alignment))
+		limits.alignment = alignment % limits.granularity;
+
+	return limits;
+}
+
+//----------------------------------------------------------------
+
+discard_planner::discard_planner(discard_limits const &limits, discard_sink &sink)
+	: limits_(limits),
+	  max_chunk_(0),
+	  sink_(sink),
+	  end_(0)
+{
+	if (!limits_.granularity)
+		throw runtime_error("discard granularity must be greater than zero");
+
+	// A request must still cover whole granules.
+	if (limits_.max_bytes)
+		max_chunk_ = max<uint64_t>(round_down(limits_.max_bytes, limits_.granularity),
+					   limits_.granularity);
+}
+
+void
+discard_planner::add(uint64_t begin, uint64_t end)
+{
+	if (begin_ && begin == end_) {
+		end_ = end;
+		return;
+	}
+
+	complete();
+	begin_ = begin;
+	end_ = end;
+}
+
+void
+discard_planner::complete()
+{
+	if (begin_) {
+		issue(*begin_, end_);
+		begin_ = boost::optional<uint64_t>();
+	}
+}
+
+void
+discard_planner::issue(uint64_t begin, uint64_t end)
+{
+	uint64_t g = limits_.granularity;
+	uint64_t a = limits_.alignment;
+
+	if (end <= a)
+		return;
+
+	begin = a + round_up(max(begin, a) - a, g);
+	end = a + round_down(end - a, g);
+
+	while (begin < end) {
+		uint64_t len = end - begin;
+		if (max_chunk_)
+			len = min(len, max_chunk_);
+
+		sink_.discard(begin, len);
+		begin += len;
+	}
+}
+
+//----------------------------------------------------------------
+
+threaded_discarder::threaded_discarder(int fd, unsigned nr_threads)
+	: fd_(fd),
+	  queue_depth_(nr_threads * 2),
+	  stopping_(false),
+	  nr_bytes_(0),
+	  nr_requests_(0)
+{
+	if (!nr_threads)
+		throw runtime_error("need at least one discard thread");
+
+	pthread_mutex_init(&lock_, NULL);
+	pthread_cond_init(&work_cond_, NULL);
+	pthread_cond_init(&space_cond_, NULL);
+
+	for (unsigned i = 0; i < nr_threads; i++) {
+		pthread_t t;
+		if (pthread_create(&t, NULL, worker_, this)) {
+			stop();
+			pthread_cond_destroy(&space_cond_);
+			pthread_cond_destroy(&work_cond_);
+			pthread_mutex_destroy(&lock_);
+			throw runtime_error("couldn't create discard thread");
+		}
+
+		threads_.push_back(t);
+	}
+}
+
+threaded_discarder::~threaded_discarder()
+{
+	stop();
+
+	pthread_cond_destroy(&space_cond_);
+	pthread_cond_destroy(&work_cond_);
+	pthread_mutex_destroy(&lock_);
+}
+
+void
+threaded_discarder::discard(uint64_t begin, uint64_t len)
+{
+	{
+		mutex_lock l(lock_);
+
+		while (queue_.size() >= queue_depth_ && error_.empty())
+			pthread_cond_wait(&space_cond_, &lock_);
+
+		if (error_.empty()) {
+			queue_.push_back(make_pair(begin, len));
+			pthread_cond_signal(&work_cond_);
+		}
+	}
+
+	check_error();
+}
+
+void
+threaded_discarder::complete()
+{
+	stop();
+	check_error();
+}
+
+void *
+threaded_discarder::worker_(void *context)
+{
+	static_cast<threaded_discarder *>(context)->worker();
+	return NULL;
+}
+
+void
+threaded_discarder::worker()
+{
+	for (;;) {
+		range r;
+
+		{
+			mutex_lock l(lock_);
+
+			while (queue_.empty() && !stopping_ && error_.empty())
+				pthread_cond_wait(&work_cond_, &lock_);
+
+			if (queue_.empty() || !error_.empty())
+				return;
+
+			r = queue_.front();
+			queue_.pop_front();
+			pthread_cond_signal(&space_cond_);
+		}
+
+		uint64_t args[2] = {r.first, r.second};
+		int e = ioctl(fd_, BLKDISCARD, &args) ? errno : 0;
+
+		{
+			mutex_lock l(lock_);
+
+			if (e) {
+				if (error_.empty()) {
+					ostringstream out;
+					out << "discard of " << r.second << " bytes at "
+					    << r.first << " failed: " << error_string(e);
+					error_ = out.str();
+				}
+
+				// Wake everyone, so they see the error.
+				pthread_cond_broadcast(&work_cond_);
+				pthread_cond_broadcast(&space_cond_);
+
+			} else {
+				nr_bytes_ += r.second;
+				nr_requests_++;
+			}
+		}
+	}
+}
+
+void
+threaded_discarder::stop()
+{
+	{
+		mutex_lock l(lock_);
+		stopping_ = true;
+		pthread_cond_broadcast(&work_cond_);
+	}
+
+	for (size_t i = 0; i < threads_.size(); i++)
+		pthread_join(threads_[i], NULL);
+
+	threads_.clear();
+}
+
+void
+threaded_discarder::check_error()
+{
+	mutex_lock l(lock_);
+	if (!error_.empty())
+		throw runtime_error(error_);
+}
+
+//----------------------------------------------------------------
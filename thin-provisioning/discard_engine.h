@@ -0,0 +1,107 @@
+#ifndef THIN_DISCARD_ENGINE_H
+#define THIN_DISCARD_ENGINE_H
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace thin_provisioning {
+	// All in bytes.
+	struct discard_limits {
+		discard_limits();
+
+		uint64_t granularity;
+
+		// Offset of the first granularity boundary.
+		uint64_t alignment;
+
+		// Zero means there's no limit.
+		uint64_t max_bytes;
+	};
+
+	// Reads the limits of a block device from sysfs.  Throws if the
+	// device doesn't support discard.
+	discard_limits get_discard_limits(int fd);
+
+	class discard_sink {
+	public:
+		virtual ~discard_sink() {}
+		virtual void discard(uint64_t begin, uint64_t len) = 0;
+	};
+
+	// Merges adjacent ranges, trims them to the discard granularity,
+	// and splits any that are too large for a single request.
+	// Ranges must be added in ascending order.
+	class discard_planner {
+	public:
+		discard_planner(discard_limits const &limits, discard_sink &sink);
+
+		void add(uint64_t begin, uint64_t end);
+		void complete();
+
+	private:
+		void issue(uint64_t begin, uint64_t end);
+
+		discard_limits limits_;
+		uint64_t max_chunk_;
+		discard_sink &sink_;
+
+		boost::optional<uint64_t> begin_;
+		uint64_t end_;
+	};
+
+	// Discards on a pool of threads, so several requests can be in
+	// flight at once.  Once a request fails no more are issued, and
+	// the error is thrown by the next call.
+	class threaded_discarder : public discard_sink, private boost::noncopyable {
+	public:
+		threaded_discarder(int fd, unsigned nr_threads);
+		~threaded_discarder();
+
+		virtual void discard(uint64_t begin, uint64_t len);
+
+		// Waits for everything to be discarded.
+		void complete();
+
+		uint64_t get_nr_bytes() const {
+			return nr_bytes_;
+		}
+
+		uint64_t get_nr_requests() const {
+			return nr_requests_;
+		}
+
+	private:
+		typedef std::pair<uint64_t, uint64_t> range;
+
+		static void *worker_(void *context);
+
+		void worker();
+		void stop();
+		void check_error();
+
+		int fd_;
+		unsigned queue_depth_;
+		std::vector<pthread_t> threads_;
+
+		pthread_mutex_t lock_;
+		pthread_cond_t work_cond_;
+		pthread_cond_t space_cond_;
+		std::deque<range> queue_;
+		bool stopping_;
+		std::string error_;
+
+		uint64_t nr_bytes_;
+		uint64_t nr_requests_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
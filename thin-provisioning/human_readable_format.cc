@@ -18,6 +18,8 @@
 
 #include "human_readable_format.h"
 
+#include "base/output_buffer.h"
+
 #include <iostream>
 
 using namespace std;
@@ -26,14 +28,6 @@ using namespace thin_provisioning;
 //----------------------------------------------------------------
 
 namespace {
-	template <typename T>
-	std::ostream &operator << (ostream &out, boost::optional<T> const &maybe) {
-		if (maybe)
-			out << *maybe;
-
-		return out;
-	}
-
 	class hr_emitter : public emitter {
 	public:
 		hr_emitter(ostream &out)
@@ -52,7 +46,7 @@ namespace {
 			     << ", " << data_block_size
 			     << ", " << nr_data_blocks;
 			if (metadata_snap)
-				out_ << ", " << metadata_snap;
+				out_ << ", " << *metadata_snap;
 
 			out_ << endl;
 		}
@@ -78,7 +72,7 @@ namespace {
 		}
 
 		void begin_named_mapping(string const &name) {
-			out_ << "begin named mapping"
+			out_ << "begin named mapping " << name
 			     << endl;
 		}
 
@@ -109,7 +103,7 @@ namespace {
 		}
 
 	private:
-		ostream &out_;
+		base::output_buffer out_;
 	};
 }
 
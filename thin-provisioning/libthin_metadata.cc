@@ -0,0 +1,254 @@
+#include "thin-provisioning/libthin_metadata.h"
+
+#include "thin-provisioning/metadata_session.h"
+
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+struct thin_md_session {
+	thin_md_session(metadata_session::ptr session)
+		: session(session) {
+	}
+
+	metadata_session::ptr session;
+	string error;
+};
+
+//----------------------------------------------------------------
+
+namespace {
+	// Thrown by the visitors when a callback asks to stop.
+	struct stop_query {
+	};
+
+	void fill_device(uint64_t dev_id, device_tree_detail::device_details const &dd,
+			 thin_md_device *dev) {
+		dev->dev_id = dev_id;
+		dev->mapped_blocks = dd.mapped_blocks_;
+		dev->transaction_id = dd.transaction_id_;
+		dev->creation_time = dd.creation_time_;
+		dev->snapshotted_time = dd.snapshotted_time_;
+	}
+
+	class delta_adaptor : public delta_visitor {
+	public:
+		delta_adaptor(thin_md_delta_fn fn, void *context)
+			: fn_(fn),
+			  context_(context) {
+		}
+
+		virtual void left_only(uint64_t vbegin, uint64_t dbegin, uint64_t len) {
+			call(THIN_MD_LEFT_ONLY, vbegin, dbegin, 0, len);
+		}
+
+		virtual void right_only(uint64_t vbegin, uint64_t dbegin, uint64_t len) {
+			call(THIN_MD_RIGHT_ONLY, vbegin, dbegin, 0, len);
+		}
+
+		virtual void blocks_differ(uint64_t vbegin, uint64_t left_dbegin,
+					   uint64_t right_dbegin, uint64_t len) {
+			call(THIN_MD_DIFFERENT, vbegin, left_dbegin, right_dbegin, len);
+		}
+
+		virtual void blocks_same(uint64_t vbegin, uint64_t dbegin, uint64_t len) {
+			call(THIN_MD_SAME, vbegin, dbegin, 0, len);
+		}
+
+		virtual void complete() {
+		}
+
+	private:
+		void call(thin_md_delta_type t, uint64_t vbegin, uint64_t dbegin,
+			  uint64_t right_dbegin, uint64_t len) {
+			if (fn_(context_, t, vbegin, dbegin, right_dbegin, len))
+				throw stop_query();
+		}
+
+		thin_md_delta_fn fn_;
+		void *context_;
+	};
+
+	// Exceptions mustn't escape into C.
+	template <typename Fn>
+	int guard(thin_md_session *s, Fn fn) {
+		try {
+			fn();
+			return 0;
+
+		} catch (stop_query &) {
+			return 0;
+
+		} catch (std::exception &e) {
+			s->error = e.what();
+
+		} catch (...) {
+			s->error = "unknown error";
+		}
+
+		return -1;
+	}
+
+	struct get_device {
+		get_device(thin_md_session *s, uint64_t dev_id, thin_md_device *dev)
+			: s(s), dev_id(dev_id), dev(dev) {
+		}
+
+		void operator()() {
+			fill_device(dev_id, s->session->get_device(dev_id), dev);
+		}
+
+		thin_md_session *s;
+		uint64_t dev_id;
+		thin_md_device *dev;
+	};
+
+	struct exclusive_blocks {
+		exclusive_blocks(thin_md_session *s, uint64_t dev_id, uint64_t *nr_blocks)
+			: s(s), dev_id(dev_id), nr_blocks(nr_blocks) {
+		}
+
+		void operator()() {
+			*nr_blocks = s->session->get_exclusive_blocks(dev_id);
+		}
+
+		thin_md_session *s;
+		uint64_t dev_id;
+		uint64_t *nr_blocks;
+	};
+
+	struct lookup_range {
+		lookup_range(thin_md_session *s, uint64_t dev_id, uint64_t begin, uint64_t end,
+			     thin_md_mapping_fn fn, void *context)
+			: s(s), dev_id(dev_id), begin(begin), end(end), fn(fn), context(context) {
+		}
+
+		void operator()() {
+			delta_detail::mapping_deque ms = s->session->lookup_range(dev_id, begin, end);
+
+			delta_detail::mapping_deque::const_iterator it;
+			for (it = ms.begin(); it != ms.end(); ++it)
+				if (fn(context, it->vbegin_, it->dbegin_, it->len_))
+					break;
+		}
+
+		thin_md_session *s;
+		uint64_t dev_id, begin, end;
+		thin_md_mapping_fn fn;
+		void *context;
+	};
+
+	struct delta {
+		delta(thin_md_session *s, uint64_t left, uint64_t right,
+		      thin_md_delta_fn fn, void *context)
+			: s(s), left(left), right(right), fn(fn), context(context) {
+		}
+
+		void operator()() {
+			delta_adaptor v(fn, context);
+			s->session->delta(left, right, v);
+		}
+
+		thin_md_session *s;
+		uint64_t left, right;
+		thin_md_delta_fn fn;
+		void *context;
+	};
+}
+
+//----------------------------------------------------------------
+
+thin_md_session *
+thin_md_open(char const *path, unsigned flags, size_t cache_mem, char **err)
+{
+	if (err)
+		*err = NULL;
+
+	try {
+		metadata_session::ptr session(
+			new metadata_session(path, flags & THIN_MD_METADATA_SNAP,
+					     cache_mem ? cache_mem : DEFAULT_BLOCK_CACHE_MEM));
+		return new thin_md_session(session);
+
+	} catch (std::exception &e) {
+		if (err)
+			*err = strdup(e.what());
+
+	} catch (...) {
+		if (err)
+			*err = strdup("unknown error");
+	}
+
+	return NULL;
+}
+
+void
+thin_md_close(thin_md_session *s)
+{
+	delete s;
+}
+
+char const *
+thin_md_error(thin_md_session *s)
+{
+	return s->error.c_str();
+}
+
+uint32_t
+thin_md_data_block_size(thin_md_session *s)
+{
+	return s->session->get_superblock().data_block_size_;
+}
+
+uint64_t
+thin_md_nr_data_blocks(thin_md_session *s)
+{
+	return s->session->get_nr_data_blocks();
+}
+
+int
+thin_md_list_devices(thin_md_session *s, thin_md_device *devs, unsigned max)
+{
+	dd_map const &dds = s->session->get_devices();
+
+	unsigned i = 0;
+	dd_map::const_iterator it;
+	for (it = dds.begin(); it != dds.end() && i < max; ++it, ++i)
+		fill_device(it->first, it->second, devs + i);
+
+	return dds.size();
+}
+
+int
+thin_md_get_device(thin_md_session *s, uint64_t dev_id, thin_md_device *dev)
+{
+	return guard(s, get_device(s, dev_id, dev));
+}
+
+int
+thin_md_exclusive_blocks(thin_md_session *s, uint64_t dev_id, uint64_t *nr_blocks)
+{
+	return guard(s, exclusive_blocks(s, dev_id, nr_blocks));
+}
+
+int
+thin_md_lookup_range(thin_md_session *s, uint64_t dev_id,
+		     uint64_t begin, uint64_t end,
+		     thin_md_mapping_fn fn, void *context)
+{
+	return guard(s, lookup_range(s, dev_id, begin, end, fn, context));
+}
+
+int
+thin_md_delta(thin_md_session *s, uint64_t left_dev, uint64_t right_dev,
+	      thin_md_delta_fn fn, void *context)
+{
+	return guard(s, delta(s, left_dev, right_dev, fn, context));
+}
+
+//----------------------------------------------------------------
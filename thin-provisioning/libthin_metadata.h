@@ -0,0 +1,106 @@
+#ifndef THIN_LIBTHIN_METADATA_H
+#define THIN_LIBTHIN_METADATA_H
+
+/*
+ * A C interface onto thin pool metadata, for programs that would
+ * otherwise run thin_ls, thin_delta or thin_dump over and over against
+ * the same metadata.  A session opens the metadata once and keeps it,
+ * and its block cache, for all the queries made on it.
+ *
+ * The metadata mustn't change while a session is open.  For a live
+ * pool, reserve a metadata snap and open the session with
+ * THIN_MD_METADATA_SNAP.
+ *
+ * Functions returning int return 0 on success and -1 on failure;
+ * thin_md_error() then says what went wrong.  A session may only be
+ * used by one thread at a time.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct thin_md_session;
+
+enum thin_md_open_flags {
+	THIN_MD_METADATA_SNAP = (1 << 0)
+};
+
+struct thin_md_device {
+	uint64_t dev_id;
+	uint64_t mapped_blocks;
+	uint64_t transaction_id;
+	uint32_t creation_time;
+	uint32_t snapshotted_time;
+};
+
+enum thin_md_delta_type {
+	THIN_MD_LEFT_ONLY,
+	THIN_MD_RIGHT_ONLY,
+	THIN_MD_DIFFERENT,
+	THIN_MD_SAME
+};
+
+/*
+ * Callbacks return 0 to carry on, or anything else to stop the query
+ * early, which isn't an error.
+ */
+typedef int (*thin_md_mapping_fn)(void *context, uint64_t thin_begin,
+				  uint64_t data_begin, uint64_t len);
+
+/*
+ * data_begin is from the left device, except for THIN_MD_RIGHT_ONLY.
+ * right_data_begin is only set for THIN_MD_DIFFERENT.
+ */
+typedef int (*thin_md_delta_fn)(void *context, enum thin_md_delta_type type,
+				uint64_t thin_begin, uint64_t data_begin,
+				uint64_t right_data_begin, uint64_t len);
+
+/*
+ * cache_mem is the size of the block cache in bytes, or 0 for the
+ * default.  On failure NULL is returned and, if err isn't NULL, *err
+ * is set to a message the caller must free().
+ */
+struct thin_md_session *thin_md_open(const char *path, unsigned flags,
+				     size_t cache_mem, char **err);
+void thin_md_close(struct thin_md_session *s);
+
+const char *thin_md_error(struct thin_md_session *s);
+
+/* In 512 byte sectors. */
+uint32_t thin_md_data_block_size(struct thin_md_session *s);
+uint64_t thin_md_nr_data_blocks(struct thin_md_session *s);
+
+/*
+ * Returns the number of thin devices, filling in up to max of them in
+ * order of dev_id, or -1.
+ */
+int thin_md_list_devices(struct thin_md_session *s,
+			 struct thin_md_device *devs, unsigned max);
+int thin_md_get_device(struct thin_md_session *s, uint64_t dev_id,
+		       struct thin_md_device *dev);
+
+/*
+ * Blocks mapped by no other thin device.  The first call walks every
+ * device's mappings; later calls are cheap.
+ */
+int thin_md_exclusive_blocks(struct thin_md_session *s, uint64_t dev_id,
+			     uint64_t *nr_blocks);
+
+/* Visits the mappings of thin blocks [begin, end), in runs. */
+int thin_md_lookup_range(struct thin_md_session *s, uint64_t dev_id,
+			 uint64_t begin, uint64_t end,
+			 thin_md_mapping_fn fn, void *context);
+
+/* As thin_delta --verbose. */
+int thin_md_delta(struct thin_md_session *s, uint64_t left_dev, uint64_t right_dev,
+		  thin_md_delta_fn fn, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,207 @@
+#include "thin-provisioning/mapping_delta.h"
+
+#include "persistent-data/data-structures/btree_damage_visitor.h"
+
+#include <stdexcept>
+
+using namespace persistent_data;
+using namespace std;
+using namespace thin_provisioning;
+using namespace delta_detail;
+
+//----------------------------------------------------------------
+
+mapping_recorder::mapping_recorder()
+{
+	no_range();
+}
+
+void
+mapping_recorder::visit(btree_path const &path, mapping_tree_detail::block_time const &bt)
+{
+	record(path[0], bt.block_);
+}
+
+void
+mapping_recorder::complete()
+{
+	if (range_in_progress()) {
+		push_range();
+		no_range();
+	}
+}
+
+void
+mapping_recorder::no_range()
+{
+	obegin_ = oend_ = 0;
+	dbegin_ = dend_ = 0;
+}
+
+void
+mapping_recorder::inc_range()
+{
+	oend_++;
+	dend_++;
+}
+
+void
+mapping_recorder::begin_range(uint64_t oblock, uint64_t dblock)
+{
+	obegin_ = oend_ = oblock;
+	dbegin_ = dend_ = dblock;
+	inc_range();
+}
+
+bool
+mapping_recorder::range_in_progress()
+{
+	return oend_ != obegin_;
+}
+
+bool
+mapping_recorder::continues_range(uint64_t oblock, uint64_t dblock)
+{
+	return (oblock == oend_) && (dblock == dend_);
+}
+
+void
+mapping_recorder::push_range()
+{
+	mapping m(obegin_, dbegin_, oend_ - obegin_);
+	mappings_.push_back(m);
+}
+
+void
+mapping_recorder::record(uint64_t oblock, uint64_t dblock)
+{
+	if (!range_in_progress())
+		begin_range(oblock, dblock);
+
+	else if (!continues_range(oblock, dblock)) {
+		push_range();
+		begin_range(oblock, dblock);
+	} else
+		inc_range();
+}
+
+//----------------------------------------------------------------
+
+namespace {
+	template <typename Container>
+	class mapping_stream {
+	public:
+		mapping_stream(Container const &c)
+		: it_(c.begin()),
+		  end_(c.end()) {
+			if (it_ != end_)
+				m_ = *it_;
+		}
+
+		mapping const &get_mapping() const {
+			return m_;
+		}
+
+		bool more_mappings() const {
+			return it_ != end_;
+		}
+
+		void consume(uint64_t delta) {
+			if (it_ == end_)
+				throw runtime_error("end of stream already reached");
+
+			if (delta > m_.len_)
+				throw runtime_error("delta too long");
+
+			if (delta == m_.len_) {
+				++it_;
+				if (it_ != end_)
+					m_ = *it_;
+
+			} else {
+				m_.vbegin_ += delta;
+				m_.dbegin_ += delta;
+				m_.len_ -= delta;
+			}
+		}
+
+	private:
+		typename Container::const_iterator it_;
+		typename Container::const_iterator end_;
+		mapping m_;
+	};
+
+	class damage_visitor {
+	public:
+		virtual void visit(btree_path const &path, btree_detail::damage const &d) {
+			throw std::runtime_error("damage in mapping tree, please run thin_check");
+		}
+	};
+}
+
+//----------------------------------------------------------------
+
+mapping_deque
+thin_provisioning::read_mappings(single_mapping_tree const &tree)
+{
+	mapping_recorder mr;
+	damage_visitor damage_v;
+
+	btree_visit_values(tree, mr, damage_v);
+	mr.complete();
+
+	return mr.get_mappings();
+}
+
+void
+thin_provisioning::compare_mappings(mapping_deque const &left,
+				    mapping_deque const &right,
+				    delta_visitor &e)
+{
+	mapping_stream<mapping_deque> ls(left);
+	mapping_stream<mapping_deque> rs(right);
+
+	while (ls.more_mappings() && rs.more_mappings()) {
+		mapping const &lm = ls.get_mapping();
+		mapping const &rm = rs.get_mapping();
+
+		if (lm.vbegin_ < rm.vbegin_) {
+			uint64_t delta = min<uint64_t>(lm.len_, rm.vbegin_ - lm.vbegin_);
+			e.left_only(lm.vbegin_, lm.dbegin_, delta);
+			ls.consume(delta);
+
+		} else if (lm.vbegin_ > rm.vbegin_) {
+			uint64_t delta = min<uint64_t>(rm.len_, lm.vbegin_ - rm.vbegin_);
+			e.right_only(rm.vbegin_, rm.dbegin_, delta);
+			rs.consume(delta);
+
+		} else if (lm.dbegin_ != rm.dbegin_) {
+			uint64_t delta = min<uint64_t>(lm.len_, rm.len_);
+			e.blocks_differ(lm.vbegin_, lm.dbegin_, rm.dbegin_, delta);
+			ls.consume(delta);
+			rs.consume(delta);
+
+		} else {
+			uint64_t delta = min<uint64_t>(lm.len_, rm.len_);
+			e.blocks_same(lm.vbegin_, lm.dbegin_, delta);
+			ls.consume(delta);
+			rs.consume(delta);
+		}
+	}
+
+	while (ls.more_mappings()) {
+		mapping const &lm = ls.get_mapping();
+		e.left_only(lm.vbegin_, lm.dbegin_, lm.len_);
+		ls.consume(lm.len_);
+	}
+
+	while (rs.more_mappings()) {
+		mapping const &rm = rs.get_mapping();
+		e.right_only(rm.vbegin_, rm.dbegin_, rm.len_);
+		rs.consume(rm.len_);
+	}
+
+	e.complete();
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,82 @@
+#ifndef THIN_MAPPING_DELTA_H
+#define THIN_MAPPING_DELTA_H
+
+#include "thin-provisioning/mapping_tree.h"
+
+#include <deque>
+
+//----------------------------------------------------------------
+
+namespace thin_provisioning {
+	namespace delta_detail {
+		// A run of thin blocks mapped to consecutive data blocks.
+		struct mapping {
+			mapping()
+				: vbegin_(0),
+				  dbegin_(0),
+				  len_(0) {
+			}
+
+			mapping(uint64_t vbegin, uint64_t dbegin, uint64_t len)
+				: vbegin_(vbegin),
+				  dbegin_(dbegin),
+				  len_(len) {
+			}
+
+			uint64_t vbegin_, dbegin_, len_;
+		};
+
+		typedef std::deque<mapping> mapping_deque;
+
+		// Builds up an in core rep of the mappings for a device.
+		class mapping_recorder {
+		public:
+			mapping_recorder();
+
+			void visit(btree_path const &path, mapping_tree_detail::block_time const &bt);
+			void complete();
+
+			mapping_deque const &get_mappings() const {
+				return mappings_;
+			}
+
+		private:
+			void no_range();
+			void inc_range();
+			void begin_range(uint64_t oblock, uint64_t dblock);
+			bool range_in_progress();
+			bool continues_range(uint64_t oblock, uint64_t dblock);
+			void push_range();
+			void record(uint64_t oblock, uint64_t dblock);
+
+			uint64_t obegin_, oend_;
+			uint64_t dbegin_, dend_;
+
+			mapping_deque mappings_;
+		};
+	}
+
+	class delta_visitor {
+	public:
+		virtual ~delta_visitor() {}
+
+		virtual void left_only(uint64_t vbegin, uint64_t dbegin, uint64_t len) = 0;
+		virtual void right_only(uint64_t vbegin, uint64_t dbegin, uint64_t len) = 0;
+		virtual void blocks_differ(uint64_t vbegin, uint64_t left_dbegin, uint64_t right_dbegin, uint64_t len) = 0;
+		virtual void blocks_same(uint64_t vbegin, uint64_t dbegin, uint64_t len) = 0;
+		virtual void complete() = 0;
+	};
+
+	// Throws if the tree is damaged.
+	delta_detail::mapping_deque read_mappings(single_mapping_tree const &tree);
+
+	// Iterates through both sets of mappings in parallel, noting
+	// any differences.
+	void compare_mappings(delta_detail::mapping_deque const &left,
+			      delta_detail::mapping_deque const &right,
+			      delta_visitor &v);
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -0,0 +1,251 @@
+#include "thin-provisioning/mapping_sampler.h"
+
+#include "persistent-data/data-structures/btree.h"
+#include "persistent-data/data-structures/simple_traits.h"
+#include "persistent-data/validators.h"
+#include "thin-provisioning/mapping_tree.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace persistent_data;
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	using namespace btree_detail;
+
+	class sample_damage : public runtime_error {
+	public:
+		sample_damage(string const &what)
+			: runtime_error(what) {
+		}
+	};
+
+	void damaged(block_address b, string const &what) {
+		ostringstream out;
+		out << "block " << b << ": " << what;
+		throw sample_damage(out.str());
+	}
+
+	template <typename ValueTraits>
+	void check_header(node_ref<ValueTraits> const &n, bool is_root) {
+		block_address b = n.get_location();
+
+		if (!n.value_sizes_match())
+			damaged(b, n.value_mismatch_string());
+
+		size_t elt_size = sizeof(uint64_t) + n.get_value_size();
+		if (elt_size * n.get_max_entries() + sizeof(node_header) > MD_BLOCK_SIZE ||
+		    n.get_max_entries() % 3)
+			damaged(b, "bad max entries");
+
+		unsigned nr_entries = n.get_nr_entries();
+		if (nr_entries > n.get_max_entries())
+			damaged(b, "too many entries");
+
+		if (!is_root && nr_entries < n.get_max_entries() / 3)
+			damaged(b, "too few entries");
+	}
+
+	// The keys a node may hold, as given by its parent: at least
+	// lowest, and below highest if there is one.
+	struct bounds {
+		bounds()
+			: lowest(0),
+			  has_highest(false),
+			  highest(0) {
+		}
+
+		uint64_t lowest;
+		bool has_highest;
+		uint64_t highest;
+	};
+
+	template <typename ValueTraits>
+	void check_keys(node_ref<ValueTraits> const &n, bounds const &bs) {
+		block_address b = n.get_location();
+		unsigned nr_entries = n.get_nr_entries();
+
+		for (unsigned i = 1; i < nr_entries; i++)
+			if (n.key_at(i) <= n.key_at(i - 1))
+				damaged(b, "keys are out of order");
+
+		if (!nr_entries)
+			return;
+
+		if (n.key_at(0) < bs.lowest)
+			damaged(b, "lowest key is below the parent's key");
+
+		if (bs.has_highest && n.key_at(nr_entries - 1) >= bs.highest)
+			damaged(b, "highest key is beyond the parent's next key");
+	}
+}
+
+//----------------------------------------------------------------
+
+mapping_sampler::mapping_sampler(transaction_manager &tm,
+				 block_address nr_data_blocks,
+				 uint64_t seed)
+	: tm_(tm),
+	  nr_data_blocks_(nr_data_blocks),
+	  rand_state_(seed ? seed : 1),
+	  nr_paths_(0),
+	  nr_leaves_(0),
+	  nr_mappings_(0)
+{
+}
+
+void
+mapping_sampler::sample(uint64_t thin_dev, block_address root, unsigned nr_paths)
+{
+	try {
+		for (unsigned i = 0; i < nr_paths; i++)
+			descend(thin_dev, root);
+
+	} catch (std::exception &e) {
+		ostringstream out;
+		out << "thin device " << thin_dev << ", " << e.what();
+		damage_.push_back(out.str());
+	}
+}
+
+void
+mapping_sampler::descend(uint64_t thin_dev, block_address root)
+{
+	bcache::validator::ptr v = create_btree_node_validator();
+
+	block_address b = root;
+	bounds bs;
+	bool is_root = true;
+
+	nr_paths_++;
+
+	for (;;) {
+		if (b >= tm_.get_bm()->get_nr_blocks())
+			damaged(b, "beyond the end of the metadata device");
+
+		transaction_manager::read_ref rr = tm_.read_lock(b, v);
+		node_ref<uint64_traits> n = to_node<uint64_traits>(rr);
+
+		if (n.get_type() == INTERNAL) {
+			check_header(n, is_root);
+			check_keys(n, bs);
+
+			unsigned nr_entries = n.get_nr_entries();
+			if (!nr_entries)
+				damaged(b, "internal node has no entries");
+
+			unsigned i = random() % nr_entries;
+			bs.lowest = n.key_at(i);
+			if (i + 1 < nr_entries) {
+				bs.has_highest = true;
+				bs.highest = n.key_at(i + 1);
+			}
+
+			b = n.value_at(i);
+			is_root = false;
+			continue;
+		}
+
+		node_ref<mapping_tree_detail::block_traits> leaf =
+			to_node<mapping_tree_detail::block_traits>(rr);
+
+		check_header(leaf, is_root);
+		check_keys(leaf, bs);
+
+		for (unsigned i = 0; i < leaf.get_nr_entries(); i++) {
+			mapping_tree_detail::block_time bt = leaf.value_at(i);
+
+			if (bt.block_ >= nr_data_blocks_) {
+				ostringstream out;
+				out << "thin block " << leaf.key_at(i)
+				    << " maps to data block " << bt.block_
+				    << ", beyond the end of the data device";
+				damaged(b, out.str());
+			}
+		}
+
+		if (leaves_.insert(b).second) {
+			nr_leaves_++;
+			nr_mappings_ += leaf.get_nr_entries();
+		}
+
+		return;
+	}
+}
+
+// xorshift64*; the quality of rand() varies too much.
+uint64_t
+mapping_sampler::random()
+{
+	rand_state_ ^= rand_state_ >> 12;
+	rand_state_ ^= rand_state_ << 25;
+	rand_state_ ^= rand_state_ >> 27;
+	return rand_state_ * 2685821657736338717ULL;
+}
+
+//----------------------------------------------------------------
+
+namespace {
+	struct remainder {
+		remainder(uint64_t r, size_t i)
+			: rem(r),
+			  index(i) {
+		}
+
+		bool operator <(remainder const &rhs) const {
+			return (rem != rhs.rem) ? rem > rhs.rem : index < rhs.index;
+		}
+
+		uint64_t rem;
+		size_t index;
+	};
+}
+
+vector<unsigned>
+thin_provisioning::share_paths(vector<uint64_t> const &mapped_blocks, unsigned nr_paths)
+{
+	size_t nr_devs = mapped_blocks.size();
+	vector<unsigned> shares(nr_devs, 1);
+
+	if (nr_paths <= nr_devs)
+		return shares;
+
+	// If nothing claims to be mapped the counts can't be trusted,
+	// so share the paths evenly.
+	uint64_t total = 0;
+	for (size_t i = 0; i < nr_devs; i++)
+		total += mapped_blocks[i];
+
+	vector<uint64_t> weights(mapped_blocks);
+	if (!total) {
+		weights.assign(nr_devs, 1);
+		total = nr_devs;
+	}
+
+	// Largest remainder, so the shares add up.
+	uint64_t spare = nr_paths - nr_devs;
+	uint64_t given = 0;
+	vector<remainder> remainders;
+	for (size_t i = 0; i < nr_devs; i++) {
+		// Avoid overflowing the multiplication on huge pools.
+		long double exact = static_cast<long double>(spare) * weights[i] / total;
+		uint64_t whole = static_cast<uint64_t>(exact);
+
+		shares[i] += whole;
+		given += whole;
+		remainders.push_back(remainder(static_cast<uint64_t>((exact - whole) * 1000000), i));
+	}
+
+	sort(remainders.begin(), remainders.end());
+	for (size_t i = 0; given < spare && i < remainders.size(); i++, given++)
+		shares[remainders[i].index]++;
+
+	return shares;
+}
+
+//----------------------------------------------------------------
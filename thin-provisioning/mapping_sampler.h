@@ -0,0 +1,73 @@
+#ifndef THIN_MAPPING_SAMPLER_H
+#define THIN_MAPPING_SAMPLER_H
+
+#include "persistent-data/transaction_manager.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace thin_provisioning {
+	using namespace persistent_data;
+
+	// Checks a thin device's mappings by following random paths
+	// from the root to a leaf, rather than walking the whole tree.
+	// Every node on a path is checked as thoroughly as a full walk
+	// would: checksum, header, key order and the bounds given by
+	// the parent.  Every mapping in a sampled leaf must point
+	// inside the data device.
+	class mapping_sampler {
+	public:
+		mapping_sampler(transaction_manager &tm,
+				block_address nr_data_blocks,
+				uint64_t seed);
+
+		// Stops at the first damage found in the device.
+		void sample(uint64_t thin_dev, block_address root, unsigned nr_paths);
+
+		// A description of each piece of damage found.
+		std::vector<std::string> const &get_damage() const {
+			return damage_;
+		}
+
+		unsigned get_nr_paths() const {
+			return nr_paths_;
+		}
+
+		// Leaves are only counted once, however many paths reach
+		// them.
+		uint64_t get_nr_leaves() const {
+			return nr_leaves_;
+		}
+
+		uint64_t get_nr_mappings() const {
+			return nr_mappings_;
+		}
+
+	private:
+		void descend(uint64_t thin_dev, block_address root);
+		uint64_t random();
+
+		transaction_manager &tm_;
+		block_address nr_data_blocks_;
+		uint64_t rand_state_;
+
+		std::vector<std::string> damage_;
+		std::set<block_address> leaves_;
+		unsigned nr_paths_;
+		uint64_t nr_leaves_;
+		uint64_t nr_mappings_;
+	};
+
+	// Shares out nr_paths between devices in proportion to their
+	// mapped blocks.  Every device gets at least one path.  If no
+	// device has any blocks mapped, they're shared evenly.
+	std::vector<unsigned> share_paths(std::vector<uint64_t> const &mapped_blocks,
+					  unsigned nr_paths);
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -191,6 +191,65 @@ namespace {
 		damage_visitor &v_;
 	};
 
+	class observed_damage_visitor :
+		public btree_detail::btree_damage_visitor<noop_block_time_visitor,
+							  mapping_tree_damage_visitor,
+							  2, mapping_tree_detail::block_traits> {
+	public:
+		typedef btree_detail::btree_damage_visitor<noop_block_time_visitor,
+							   mapping_tree_damage_visitor,
+							   2, mapping_tree_detail::block_traits> base;
+		typedef btree_detail::node_location node_location;
+
+		observed_damage_visitor(noop_block_time_visitor &mv,
+					mapping_tree_damage_visitor &dv,
+					subtree_observer &observer)
+			: base(mv, dv),
+			  observer_(observer) {
+		}
+
+		bool visit_internal(node_location const &loc,
+				    btree_detail::node_ref<persistent_data::block_traits> const &n) {
+			if (!enter(loc, n) || !base::visit_internal(loc, n))
+				return false;
+
+			if (loc.level() == 1) {
+				std::vector<block_address> children;
+				children.reserve(n.get_nr_entries());
+				for (unsigned i = 0; i < n.get_nr_entries(); i++)
+					children.push_back(n.value_at(i));
+
+				observer_.visit_internal(n.get_location(), children);
+			}
+
+			return true;
+		}
+
+		bool visit_leaf(node_location const &loc,
+				btree_detail::node_ref<mapping_tree_detail::block_traits> const &n) {
+			if (!enter(loc, n) || !base::visit_leaf(loc, n))
+				return false;
+
+			unsigned nr = n.get_nr_entries();
+			observer_.visit_leaf(n.get_location(), nr,
+					     nr ? n.key_at(0) : 0,
+					     nr ? n.key_at(nr - 1) : 0);
+			return true;
+		}
+
+	private:
+		template <typename Node>
+		bool enter(node_location const &loc, Node const &n) {
+			if (loc.level() != 1 || !loc.is_sub_root())
+				return true;
+
+			return observer_.enter_subtree(loc.path[0], n.get_location(),
+						       n.get_checksum());
+		}
+
+		subtree_observer &observer_;
+	};
+
 	class single_mapping_tree_damage_visitor {
 	public:
 		single_mapping_tree_damage_visitor(damage_visitor &v)
@@ -248,6 +307,17 @@ thin_provisioning::check_mapping_tree(mapping_tree const &tree,
 	walk_mapping_tree(tree, mv, visitor);
 }
 
+void
+thin_provisioning::check_mapping_tree(mapping_tree const &tree,
+				      mapping_tree_detail::damage_visitor &visitor,
+				      mapping_tree_detail::subtree_observer &observer)
+{
+	noop_block_time_visitor mv;
+	mapping_tree_damage_visitor ll_dv(visitor);
+	observed_damage_visitor v(mv, ll_dv, observer);
+	tree.visit_depth_first(v);
+}
+
 void
 thin_provisioning::walk_mapping_tree(single_mapping_tree const &tree,
 				     mapping_tree_detail::mapping_visitor &mv,
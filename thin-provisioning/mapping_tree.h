@@ -4,6 +4,8 @@
 #include "persistent-data/data-structures/btree.h"
 #include "persistent-data/run.h"
 
+#include <vector>
+
 //----------------------------------------------------------------
 
 namespace thin_provisioning {
@@ -120,6 +122,25 @@ namespace thin_provisioning {
 			virtual ~device_visitor() {}
 			virtual void visit(btree_path const &path, block_address dtree_root) = 0;
 		};
+
+		// Lets a check of the mapping tree skip the subtrees of
+		// thin devices, and see the nodes of the ones it walks.
+		class subtree_observer {
+		public:
+			virtual ~subtree_observer() {}
+
+			// Called with the root of each device's subtree.
+			// Return false to skip the subtree.
+			virtual bool enter_subtree(uint64_t thin_dev, block_address root,
+						   uint32_t csum) = 0;
+
+			// These are only called for nodes that pass their
+			// checks, and only once per node.
+			virtual void visit_internal(block_address b,
+						    std::vector<block_address> const &children) = 0;
+			virtual void visit_leaf(block_address b, unsigned nr_entries,
+						uint64_t lowest_key, uint64_t highest_key) = 0;
+		};
 	}
 
 	typedef persistent_data::btree<2, mapping_tree_detail::block_traits> mapping_tree;
@@ -137,6 +158,9 @@ namespace thin_provisioning {
 			       mapping_tree_detail::damage_visitor &dv);
 	void check_mapping_tree(mapping_tree const &tree,
 				mapping_tree_detail::damage_visitor &visitor);
+	void check_mapping_tree(mapping_tree const &tree,
+				mapping_tree_detail::damage_visitor &visitor,
+				mapping_tree_detail::subtree_observer &observer);
 
 	void walk_mapping_tree(single_mapping_tree const &tree,
 			       mapping_tree_detail::mapping_visitor &mv,
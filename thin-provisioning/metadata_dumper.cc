@@ -16,9 +16,13 @@
 // with thin-provisioning-tools.  If not, see
 // <http://www.gnu.org/licenses/>.
 
+#include "base/metrics.h"
+#include "base/progress_monitor.h"
 #include "thin-provisioning/emitter.h"
 #include "thin-provisioning/metadata_dumper.h"
 #include "thin-provisioning/mapping_tree.h"
+#include "persistent-data/data-structures/btree_counter.h"
+#include "persistent-data/validators.h"
 
 using namespace persistent_data;
 using namespace thin_provisioning;
@@ -104,11 +108,19 @@ namespace {
 	public:
 		mapping_emitter(emitter::ptr e)
 			: e_(e),
-			  in_range_(false) {
+			  in_range_(false),
+			  nr_runs_(0),
+			  nr_blocks_(0) {
 		}
 
 		~mapping_emitter() {
 			end_mapping();
+
+			if (base::metrics_enabled()) {
+				base::metrics_registry &m = base::get_metrics();
+				m.get_counter("emitter.mapping_runs").add(nr_runs_);
+				m.get_counter("emitter.mapped_blocks").add(nr_blocks_);
+			}
 		}
 
 		typedef mapping_tree_detail::block_time block_time;
@@ -116,26 +128,6 @@ namespace {
 			add_mapping(path[0], bt);
 		}
 
-	private:
-		void start_mapping(uint64_t origin_block, block_time const &bt) {
-			origin_start_ = origin_block;
-			dest_start_ = bt.block_;
-			time_ = bt.time_;
-			len_ = 1;
-			in_range_ = true;
-		}
-
-		void end_mapping() {
-			if (in_range_) {
-				if (len_ == 1)
-					e_->single_map(origin_start_, dest_start_, time_);
-				else
-					e_->range_map(origin_start_, dest_start_, time_, len_);
-
-				in_range_ = false;
-			}
-		}
-
 		void add_mapping(uint64_t origin_block, block_time const &bt) {
 			if (!in_range_)
 				start_mapping(origin_block, bt);
@@ -151,12 +143,37 @@ namespace {
 			}
 		}
 
+		void end_mapping() {
+			if (in_range_) {
+				if (len_ == 1)
+					e_->single_map(origin_start_, dest_start_, time_);
+				else
+					e_->range_map(origin_start_, dest_start_, time_, len_);
+
+				nr_runs_++;
+				nr_blocks_ += len_;
+				in_range_ = false;
+			}
+		}
+
+	private:
+		void start_mapping(uint64_t origin_block, block_time const &bt) {
+			origin_start_ = origin_block;
+			dest_start_ = bt.block_;
+			time_ = bt.time_;
+			len_ = 1;
+			in_range_ = true;
+		}
+
 		emitter::ptr e_;
 		block_address origin_start_;
 		block_address dest_start_;
 		uint32_t time_;
 		block_address len_;
 		bool in_range_;
+
+		uint64_t nr_runs_;
+		uint64_t nr_blocks_;
 	};
 
 	class mapping_tree_emitter : public mapping_tree_detail::device_visitor {
@@ -217,6 +234,130 @@ namespace {
 		mapping_tree_detail::damage_visitor::ptr damage_policy_;
 		const block_address * const dev_id_;
 	};
+
+	//--------------------------------
+
+	// Counts the references to each mapping tree node.  Nodes
+	// referenced more than once are shared between devices.
+	class shared_node_counter : public mapping_tree_detail::device_visitor {
+	public:
+		shared_node_counter(metadata::ptr md, block_counter &bc,
+				    const block_address * const dev_id)
+			: md_(md),
+			  bc_(bc),
+			  dev_id_(dev_id) {
+		}
+
+		void visit(btree_path const &path, block_address tree_root) {
+			if (dev_id_ && path[0] != *dev_id_)
+				return;
+
+			noop_value_counter<mapping_tree_detail::block_time> vc;
+			single_mapping_tree tree(*md_->tm_, tree_root,
+						 mapping_tree_detail::block_time_ref_counter(md_->data_sm_));
+			count_btree_blocks(tree, bc_, vc);
+		}
+
+	private:
+		metadata::ptr md_;
+		block_counter &bc_;
+		const block_address * const dev_id_;
+	};
+
+	class shared_mapping_tree_emitter : public mapping_tree_detail::device_visitor {
+	public:
+		shared_mapping_tree_emitter(metadata::ptr md,
+					    emitter::ptr e,
+					    dd_map const &dd,
+					    block_counter const &bc,
+					    const block_address * const dev_id)
+			: md_(md),
+			  e_(e),
+			  dd_(dd),
+			  bc_(bc),
+			  dev_id_(dev_id),
+			  validator_(create_btree_node_validator()) {
+		}
+
+		void visit(btree_path const &path, block_address tree_root) {
+			block_address dev_id = path[0];
+
+			if (dev_id_ && dev_id != *dev_id_)
+				return;
+
+			dd_map::const_iterator it = dd_.find(dev_id);
+			if (it == dd_.end()) {
+				ostringstream msg;
+				msg << "mappings present for device " << dev_id
+				    << ", but it isn't present in device tree";
+				throw runtime_error(msg.str());
+			}
+
+			device_tree_detail::device_details const &d = it->second;
+			e_->begin_device(dev_id,
+					 d.mapped_blocks_,
+					 d.transaction_id_,
+					 d.creation_time_,
+					 d.snapshotted_time_);
+
+			{
+				mapping_emitter me(e_);
+				emit_node(me, tree_root);
+			}
+
+			e_->end_device();
+		}
+
+	private:
+		void emit_node(mapping_emitter &me, block_address b) {
+			using namespace btree_detail;
+
+			bool shared = bc_.get_count(b) > 1;
+			if (shared) {
+				me.end_mapping();
+
+				map<block_address, string>::const_iterator it = names_.find(b);
+				if (it != names_.end()) {
+					e_->identifier(it->second);
+					return;
+				}
+
+				ostringstream name;
+				name << b;
+				names_.insert(make_pair(b, name.str()));
+				e_->begin_named_mapping(name.str());
+			}
+
+			transaction_manager::read_ref rr = md_->tm_->read_lock(b, validator_);
+			node_ref<block_traits> n = to_node<block_traits>(rr);
+			base::walk_progress_node();
+
+			if (n.get_type() == INTERNAL) {
+				for (unsigned i = 0; i < n.get_nr_entries(); i++)
+					emit_node(me, n.value_at(i));
+
+			} else {
+				node_ref<mapping_tree_detail::block_traits> leaf =
+					to_node<mapping_tree_detail::block_traits>(rr);
+
+				for (unsigned i = 0; i < leaf.get_nr_entries(); i++)
+					me.add_mapping(leaf.key_at(i), leaf.value_at(i));
+			}
+
+			if (shared) {
+				me.end_mapping();
+				e_->end_named_mapping();
+			}
+		}
+
+		metadata::ptr md_;
+		emitter::ptr e_;
+		dd_map const &dd_;
+		block_counter const &bc_;
+		const block_address * const dev_id_;
+		bcache::validator::ptr validator_;
+		map<block_address, string> names_;
+	};
 }
 
 //----------------------------------------------------------------
@@ -227,7 +368,10 @@ thin_provisioning::metadata_dump(metadata::ptr md, emitter::ptr e, bool repair,
 {
 	details_extractor de;
 	device_tree_detail::damage_visitor::ptr dd_policy(details_damage_policy(repair));
-	walk_device_tree(*md->details_, de, *dd_policy);
+	{
+		base::scoped_phase phase("device tree");
+		walk_device_tree(*md->details_, de, *dd_policy);
+	}
 
 	// metadata snap doesn't have the space maps so we don't know how
 	// many data blocks there are.
@@ -241,6 +385,7 @@ thin_provisioning::metadata_dump(metadata::ptr md, emitter::ptr e, bool repair,
 			boost::optional<block_address>());
 
 	{
+		base::scoped_phase phase("mapping tree");
 		mapping_tree_detail::damage_visitor::ptr md_policy(mapping_damage_policy(repair));
 		mapping_tree_emitter mte(md, e, de.get_details(), repair,
 			mapping_damage_policy(repair), dev_id);
@@ -251,4 +396,43 @@ thin_provisioning::metadata_dump(metadata::ptr md, emitter::ptr e, bool repair,
 		e->end_superblock();
 }
 
+void
+thin_provisioning::metadata_dump_shared(metadata::ptr md, emitter::ptr e,
+	const block_address *dev_id)
+{
+	details_extractor de;
+	device_tree_detail::damage_visitor::ptr dd_policy(details_damage_policy(false));
+	{
+		base::scoped_phase phase("device tree");
+		walk_device_tree(*md->details_, de, *dd_policy);
+	}
+
+	block_address nr_data_blocks = md->data_sm_ ? md->data_sm_->get_nr_blocks() : 0;
+
+	mapping_tree_detail::damage_visitor::ptr md_policy(mapping_damage_policy(false));
+
+	block_counter bc;
+	{
+		base::scoped_phase phase("shared node count");
+		shared_node_counter counter(md, bc, dev_id);
+		walk_mapping_tree(*md->mappings_top_level_, counter, *md_policy);
+	}
+
+	if (!dev_id)
+		e->begin_superblock("", md->sb_.time_,
+			md->sb_.trans_id_,
+			md->sb_.data_block_size_,
+			nr_data_blocks,
+			boost::optional<block_address>());
+
+	{
+		base::scoped_phase phase("mapping tree");
+		shared_mapping_tree_emitter mte(md, e, de.get_details(), bc, dev_id);
+		walk_mapping_tree(*md->mappings_top_level_, mte, *md_policy);
+	}
+
+	if (!dev_id)
+		e->end_superblock();
+}
+
 //----------------------------------------------------------------
@@ -30,6 +30,13 @@ namespace thin_provisioning {
 	// corruption encountered will cause an exception to be thrown.
 	void metadata_dump(metadata::ptr md, emitter::ptr e, bool repair,
 		const block_address * const dev_id = NULL);
+
+	// Mapping subtrees that are shared between devices (eg, by
+	// snapshots) are emitted once, as a named mapping the first time
+	// they're seen, and as an identifier thereafter.  There is no
+	// repair mode, the metadata must be intact.
+	void metadata_dump_shared(metadata::ptr md, emitter::ptr e,
+		const block_address * const dev_id = NULL);
 }
 
 //----------------------------------------------------------------
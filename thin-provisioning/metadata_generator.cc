@@ -0,0 +1,315 @@
+#include "thin-provisioning/metadata_generator.h"
+
+#include "base/rng.h"
+#include "persistent-data/math_utils.h"
+#include "persistent-data/space-maps/disk_structures.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace base;
+using namespace persistent_data;
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	// As many mappings as the btree builder packs into a leaf, so
+	// each named mapping is a single, full leaf.
+	uint64_t const LEAF_MAPPINGS = 252;
+
+	// Data is allocated from this many places at once, as if
+	// several devices were being written together.
+	unsigned const NR_STRIPES = 64;
+
+	uint64_t const ENTRIES_PER_BITMAP =
+		(MD_BLOCK_SIZE - sizeof(sm_disk_detail::bitmap_header)) * sm_disk_detail::ENTRIES_PER_BYTE;
+
+	class data_allocator {
+	public:
+		data_allocator(uint64_t nr_blocks, rng &r)
+			: rng_(r) {
+			uint64_t nr_stripes = min<uint64_t>(NR_STRIPES, nr_blocks);
+			for (uint64_t i = 0; i < nr_stripes; i++)
+				stripes_.push_back(make_pair(nr_blocks * i / nr_stripes,
+							     nr_blocks * (i + 1) / nr_stripes));
+		}
+
+		// Allocates up to |len| consecutive blocks from a random
+		// stripe, returning how many it got.
+		uint64_t alloc(uint64_t len, uint64_t &begin) {
+			if (stripes_.empty())
+				throw runtime_error("data device full, more data blocks are needed");
+
+			size_t i = rng_.below(stripes_.size());
+			pair<uint64_t, uint64_t> &s = stripes_[i];
+
+			begin = s.first;
+			len = min<uint64_t>(len, s.second - s.first);
+			s.first += len;
+
+			if (s.first == s.second) {
+				stripes_[i] = stripes_.back();
+				stripes_.pop_back();
+			}
+
+			return len;
+		}
+
+	private:
+		rng &rng_;
+		vector<pair<uint64_t, uint64_t> > stripes_;
+	};
+
+	struct mapping_run {
+		mapping_run(uint64_t origin_begin, uint64_t data_begin,
+			    uint64_t len, uint32_t time)
+			: origin_begin_(origin_begin),
+			  data_begin_(data_begin),
+			  len_(len),
+			  time_(time) {
+		}
+
+		uint64_t origin_begin_;
+		uint64_t data_begin_;
+		uint64_t len_;
+		uint32_t time_;
+	};
+
+	// The mappings of a device that's been snapshotted, split at
+	// leaf boundaries.  They're kept until the snapshot is built.
+	struct device_mappings {
+		void clear() {
+			runs_.clear();
+			leaf_begins_.clear();
+			leaf_names_.clear();
+		}
+
+		vector<mapping_run> runs_;
+		vector<size_t> leaf_begins_;
+		vector<string> leaf_names_;
+	};
+
+	class generator {
+	public:
+		generator(generator_params const &p, emitter::ptr e)
+			: p_(p),
+			  e_(e),
+			  rng_(p.seed),
+			  alloc_(get_nr_data_blocks(p), rng_),
+			  nr_leaves_(div_up<uint64_t>(p.nr_mappings, LEAF_MAPPINGS)),
+			  max_run_(2 * p.run_length - 1),
+			  keep_runs_(false),
+			  run_left_(0),
+			  run_next_(0) {
+		}
+
+		void generate() {
+			e_->begin_superblock("", p_.snap_depth, 1, p_.data_block_size,
+					     get_nr_data_blocks(p_), boost::optional<uint64_t>());
+
+			for (unsigned thin = 0; thin < p_.nr_thins; thin++)
+				generate_chain(thin);
+
+			e_->end_superblock();
+		}
+
+	private:
+		static uint64_t get_nr_data_blocks(generator_params const &p) {
+			return p.nr_data_blocks ? p.nr_data_blocks : max_data_blocks_used(p);
+		}
+
+		// The origin is created at time 0, and each snapshot
+		// bumps the time.
+		void generate_chain(unsigned thin) {
+			device_mappings parent, current;
+
+			for (unsigned depth = 0; depth <= p_.snap_depth; depth++) {
+				uint32_t dev = thin * (p_.snap_depth + 1) + depth;
+				bool snapshotted = depth < p_.snap_depth;
+
+				e_->begin_device(dev, p_.nr_mappings, 1, depth,
+						 snapshotted ? depth + 1 : depth);
+
+				current.clear();
+				keep_runs_ = snapshotted;
+				run_left_ = 0;
+
+				for (uint64_t leaf = 0; leaf < nr_leaves_; leaf++) {
+					if (depth && rng_.percent(p_.sharing)) {
+						share_leaf(parent, leaf, current);
+						continue;
+					}
+
+					if (snapshotted) {
+						ostringstream name;
+						name << dev << "." << leaf;
+						current.leaf_names_.push_back(name.str());
+						current.leaf_begins_.push_back(current.runs_.size());
+						e_->begin_named_mapping(name.str());
+					}
+
+					if (depth)
+						copy_leaf(parent, leaf, depth, current);
+					else
+						fill_leaf(leaf, current);
+
+					if (snapshotted)
+						e_->end_named_mapping();
+				}
+
+				e_->end_device();
+				swap(parent, current);
+			}
+		}
+
+		void share_leaf(device_mappings const &parent, uint64_t leaf,
+				device_mappings &current) {
+			e_->identifier(parent.leaf_names_[leaf]);
+
+			if (keep_runs_) {
+				current.leaf_names_.push_back(parent.leaf_names_[leaf]);
+				current.leaf_begins_.push_back(current.runs_.size());
+				current.runs_.insert(current.runs_.end(),
+						     parent.runs_.begin() + leaf_begin(parent, leaf),
+						     parent.runs_.begin() + leaf_end(parent, leaf));
+			}
+		}
+
+		// Origins map every block.  Runs of data carry on across
+		// leaves.
+		void fill_leaf(uint64_t leaf, device_mappings &current) {
+			uint64_t b = leaf * LEAF_MAPPINGS;
+			uint64_t e = min<uint64_t>(b + LEAF_MAPPINGS, p_.nr_mappings);
+
+			while (b < e) {
+				if (!run_left_)
+					run_left_ = alloc_.alloc(1 + rng_.below(max_run_), run_next_);
+
+				uint64_t len = min<uint64_t>(run_left_, e - b);
+				emit(current, mapping_run(b, run_next_, len, 0));
+
+				b += len;
+				run_next_ += len;
+				run_left_ -= len;
+			}
+		}
+
+		// Overwrites one of the parent's runs with new data, and
+		// keeps the rest.
+		void copy_leaf(device_mappings const &parent, uint64_t leaf,
+			       uint32_t time, device_mappings &current) {
+			size_t begin = leaf_begin(parent, leaf);
+			size_t end = leaf_end(parent, leaf);
+			size_t overwritten = begin + rng_.below(end - begin);
+
+			for (size_t i = begin; i < end; i++) {
+				mapping_run const &r = parent.runs_[i];
+
+				if (i != overwritten) {
+					emit(current, r);
+					continue;
+				}
+
+				uint64_t b = r.origin_begin_;
+				uint64_t e = b + r.len_;
+				while (b < e) {
+					uint64_t data;
+					uint64_t len = alloc_.alloc(e - b, data);
+					emit(current, mapping_run(b, data, len, time));
+					b += len;
+				}
+			}
+		}
+
+		void emit(device_mappings &current, mapping_run const &r) {
+			e_->range_map(r.origin_begin_, r.data_begin_, r.time_, r.len_);
+			if (keep_runs_)
+				current.runs_.push_back(r);
+		}
+
+		size_t leaf_begin(device_mappings const &dm, uint64_t leaf) const {
+			return dm.leaf_begins_[leaf];
+		}
+
+		size_t leaf_end(device_mappings const &dm, uint64_t leaf) const {
+			return leaf + 1 < dm.leaf_begins_.size() ?
+				dm.leaf_begins_[leaf + 1] : dm.runs_.size();
+		}
+
+		generator_params const &p_;
+		emitter::ptr e_;
+		rng rng_;
+		data_allocator alloc_;
+		uint64_t nr_leaves_;
+		uint64_t max_run_;
+
+		// Only snapshotted devices' runs are needed later.
+		bool keep_runs_;
+
+		// The origin's current run of data blocks.
+		uint64_t run_left_;
+		uint64_t run_next_;
+	};
+}
+
+//----------------------------------------------------------------
+
+generator_params::generator_params()
+	: nr_thins(1),
+	  snap_depth(0),
+	  nr_mappings(1024 * 1024),
+	  sharing(90),
+	  run_length(16),
+	  data_block_size(128),
+	  nr_data_blocks(0),
+	  seed(0)
+{
+}
+
+uint64_t
+thin_provisioning::max_data_blocks_used(generator_params const &p)
+{
+	uint64_t nr_leaves = div_up<uint64_t>(p.nr_mappings, LEAF_MAPPINGS);
+	uint64_t max_run = min<uint64_t>(2 * p.run_length - 1, LEAF_MAPPINGS);
+
+	return p.nr_thins * (p.nr_mappings + p.snap_depth * nr_leaves * max_run);
+}
+
+// Mapping leaves dominate.  The ref count tree for data blocks that
+// are in three or more leaves takes at most as many again, and
+// internal nodes add a little over 1%.
+block_address
+thin_provisioning::estimate_metadata_size(generator_params const &p)
+{
+	uint64_t nr_leaves = div_up<uint64_t>(p.nr_mappings, LEAF_MAPPINGS);
+	uint64_t nr_unshared = nr_leaves * (100 + p.snap_depth * (100 - p.sharing)) / 100;
+	uint64_t nr_mapping_blocks = p.nr_thins * nr_unshared;
+
+	uint64_t nr_data_blocks = p.nr_data_blocks ? p.nr_data_blocks : max_data_blocks_used(p);
+	uint64_t nr_bitmaps = div_up<uint64_t>(nr_data_blocks, ENTRIES_PER_BITMAP);
+
+	uint64_t nr_devs = p.nr_thins * (p.snap_depth + 1);
+	uint64_t size = 2 * nr_mapping_blocks + nr_mapping_blocks / 64 +
+		2 * nr_bitmaps + 2 * nr_devs + 1024;
+
+	return min<uint64_t>(size, sm_disk_detail::MAX_METADATA_BLOCKS);
+}
+
+void
+thin_provisioning::generate_metadata(generator_params const &p, emitter::ptr e)
+{
+	if (!p.run_length)
+		throw runtime_error("run length must be at least one");
+
+	if (p.sharing > 100)
+		throw runtime_error("sharing is a percentage");
+
+	generator g(p, e);
+	g.generate();
+}
+
+//----------------------------------------------------------------
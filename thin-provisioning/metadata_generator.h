@@ -0,0 +1,54 @@
+#ifndef THIN_METADATA_GENERATOR_H
+#define THIN_METADATA_GENERATOR_H
+
+#include "persistent-data/block.h"
+#include "thin-provisioning/emitter.h"
+
+//----------------------------------------------------------------
+
+namespace thin_provisioning {
+	// Describes the synthetic metadata generate_metadata() makes.
+	//
+	// Each origin heads a chain of snapshots, every one taken from
+	// the device before it.  All devices map the same blocks,
+	// starting from zero.  A snapshot either shares a leaf's worth
+	// of mappings with the device it was taken from, or has a copy
+	// of them in which one run of blocks has been overwritten.
+	struct generator_params {
+		generator_params();
+
+		unsigned nr_thins;
+		unsigned snap_depth;
+		uint64_t nr_mappings;
+
+		// Percentage of a snapshot's leaves that are shared.
+		unsigned sharing;
+
+		// Mean length of a run of consecutive data blocks; the
+		// shorter the runs, the more fragmented the mappings.
+		unsigned run_length;
+
+		uint32_t data_block_size;
+
+		// Zero gives a data device just big enough for the
+		// worst case.
+		uint64_t nr_data_blocks;
+
+		uint64_t seed;
+	};
+
+	// The most data blocks the generator can allocate.
+	uint64_t max_data_blocks_used(generator_params const &p);
+
+	// A metadata device size with room for the generated metadata.
+	persistent_data::block_address estimate_metadata_size(generator_params const &p);
+
+	// The same params always give the same metadata.  Devices
+	// that have been snapshotted are emitted as named mappings,
+	// a leaf each, so the sharing survives a restore.
+	void generate_metadata(generator_params const &p, emitter::ptr e);
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -0,0 +1,308 @@
+#include "thin-provisioning/metadata_scanner.h"
+
+#include "base/endian_utils.h"
+#include "base/error_string.h"
+#include "base/progress_monitor.h"
+#include "persistent-data/data-structures/btree_disk_structures.h"
+#include "persistent-data/errors.h"
+#include "persistent-data/space-maps/disk.h"
+#include "persistent-data/validators.h"
+#include "thin-provisioning/superblock.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace base;
+using namespace persistent_data;
+using namespace std;
+using namespace thin_provisioning;
+using namespace scan_detail;
+
+//----------------------------------------------------------------
+
+namespace {
+	// Every kind of metadata block starts with a checksum, a 32 bit
+	// word, then the block's own location.
+	struct block_header {
+		le32 csum;
+		le32 flags;
+		le64 blocknr;
+	} __attribute__((packed));
+
+	bool valid(bcache::validator::ptr v, void const *data, block_address location) {
+		try {
+			v->check(data, location);
+			return true;
+
+		} catch (checksum_error &e) {
+			return false;
+		}
+	}
+
+	class classifier {
+	public:
+		classifier()
+			: btree_v_(create_btree_node_validator()),
+			  bitmap_v_(bitmap_validator()),
+			  index_v_(index_validator()),
+			  sb_v_(superblock_validator()) {
+		}
+
+		block_type classify(void const *data, block_address location) const {
+			using namespace btree_detail;
+
+			block_header const *h = reinterpret_cast<block_header const *>(data);
+			if (to_cpu<uint64_t>(h->blocknr) != location)
+				return UNKNOWN;
+
+			uint32_t flags = to_cpu<uint32_t>(h->flags);
+			if ((flags == INTERNAL_NODE || flags == LEAF_NODE) &&
+			    valid(btree_v_, data, location))
+				return (flags == INTERNAL_NODE) ? BTREE_INTERNAL : BTREE_LEAF;
+
+			if (valid(bitmap_v_, data, location))
+				return BITMAP;
+
+			if (valid(index_v_, data, location))
+				return INDEX;
+
+			if (valid(sb_v_, data, location))
+				return SUPERBLOCK;
+
+			return UNKNOWN;
+		}
+
+	private:
+		bcache::validator::ptr btree_v_;
+		bcache::validator::ptr bitmap_v_;
+		bcache::validator::ptr index_v_;
+		bcache::validator::ptr sb_v_;
+	};
+
+	classifier const &get_classifier() {
+		static classifier c;
+		return c;
+	}
+
+	void summarise_node(void const *data, block_info &info) {
+		using namespace btree_detail;
+
+		disk_node const *n = reinterpret_cast<disk_node const *>(data);
+		info.nr_entries = to_cpu<uint32_t>(n->header.nr_entries);
+		info.value_size = to_cpu<uint32_t>(n->header.value_size);
+
+		uint64_t max_entries = to_cpu<uint32_t>(n->header.max_entries);
+		uint64_t entry_size = sizeof(uint64_t) + info.value_size;
+		if (!info.nr_entries || info.nr_entries > max_entries ||
+		    sizeof(node_header) + max_entries * entry_size > MD_BLOCK_SIZE)
+			return;
+
+		info.lowest_key = to_cpu<uint64_t>(n->keys[0]);
+		info.highest_key = to_cpu<uint64_t>(n->keys[info.nr_entries - 1]);
+	}
+}
+
+//----------------------------------------------------------------
+
+block_info::block_info()
+	: location(0),
+	  type(UNKNOWN),
+	  nr_entries(0),
+	  value_size(0),
+	  lowest_key(0),
+	  highest_key(0)
+{
+}
+
+block_type
+thin_provisioning::classify_block(void const *data, block_address location)
+{
+	return get_classifier().classify(data, location);
+}
+
+//----------------------------------------------------------------
+
+block_address const metadata_scanner::DEFAULT_CHUNK_BLOCKS;
+
+metadata_scanner::metadata_scanner(string const &path, block_address nr_blocks,
+				   block_address chunk_blocks)
+	: fd_(-1),
+	  nr_blocks_(nr_blocks),
+	  chunk_blocks_(chunk_blocks),
+	  buffer_(NULL),
+	  nr_read_(0)
+{
+	if (!chunk_blocks_)
+		throw runtime_error("scan chunk size must be greater than zero");
+
+	void *buffer;
+	if (posix_memalign(&buffer, MD_BLOCK_SIZE, chunk_blocks_ * MD_BLOCK_SIZE))
+		throw runtime_error("couldn't allocate scan buffer");
+	buffer_ = static_cast<unsigned char *>(buffer);
+
+	// O_DIRECT, like the block manager, so the scan doesn't fill
+	// the page cache.
+	fd_ = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+	if (fd_ < 0) {
+		free(buffer_);
+		throw runtime_error("couldn't open " + path + ": " + error_string(errno));
+	}
+
+	posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+metadata_scanner::~metadata_scanner()
+{
+	::close(fd_);
+	free(buffer_);
+}
+
+void
+metadata_scanner::scan(scan_visitor &v)
+{
+	scan_(vector<bool>(nr_blocks_, true), v);
+}
+
+namespace {
+	class allocation_iterator : public space_map::iterator {
+	public:
+		allocation_iterator(vector<bool> &allocated)
+			: allocated_(allocated) {
+		}
+
+		virtual void operator() (block_address b, ref_t c) {
+			if (c && b < allocated_.size())
+				allocated_[b] = true;
+		}
+
+	private:
+		vector<bool> &allocated_;
+	};
+}
+
+void
+metadata_scanner::scan(space_map const &sm, scan_visitor &v)
+{
+	// Asking for each block's count in turn is slower than the
+	// scan itself.
+	vector<bool> allocated(nr_blocks_, false);
+	allocation_iterator it(allocated);
+	sm.iterate(it);
+
+	scan_(allocated, v);
+}
+
+void
+metadata_scanner::scan_(vector<bool> const &wanted, scan_visitor &v)
+{
+	for (block_address chunk = 0; chunk < nr_blocks_; chunk += chunk_blocks_) {
+		block_address chunk_end = min(chunk + chunk_blocks_, nr_blocks_);
+
+		block_address begin = chunk;
+		while (begin < chunk_end && !wanted[begin])
+			begin++;
+
+		block_address end = chunk_end;
+		while (end > begin && !wanted[end - 1])
+			end--;
+
+		if (begin == end)
+			continue;
+
+		read_blocks(begin, end);
+
+		for (block_address b = begin; b < end; b++) {
+			if (!wanted[b])
+				continue;
+
+			void const *data = buffer_ + (b - begin) * MD_BLOCK_SIZE;
+			v.visit(b, classify_block(data, b), data);
+			walk_progress_node();
+		}
+	}
+}
+
+void
+metadata_scanner::read_blocks(block_address begin, block_address end)
+{
+	size_t len = (end - begin) * MD_BLOCK_SIZE;
+	off_t offset = begin * MD_BLOCK_SIZE;
+
+	size_t done = 0;
+	while (done < len) {
+		ssize_t r = ::pread(fd_, buffer_ + done, len - done, offset + done);
+		if (r < 0 && errno == EINTR)
+			continue;
+
+		if (r <= 0) {
+			ostringstream out;
+			out << "couldn't read metadata blocks " << begin << ".." << end << ": "
+			    << (r < 0 ? error_string(errno) : "unexpected end of device");
+			throw runtime_error(out.str());
+		}
+
+		done += r;
+	}
+
+	nr_read_ += end - begin;
+}
+
+//----------------------------------------------------------------
+
+node_index::node_index(block_manager<>::ptr bm)
+	: bm_(bm),
+	  counts_(NR_BLOCK_TYPES, 0)
+{
+}
+
+void
+node_index::visit(block_address b, block_type t, void const *data)
+{
+	counts_[t]++;
+	if (t == UNKNOWN)
+		return;
+
+	block_info info;
+	info.location = b;
+	info.type = t;
+	if (t == BTREE_INTERNAL || t == BTREE_LEAF)
+		summarise_node(data, info);
+
+	if (!blocks_.empty() && blocks_.back().location >= b)
+		throw runtime_error("node_index: blocks visited out of order");
+	blocks_.push_back(info);
+
+	if (bm_)
+		bm_->preload(b, data);
+}
+
+namespace {
+	bool cmp_location(block_info const &lhs, block_address rhs) {
+		return lhs.location < rhs;
+	}
+}
+
+block_info const *
+node_index::find(block_address b) const
+{
+	vector<block_info>::const_iterator it =
+		lower_bound(blocks_.begin(), blocks_.end(), b, cmp_location);
+
+	if (it == blocks_.end() || it->location != b)
+		return NULL;
+
+	return &(*it);
+}
+
+block_address
+node_index::get_nr_blocks(block_type t) const
+{
+	return counts_[t];
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,115 @@
+#ifndef THIN_METADATA_SCANNER_H
+#define THIN_METADATA_SCANNER_H
+
+#include "persistent-data/block.h"
+#include "persistent-data/space_map.h"
+
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace thin_provisioning {
+	using namespace persistent_data;
+
+	namespace scan_detail {
+		enum block_type {
+			UNKNOWN,
+			SUPERBLOCK,
+			BTREE_INTERNAL,
+			BTREE_LEAF,
+			BITMAP,
+			INDEX,
+			NR_BLOCK_TYPES
+		};
+
+		// A block that passed its checksum.
+		struct block_info {
+			block_info();
+
+			block_address location;
+			block_type type;
+
+			// btree nodes only.  The keys are only filled in if
+			// the header is sane.
+			uint32_t nr_entries;
+			uint32_t value_size;
+			uint64_t lowest_key;
+			uint64_t highest_key;
+		};
+	}
+
+	// Works out what a metadata block is from the checksum it
+	// carries.  A block with a bad checksum, or that belongs
+	// somewhere else, is UNKNOWN.
+	scan_detail::block_type classify_block(void const *data, block_address location);
+
+	class scan_visitor {
+	public:
+		virtual ~scan_visitor() {}
+		virtual void visit(block_address b, scan_detail::block_type t, void const *data) = 0;
+	};
+
+	// Reads the metadata device from start to finish in large
+	// chunks, rather than chasing pointers from the superblock,
+	// which is many times slower on rotational devices.  Every
+	// block read is classified and passed to the visitor, in order.
+	class metadata_scanner : private boost::noncopyable {
+	public:
+		static block_address const DEFAULT_CHUNK_BLOCKS = 256;
+
+		metadata_scanner(std::string const &path, block_address nr_blocks,
+				 block_address chunk_blocks = DEFAULT_CHUNK_BLOCKS);
+		~metadata_scanner();
+
+		void scan(scan_visitor &v);
+
+		// Only reads blocks the space map holds references to.  Free
+		// blocks in between allocated ones in the same chunk are
+		// read anyway, to keep the io large, but aren't visited.
+		void scan(space_map const &sm, scan_visitor &v);
+
+		block_address get_nr_read() const {
+			return nr_read_;
+		}
+
+	private:
+		void scan_(std::vector<bool> const &wanted, scan_visitor &v);
+		void read_blocks(block_address begin, block_address end);
+
+		int fd_;
+		block_address nr_blocks_;
+		block_address chunk_blocks_;
+		unsigned char *buffer_;
+
+		block_address nr_read_;
+	};
+
+	// Records what a scan found.  If a block manager is given, the
+	// blocks that passed their checksum are also preloaded into its
+	// cache, so walking the trees afterwards doesn't go to disk.
+	class node_index : public scan_visitor {
+	public:
+		node_index(block_manager<>::ptr bm = block_manager<>::ptr());
+
+		virtual void visit(block_address b, scan_detail::block_type t, void const *data);
+
+		// Returns NULL for blocks that weren't recognised.
+		scan_detail::block_info const *find(block_address b) const;
+
+		block_address get_nr_blocks(scan_detail::block_type t) const;
+
+	private:
+		block_manager<>::ptr bm_;
+
+		// Kept in block order, since that's the order they're
+		// scanned in.
+		std::vector<scan_detail::block_info> blocks_;
+		std::vector<block_address> counts_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
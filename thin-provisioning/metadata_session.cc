@@ -0,0 +1,155 @@
+#include "thin-provisioning/metadata_session.h"
+
+#include "persistent-data/data-structures/simple_traits.h"
+#include "persistent-data/file_utils.h"
+#include "persistent-data/validators.h"
+
+#include <sstream>
+#include <stdexcept>
+
+using namespace persistent_data;
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_manager<>::ptr open_session_bm(string const &path, bool use_metadata_snap,
+					     size_t cache_mem) {
+		block_address nr_blocks = get_nr_blocks(path);
+		return block_manager<>::ptr(
+			new block_manager<>(path, nr_blocks, 1, block_manager<>::READ_ONLY,
+					    !use_metadata_snap, cache_mem));
+	}
+
+	void no_such_device(uint64_t dev_id) {
+		ostringstream out;
+		out << "no such thin device: " << dev_id;
+		throw runtime_error(out.str());
+	}
+
+	// Descends only into the subtrees that overlap the range.
+	void record_range(transaction_manager &tm, bcache::validator::ptr v,
+			  block_address b, uint64_t begin, uint64_t end,
+			  delta_detail::mapping_recorder &mr) {
+		using namespace btree_detail;
+
+		vector<block_address> children;
+		{
+			transaction_manager::read_ref rr = tm.read_lock(b, v);
+			node_ref<uint64_traits> n = to_node<uint64_traits>(rr);
+			unsigned nr_entries = n.get_nr_entries();
+			unsigned i = max(n.lower_bound(begin), 0);
+
+			if (n.get_type() == INTERNAL) {
+				for (; i < nr_entries && n.key_at(i) < end; i++)
+					children.push_back(n.value_at(i));
+
+			} else {
+				node_ref<mapping_tree_detail::block_traits> leaf =
+					to_node<mapping_tree_detail::block_traits>(rr);
+				btree_path path(1, 0);
+
+				for (; i < nr_entries && leaf.key_at(i) < end; i++) {
+					if (leaf.key_at(i) < begin)
+						continue;
+
+					path[0] = leaf.key_at(i);
+					mr.visit(path, leaf.value_at(i));
+				}
+			}
+		}
+
+		vector<block_address>::const_iterator it;
+		for (it = children.begin(); it != children.end(); ++it)
+			record_range(tm, v, *it, begin, end, mr);
+	}
+}
+
+//----------------------------------------------------------------
+
+metadata_session::metadata_session(string const &path, bool use_metadata_snap,
+				   size_t cache_mem)
+	: bm_(open_session_bm(path, use_metadata_snap, cache_mem)),
+	  nr_data_blocks_(0)
+{
+	if (use_metadata_snap)
+		md_.reset(new metadata(bm_, boost::optional<block_address>()));
+	else
+		md_.reset(new metadata(bm_));
+
+	if (md_->data_sm_)
+		nr_data_blocks_ = md_->data_sm_->get_nr_blocks();
+
+	devices_ = read_device_details(*md_);
+}
+
+device_tree_detail::device_details const &
+metadata_session::get_device(uint64_t dev_id) const
+{
+	dd_map::const_iterator it = devices_.find(dev_id);
+	if (it == devices_.end())
+		no_such_device(dev_id);
+
+	return it->second;
+}
+
+block_address
+metadata_session::get_exclusive_blocks(uint64_t dev_id)
+{
+	get_device(dev_id);
+
+	if (!shared_.get()) {
+		auto_ptr<mapping_set> shared(new mapping_set());
+
+		dd_map::const_iterator it;
+		for (it = devices_.begin(); it != devices_.end(); ++it)
+			add_mappings(*md_, it->first, *shared);
+
+		shared_ = shared;
+	}
+
+	map<uint64_t, block_address>::const_iterator it = exclusives_.find(dev_id);
+	if (it != exclusives_.end())
+		return it->second;
+
+	block_address exclusive = count_exclusives(*md_, *shared_, dev_id);
+	exclusives_.insert(make_pair(dev_id, exclusive));
+	return exclusive;
+}
+
+delta_detail::mapping_deque
+metadata_session::lookup_range(uint64_t dev_id, uint64_t begin, uint64_t end)
+{
+	delta_detail::mapping_recorder mr;
+
+	if (begin < end)
+		record_range(*md_->tm_, create_btree_node_validator(),
+			     get_root(dev_id), begin, end, mr);
+	mr.complete();
+
+	return mr.get_mappings();
+}
+
+void
+metadata_session::delta(uint64_t left_dev, uint64_t right_dev, delta_visitor &v)
+{
+	mapping_tree_detail::block_traits::ref_counter rc(md_->tm_->get_sm());
+	single_mapping_tree left(*md_->tm_, get_root(left_dev), rc);
+	single_mapping_tree right(*md_->tm_, get_root(right_dev), rc);
+
+	compare_mappings(read_mappings(left), read_mappings(right), v);
+}
+
+block_address
+metadata_session::get_root(uint64_t dev_id) const
+{
+	dev_tree::key k = {dev_id};
+	boost::optional<uint64_t> root = md_->mappings_top_level_->lookup(k);
+	if (!root)
+		no_such_device(dev_id);
+
+	return *root;
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,69 @@
+#ifndef THIN_METADATA_SESSION_H
+#define THIN_METADATA_SESSION_H
+
+#include "thin-provisioning/device_accounting.h"
+#include "thin-provisioning/mapping_delta.h"
+#include "thin-provisioning/metadata.h"
+
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <string>
+
+//----------------------------------------------------------------
+
+namespace thin_provisioning {
+	// Keeps a pool's metadata open between queries, so the
+	// superblock, space maps and devices tree are only read once
+	// and the block cache stays warm.  Nothing is re-read, so the
+	// metadata mustn't change underneath it: for a live pool, open
+	// the metadata snap.
+	class metadata_session : private boost::noncopyable {
+	public:
+		typedef boost::shared_ptr<metadata_session> ptr;
+
+		metadata_session(std::string const &path, bool use_metadata_snap,
+				 size_t cache_mem = DEFAULT_BLOCK_CACHE_MEM);
+
+		superblock_detail::superblock const &get_superblock() const {
+			return md_->sb_;
+		}
+
+		block_address get_nr_data_blocks() const {
+			return nr_data_blocks_;
+		}
+
+		dd_map const &get_devices() const {
+			return devices_;
+		}
+
+		// The queries on a device throw if there's no such device.
+		device_tree_detail::device_details const &get_device(uint64_t dev_id) const;
+
+		// The first call walks every device's mappings, to see
+		// which data blocks are shared.
+		block_address get_exclusive_blocks(uint64_t dev_id);
+
+		// The mappings for thin blocks [begin, end), merged into
+		// runs.  Only the parts of the tree that cover the range
+		// are read.
+		delta_detail::mapping_deque lookup_range(uint64_t dev_id,
+							  uint64_t begin, uint64_t end);
+
+		void delta(uint64_t left_dev, uint64_t right_dev, delta_visitor &v);
+
+	private:
+		block_address get_root(uint64_t dev_id) const;
+
+		block_manager<>::ptr bm_;
+		metadata::ptr md_;
+		block_address nr_data_blocks_;
+		dd_map devices_;
+
+		std::auto_ptr<mapping_set> shared_;
+		std::map<uint64_t, block_address> exclusives_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
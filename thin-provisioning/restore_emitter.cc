@@ -18,6 +18,9 @@
 
 #include "thin-provisioning/restore_emitter.h"
 #include "thin-provisioning/superblock.h"
+#include "persistent-data/data-structures/btree_builder.h"
+
+#include <algorithm>
 
 using namespace std;
 using namespace thin_provisioning;
@@ -27,18 +30,15 @@ using namespace thin_provisioning;
 namespace {
 	using namespace superblock_detail;
 
+	// Mapping trees are built bottom up, from mappings in ascending
+	// order.  Named mappings get their own tree; each reference to
+	// one shares that tree's nodes rather than copying them.
 	class restorer : public emitter {
 	public:
 		restorer(metadata::ptr md)
 			: md_(md),
 			  in_superblock_(false),
-			  nr_data_blocks_(),
-			  empty_mapping_(new_mapping_tree()) {
-		}
-
-		virtual ~restorer() {
-			// FIXME: replace with a call to empty_mapping_->destroy()
-			md_->metadata_sm_->dec(empty_mapping_->get_root());
+			  nr_data_blocks_() {
 		}
 
 		virtual void begin_superblock(std::string const &uuid,
@@ -63,6 +63,7 @@ namespace {
 			if (!in_superblock_)
 				throw runtime_error("missing superblock");
 
+			release_named_mappings();
 			md_->commit();
 			in_superblock_ = false;
 		}
@@ -83,38 +84,97 @@ namespace {
 			device_tree_detail::device_details details = {mapped_blocks, trans_id, (uint32_t)creation_time, (uint32_t)snap_time};
 			md_->details_->insert(key, details);
 
-			current_mapping_ = empty_mapping_->clone();
+			builders_.push_back(new_builder());
 			current_device_ = boost::optional<uint32_t>(dev);
 		}
 
 		virtual void end_device() {
+			if (!current_device_ || !named_.empty())
+				throw runtime_error("unexpected end of device");
+
 			uint64_t key[1] = {*current_device_};
+			block_address root;
+
+			if (current_mapping_) {
+				root = current_mapping_->get_root();
+				current_mapping_.reset();
+			} else
+				root = builders_.back()->get_root();
+			builders_.pop_back();
 
-			md_->mappings_top_level_->insert(key, current_mapping_->get_root());
+			md_->mappings_top_level_->insert(key, root);
 			md_->mappings_->set_root(md_->mappings_top_level_->get_root()); // FIXME: ugly
 
 			current_device_ = boost::optional<uint32_t>();
+			last_key_ = boost::optional<uint64_t>();
 		}
 
+		// A named mapping within a device also forms part of that
+		// device at the point it's defined.
 		virtual void begin_named_mapping(std::string const &name) {
-			throw runtime_error("not implemented");
+			if (!in_superblock_)
+				throw runtime_error("missing superblock");
+
+			if (named_mappings_.count(name) || std::count(named_.begin(), named_.end(), name))
+				throw runtime_error("duplicate named mapping '" + name + "'");
+
+			named_.push_back(name);
+			builders_.push_back(new_builder());
 		}
 
 		virtual void end_named_mapping() {
-			throw runtime_error("not implemented");
+			if (named_.empty())
+				throw runtime_error("unexpected end of named mapping");
+
+			block_address root = builders_.back()->get_root();
+			builders_.pop_back();
+			named_mappings_.insert(make_pair(named_.back(), root));
+			named_.pop_back();
+
+			if (!builders_.empty())
+				reference(root);
 		}
 
 		virtual void identifier(std::string const &name) {
-			throw runtime_error("not implemented");
+			std::map<std::string, block_address>::const_iterator it = named_mappings_.find(name);
+			if (it == named_mappings_.end())
+				throw runtime_error("unknown named mapping '" + name + "'");
+
+			if (builders_.empty())
+				throw runtime_error("not in device");
+
+			reference(it->second);
 		}
 
+		// The data blocks' counts are bumped together, a space
+		// map bitmap at a time.
 		virtual void range_map(uint64_t origin_begin, uint64_t data_begin, uint32_t time, uint64_t len) {
+			if (!len)
+				return;
+
+			check_data_block(data_begin + len - 1);
 			for (uint64_t i = 0; i < len; i++)
-				single_map(origin_begin++, data_begin++, time);
+				push_mapping(origin_begin + i, data_begin + i, time);
+
+			md_->data_sm_->inc_range(data_begin, data_begin + len);
 		}
 
 		virtual void single_map(uint64_t origin_block, uint64_t data_block, uint32_t time) {
-			if (!current_device_)
+			check_data_block(data_block);
+			push_mapping(origin_block, data_block, time);
+			md_->data_sm_->inc(data_block);
+		}
+
+	private:
+		typedef btree_builder<mapping_tree_detail::block_traits> builder;
+		typedef boost::shared_ptr<builder> builder_ptr;
+
+		mapping_tree_detail::block_time_ref_counter ref_counter() {
+			return mapping_tree_detail::block_time_ref_counter(md_->data_sm_);
+		}
+
+		void check_data_block(uint64_t data_block) const {
+			if (builders_.empty())
 				throw runtime_error("not in device");
 
 			if (data_block >= nr_data_blocks_) {
@@ -123,20 +183,56 @@ namespace {
 				    << " >= " << nr_data_blocks_ << ")";
 				throw std::runtime_error(out.str());
 			}
+		}
 
-			uint64_t key[1] = {origin_block};
+		void push_mapping(uint64_t origin_block, uint64_t data_block, uint32_t time) {
 			mapping_tree_detail::block_time bt;
 			bt.block_ = data_block;
 			bt.time_ = time;
-			current_mapping_->insert(key, bt);
-			md_->data_sm_->inc(data_block);
+
+			// Hand written metadata may not be in order, in which
+			// case we fall back to inserting into the tree built
+			// so far.
+			if (named_.empty() && !current_mapping_ &&
+			    last_key_ && origin_block <= *last_key_)
+				current_mapping_ = single_mapping_tree::ptr(
+					new single_mapping_tree(*md_->tm_,
+								builders_.back()->get_root(),
+								ref_counter()));
+
+			if (current_mapping_) {
+				uint64_t key[1] = {origin_block};
+				current_mapping_->insert(key, bt);
+			} else
+				builders_.back()->push_value(origin_block, bt);
+
+			if (named_.empty())
+				last_key_ = origin_block;
 		}
 
-	private:
-		single_mapping_tree::ptr new_mapping_tree() {
-			return single_mapping_tree::ptr(
-				new single_mapping_tree(*md_->tm_,
-							mapping_tree_detail::block_time_ref_counter(md_->data_sm_)));
+		builder_ptr new_builder() {
+			return builder_ptr(new builder(*md_->tm_, ref_counter()));
+		}
+
+		void reference(block_address root) {
+			if (current_mapping_)
+				throw runtime_error("named mappings can't be referenced after out of order mappings");
+
+			builders_.back()->push_subtree(root);
+			if (named_.empty())
+				last_key_ = builders_.back()->get_last_key();
+		}
+
+		// Each named mapping holds a reference to its tree, which
+		// is dropped once all the devices have been restored.
+		void release_named_mappings() {
+			builder b(*md_->tm_, ref_counter());
+
+			std::map<std::string, block_address>::const_iterator it;
+			for (it = named_mappings_.begin(); it != named_mappings_.end(); ++it)
+				b.release_subtree(it->second);
+
+			named_mappings_.clear();
 		}
 
 		bool device_exists(thin_dev_t dev) const {
@@ -149,8 +245,12 @@ namespace {
 		bool in_superblock_;
 		block_address nr_data_blocks_;
 		boost::optional<uint32_t> current_device_;
+		boost::optional<uint64_t> last_key_;
 		single_mapping_tree::ptr current_mapping_;
-		single_mapping_tree::ptr empty_mapping_;
+
+		std::vector<builder_ptr> builders_;
+		std::vector<std::string> named_;
+		std::map<std::string, block_address> named_mappings_;
 	};
 }
 
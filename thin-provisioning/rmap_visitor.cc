@@ -2,12 +2,16 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 
 using namespace thin_provisioning;
 
 //----------------------------------------------------------------
 
 rmap_visitor::rmap_visitor()
+	: index_built_(false),
+	  hull_begin_(0),
+	  hull_end_(0)
 {
 }
 
@@ -15,6 +19,7 @@ void
 rmap_visitor::add_data_region(region const &r)
 {
 	regions_.push_back(r);
+	index_built_ = false;
 }
 
 void
@@ -29,11 +34,34 @@ rmap_visitor::visit(btree_path const &path,
 	}
 }
 
+void
+rmap_visitor::visit_mapping(uint32_t thin_dev, block_address thin_block,
+			    mapping_tree_detail::block_time const &bt)
+{
+	if (in_regions(bt.block_))
+		visit_block(thin_dev, thin_block, bt.block_);
+}
+
 namespace {
+	// Blocks may be shared between devices, so ties are broken to
+	// keep the output the same however the walk was split up.
 	bool cmp_data_begin(rmap_visitor::rmap_region const &lhs,
 			    rmap_visitor::rmap_region const &rhs) {
-		return lhs.data_begin < rhs.data_begin;
+		if (lhs.data_begin != rhs.data_begin)
+			return lhs.data_begin < rhs.data_begin;
+
+		if (lhs.thin_dev != rhs.thin_dev)
+			return lhs.thin_dev < rhs.thin_dev;
+
+		return lhs.thin_begin < rhs.thin_begin;
 	};
+
+	typedef pair<block_address, block_address> interval;
+
+	interval to_interval(rmap_visitor::region const &r) {
+		return interval(r.begin_ ? *r.begin_ : 0,
+				r.end_ ? *r.end_ : numeric_limits<block_address>::max());
+	}
 }
 
 void
@@ -45,22 +73,73 @@ rmap_visitor::complete()
 	std::sort(rmap_.begin(), rmap_.end(), cmp_data_begin);
 }
 
+void
+rmap_visitor::merge(rmap_visitor const &rhs)
+{
+	size_t middle = rmap_.size();
+	rmap_.insert(rmap_.end(), rhs.rmap_.begin(), rhs.rmap_.end());
+	std::inplace_merge(rmap_.begin(), rmap_.begin() + middle, rmap_.end(), cmp_data_begin);
+}
+
 vector<rmap_visitor::rmap_region> const &
 rmap_visitor::get_rmap() const
 {
 	return rmap_;
 }
 
-// Slow, but I suspect we wont run with many regions.
+void
+rmap_visitor::build_index()
+{
+	vector<interval> intervals;
+	for (size_t i = 0; i < regions_.size(); i++) {
+		interval r = to_interval(regions_[i]);
+		if (r.first < r.second)
+			intervals.push_back(r);
+	}
+
+	std::sort(intervals.begin(), intervals.end());
+
+	begins_.clear();
+	ends_.clear();
+	for (size_t i = 0; i < intervals.size(); i++) {
+		interval const &r = intervals[i];
+
+		if (!ends_.empty() && r.first <= ends_.back())
+			ends_.back() = max(ends_.back(), r.second);
+		else {
+			begins_.push_back(r.first);
+			ends_.push_back(r.second);
+		}
+	}
+
+	hull_begin_ = begins_.empty() ? 0 : begins_.front();
+	hull_end_ = ends_.empty() ? 0 : ends_.back();
+	index_built_ = true;
+}
+
+// There may be thousands of regions (eg, bad sectors on the data
+// device), and this is called for every mapping.
 bool
-rmap_visitor::in_regions(block_address b) const
+rmap_visitor::in_regions(block_address b)
 {
-	vector<region>::const_iterator it;
-	for (it = regions_.begin(); it != regions_.end(); ++it)
-		if (it->contains(b))
-			return true;
+	if (!index_built_)
+		build_index();
+
+	if (b < hull_begin_ || b >= hull_end_)
+		return false;
+
+	// Find the last region beginning at or before b.  The loop
+	// runs a fixed number of times for a given number of regions,
+	// and the conditional is a select rather than a branch.
+	block_address const *base = &begins_[0];
+	size_t n = begins_.size();
+	while (n > 1) {
+		size_t half = n / 2;
+		base = (base[half] <= b) ? base + half : base;
+		n -= half;
+	}
 
-	return false;
+	return b < ends_[base - &begins_[0]];
 }
 
 bool
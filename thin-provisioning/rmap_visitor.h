@@ -14,6 +14,9 @@ namespace thin_provisioning {
 	// ii) visit the mapping tree
 	// iii) call complete()
 	// iv) get the rmaps with get_rmap();
+	//
+	// Visitors that walked different devices can be combined with
+	// merge(), so the walk can be split across threads.
 	class rmap_visitor {
 	public:
 		typedef run<block_address> region;
@@ -24,6 +27,10 @@ namespace thin_provisioning {
 		void add_data_region(region const &r);
 		void visit(btree_path const &path, mapping_tree_detail::block_time const &bt);
 
+		// For walking a single device's mapping tree.
+		void visit_mapping(uint32_t thin_dev, block_address thin_block,
+				   mapping_tree_detail::block_time const &bt);
+
 		struct rmap_region {
 			// FIXME: surely we don't need to provide this for
 			// a POD structure?
@@ -42,10 +49,16 @@ namespace thin_provisioning {
 		};
 
 		void complete();
+
+		// Both visitors must be complete, and must not have
+		// visited the same device.
+		void merge(rmap_visitor const &rhs);
+
 		vector<rmap_region> const &get_rmap() const;
 
 	private:
-		bool in_regions(block_address b) const;
+		void build_index();
+		bool in_regions(block_address b);
 		bool adjacent_block(rmap_region const &rr,
 				    uint32_t thin_dev, block_address thin_block,
 				    block_address data_block) const;
@@ -58,6 +71,14 @@ namespace thin_provisioning {
 
 		vector<region> regions_;
 
+		// The regions, merged and sorted.  Kept as separate arrays
+		// so the search only touches the begins.
+		bool index_built_;
+		vector<block_address> begins_;
+		vector<block_address> ends_;
+		block_address hull_begin_;
+		block_address hull_end_;
+
 		boost::optional<rmap_region> current_rmap_;
 		vector<rmap_region> rmap_;
 	};
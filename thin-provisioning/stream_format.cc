@@ -0,0 +1,538 @@
+// Copyright (C) 2011 Red Hat, Inc. All rights reserved.
+//
+// This file is part of the thin-provisioning-tools source.
+//
+// thin-provisioning-tools is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// thin-provisioning-tools is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with thin-provisioning-tools.  If not, see
+// <http://www.gnu.org/licenses/>.
+
+#include "thin-provisioning/stream_format.h"
+
+#include "base/compression.h"
+#include "persistent-data/checksum.h"
+#include "persistent-data/file_utils.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	char const STREAM_MAGIC[8] = { 'T', 'H', 'I', 'N', 'S', 'T', 'R', 'M' };
+	uint32_t const STREAM_VERSION = 1;
+	uint32_t const STREAM_CSUM_XOR = 0x5d3a1e07;
+
+	unsigned const HEADER_SIZE = 16;
+	unsigned const CHUNK_HEADER_SIZE = 8;
+
+	// Chunks are flushed once the payload passes this size.  It's a
+	// soft limit, a single record can take it a little over.
+	size_t const CHUNK_SIZE = 64 * 1024;
+
+	// No encoder ever produces anything this big, so a larger
+	// length means the stream is corrupt.
+	uint32_t const MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+	enum record_type {
+		SUPERBLOCK = 1,
+		END_SUPERBLOCK,
+		DEVICE,
+		END_DEVICE,
+		MAPPING,
+		NAMED_MAPPING,
+		END_NAMED_MAPPING,
+		IDENTIFIER
+	};
+
+	void put_le32(unsigned char *p, uint32_t v) {
+		p[0] = v & 0xff;
+		p[1] = (v >> 8) & 0xff;
+		p[2] = (v >> 16) & 0xff;
+		p[3] = (v >> 24) & 0xff;
+	}
+
+	uint32_t get_le32(unsigned char const *p) {
+		return static_cast<uint32_t>(p[0]) |
+			(static_cast<uint32_t>(p[1]) << 8) |
+			(static_cast<uint32_t>(p[2]) << 16) |
+			(static_cast<uint32_t>(p[3]) << 24);
+	}
+
+	uint32_t chunk_sum(unsigned char const *len, unsigned char const *payload,
+			   uint32_t payload_len) {
+		base::crc32c sum(STREAM_CSUM_XOR);
+		sum.append(len, 4);
+		sum.append(payload, payload_len);
+		return sum.get_sum();
+	}
+
+	uint64_t zigzag(int64_t v) {
+		return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+	}
+
+	int64_t unzigzag(uint64_t v) {
+		return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+	}
+
+	//------------------------------------------------
+
+	class stream_emitter : public emitter {
+	public:
+		stream_emitter(ostream &out)
+			: out_(out) {
+			unsigned char header[HEADER_SIZE];
+
+			memcpy(header, STREAM_MAGIC, sizeof(STREAM_MAGIC));
+			put_le32(header + 8, STREAM_VERSION);
+			put_le32(header + 12, 0);
+			out_.write(reinterpret_cast<char const *>(header), sizeof(header));
+
+			reset_deltas();
+		}
+
+		// A dump that stops early still writes every record it
+		// got, just as the text formats do.  The stream has no
+		// END_SUPERBLOCK record, so it can be told apart from a
+		// complete one.
+		~stream_emitter() {
+			try {
+				flush_chunk();
+				out_.flush();
+
+			} catch (...) {
+			}
+		}
+
+		void begin_superblock(string const &uuid,
+				      uint64_t time,
+				      uint64_t trans_id,
+				      uint32_t data_block_size,
+				      uint64_t nr_data_blocks,
+				      boost::optional<uint64_t> metadata_snap) {
+			put_byte(SUPERBLOCK);
+			put_string(uuid);
+			put_varint(time);
+			put_varint(trans_id);
+			put_varint(data_block_size);
+			put_varint(nr_data_blocks);
+			put_byte(metadata_snap ? 1 : 0);
+			put_varint(metadata_snap ? *metadata_snap : 0);
+			end_record();
+		}
+
+		void end_superblock() {
+			put_byte(END_SUPERBLOCK);
+			flush_chunk();
+			out_.flush();
+		}
+
+		void begin_device(uint32_t dev_id,
+				  uint64_t mapped_blocks,
+				  uint64_t trans_id,
+				  uint64_t creation_time,
+				  uint64_t snap_time) {
+			put_byte(DEVICE);
+			put_varint(dev_id);
+			put_varint(mapped_blocks);
+			put_varint(trans_id);
+			put_varint(creation_time);
+			put_varint(snap_time);
+			reset_deltas();
+			end_record();
+		}
+
+		void end_device() {
+			put_byte(END_DEVICE);
+			end_record();
+		}
+
+		void begin_named_mapping(string const &name) {
+			put_byte(NAMED_MAPPING);
+			put_string(name);
+			end_record();
+		}
+
+		void end_named_mapping() {
+			put_byte(END_NAMED_MAPPING);
+			end_record();
+		}
+
+		void identifier(string const &name) {
+			put_byte(IDENTIFIER);
+			put_string(name);
+			end_record();
+		}
+
+		// Mappings come out of the dumper in origin order, and
+		// neighbouring runs tend to be close together on the data
+		// device and share a time, so the deltas are usually tiny.
+		void range_map(uint64_t origin_begin, uint64_t data_begin,
+			       uint32_t time, uint64_t len) {
+			put_byte(MAPPING);
+			put_varint(zigzag(origin_begin - origin_end_));
+			put_varint(zigzag(data_begin - data_end_));
+			put_varint(zigzag(static_cast<int64_t>(time) - time_));
+			put_varint(len);
+
+			origin_end_ = origin_begin + len;
+			data_end_ = data_begin + len;
+			time_ = time;
+			end_record();
+		}
+
+		void single_map(uint64_t origin_block, uint64_t data_block,
+				uint32_t time) {
+			range_map(origin_block, data_block, time, 1);
+		}
+
+	private:
+		void put_byte(unsigned char b) {
+			chunk_.push_back(b);
+		}
+
+		void put_varint(uint64_t v) {
+			while (v >= 0x80) {
+				chunk_.push_back(static_cast<unsigned char>(v) | 0x80);
+				v >>= 7;
+			}
+
+			chunk_.push_back(static_cast<unsigned char>(v));
+		}
+
+		void put_string(string const &str) {
+			put_varint(str.length());
+			chunk_.insert(chunk_.end(), str.begin(), str.end());
+		}
+
+		void reset_deltas() {
+			origin_end_ = 0;
+			data_end_ = 0;
+			time_ = 0;
+		}
+
+		void end_record() {
+			if (chunk_.size() >= CHUNK_SIZE)
+				flush_chunk();
+		}
+
+		void flush_chunk() {
+			if (chunk_.empty())
+				return;
+
+			unsigned char header[CHUNK_HEADER_SIZE];
+			put_le32(header, chunk_.size());
+			put_le32(header + 4, chunk_sum(header, &chunk_[0], chunk_.size()));
+
+			out_.write(reinterpret_cast<char const *>(header), sizeof(header));
+			out_.write(reinterpret_cast<char const *>(&chunk_[0]), chunk_.size());
+			chunk_.clear();
+
+			reset_deltas();
+		}
+
+		ostream &out_;
+		vector<unsigned char> chunk_;
+
+		uint64_t origin_end_;
+		uint64_t data_end_;
+		int64_t time_;
+	};
+
+	//------------------------------------------------
+
+	class chunk_decoder {
+	public:
+		chunk_decoder(unsigned char const *begin, unsigned char const *end,
+			      emitter &e)
+			: pos_(begin),
+			  end_(end),
+			  e_(e) {
+			reset_deltas();
+		}
+
+		void decode() {
+			while (pos_ != end_) {
+				unsigned char type = get_byte();
+
+				switch (type) {
+				case SUPERBLOCK:
+					decode_superblock();
+					break;
+
+				case END_SUPERBLOCK:
+					e_.end_superblock();
+					break;
+
+				case DEVICE:
+					decode_device();
+					break;
+
+				case END_DEVICE:
+					e_.end_device();
+					break;
+
+				case MAPPING:
+					decode_mapping();
+					break;
+
+				case NAMED_MAPPING:
+					e_.begin_named_mapping(get_string());
+					break;
+
+				case END_NAMED_MAPPING:
+					e_.end_named_mapping();
+					break;
+
+				case IDENTIFIER:
+					e_.identifier(get_string());
+					break;
+
+				default: {
+					ostringstream out;
+					out << "unknown record type in stream: " << static_cast<unsigned>(type);
+					throw runtime_error(out.str());
+				}
+				}
+			}
+		}
+
+	private:
+		void decode_superblock() {
+			string uuid = get_string();
+			uint64_t time = get_varint();
+			uint64_t trans_id = get_varint();
+			uint64_t data_block_size = get_varint();
+			uint64_t nr_data_blocks = get_varint();
+			bool has_snap = get_byte();
+			uint64_t snap = get_varint();
+
+			e_.begin_superblock(uuid, time, trans_id, data_block_size, nr_data_blocks,
+					    has_snap ? boost::optional<uint64_t>(snap) :
+					    boost::optional<uint64_t>());
+		}
+
+		void decode_device() {
+			uint64_t dev_id = get_varint();
+			uint64_t mapped_blocks = get_varint();
+			uint64_t trans_id = get_varint();
+			uint64_t creation_time = get_varint();
+			uint64_t snap_time = get_varint();
+
+			reset_deltas();
+			e_.begin_device(dev_id, mapped_blocks, trans_id, creation_time, snap_time);
+		}
+
+		void decode_mapping() {
+			uint64_t origin_begin = origin_end_ + unzigzag(get_varint());
+			uint64_t data_begin = data_end_ + unzigzag(get_varint());
+			int64_t time = time_ + unzigzag(get_varint());
+			uint64_t len = get_varint();
+
+			if (!len)
+				throw runtime_error("zero length mapping in stream");
+
+			origin_end_ = origin_begin + len;
+			data_end_ = data_begin + len;
+			time_ = time;
+
+			if (len == 1)
+				e_.single_map(origin_begin, data_begin, time);
+			else
+				e_.range_map(origin_begin, data_begin, time, len);
+		}
+
+		unsigned char get_byte() {
+			if (pos_ == end_)
+				truncated();
+
+			return *pos_++;
+		}
+
+		uint64_t get_varint() {
+			uint64_t v = 0;
+
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				unsigned char b = get_byte();
+				v |= static_cast<uint64_t>(b & 0x7f) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+
+			throw runtime_error("bad varint in stream");
+		}
+
+		string get_string() {
+			uint64_t len = get_varint();
+			if (len > static_cast<uint64_t>(end_ - pos_))
+				truncated();
+
+			string r(reinterpret_cast<char const *>(pos_), len);
+			pos_ += len;
+			return r;
+		}
+
+		void reset_deltas() {
+			origin_end_ = 0;
+			data_end_ = 0;
+			time_ = 0;
+		}
+
+		void truncated() {
+			throw runtime_error("truncated record in stream chunk");
+		}
+
+		unsigned char const *pos_;
+		unsigned char const *end_;
+		emitter &e_;
+
+		uint64_t origin_end_;
+		uint64_t data_end_;
+		int64_t time_;
+	};
+
+	void check_header(unsigned char const *header) {
+		if (memcmp(header, STREAM_MAGIC, sizeof(STREAM_MAGIC)))
+			throw runtime_error("not a thin metadata stream");
+
+		uint32_t version = get_le32(header + 8);
+		if (version != STREAM_VERSION) {
+			ostringstream out;
+			out << "unsupported stream version: " << version;
+			throw runtime_error(out.str());
+		}
+	}
+
+	size_t get_file_length(string const &path) {
+		struct stat info;
+
+		if (::stat(path.c_str(), &info))
+			throw runtime_error("Couldn't stat backup path");
+
+		return info.st_size;
+	}
+}
+
+//----------------------------------------------------------------
+
+emitter::ptr
+thin_provisioning::create_stream_emitter(ostream &out)
+{
+	return emitter::ptr(new stream_emitter(out));
+}
+
+bool
+thin_provisioning::is_stream_file(string const &path)
+{
+	char magic[sizeof(STREAM_MAGIC)];
+	ifstream in(path.c_str(), ifstream::in | ifstream::binary);
+	streamsize len;
+
+	if (base::is_compressed_file(path)) {
+		try {
+			base::decompressing_istream zin(in);
+			zin.read(magic, sizeof(magic));
+			len = zin.gcount();
+
+		} catch (std::exception &) {
+			return false;
+		}
+	} else {
+		in.read(magic, sizeof(magic));
+		len = in.gcount();
+	}
+
+	return len == sizeof(magic) && !memcmp(magic, STREAM_MAGIC, sizeof(magic));
+}
+
+void
+thin_provisioning::parse_stream(string const &backup_file, emitter::ptr e, bool quiet)
+{
+	persistent_data::check_file_exists(backup_file);
+	ifstream in(backup_file.c_str(), ifstream::in | ifstream::binary);
+
+	auto_ptr<base::progress_monitor> monitor;
+	if (!quiet && isatty(fileno(stdout)))
+		monitor = base::create_progress_bar("Restoring");
+	else
+		monitor = base::create_quiet_progress_monitor();
+
+	size_t len = get_file_length(backup_file);
+	if (base::is_compressed_file(backup_file)) {
+		base::decompressing_istream zin(in);
+		base::file_offset_monitor zmonitor(*monitor, in, len);
+		parse_stream(zin, e, len, zmonitor);
+	} else
+		parse_stream(in, e, len, *monitor);
+}
+
+void
+thin_provisioning::parse_stream(istream &in, emitter::ptr e,
+				size_t input_length, base::progress_monitor &monitor)
+{
+	unsigned char header[HEADER_SIZE];
+
+	in.read(reinterpret_cast<char *>(header), sizeof(header));
+	if (in.gcount() != sizeof(header))
+		throw runtime_error("not a thin metadata stream");
+	check_header(header);
+
+	size_t total = sizeof(header);
+	vector<unsigned char> payload;
+
+	for (;;) {
+		unsigned char chunk_header[CHUNK_HEADER_SIZE];
+
+		in.read(reinterpret_cast<char *>(chunk_header), sizeof(chunk_header));
+		if (in.gcount() == 0)
+			break;
+
+		if (in.gcount() != sizeof(chunk_header))
+			throw runtime_error("truncated stream chunk header");
+
+		uint32_t len = get_le32(chunk_header);
+		if (!len || len > MAX_CHUNK_SIZE) {
+			ostringstream out;
+			out << "bad stream chunk length at offset " << total;
+			throw runtime_error(out.str());
+		}
+
+		payload.resize(len);
+		in.read(reinterpret_cast<char *>(&payload[0]), len);
+		if (static_cast<uint32_t>(in.gcount()) != len)
+			throw runtime_error("truncated stream chunk");
+
+		if (chunk_sum(chunk_header, &payload[0], len) != get_le32(chunk_header + 4)) {
+			ostringstream out;
+			out << "checksum error in stream chunk at offset " << total;
+			throw runtime_error(out.str());
+		}
+
+		chunk_decoder(&payload[0], &payload[0] + len, *e).decode();
+
+		total += sizeof(chunk_header) + len;
+		if (input_length)
+			monitor.update_percent(total * 100 / input_length);
+	}
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,52 @@
+// Copyright (C) 2011 Red Hat, Inc. All rights reserved.
+//
+// This file is part of the thin-provisioning-tools source.
+//
+// thin-provisioning-tools is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// thin-provisioning-tools is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with thin-provisioning-tools.  If not, see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef THIN_STREAM_FORMAT_H
+#define THIN_STREAM_FORMAT_H
+
+#include "emitter.h"
+#include "base/progress_monitor.h"
+
+#include <iosfwd>
+
+//----------------------------------------------------------------
+
+// A compact binary alternative to the xml format, carrying exactly
+// the same information.
+//
+// The file starts with a 16 byte header (magic, version, flags).  This
+// is followed by a sequence of chunks, each of which is a little endian
+// payload length, a crc32c of the length and payload, and the payload
+// itself.  A payload is a sequence of records (superblock, device,
+// mapping, ...); every integer is a varint.  Mappings are delta encoded
+// against the previous mapping in the same device, and the delta state
+// is reset at the start of every chunk, so each chunk can be verified
+// and decoded without reference to any other.
+
+namespace thin_provisioning {
+	emitter::ptr create_stream_emitter(std::ostream &out);
+
+	bool is_stream_file(std::string const &path);
+	void parse_stream(std::string const &backup_file, emitter::ptr e, bool quiet);
+	void parse_stream(std::istream &in, emitter::ptr e,
+			  size_t input_length, base::progress_monitor &monitor);
+}
+
+//----------------------------------------------------------------
+
+#endif
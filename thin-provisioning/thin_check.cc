@@ -19,20 +19,27 @@
 #include <iostream>
 #include <getopt.h>
 #include <libgen.h>
+#include <math.h>
+#include <time.h>
 
 #include "version.h"
 
 #include "base/application.h"
 #include "base/error_state.h"
+#include "base/metrics.h"
 #include "base/nested_output.h"
+#include "base/progress_monitor.h"
 #include "persistent-data/data-structures/btree_counter.h"
 #include "persistent-data/space-maps/core.h"
 #include "persistent-data/space-maps/disk.h"
 #include "persistent-data/file_utils.h"
 #include "thin-provisioning/device_tree.h"
+#include "thin-provisioning/mapping_sampler.h"
 #include "thin-provisioning/mapping_tree.h"
+#include "thin-provisioning/metadata_scanner.h"
 #include "thin-provisioning/superblock.h"
 #include "thin-provisioning/commands.h"
+#include "thin-provisioning/verification_cache.h"
 
 using namespace base;
 using namespace std;
@@ -41,11 +48,22 @@ using namespace thin_provisioning;
 //----------------------------------------------------------------
 
 namespace {
+	// The most memory a scan will preload metadata into.
+	size_t const MAX_SCAN_CACHE_MEM = 1024u * 1024u * 1024u;
+
 	block_manager<>::ptr
-	open_bm(string const &path) {
+	open_bm(string const &path, size_t cache_mem = DEFAULT_BLOCK_CACHE_MEM) {
 		block_address nr_blocks = get_nr_blocks(path);
 		block_manager<>::mode m = block_manager<>::READ_ONLY;
-		return block_manager<>::ptr(new block_manager<>(path, nr_blocks, 1, m));
+		return block_manager<>::ptr(new block_manager<>(path, nr_blocks, 1, m, true, cache_mem));
+	}
+
+	// Enough to hold the whole device, if possible.  Memory is only
+	// touched as blocks are loaded.
+	size_t scan_cache_mem(string const &path) {
+		uint64_t per_block = MD_BLOCK_SIZE + sizeof(block_cache::block);
+		uint64_t mem = get_nr_blocks(path) * per_block;
+		return max<uint64_t>(DEFAULT_BLOCK_CACHE_MEM, min<uint64_t>(mem, MAX_SCAN_CACHE_MEM));
 	}
 
 	transaction_manager::ptr
@@ -156,7 +174,9 @@ namespace {
 			  check_mapping_tree_level2(true),
 			  ignore_non_fatal_errors(false),
 			  quiet(false),
-			  clear_needs_check_flag_on_success(false) {
+			  clear_needs_check_flag_on_success(false),
+			  scan(false),
+			  sample_paths(0) {
 		}
 
 		bool check_device_tree;
@@ -167,11 +187,83 @@ namespace {
 
 		bool quiet;
 		bool clear_needs_check_flag_on_success;
+
+		string verification_cache;
+		bool scan;
+
+		// Zero means check every mapping.
+		unsigned sample_paths;
+	};
+
+	// Reads the metadata sequentially into the block cache, so the
+	// checks that follow don't have to seek.  Only allocated blocks
+	// are read, if the space map can be opened.  If it's wrong the
+	// blocks it missed are just read on demand.
+	void scan_metadata(string const &path, nested_output &out,
+			   superblock_detail::superblock &sb,
+			   block_manager<>::ptr bm,
+			   transaction_manager::ptr tm) {
+		using namespace scan_detail;
+
+		metadata_scanner scanner(path, bm->get_nr_blocks());
+		node_index index(bm);
+
+		space_map::ptr metadata_sm;
+		try {
+			metadata_sm = open_metadata_sm(*tm, static_cast<void *>(&sb.metadata_space_map_root_));
+
+		} catch (std::exception &e) {
+			out << "couldn't open the metadata space map, scanning every block" << end_message();
+		}
+
+		if (metadata_sm)
+			scanner.scan(*metadata_sm, index);
+		else
+			scanner.scan(index);
+
+		out << "read " << scanner.get_nr_read() << " blocks: "
+		    << index.get_nr_blocks(BTREE_INTERNAL) + index.get_nr_blocks(BTREE_LEAF) << " btree nodes, "
+		    << index.get_nr_blocks(BITMAP) << " bitmaps, "
+		    << index.get_nr_blocks(INDEX) << " index blocks, "
+		    << index.get_nr_blocks(SUPERBLOCK) << " superblocks, "
+		    << index.get_nr_blocks(UNKNOWN) << " unrecognised"
+		    << end_message();
+	}
+
+	// Counts the blocks in each thin device's mapping subtree.  The
+	// verification cache already knows the shape of the subtrees
+	// the check has just skipped or walked, so they needn't be read
+	// again.
+	class subtree_counter {
+	public:
+		subtree_counter(transaction_manager::ptr tm,
+				verification_cache const &cache,
+				block_counter &bc)
+			: tm_(tm),
+			  cache_(cache),
+			  bc_(bc) {
+		}
+
+		void visit(btree_detail::node_location const &loc, uint64_t root) {
+			if (cache_.count_subtree(root, bc_))
+				return;
+
+			noop_value_counter<mapping_tree_detail::block_time> vc;
+			single_mapping_tree tree(*tm_, root,
+						 mapping_tree_detail::block_traits::ref_counter(tm_->get_sm()));
+			count_btree_blocks(tree, bc_, vc);
+		}
+
+	private:
+		transaction_manager::ptr tm_;
+		verification_cache const &cache_;
+		block_counter &bc_;
 	};
 
 	void count_trees(transaction_manager::ptr tm,
 			 superblock_detail::superblock &sb,
-			 block_counter &bc) {
+			 block_counter &bc,
+			 verification_cache const *cache) {
 
 		// Count the device tree
 		{
@@ -182,7 +274,13 @@ namespace {
 		}
 
 		// Count the mapping tree
-		{
+		if (cache) {
+			subtree_counter vc(tm, *cache, bc);
+			dev_tree dtree(*tm, sb.data_mapping_root_,
+				       mapping_tree_detail::mtree_traits::ref_counter(tm));
+			count_btree_blocks(dtree, bc, vc);
+
+		} else {
 			noop_value_counter<mapping_tree_detail::block_time> vc;
 			mapping_tree mtree(*tm, sb.data_mapping_root_,
 					   mapping_tree_detail::block_traits::ref_counter(tm->get_sm()));
@@ -193,19 +291,20 @@ namespace {
 	error_state check_space_map_counts(flags const &fs, nested_output &out,
 					   superblock_detail::superblock &sb,
 					   block_manager<>::ptr bm,
-					   transaction_manager::ptr tm) {
+					   transaction_manager::ptr tm,
+					   verification_cache const *cache) {
 		block_counter bc;
 
 		// Count the superblock
 		bc.inc(superblock_detail::SUPERBLOCK_LOCATION);
-		count_trees(tm, sb, bc);
+		count_trees(tm, sb, bc, cache);
 
 		// Count the metadata snap, if present
 		if (sb.metadata_snap_ != superblock_detail::SUPERBLOCK_LOCATION) {
 			bc.inc(sb.metadata_snap_);
 
 			superblock_detail::superblock snap = read_superblock(bm, sb.metadata_snap_);
-			count_trees(tm, snap, bc);
+			count_trees(tm, snap, bc, cache);
 		}
 
 		// Count the metadata space map
@@ -245,8 +344,11 @@ namespace {
 		return err;
 	}
 
-	error_state metadata_check(string const &path, flags fs) {
-		block_manager<>::ptr bm = open_bm(path);
+	// If use_cache is false, the verification cache file isn't read,
+	// but a new one is still written if the check passes.
+	error_state metadata_check(string const &path, flags fs,
+				   bool use_cache, bool &used_cache) {
+		block_manager<>::ptr bm = fs.scan ? open_bm(path, scan_cache_mem(path)) : open_bm(path);
 
 		nested_output out(cerr, 2);
 		if (fs.quiet)
@@ -259,6 +361,7 @@ namespace {
 		out << "examining superblock" << end_message();
 		{
 			nested_output::nest _ = out.push();
+			scoped_phase phase("superblock");
 			check_superblock(bm, sb_rep);
 		}
 
@@ -268,10 +371,42 @@ namespace {
 		superblock_detail::superblock sb = read_superblock(bm);
 		transaction_manager::ptr tm = open_tm(bm);
 
+		// The scan, the tree checks and the space map counts
+		// each read roughly every allocated block.
+		bool counting = fs.check_device_tree && fs.check_mapping_tree_level2;
+		set_walk_progress_total(get_nr_allocated(sb.metadata_space_map_root_) *
+					((fs.scan ? 1 : 0) + 1 + (counting ? 1 : 0)));
+
+		if (fs.scan) {
+			out << "scanning metadata" << end_message();
+			{
+				nested_output::nest _ = out.push();
+				scoped_phase phase("metadata scan");
+				scan_metadata(path, out, sb, bm, tm);
+			}
+		}
+
+		// The cache is only any use if the whole mapping tree is
+		// being checked.
+		verification_cache::ptr cache;
+		if (!fs.verification_cache.empty() &&
+		    fs.check_device_tree && fs.check_mapping_tree_level2) {
+			verification_cache_key key(sb);
+			space_map::ptr metadata_sm =
+				open_metadata_sm(*tm, static_cast<void *>(&sb.metadata_space_map_root_));
+
+			if (use_cache)
+				cache = verification_cache::read(fs.verification_cache, key, metadata_sm);
+
+			if (!cache)
+				cache.reset(new verification_cache(key, metadata_sm));
+		}
+
 		if (fs.check_device_tree) {
 			out << "examining devices tree" << end_message();
 			{
 				nested_output::nest _ = out.push();
+				scoped_phase phase("device tree");
 				device_tree dtree(*tm, sb.device_details_root_,
 						  device_tree_detail::device_details_traits::ref_counter());
 				check_device_tree(dtree, dev_rep);
@@ -282,6 +417,7 @@ namespace {
 			out << "examining top level of mapping tree" << end_message();
 			{
 				nested_output::nest _ = out.push();
+				scoped_phase phase("mapping tree top level");
 				dev_tree dtree(*tm, sb.data_mapping_root_,
 					       mapping_tree_detail::mtree_traits::ref_counter(tm));
 				check_mapping_tree(dtree, mapping_rep);
@@ -291,12 +427,22 @@ namespace {
 			out << "examining mapping tree" << end_message();
 			{
 				nested_output::nest _ = out.push();
+				scoped_phase phase("mapping tree");
 				mapping_tree mtree(*tm, sb.data_mapping_root_,
 						   mapping_tree_detail::block_traits::ref_counter(tm->get_sm()));
-				check_mapping_tree(mtree, mapping_rep);
+				if (cache) {
+					check_mapping_tree(mtree, mapping_rep, *cache);
+					if (cache->get_nr_skipped())
+						out << cache->get_nr_skipped()
+						    << " thin devices unchanged since the last check"
+						    << end_message();
+				} else
+					check_mapping_tree(mtree, mapping_rep);
 			}
 		}
 
+		used_cache = cache && cache->get_nr_skipped();
+
 		error_state err = NO_ERROR;
 		err << sb_rep.get_error() << mapping_rep.get_error() << dev_rep.get_error();
 
@@ -304,7 +450,202 @@ namespace {
 		// then we should check the space maps too.
 		if (fs.check_device_tree && fs.check_mapping_tree_level2 && err != FATAL) {
 			out << "checking space map counts" << end_message();
-			err << check_space_map_counts(fs, out, sb, bm, tm);
+			scoped_phase phase("space map counts");
+			err << check_space_map_counts(fs, out, sb, bm, tm, cache.get());
+		}
+
+		// A cache that can't be written just means the next check
+		// takes longer.
+		if (cache && err == NO_ERROR) {
+			try {
+				cache->write(fs.verification_cache);
+
+			} catch (std::exception &e) {
+				out << e.what() << end_message();
+			}
+		}
+
+		return err;
+	}
+
+	//--------------------------------
+
+	class details_collector : public device_tree_detail::device_visitor {
+	public:
+		virtual void visit(block_address dev_id, device_tree_detail::device_details const &v) {
+			mapped_blocks_[dev_id] = v.mapped_blocks_;
+		}
+
+		uint64_t get_mapped_blocks(uint64_t dev_id) const {
+			map<uint64_t, uint64_t>::const_iterator it = mapped_blocks_.find(dev_id);
+			return (it == mapped_blocks_.end()) ? 0 : it->second;
+		}
+
+	private:
+		map<uint64_t, uint64_t> mapped_blocks_;
+	};
+
+	class root_collector : public mapping_tree_detail::device_visitor {
+	public:
+		typedef pair<uint64_t, block_address> device;
+
+		virtual void visit(btree_path const &path, block_address root) {
+			devs_.push_back(device(path[0], root));
+		}
+
+		vector<device> const &get_devices() const {
+			return devs_;
+		}
+
+	private:
+		vector<device> devs_;
+	};
+
+	// Reads the metadata that every mapping depends on, so must be
+	// checked in full: both space map indexes.  A broken one throws.
+	error_state check_space_map_indexes(nested_output &out,
+					    superblock_detail::superblock &sb,
+					    transaction_manager::ptr tm,
+					    block_address &nr_data_blocks) {
+		try {
+			block_counter bc;
+
+			persistent_space_map::ptr metadata_sm =
+				open_metadata_sm(*tm, static_cast<void *>(&sb.metadata_space_map_root_));
+			metadata_sm->count_metadata(bc);
+
+			persistent_space_map::ptr data_sm =
+				open_disk_sm(*tm, static_cast<void *>(&sb.data_space_map_root_));
+			data_sm->count_metadata(bc);
+			nr_data_blocks = data_sm->get_nr_blocks();
+
+			block_counter::count_map const &counts = bc.get_counts();
+			if (!counts.empty() && counts.rbegin()->first >= tm->get_bm()->get_nr_blocks()) {
+				out << "space map block " << counts.rbegin()->first
+				    << " is beyond the end of the metadata device" << end_message();
+				return FATAL;
+			}
+
+		} catch (std::exception &e) {
+			out << e.what() << end_message();
+			return FATAL;
+		}
+
+		return NO_ERROR;
+	}
+
+	// Checks everything except the mappings in full, then follows
+	// a number of random paths through each thin device's mappings,
+	// shared out by how many blocks it has mapped.  Only finds
+	// damage by chance, so a clean result comes with an estimate of
+	// how much could have been missed.
+	error_state sample_check(string const &path, flags const &fs) {
+		block_manager<>::ptr bm = open_bm(path);
+
+		nested_output out(cerr, 2);
+		if (fs.quiet)
+			out.disable();
+
+		superblock_reporter sb_rep(out);
+		devices_reporter dev_rep(out);
+		mapping_reporter mapping_rep(out);
+
+		out << "examining superblock" << end_message();
+		{
+			nested_output::nest _ = out.push();
+			scoped_phase phase("superblock");
+			check_superblock(bm, sb_rep);
+		}
+
+		if (sb_rep.get_error() == FATAL)
+			return FATAL;
+
+		superblock_detail::superblock sb = read_superblock(bm);
+		transaction_manager::ptr tm = open_tm(bm);
+
+		error_state err = NO_ERROR;
+
+		out << "examining space map indexes" << end_message();
+		block_address nr_data_blocks = 0;
+		{
+			nested_output::nest _ = out.push();
+			scoped_phase phase("space map indexes");
+			err << check_space_map_indexes(out, sb, tm, nr_data_blocks);
+		}
+
+		out << "examining devices tree" << end_message();
+		details_collector details;
+		{
+			nested_output::nest _ = out.push();
+			scoped_phase phase("device tree");
+			device_tree dtree(*tm, sb.device_details_root_,
+					  device_tree_detail::device_details_traits::ref_counter());
+			walk_device_tree(dtree, details, dev_rep);
+		}
+
+		out << "examining top level of mapping tree" << end_message();
+		root_collector roots;
+		{
+			nested_output::nest _ = out.push();
+			scoped_phase phase("mapping tree top level");
+			dev_tree dtree(*tm, sb.data_mapping_root_,
+				       mapping_tree_detail::mtree_traits::ref_counter(tm));
+			walk_mapping_tree(dtree, roots, mapping_rep);
+		}
+
+		err << dev_rep.get_error() << mapping_rep.get_error();
+		if (err == FATAL)
+			return FATAL;
+
+		vector<root_collector::device> const &devs = roots.get_devices();
+		vector<uint64_t> mapped_blocks;
+		uint64_t total_mapped = 0;
+		for (size_t i = 0; i < devs.size(); i++) {
+			mapped_blocks.push_back(details.get_mapped_blocks(devs[i].first));
+			total_mapped += mapped_blocks.back();
+		}
+
+		out << "sampling mapping tree" << end_message();
+		{
+			nested_output::nest _ = out.push();
+			scoped_phase phase("mapping tree samples");
+
+			mapping_sampler sampler(*tm, nr_data_blocks, time(NULL));
+			vector<unsigned> shares = share_paths(mapped_blocks, fs.sample_paths);
+			for (size_t i = 0; i < devs.size(); i++)
+				sampler.sample(devs[i].first, devs[i].second, shares[i]);
+
+			vector<string> const &damage = sampler.get_damage();
+			for (size_t i = 0; i < damage.size(); i++)
+				out << damage[i] << end_message();
+
+			if (!damage.empty())
+				return FATAL;
+
+			out << "followed " << sampler.get_nr_paths() << " paths through "
+			    << devs.size() << " thin devices, reaching "
+			    << sampler.get_nr_leaves() << " distinct leaves" << end_message();
+
+			// The mapped block counts can be zero in metadata
+			// that's been restored from xml.
+			out << "checked " << sampler.get_nr_mappings();
+			if (total_mapped) {
+				double fraction = static_cast<double>(sampler.get_nr_mappings()) / total_mapped;
+				out << " of " << total_mapped
+				    << " mappings (" << min(fraction, 1.0) * 100.0 << "%)";
+			} else
+				out << " mappings";
+			out << end_message();
+
+			// If a fraction p of the leaves were damaged, the
+			// chance of n random leaves all being sound is
+			// (1 - p)^n.  Paths don't pick leaves quite
+			// uniformly, so this is an estimate.
+			if (sampler.get_nr_leaves()) {
+				double bound = 1.0 - pow(0.05, 1.0 / sampler.get_nr_leaves());
+				out << "with 95% confidence, fewer than " << bound * 100.0
+				    << "% of leaves are damaged" << end_message();
+			}
 		}
 
 		return err;
@@ -318,6 +659,22 @@ namespace {
 		write_superblock(bm, sb);
 	}
 
+	error_state full_check(string const &path, flags const &fs) {
+		bool used_cache = false;
+		error_state err = metadata_check(path, fs, true, used_cache);
+
+		// Make sure a stale cache can't be the cause of a
+		// failure.
+		if (err != NO_ERROR && used_cache) {
+			if (!fs.quiet)
+				cerr << "rechecking without the verification cache" << endl;
+
+			err = metadata_check(path, fs, false, used_cache);
+		}
+
+		return err;
+	}
+
 	// Returns 0 on success, 1 on failure (this gets returned directly
 	// by main).
 	int check(string const &path, flags fs) {
@@ -325,7 +682,18 @@ namespace {
 		bool success = false;
 
 		try {
-			err = metadata_check(path, fs);
+			// Sampling can only stand in for a check of every
+			// mapping.
+			if (fs.sample_paths && fs.check_device_tree && fs.check_mapping_tree_level2) {
+				err = sample_check(path, fs);
+				if (err != NO_ERROR) {
+					if (!fs.quiet)
+						cerr << "sampling found damage, running a full check" << endl;
+
+					err = full_check(path, fs);
+				}
+			} else
+				err = full_check(path, fs);
 
 			if (fs.ignore_non_fatal_errors)
 				success = (err == FATAL) ? false : true;
@@ -364,13 +732,17 @@ thin_check_cmd::usage(std::ostream &out) const
 	    << "  {--clear-needs-check-flag}" << endl
 	    << "  {--ignore-non-fatal-errors}" << endl
 	    << "  {--skip-mappings}" << endl
-	    << "  {--super-block-only}" << endl;
+	    << "  {--sample} <nr paths>" << endl
+	    << "  {--scan}" << endl
+	    << "  {--super-block-only}" << endl
+	    << "  {--verification-cache} <file>" << endl;
 }
 
 int
 thin_check_cmd::run(int argc, char **argv)
 {
 	int c;
+	char *end;
 	flags fs;
 
 	char const shortopts[] = "qhV";
@@ -382,6 +754,9 @@ thin_check_cmd::run(int argc, char **argv)
 		{ "skip-mappings", no_argument, NULL, 2},
 		{ "ignore-non-fatal-errors", no_argument, NULL, 3},
 		{ "clear-needs-check-flag", no_argument, NULL, 4 },
+		{ "verification-cache", required_argument, NULL, 5 },
+		{ "scan", no_argument, NULL, 6 },
+		{ "sample", required_argument, NULL, 7 },
 		{ NULL, no_argument, NULL, 0 }
 	};
 
@@ -421,12 +796,34 @@ thin_check_cmd::run(int argc, char **argv)
 			fs.clear_needs_check_flag_on_success = true;
 			break;
 
+		case 5:
+			fs.verification_cache = optarg;
+			break;
+
+		case 6:
+			fs.scan = true;
+			break;
+
+		case 7:
+			fs.sample_paths = strtoul(optarg, &end, 10);
+			if (*end || !fs.sample_paths) {
+				cerr << "invalid number of sample paths: " << optarg << endl;
+				return 1;
+			}
+			break;
+
 		default:
 			usage(cerr);
 			return 1;
 		}
 	}
 
+	// A sample can't prove the metadata is sound.
+	if (fs.sample_paths && fs.clear_needs_check_flag_on_success) {
+		cerr << "--sample can't be used with --clear-needs-check-flag" << endl;
+		return 1;
+	}
+
 	if (argc == optind) {
 		if (!fs.quiet) {
 			cerr << "No input file provided." << endl;
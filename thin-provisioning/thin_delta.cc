@@ -7,12 +7,14 @@
 #include "version.h"
 
 #include "base/indented_stream.h"
+#include "base/progress_monitor.h"
 #include "persistent-data/data-structures/btree_damage_visitor.h"
 #include "persistent-data/run.h"
 #include "persistent-data/space-maps/core.h"
 #include "persistent-data/space-maps/disk.h"
 #include "persistent-data/file_utils.h"
 #include "thin-provisioning/superblock.h"
+#include "thin-provisioning/mapping_delta.h"
 #include "thin-provisioning/mapping_tree.h"
 #include "thin-provisioning/metadata.h"
 #include "thin-provisioning/commands.h"
@@ -90,168 +92,12 @@ namespace local {
 
 	//--------------------------------
 
-	struct mapping {
-		mapping()
-			: vbegin_(0),
-			  dbegin_(0),
-			  len_(0) {
-		}
-
-		mapping(uint64_t vbegin, uint64_t dbegin, uint64_t len)
-			: vbegin_(vbegin),
-			  dbegin_(dbegin),
-			  len_(len) {
-		}
-
-		uint64_t vbegin_, dbegin_, len_;
-	};
-
-	ostream &operator <<(ostream &out, mapping const &m) {
-		out << "mapping[vbegin = " << m.vbegin_
-		    << ", dbegin = " << m.dbegin_
-		    << ", len = " << m.len_ << "]";
-		return out;
-	}
-
-	//--------------------------------
-
-	template <typename Container>
-	class mapping_stream {
-	public:
-		mapping_stream(Container const &c)
-		: it_(c.begin()),
-		  end_(c.end()) {
-			m_ = *it_;
-		}
-
-		mapping const &get_mapping() const {
-			return m_;
-		}
-
-		bool more_mappings() const {
-			return it_ != end_;
-		}
-
-		void consume(uint64_t delta) {
-			if (it_ == end_)
-				throw runtime_error("end of stream already reached");
-
-			if (delta > m_.len_)
-				throw runtime_error("delta too long");
-
-			if (delta == m_.len_) {
-				++it_;
-				m_ = *it_;
-
-			} else {
-				m_.vbegin_ += delta;
-				m_.dbegin_ += delta;
-				m_.len_ -= delta;
-			}
-		}
-
-	private:
-		typename Container::const_iterator it_;
-		typename Container::const_iterator end_;
-		mapping m_;
-	};
-
-	//--------------------------------
-
-	typedef std::deque<mapping> mapping_deque;
-
-	// Builds up an in core rep of the mappings for a device.
-	class mapping_recorder {
-	public:
-		mapping_recorder() {
-			no_range();
-		}
-
-		void visit(btree_path const &path, mapping_tree_detail::block_time const &bt) {
-			record(path[0], bt.block_);
-		}
-
-		void complete() {
-			if (range_in_progress()) {
-				push_range();
-				no_range();
-			}
-		}
-
-		mapping_deque const &get_mappings() const {
-			return mappings_;
-		}
-
-	private:
-		void no_range() {
-			obegin_ = oend_ = 0;
-			dbegin_ = dend_ = 0;
-		}
-
-		void inc_range() {
-			oend_++;
-			dend_++;
-		}
-
-		void begin_range(uint64_t oblock, uint64_t dblock) {
-			obegin_ = oend_ = oblock;
-			dbegin_ = dend_ = dblock;
-			inc_range();
-		}
-
-		bool range_in_progress() {
-			return oend_ != obegin_;
-		}
-
-		bool continues_range(uint64_t oblock, uint64_t dblock) {
-			return (oblock == oend_) && (dblock == dend_);
-		}
-
-		void push_range() {
-			mapping m(obegin_, dbegin_, oend_ - obegin_);
-			mappings_.push_back(m);
-		}
-
-		void record(uint64_t oblock, uint64_t dblock) {
-			if (!range_in_progress())
-				begin_range(oblock, dblock);
-
-			else if (!continues_range(oblock, dblock)) {
-				push_range();
-				begin_range(oblock, dblock);
-			} else
-				inc_range();
-		}
-
-		uint64_t obegin_, oend_;
-		uint64_t dbegin_, dend_;
-
-		mapping_deque mappings_;
-	};
-
-	//--------------------------------
-
-	class damage_visitor {
-	public:
-		virtual void visit(btree_path const &path, btree_detail::damage const &d) {
-			throw std::runtime_error("damage in mapping tree, please run thin_check");
-		}
-	};
-
-	//--------------------------------
-
-	class diff_emitter {
+	class diff_emitter : public delta_visitor {
 	public:
 		diff_emitter(indented_stream &out)
 		: out_(out) {
 		}
 
-		virtual void left_only(uint64_t vbegin, uint64_t dbegin, uint64_t len) = 0;
-		virtual void right_only(uint64_t vbegin, uint64_t dbegin, uint64_t len) = 0;
-		virtual void blocks_differ(uint64_t vbegin, uint64_t left_dbegin, uint64_t right_dbegin, uint64_t len) = 0;
-		virtual void blocks_same(uint64_t vbegin, uint64_t dbegin, uint64_t len) = 0;
-		virtual void complete() = 0;
-
 	protected:
 		void indent() {
 			out_.indent();
@@ -458,58 +304,6 @@ namespace local {
 
 	//----------------------------------------------------------------
 
-	void dump_diff(mapping_deque const &left,
-		       mapping_deque const &right,
-		       diff_emitter &e) {
-
-		// We iterate through both sets of mappings in parallel
-		// noting any differences.
-		mapping_stream<mapping_deque> ls(left);
-		mapping_stream<mapping_deque> rs(right);
-
-		while (ls.more_mappings() && rs.more_mappings()) {
-			mapping const &lm = ls.get_mapping();
-			mapping const &rm = rs.get_mapping();
-
-			if (lm.vbegin_ < rm.vbegin_) {
-				uint64_t delta = min<uint64_t>(lm.len_, rm.vbegin_ - lm.vbegin_);
-				e.left_only(lm.vbegin_, lm.dbegin_, delta);
-				ls.consume(delta);
-
-			} else if (lm.vbegin_ > rm.vbegin_) {
-				uint64_t delta = min<uint64_t>(rm.len_, lm.vbegin_ - rm.vbegin_);
-				e.right_only(rm.vbegin_, rm.dbegin_, delta);
-				rs.consume(delta);
-
-			} else if (lm.dbegin_ != rm.dbegin_) {
-				uint64_t delta = min<uint64_t>(lm.len_, rm.len_);
-				e.blocks_differ(lm.vbegin_, lm.dbegin_, rm.dbegin_, delta);
-				ls.consume(delta);
-				rs.consume(delta);
-
-			} else {
-				uint64_t delta = min<uint64_t>(lm.len_, rm.len_);
-				e.blocks_same(lm.vbegin_, lm.dbegin_, delta);
-				ls.consume(delta);
-				rs.consume(delta);
-			}
-		}
-
-		while (ls.more_mappings()) {
-			mapping const &lm = ls.get_mapping();
-			e.left_only(lm.vbegin_, lm.dbegin_, lm.len_);
-			ls.consume(lm.len_);
-		}
-
-		while (rs.more_mappings()) {
-			mapping const &rm = rs.get_mapping();
-			e.right_only(rm.vbegin_, rm.dbegin_, rm.len_);
-			rs.consume(rm.len_);
-		}
-
-		e.complete();
-	}
-
 	// FIXME: duplication with xml_format
 	void begin_superblock(indented_stream &out,
 			      string const &uuid,
@@ -551,9 +345,8 @@ namespace local {
 	}
 
 	void delta_(application &app, flags const &fs) {
-		mapping_recorder mr1;
-		mapping_recorder mr2;
-		damage_visitor damage_v;
+		delta_detail::mapping_deque mappings1;
+		delta_detail::mapping_deque mappings2;
 		superblock_detail::superblock sb;
 		block_address nr_data_blocks = 0ull;
 
@@ -562,6 +355,9 @@ namespace local {
 			metadata::ptr md(fs.use_metadata_snap ? new metadata(bm, fs.metadata_snap) : new metadata(bm));
 			sb = md->sb_;
 
+			// Only two devices are read, so this overestimates.
+			base::set_walk_progress_total(persistent_data::get_nr_allocated(sb.metadata_space_map_root_));
+
 			dev_tree::key k = {*fs.snap1};
 			boost::optional<uint64_t> snap1_root = md->mappings_top_level_->lookup(k);
 
@@ -585,11 +381,8 @@ namespace local {
 
 			single_mapping_tree snap2(*md->tm_, *snap2_root,
 						  mapping_tree_detail::block_traits::ref_counter(md->tm_->get_sm()));
-			btree_visit_values(snap1, mr1, damage_v);
-			mr1.complete();
-
-			btree_visit_values(snap2, mr2, damage_v);
-			mr2.complete();
+			mappings1 = read_mappings(snap1);
+			mappings2 = read_mappings(snap2);
 
 			if (md->data_sm_)
 				nr_data_blocks = md->data_sm_->get_nr_blocks();
@@ -607,10 +400,10 @@ namespace local {
 
 		if (fs.verbose) {
 			verbose_emitter e(is);
-			dump_diff(mr1.get_mappings(), mr2.get_mappings(), e);
+			compare_mappings(mappings1, mappings2, e);
 		} else {
 			simple_emitter e(is);
-			dump_diff(mr1.get_mappings(), mr2.get_mappings(), e);
+			compare_mappings(mappings1, mappings2, e);
 		}
 
 		end_diff(is);
@@ -21,6 +21,8 @@
 #include <getopt.h>
 #include <libgen.h>
 
+#include "base/compression.h"
+#include "base/progress_monitor.h"
 #include "human_readable_format.h"
 #include "metadata_dumper.h"
 #include "metadata.h"
@@ -28,7 +30,9 @@
 #include "version.h"
 #include "thin-provisioning/commands.h"
 #include "persistent-data/file_utils.h"
+#include "persistent-data/space-maps/disk.h"
 #include "binary_format.h"
+#include "stream_format.h"
 
 using namespace boost;
 using namespace persistent_data;
@@ -40,11 +44,15 @@ namespace {
 	struct flags {
 		flags()
 			: repair(false),
-			  use_metadata_snap(false) {
+			  use_metadata_snap(false),
+			  compress(false),
+			  shared(false) {
 		}
 
 		bool repair;
 		bool use_metadata_snap;
+		bool compress;
+		bool shared;
 		optional<block_address> snap_location;
 	};
 
@@ -55,27 +63,48 @@ namespace {
 		return md;
 	}
 
-	int dump_(string const &path, ostream &out, string const &format,
-		struct flags &flags, const block_address * const dev_id = NULL) {
-		try {
-			metadata::ptr md = open_metadata(path, flags);
-			emitter::ptr e;
+	void dump_to(metadata::ptr md, ostream &out, string const &format,
+		     struct flags &flags, const block_address * const dev_id) {
+		emitter::ptr e;
 
-			if (format == "xml")
-				e = create_xml_emitter(out);
+		if (format == "xml")
+			e = create_xml_emitter(out);
 
-			else if (format == "human_readable")
-				e = create_human_readable_emitter(out);
+		else if (format == "human_readable")
+			e = create_human_readable_emitter(out);
 
-			else if (format == "binary")
-				e = create_binary_emitter(out);
+		else if (format == "binary")
+			e = create_binary_emitter(out);
 
-			else {
-				cerr << "unknown format '" << format << "'" << endl;
-				exit(1);
-			}
+		else if (format == "stream")
+			e = create_stream_emitter(out);
 
+		else {
+			cerr << "unknown format '" << format << "'" << endl;
+			exit(1);
+		}
+
+		if (flags.shared)
+			metadata_dump_shared(md, e, dev_id);
+		else
 			metadata_dump(md, e, flags.repair, dev_id);
+	}
+
+	int dump_(string const &path, ostream &out, string const &format,
+		struct flags &flags, const block_address * const dev_id = NULL) {
+		try {
+			metadata::ptr md = open_metadata(path, flags);
+
+			// --shared counts the mapping tree before dumping it.
+			base::set_walk_progress_total(get_nr_allocated(md->sb_.metadata_space_map_root_) *
+						      (flags.shared ? 2 : 1));
+
+			if (flags.compress) {
+				base::compressing_ostream zout(out);
+				dump_to(md, zout, format, flags, dev_id);
+				zout.close();
+			} else
+				dump_to(md, out, format, flags, dev_id);
 
 		} catch (std::exception &e) {
 			cerr << e.what() << endl;
@@ -89,7 +118,7 @@ namespace {
 		struct flags &flags, const block_address * const dev_id = NULL) {
 		if (output) {
 			ios_base::openmode mode = ios_base::out;
-			if (format == "binary")
+			if (format == "binary" || format == "stream" || flags.compress)
 				mode |= ios_base::binary;
 			ofstream out(output, mode);
 			assert(out.is_open());
@@ -112,10 +141,12 @@ thin_dump_cmd::usage(std::ostream &out) const
 	out << "Usage: " << get_name() << " [options] {device|file}" << endl
 	    << "Options:" << endl
 	    << "  {-h|--help}" << endl
-	    << "  {-f|--format} {xml|human_readable|binary}" << endl
+	    << "  {-f|--format} {xml|human_readable|binary|stream}" << endl
 	    << "  {-r|--repair}" << endl
 	    << "  {-m|--metadata-snap} [block#]" << endl
 	    << "  {-o <xml file>}" << endl
+	    << "  {-z|--compress}" << endl
+	    << "  {--shared}" << endl
 	    << "  {-V|--version}" << endl
 	    << "  {-n|--name}" << endl;
 }
@@ -125,7 +156,7 @@ thin_dump_cmd::run(int argc, char **argv)
 {
 	int c;
 	char const *output = NULL;
-	const char shortopts[] = "hm::o:f:rVn:";
+	const char shortopts[] = "hm::o:f:rVn:z";
 	char *end_ptr;
 	string format = "xml";
 	block_address metadata_snap = 0;
@@ -140,6 +171,8 @@ thin_dump_cmd::run(int argc, char **argv)
 		{ "repair", no_argument, NULL, 'r'},
 		{ "version", no_argument, NULL, 'V'},
 		{ "name", required_argument, NULL, 'n'},
+		{ "compress", no_argument, NULL, 'z'},
+		{ "shared", no_argument, NULL, 1},
 		{ NULL, no_argument, NULL, 0 }
 	};
 
@@ -185,6 +218,14 @@ thin_dump_cmd::run(int argc, char **argv)
 			*dev_id = atoi(optarg);
 			break;
 
+		case 'z':
+			flags.compress = true;
+			break;
+
+		case 1:
+			flags.shared = true;
+			break;
+
 		default:
 			usage(cerr);
 			return 1;
@@ -197,6 +238,11 @@ thin_dump_cmd::run(int argc, char **argv)
 		return 1;
 	}
 
+	if (flags.shared && flags.repair) {
+		cerr << "--shared can't be used with --repair" << endl;
+		return 1;
+	}
+
 	if (format == "binary" && !dev_id) {
 		cerr << "binary format can only be used with -n" << endl;
 		return 1;
@@ -23,11 +23,14 @@
 
 #include "base/disk_units.h"
 #include "base/grid_layout.h"
+#include "base/progress_monitor.h"
 #include "boost/lexical_cast.hpp"
 #include "boost/optional.hpp"
 #include "boost/range.hpp"
 #include "persistent-data/file_utils.h"
+#include "persistent-data/space-maps/disk.h"
 #include "thin-provisioning/commands.h"
+#include "thin-provisioning/device_accounting.h"
 #include "thin-provisioning/human_readable_format.h"
 #include "thin-provisioning/metadata.h"
 #include "thin-provisioning/metadata_dumper.h"
@@ -44,61 +47,6 @@ using namespace thin_provisioning;
 //----------------------------------------------------------------
 
 namespace {
-	class mapping_set {
-	public:
-		mapping_set()
-		: bits_(10240, false) {
-		}
-
-		enum block_state {
-			UNMAPPED,
-			EXCLUSIVE,
-			SHARED
-		};
-
-		void inc(block_address b) {
-			if (get_bit(b * 2))
-				set_bit(b * 2 + 1, true); // shared
-			else
-				set_bit(b * 2, true); // exclusive
-		}
-
-		block_state get_state(block_address b) const {
-			if (get_bit(b * 2)) {
-				if (get_bit(b * 2 + 1))
-					return SHARED;
-				else
-					return EXCLUSIVE;
-			} else
-				return UNMAPPED;
-		}
-
-	private:
-		void ensure_size(block_address bit) const {
-			if (bit >= bits_.size()) {
-				unsigned new_size = bits_.size() * 2;
-				while (new_size < bit)
-					new_size *= 2;
-
-				bits_.resize(new_size, false);
-			}
-		}
-
-		bool get_bit(block_address bit) const {
-			ensure_size(bit);
-			return bits_[bit];
-		}
-
-		void set_bit(block_address bit, bool v) {
-			ensure_size(bit);
-			bits_[bit] = v;
-		}
-
-		mutable vector<bool> bits_;
-	};
-
-	//------------------------------------------------
-
 	enum output_field {
 		DEV_ID,
 		MAPPED_BLOCKS,
@@ -186,119 +134,6 @@ namespace {
 
 	//------------------------------------------------
 
-	class mapping_pass1 : public mapping_tree_detail::mapping_visitor {
-	public:
-		mapping_pass1(mapping_set &mappings)
-		: mappings_(mappings) {
-		}
-
-		virtual void visit(btree_path const &path, mapping_tree_detail::block_time const &bt) {
-			mappings_.inc(bt.block_);
-		}
-
-	private:
-		mapping_set &mappings_;
-	};
-
-	class mapping_pass2 : public mapping_tree_detail::mapping_visitor {
-	public:
-		mapping_pass2(mapping_set const &mappings)
-		: mappings_(mappings),
-		  exclusives_(0) {
-		}
-
-		virtual void visit(btree_path const &path, mapping_tree_detail::block_time const &bt) {
-			if (mappings_.get_state(bt.block_) == mapping_set::EXCLUSIVE)
-				exclusives_++;
-		}
-
-		block_address get_exclusives() const {
-			return exclusives_;
-		}
-
-	private:
-		mapping_set const &mappings_;
-		block_address exclusives_;
-	};
-
-	void raise_metadata_damage() {
-		throw std::runtime_error("metadata contains errors (run thin_check for details).");
-	}
-
-	class fatal_mapping_damage : public mapping_tree_detail::damage_visitor {
-	public:
-		virtual void visit(mapping_tree_detail::missing_devices const &d) {
-			raise_metadata_damage();
-		}
-
-		virtual void visit(mapping_tree_detail::missing_mappings const &d) {
-			raise_metadata_damage();
-		}
-	};
-
-	void pass1(metadata::ptr md, mapping_set &mappings, uint64_t dev_id) {
-		dev_tree::key k = {dev_id};
-		optional<uint64_t> dev_root = md->mappings_top_level_->lookup(k);
-
-		if (!dev_root)
-			throw runtime_error("couldn't find mapping tree root");
-
-		single_mapping_tree dev_mappings(*md->tm_, *dev_root,
-				   mapping_tree_detail::block_traits::ref_counter(md->tm_->get_sm()));
-
-		mapping_pass1 pass1(mappings);
-		fatal_mapping_damage dv;
-		walk_mapping_tree(dev_mappings, pass1, dv);
-	}
-
-
-	block_address count_exclusives(metadata::ptr md, mapping_set const &mappings, uint64_t dev_id) {
-		dev_tree::key k = {dev_id};
-		optional<uint64_t> dev_root = md->mappings_top_level_->lookup(k);
-
-		if (!dev_root)
-			throw runtime_error("couldn't find mapping tree root");
-
-		single_mapping_tree dev_mappings(*md->tm_, *dev_root,
-				   mapping_tree_detail::block_traits::ref_counter(md->tm_->get_sm()));
-
-		mapping_pass2 pass2(mappings);
-		fatal_mapping_damage dv;
-		walk_mapping_tree(dev_mappings, pass2, dv);
-		return pass2.get_exclusives();
-	}
-
-	//------------------------------------------------
-
- 	typedef map<block_address, device_tree_detail::device_details> dd_map;
-
-	class details_extractor : public device_tree_detail::device_visitor {
-	public:
-		void visit(block_address dev_id, device_tree_detail::device_details const &dd) {
-			dd_.insert(make_pair(dev_id, dd));
-		}
-
-		dd_map const &get_details() const {
-			return dd_;
-		}
-
-	private:
-		dd_map dd_;
-	};
-
-	struct fatal_details_damage : public device_tree_detail::damage_visitor {
-		void visit(device_tree_detail::missing_devices const &d) {
-			raise_metadata_damage();
-		}
-	};
-
-	device_tree_detail::damage_visitor::ptr details_damage_policy() {
-		typedef device_tree_detail::damage_visitor::ptr dvp;
-		return dvp(new fatal_details_damage());
-	}
-
-	//------------------------------------------------
-
 	bool pass1_needed(vector<output_field> const &fields) {
 		vector<output_field>::const_iterator it;
 		for (it = fields.begin(); it != fields.end(); ++it) {
@@ -328,20 +163,18 @@ namespace {
 		else
 			md.reset(new metadata(bm));
 
-		block_address block_size = md->sb_.data_block_size_;
+		set_walk_progress_total(get_nr_allocated(md->sb_.metadata_space_map_root_));
 
-		details_extractor de;
-		device_tree_detail::damage_visitor::ptr dd_policy(details_damage_policy());
-		walk_device_tree(*md->details_, de, *dd_policy);
+		block_address block_size = md->sb_.data_block_size_;
 
-		mapping_set mappings;
+		dd_map const map = read_device_details(*md);
 		dd_map::const_iterator it;
-		dd_map const &map = de.get_details();
 
+		mapping_set mappings;
 		bool some_exclusive_fields = pass1_needed(flags.fields);
 		if (some_exclusive_fields) {
 			for (it = map.begin(); it != map.end(); ++it)
-				pass1(md, mappings, it->first);
+				add_mappings(*md, it->first, mappings);
 		}
 
 		if (flags.headers)
@@ -353,7 +186,7 @@ namespace {
 			block_address exclusive = 0;
 
 			if (some_exclusive_fields)
-				exclusive = count_exclusives(md, mappings, it->first);
+				exclusive = count_exclusives(*md, mappings, it->first);
 
 			for (f = flags.fields.begin(); f != flags.fields.end(); ++f) {
 				switch (*f) {
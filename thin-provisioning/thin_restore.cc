@@ -22,6 +22,7 @@
 #include "thin-provisioning/human_readable_format.h"
 #include "thin-provisioning/metadata.h"
 #include "thin-provisioning/restore_emitter.h"
+#include "thin-provisioning/stream_format.h"
 #include "thin-provisioning/xml_format.h"
 #include "version.h"
 
@@ -49,7 +50,10 @@ namespace {
 			metadata::ptr md(new metadata(bm, metadata::CREATE, 128, 0));
 			emitter::ptr restorer = create_restore_emitter(md);
 
-			parse_xml(backup_file, restorer, quiet);
+			if (is_stream_file(backup_file))
+				parse_stream(backup_file, restorer, quiet);
+			else
+				parse_xml(backup_file, restorer, quiet);
 
 		} catch (std::exception &e) {
 			cerr << e.what() << endl;
@@ -73,7 +77,7 @@ thin_restore_cmd::usage(std::ostream &out) const
 	out << "Usage: " << get_name() << " [options]" << endl
 	    << "Options:" << endl
 	    << "  {-h|--help}" << endl
-	    << "  {-i|--input} <input xml file>" << endl
+	    << "  {-i|--input} <input xml or stream file>" << endl
 	    << "  {-o|--output} <output device or file>" << endl
 	    << "  {-q|--quiet}" << endl
 	    << "  {-V|--version}" << endl;
@@ -1,11 +1,16 @@
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 #include <iostream>
 #include <getopt.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <sstream>
+#include <stdlib.h>
 #include <vector>
 
 #include "version.h"
 
+#include "base/mutex_lock.h"
 #include "persistent-data/data-structures/btree_damage_visitor.h"
 #include "persistent-data/run.h"
 #include "persistent-data/space-maps/core.h"
@@ -15,17 +20,20 @@
 #include "thin-provisioning/mapping_tree.h"
 #include "thin-provisioning/rmap_visitor.h"
 
+using namespace base;
 using namespace std;
 using namespace thin_provisioning;
 
 //----------------------------------------------------------------
 
 namespace {
+	unsigned const DEFAULT_NR_THREADS = 4;
+
 	block_manager<>::ptr
-	open_bm(string const &path) {
+	open_bm(string const &path, bool excl = true) {
 		block_address nr_blocks = get_nr_blocks(path);
 		block_manager<>::mode m = block_manager<>::READ_ONLY;
-		return block_manager<>::ptr(new block_manager<>(path, nr_blocks, 1, m));
+		return block_manager<>::ptr(new block_manager<>(path, nr_blocks, 1, m, excl));
 	}
 
 	transaction_manager::ptr
@@ -63,24 +71,177 @@ namespace {
 		}
 	}
 
-	int rmap(string const &path, vector<region> const &regions) {
-		damage_visitor dv;
-		rmap_visitor rv;
+	class device_collector {
+	public:
+		typedef pair<uint32_t, block_address> device;
 
-		try {
+		void visit(btree_path const &path, block_address root) {
+			devs_.push_back(device(path[0], root));
+		}
+
+		vector<device> const &get_devices() const {
+			return devs_;
+		}
+
+	private:
+		vector<device> devs_;
+	};
+
+	class single_rmap_visitor {
+	public:
+		single_rmap_visitor(rmap_visitor &rv, uint32_t thin_dev)
+			: rv_(rv),
+			  thin_dev_(thin_dev) {
+		}
+
+		void visit(btree_path const &path, block_time const &bt) {
+			rv_.visit_mapping(thin_dev_, path[0], bt);
+		}
+
+	private:
+		rmap_visitor &rv_;
+		uint32_t thin_dev_;
+	};
+
+	// Devices are handed out to the workers one at a time.  The
+	// block cache isn't thread safe, so each worker opens the
+	// metadata with its own block manager, and builds its own rmap.
+	// These are merged once every worker has finished.
+	class rmap_worker : private boost::noncopyable {
+	public:
+		typedef device_collector::device device;
+
+		struct work {
+			work(string const &path_, vector<device> const &devs_)
+				: path(path_),
+				  devs(devs_),
+				  next(0) {
+				pthread_mutex_init(&lock, NULL);
+			}
+
+			~work() {
+				pthread_mutex_destroy(&lock);
+			}
+
+			string path;
+			vector<device> const &devs;
+
+			pthread_mutex_t lock;
+			size_t next;
+		};
+
+		rmap_worker(work &w, vector<region> const &regions)
+			: work_(w),
+			  started_(false) {
 			vector<region>::const_iterator it;
 			for (it = regions.begin(); it != regions.end(); ++it)
-				rv.add_data_region(*it);
+				rv_.add_data_region(*it);
+		}
+
+		~rmap_worker() {
+			join();
+		}
+
+		void start() {
+			if (pthread_create(&thread_, NULL, worker_, this))
+				throw runtime_error("couldn't create rmap thread");
+
+			started_ = true;
+		}
+
+		void join() {
+			if (started_) {
+				pthread_join(thread_, NULL);
+				started_ = false;
+			}
+		}
+
+		// Throws if the worker did.
+		rmap_visitor const &get_rmap_visitor() const {
+			if (!exception_.empty())
+				throw runtime_error(exception_);
+
+			return rv_;
+		}
+
+	private:
+		static void *worker_(void *context) {
+			static_cast<rmap_worker *>(context)->worker();
+			return NULL;
+		}
+
+		void worker() {
+			try {
+				block_manager<>::ptr bm = open_bm(work_.path, false);
+				transaction_manager::ptr tm = open_tm(bm);
+				damage_visitor dv;
+
+				device d;
+				while (next_device(d)) {
+					single_mapping_tree tree(*tm, d.second,
+								 mapping_tree_detail::block_traits::ref_counter(tm->get_sm()));
+					single_rmap_visitor v(rv_, d.first);
+					btree_visit_values(tree, v, dv);
+				}
+
+				rv_.complete();
+
+			} catch (std::exception &e) {
+				exception_ = e.what();
+			}
+		}
+
+		bool next_device(device &d) {
+			mutex_lock l(work_.lock);
+
+			if (work_.next == work_.devs.size())
+				return false;
+
+			d = work_.devs[work_.next++];
+			return true;
+		}
+
+		work &work_;
+		rmap_visitor rv_;
+		string exception_;
 
+		pthread_t thread_;
+		bool started_;
+	};
+
+	int rmap(string const &path, vector<region> const &regions, unsigned nr_threads) {
+		damage_visitor dv;
+
+		try {
 			block_manager<>::ptr bm = open_bm(path);
 			transaction_manager::ptr tm = open_tm(bm);
 
 			superblock_detail::superblock sb = read_superblock(bm);
-			mapping_tree mtree(*tm, sb.data_mapping_root_,
-					   mapping_tree_detail::block_traits::ref_counter(tm->get_sm()));
+			dev_tree dtree(*tm, sb.data_mapping_root_,
+				       mtree_traits::ref_counter(tm));
+
+			device_collector dc;
+			btree_visit_values(dtree, dc, dv);
 
-			btree_visit_values(mtree, rv, dv);
+			vector<rmap_worker::device> const &devs = dc.get_devices();
+			nr_threads = max<unsigned>(1, min<size_t>(nr_threads, devs.size()));
+
+			rmap_worker::work w(path, devs);
+			vector<boost::shared_ptr<rmap_worker> > workers;
+			for (unsigned i = 0; i < nr_threads; i++) {
+				boost::shared_ptr<rmap_worker> worker(new rmap_worker(w, regions));
+				workers.push_back(worker);
+				worker->start();
+			}
+
+			for (unsigned i = 0; i < nr_threads; i++)
+				workers[i]->join();
+
+			rmap_visitor rv;
 			rv.complete();
+			for (unsigned i = 0; i < nr_threads; i++)
+				rv.merge(workers[i]->get_rmap_visitor());
+
 			display_rmap(cout, rv.get_rmap());
 
 		} catch (std::exception const &e) {
@@ -128,6 +289,7 @@ thin_rmap_cmd::usage(std::ostream &out) const
 	    << "  {-h|--help}" << endl
 	    << "  {-V|--version}" << endl
 	    << "  {--region <block range>}*" << endl
+	    << "  {--threads <n>}" << endl
 	    << "Where:" << endl
 	    << "  <block range> is of the form <begin>..<one-past-the-end>" << endl
 	    << "  for example 5..45 denotes blocks 5 to 44 inclusive, but not block 45" << endl;
@@ -137,12 +299,15 @@ int
 thin_rmap_cmd::run(int argc, char **argv)
 {
 	int c;
+	char *end;
 	vector<region> regions;
+	unsigned nr_threads = DEFAULT_NR_THREADS;
 	char const shortopts[] = "hV";
 	option const longopts[] = {
 		{ "help", no_argument, NULL, 'h'},
 		{ "version", no_argument, NULL, 'V'},
 		{ "region", required_argument, NULL, 1},
+		{ "threads", required_argument, NULL, 2},
 		{ NULL, no_argument, NULL, 0 }
 	};
 
@@ -168,6 +333,14 @@ thin_rmap_cmd::run(int argc, char **argv)
 
 			break;
 
+		case 2:
+			nr_threads = strtoul(optarg, &end, 10);
+			if (*end || !nr_threads) {
+				cerr << "invalid number of threads: " << optarg << endl;
+				return 1;
+			}
+			break;
+
 		default:
 			usage(cerr);
 			return 1;
@@ -180,7 +353,7 @@ thin_rmap_cmd::run(int argc, char **argv)
 		exit(1);
 	}
 
-	return rmap(argv[optind], regions);
+	return rmap(argv[optind], regions, nr_threads);
 }
 
 //----------------------------------------------------------------
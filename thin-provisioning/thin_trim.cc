@@ -1,17 +1,15 @@
 #include <iostream>
 #include <getopt.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
 #include <linux/fs.h>
 #include <libgen.h>
 
 #undef BLOCK_SIZE
 
-#ifndef BLKDISCARD
-#define BLKDISCARD _IO(0x12,119)
-#endif
-
 #include "persistent-data/file_utils.h"
 #include "thin-provisioning/commands.h"
+#include "thin-provisioning/discard_engine.h"
 #include "metadata.h"
 #include "version.h"
 
@@ -22,6 +20,8 @@ using namespace thin_provisioning;
 //----------------------------------------------------------------
 
 namespace {
+	unsigned const DEFAULT_NR_THREADS = 4;
+
 	void confirm_pool_is_not_active() {
 		cout << "The pool must *not* be active when running this tool.\n"
 		     << "Do you wish to continue? [Y/N]\n"
@@ -33,116 +33,194 @@ namespace {
 			exit(0);
 	}
 
-	class discard_emitter {
-	public:
-		discard_emitter(string const &data_dev, unsigned block_size, uint64_t nr_blocks)
-			: fd_(open_dev(data_dev, block_size * nr_blocks)),
-			  block_size_(block_size) {
+	struct flags {
+		flags()
+			: pool_inactive(false),
+			  dry_run(false),
+			  nr_threads(DEFAULT_NR_THREADS) {
 		}
 
-		~discard_emitter() {
-			::close(fd_);
+		boost::optional<string> metadata_dev;
+		boost::optional<string> data_dev;
+		bool pool_inactive;
+		bool dry_run;
+		unsigned nr_threads;
+	};
+
+	// A dry run can be pointed at a plain file.
+	int open_dev(string const &data_dev, uint64_t expected_size, bool dry_run) {
+		int r, fd;
+		uint64_t size;
+		struct stat info;
+
+		fd = ::open(data_dev.c_str(), dry_run ? O_RDONLY : O_WRONLY);
+		if (fd < 0) {
+			ostringstream out;
+			out << "Couldn't open data device '" << data_dev << "'";
+			throw runtime_error(out.str());
 		}
 
-		void emit(block_address b, block_address e) {
-			uint64_t range[2];
+		try {
+			r = fstat(fd, &info);
+			if (r)
+				throw runtime_error("Couldn't stat data device");
 
-			range[0] = block_to_byte(b);
-			range[1] = block_to_byte(e) - range[0];
+			if (S_ISBLK(info.st_mode)) {
+				r = ioctl(fd, BLKGETSIZE64, &size);
+				if (r)
+					throw runtime_error("Couldn't get data device size");
 
-			if (ioctl(fd_, BLKDISCARD, &range))
-				throw runtime_error("discard ioctl failed");
-		}
+			} else if (dry_run)
+				size = info.st_size;
 
-	private:
-		static int open_dev(string const &data_dev, uint64_t expected_size) {
-			int r, fd;
-			uint64_t blksize;
-			struct stat info;
-
-			fd = ::open(data_dev.c_str(), O_WRONLY);
-			if (fd < 0) {
-				ostringstream out;
-				out << "Couldn't open data device '" << data_dev << "'";
-				throw runtime_error(out.str());
-			}
+			else
+				throw runtime_error("Data device is not a block device");
 
-			try {
-				r = fstat(fd, &info);
-				if (r)
-					throw runtime_error("Couldn't stat data device");
+			if (size != (expected_size << 9))
+				throw runtime_error("Data device is not the expected size");
 
-				if (!S_ISBLK(info.st_mode))
-					throw runtime_error("Data device is not a block device");
+		} catch (...) {
+			::close(fd);
+			throw;
+		}
 
-				r = ioctl(fd, BLKGETSIZE64, &blksize);
-				if (r)
-					throw runtime_error("Couldn't get data device size");
+		return fd;
+	}
 
-				if (blksize != (expected_size << 9))
-					throw runtime_error("Data device is not the expected size");
+	class range_printer : public discard_sink {
+	public:
+		range_printer(ostream &out)
+			: out_(out),
+			  nr_bytes_(0),
+			  nr_requests_(0) {
+		}
 
-			} catch (...) {
-				::close(fd);
-				throw;
-			}
+		virtual void discard(uint64_t begin, uint64_t len) {
+			out_ << "discard " << begin << " " << len << "\n";
+			nr_bytes_ += len;
+			nr_requests_++;
+		}
 
-			return fd;
+		uint64_t get_nr_bytes() const {
+			return nr_bytes_;
 		}
 
-		uint64_t block_to_byte(block_address b) {
-			return (b * block_size_) << 9;
+		uint64_t get_nr_requests() const {
+			return nr_requests_;
 		}
 
-		int fd_;
-		unsigned block_size_;
+	private:
+		ostream &out_;
+		uint64_t nr_bytes_;
+		uint64_t nr_requests_;
 	};
 
-	class trim_visitor : public space_map_detail::visitor {
+	// Passes each run of free data blocks to the planner.
+	class trim_iterator : public space_map::iterator {
 	public:
-		trim_visitor(discard_emitter &e)
-		: emitter_(e) {
+		trim_iterator(discard_planner &planner, uint64_t block_bytes)
+			: planner_(planner),
+			  block_bytes_(block_bytes) {
 		}
 
-		virtual void visit(space_map_detail::missing_counts const &mc) {
-			throw std::runtime_error("corrupt metadata, please use thin_check for details");
-		}
+		virtual void operator() (block_address b, ref_t count) {
+			if (count) {
+				complete();
+				return;
+			}
 
-		virtual void visit(block_address b, uint32_t count) {
-			if (last_visited_ && (b > *last_visited_ + 1))
-				emitter_.emit(*last_visited_ + 1, b);
+			if (!run_begin_)
+				run_begin_ = b;
+			run_end_ = b + 1;
+		}
 
-			last_visited_ = b;
+		void complete() {
+			if (run_begin_) {
+				planner_.add(*run_begin_ * block_bytes_, run_end_ * block_bytes_);
+				run_begin_ = boost::optional<block_address>();
+			}
 		}
 
 	private:
-		discard_emitter &emitter_;
-		boost::optional<block_address> last_visited_;
+		discard_planner &planner_;
+		uint64_t block_bytes_;
+		boost::optional<block_address> run_begin_;
+		block_address run_end_;
 	};
 
-	int trim(string const &metadata_dev, string const &data_dev) {
+	double now() {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec / 1000000.0;
+	}
+
+	void report(ostream &out, char const *what, uint64_t nr_bytes,
+		    uint64_t nr_requests, double seconds) {
+		out << what << " " << nr_bytes << " bytes in "
+		    << nr_requests << " requests";
+		if (seconds > 0)
+			out << " (" << (nr_bytes / seconds / (1024 * 1024)) << " MB/s)";
+		out << endl;
+	}
+
+	void visit_free_blocks(metadata &md, discard_planner &planner) {
+		trim_iterator it(planner, static_cast<uint64_t>(md.sb_.data_block_size_) << 9);
+		md.data_sm_->iterate(it);
+		it.complete();
+		planner.complete();
+	}
+
+	int trim(flags const &fs) {
 		// We can trim any block that has zero count in the data
 		// space map.
-		block_manager<>::ptr bm = open_bm(metadata_dev, block_manager<>::READ_ONLY);
+		block_manager<>::ptr bm = open_bm(*fs.metadata_dev, block_manager<>::READ_ONLY);
 		metadata md(bm);
 
 		if (!md.data_sm_->get_nr_free())
 			return 0;
 
-		discard_emitter de(data_dev, md.sb_.data_block_size_,
-				   md.data_sm_->get_nr_blocks());
-		trim_visitor tv(de);
+		uint64_t nr_sectors = md.sb_.data_block_size_ * md.data_sm_->get_nr_blocks();
+		int fd = open_dev(*fs.data_dev, nr_sectors, fs.dry_run);
+
+		try {
+			if (fs.dry_run) {
+				discard_limits limits;
+				try {
+					limits = get_discard_limits(fd);
+				} catch (...) {
+					// eg, a plain file; plan with the defaults.
+				}
+
+				range_printer printer(cout);
+				discard_planner planner(limits, printer);
+				visit_free_blocks(md, planner);
+				report(cout, "would discard", printer.get_nr_bytes(),
+				       printer.get_nr_requests(), 0);
+
+			} else {
+				discard_limits limits = get_discard_limits(fd);
+
+				if (!fs.pool_inactive)
+					confirm_pool_is_not_active();
+
+				double start = now();
+				threaded_discarder discarder(fd, fs.nr_threads);
+				discard_planner planner(limits, discarder);
+				visit_free_blocks(md, planner);
+				discarder.complete();
+
+				report(cout, "discarded", discarder.get_nr_bytes(),
+				       discarder.get_nr_requests(), now() - start);
+			}
 
-		confirm_pool_is_not_active();
-		md.data_sm_->visit(tv);
+		} catch (...) {
+			::close(fd);
+			throw;
+		}
 
+		::close(fd);
 		return 0;
 	}
-
-	struct flags {
-		boost::optional<string> metadata_dev;
-		boost::optional<string> data_dev;
-	};
 }
 
 //----------------------------------------------------------------
@@ -158,6 +236,8 @@ thin_trim_cmd::usage(std::ostream &out) const
 	out << "Usage: " << get_name() << " [options] {device|file}\n"
 	    << "Options:\n"
 	    << "  {--pool-inactive}\n"
+	    << "  {--dry-run}\n"
+	    << "  {--discard-threads} <n>\n"
 	    << "  {-h|--help}\n"
 	    << "  {-V|--version}" << endl;
 }
@@ -166,6 +246,7 @@ int
 thin_trim_cmd::run(int argc, char **argv)
 {
 	int c;
+	char *end;
 	flags fs;
 	const char shortopts[] = "hV";
 
@@ -175,6 +256,8 @@ thin_trim_cmd::run(int argc, char **argv)
 		{ "metadata-dev", required_argument, NULL, 0 },
 		{ "data-dev", required_argument, NULL, 1 },
 		{ "pool-inactive", no_argument, NULL, 2 },
+		{ "dry-run", no_argument, NULL, 3 },
+		{ "discard-threads", required_argument, NULL, 4 },
 		{ NULL, no_argument, NULL, 0 }
 	};
 
@@ -188,6 +271,22 @@ thin_trim_cmd::run(int argc, char **argv)
 			fs.data_dev = optarg;
 			break;
 
+		case 2:
+			fs.pool_inactive = true;
+			break;
+
+		case 3:
+			fs.dry_run = true;
+			break;
+
+		case 4:
+			fs.nr_threads = strtoul(optarg, &end, 10);
+			if (*end || !fs.nr_threads) {
+				cerr << "invalid number of discard threads: " << optarg << endl;
+				return 1;
+			}
+			break;
+
 		case 'h':
 			usage(cout);
 			return 0;
@@ -207,7 +306,13 @@ thin_trim_cmd::run(int argc, char **argv)
 		return 1;
 	}
 
-	return trim(*fs.metadata_dev, *fs.data_dev);
+	try {
+		return trim(fs);
+
+	} catch (std::exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
 }
 
 //----------------------------------------------------------------
@@ -0,0 +1,480 @@
+#include "thin-provisioning/verification_cache.h"
+
+#include "base/endian_utils.h"
+#include "persistent-data/checksum.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+
+using namespace base;
+using namespace std;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	uint64_t const CACHE_MAGIC = 0x796672766e696874ULL; // "thinvrfy"
+	uint32_t const CACHE_VERSION = 2;
+	uint32_t const CACHE_CSUM_XOR = 0x3c8e51a9;
+
+	// The file is only a hint, so anything odd about it just means
+	// it's ignored.  These are well beyond what a real mapping
+	// subtree has.
+	uint32_t const MAX_CHILDREN = 256;
+	unsigned const MAX_HEIGHT = 32;
+
+	uint32_t cache_sum(string const &data) {
+		crc32c sum(CACHE_CSUM_XOR);
+		sum.append(data.data(), data.length());
+		return sum.get_sum();
+	}
+
+	void write_u32(ostream &out, uint32_t v) {
+		le32 d = to_disk<le32>(v);
+		out.write(reinterpret_cast<char const *>(&d), sizeof(d));
+	}
+
+	void write_u64(ostream &out, uint64_t v) {
+		le64 d = to_disk<le64>(v);
+		out.write(reinterpret_cast<char const *>(&d), sizeof(d));
+	}
+
+	uint32_t read_u32(istream &in) {
+		le32 d;
+		if (!in.read(reinterpret_cast<char *>(&d), sizeof(d)))
+			throw runtime_error("verification cache truncated");
+		return to_cpu<uint32_t>(d);
+	}
+
+	uint64_t read_u64(istream &in) {
+		le64 d;
+		if (!in.read(reinterpret_cast<char *>(&d), sizeof(d)))
+			throw runtime_error("verification cache truncated");
+		return to_cpu<uint64_t>(d);
+	}
+
+	void write_key(ostream &out, verification_cache_key const &key) {
+		out.write(reinterpret_cast<char const *>(key.uuid), sizeof(key.uuid));
+		write_u64(out, key.metadata_nr_blocks);
+		write_u32(out, key.data_block_size);
+	}
+
+	verification_cache_key read_key(istream &in) {
+		verification_cache_key key;
+
+		if (!in.read(reinterpret_cast<char *>(key.uuid), sizeof(key.uuid)))
+			throw runtime_error("verification cache truncated");
+		key.metadata_nr_blocks = read_u64(in);
+		key.data_block_size = read_u32(in);
+
+		return key;
+	}
+}
+
+//----------------------------------------------------------------
+
+verification_cache_key::verification_cache_key()
+	: metadata_nr_blocks(0),
+	  data_block_size(0)
+{
+	::memset(uuid, 0, sizeof(uuid));
+}
+
+verification_cache_key::verification_cache_key(superblock_detail::superblock const &sb)
+	: metadata_nr_blocks(sb.metadata_nr_blocks_),
+	  data_block_size(sb.data_block_size_)
+{
+	::memcpy(uuid, sb.uuid_, sizeof(uuid));
+}
+
+bool
+verification_cache_key::operator ==(verification_cache_key const &rhs) const
+{
+	return !::memcmp(uuid, rhs.uuid, sizeof(uuid)) &&
+		metadata_nr_blocks == rhs.metadata_nr_blocks &&
+		data_block_size == rhs.data_block_size;
+}
+
+//----------------------------------------------------------------
+
+verification_cache::subtree::subtree()
+	: thin_dev(0),
+	  root(0),
+	  csum(0),
+	  lowest_key(0),
+	  highest_key(0),
+	  nr_mappings(0)
+{
+}
+
+verification_cache::node::node()
+	: nr_mappings(0),
+	  lowest_key(0),
+	  highest_key(0),
+	  summarised(false),
+	  allocated(false)
+{
+}
+
+verification_cache::verification_cache(verification_cache_key const &key,
+				       space_map::ptr metadata_sm)
+	: key_(key),
+	  metadata_sm_(metadata_sm),
+	  nr_skipped_(0)
+{
+}
+
+bool
+verification_cache::enter_subtree(uint64_t thin_dev, block_address root, uint32_t csum)
+{
+	subtree s;
+	s.thin_dev = thin_dev;
+	s.root = root;
+	s.csum = csum;
+	seen_.push_back(s);
+	entered_.insert(root);
+
+	map<block_address, subtree>::const_iterator it = verified_.find(root);
+	if (it == verified_.end() || it->second.csum != csum)
+		return true;
+
+	// The summary guards against a cache file that doesn't match
+	// what was written.
+	subtree now;
+	if (!summarise(root, now) ||
+	    now.nr_mappings != it->second.nr_mappings ||
+	    now.lowest_key != it->second.lowest_key ||
+	    now.highest_key != it->second.highest_key ||
+	    !still_allocated(root))
+		return true;
+
+	nr_skipped_++;
+	return false;
+}
+
+void
+verification_cache::visit_internal(block_address b, vector<block_address> const &children)
+{
+	node n;
+	n.children = children;
+	nodes_[b] = n;
+}
+
+void
+verification_cache::visit_leaf(block_address b, unsigned nr_entries,
+			       uint64_t lowest_key, uint64_t highest_key)
+{
+	node n;
+	n.nr_mappings = nr_entries;
+	n.lowest_key = lowest_key;
+	n.highest_key = highest_key;
+	n.summarised = true;
+	nodes_[b] = n;
+}
+
+bool
+verification_cache::count_subtree(block_address root, block_counter &bc) const
+{
+	subtree s;
+	if (!entered_.count(root) || !summarise(root, s))
+		return false;
+
+	count_(root, bc);
+	return true;
+}
+
+void
+verification_cache::write(string const &path) const
+{
+	vector<subtree> subtrees;
+	node_map nodes;
+
+	for (size_t i = 0; i < seen_.size(); i++) {
+		subtree s = seen_[i];
+		if (summarise(s.root, s)) {
+			subtrees.push_back(s);
+			collect(s.root, nodes);
+		}
+	}
+
+	// Write to a temporary file, so a reader never sees half a
+	// cache.  The whole file is checksummed.
+	string tmp = path + ".tmp";
+
+	{
+		ostringstream out;
+
+		write_u64(out, CACHE_MAGIC);
+		write_u32(out, CACHE_VERSION);
+		write_key(out, key_);
+
+		write_u32(out, subtrees.size());
+		for (size_t i = 0; i < subtrees.size(); i++) {
+			subtree const &s = subtrees[i];
+			write_u64(out, s.thin_dev);
+			write_u64(out, s.root);
+			write_u32(out, s.csum);
+			write_u64(out, s.lowest_key);
+			write_u64(out, s.highest_key);
+			write_u64(out, s.nr_mappings);
+		}
+
+		// Internal nodes always have children, so an empty child
+		// list marks a leaf.
+		write_u64(out, nodes.size());
+		node_map::const_iterator it;
+		for (it = nodes.begin(); it != nodes.end(); ++it) {
+			node const &n = it->second;
+
+			write_u64(out, it->first);
+			write_u32(out, n.children.size());
+			if (n.children.empty()) {
+				write_u64(out, n.nr_mappings);
+				write_u64(out, n.lowest_key);
+				write_u64(out, n.highest_key);
+			} else
+				for (size_t i = 0; i < n.children.size(); i++)
+					write_u64(out, n.children[i]);
+		}
+
+		string data = out.str();
+		ofstream file(tmp.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+		file.write(data.data(), data.length());
+		write_u32(file, cache_sum(data));
+
+		file.flush();
+		if (!file)
+			throw runtime_error("couldn't write verification cache " + tmp);
+	}
+
+	if (::rename(tmp.c_str(), path.c_str()))
+		throw runtime_error("couldn't rename verification cache to " + path);
+}
+
+verification_cache::ptr
+verification_cache::read(string const &path,
+			 verification_cache_key const &key,
+			 space_map::ptr metadata_sm)
+{
+	ifstream file(path.c_str(), ios_base::in | ios_base::binary);
+	if (!file)
+		return ptr();
+
+	try {
+		string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+		if (data.length() < sizeof(le32))
+			return ptr();
+
+		istringstream csum_in(data.substr(data.length() - sizeof(le32)));
+		data.resize(data.length() - sizeof(le32));
+		if (read_u32(csum_in) != cache_sum(data))
+			return ptr();
+
+		istringstream in(data);
+		if (read_u64(in) != CACHE_MAGIC || read_u32(in) != CACHE_VERSION)
+			return ptr();
+
+		if (read_key(in) != key)
+			return ptr();
+
+		ptr cache(new verification_cache(key, metadata_sm));
+
+		uint32_t nr_subtrees = read_u32(in);
+		for (uint32_t i = 0; i < nr_subtrees; i++) {
+			subtree s;
+			s.thin_dev = read_u64(in);
+			s.root = read_u64(in);
+			s.csum = read_u32(in);
+			s.lowest_key = read_u64(in);
+			s.highest_key = read_u64(in);
+			s.nr_mappings = read_u64(in);
+			cache->verified_[s.root] = s;
+		}
+
+		uint64_t nr_nodes = read_u64(in);
+		for (uint64_t i = 0; i < nr_nodes; i++) {
+			block_address b = read_u64(in);
+			node &n = cache->nodes_[b];
+
+			uint32_t nr_children = read_u32(in);
+			if (nr_children > MAX_CHILDREN)
+				return ptr();
+
+			if (!nr_children) {
+				n.nr_mappings = read_u64(in);
+				n.lowest_key = read_u64(in);
+				n.highest_key = read_u64(in);
+				n.summarised = true;
+			} else {
+				n.children.resize(nr_children);
+				for (uint32_t c = 0; c < nr_children; c++)
+					n.children[c] = read_u64(in);
+			}
+		}
+
+		if (!cache->check_nodes())
+			return ptr();
+
+		return cache;
+
+	} catch (std::exception &e) {
+		return ptr();
+	}
+}
+
+// The walkers trust the nodes completely, so every child must be
+// there, and no path through the nodes may be long.  Which rules out
+// cycles too.
+bool
+verification_cache::check_nodes() const
+{
+	map<block_address, unsigned> heights;
+
+	node_map::const_iterator it;
+	for (it = nodes_.begin(); it != nodes_.end(); ++it) {
+		unsigned height;
+		if (!check_node(it->first, 0, heights, height))
+			return false;
+	}
+
+	return true;
+}
+
+bool
+verification_cache::check_node(block_address b, unsigned depth,
+			       map<block_address, unsigned> &heights,
+			       unsigned &height) const
+{
+	if (depth > MAX_HEIGHT)
+		return false;
+
+	map<block_address, unsigned>::const_iterator h = heights.find(b);
+	if (h != heights.end()) {
+		height = h->second;
+		return true;
+	}
+
+	node_map::const_iterator it = nodes_.find(b);
+	if (b >= metadata_sm_->get_nr_blocks() || it == nodes_.end())
+		return false;
+
+	height = 0;
+	node const &n = it->second;
+	for (size_t i = 0; i < n.children.size(); i++) {
+		unsigned child_height;
+		if (!check_node(n.children[i], depth + 1, heights, child_height))
+			return false;
+
+		height = max(height, child_height + 1);
+	}
+
+	if (height > MAX_HEIGHT)
+		return false;
+
+	heights[b] = height;
+	return true;
+}
+
+bool
+verification_cache::summarise(block_address root, subtree &s) const
+{
+	if (!summarise_(root))
+		return false;
+
+	node const &n = nodes_.find(root)->second;
+	s.lowest_key = n.lowest_key;
+	s.highest_key = n.highest_key;
+	s.nr_mappings = n.nr_mappings;
+	return true;
+}
+
+bool
+verification_cache::summarise_(block_address b) const
+{
+	node_map::const_iterator it = nodes_.find(b);
+	if (it == nodes_.end())
+		return false;
+
+	node const &n = it->second;
+	if (n.summarised)
+		return true;
+
+	uint64_t nr_mappings = 0;
+	bool have_keys = false;
+	uint64_t lowest_key = 0, highest_key = 0;
+
+	for (size_t i = 0; i < n.children.size(); i++) {
+		block_address child = n.children[i];
+		if (!summarise_(child))
+			return false;
+
+		node const &c = nodes_.find(child)->second;
+		if (!c.nr_mappings)
+			continue;
+
+		if (!have_keys)
+			lowest_key = c.lowest_key;
+		highest_key = c.highest_key;
+		have_keys = true;
+		nr_mappings += c.nr_mappings;
+	}
+
+	n.nr_mappings = nr_mappings;
+	n.lowest_key = lowest_key;
+	n.highest_key = highest_key;
+	n.summarised = true;
+	return true;
+}
+
+// A node that's been freed may since have been reused for something
+// else, in which case the subtree can't be trusted.
+bool
+verification_cache::still_allocated(block_address b) const
+{
+	node const &n = nodes_.find(b)->second;
+	if (n.allocated)
+		return true;
+
+	if (b >= metadata_sm_->get_nr_blocks() || !metadata_sm_->get_count(b))
+		return false;
+
+	for (size_t i = 0; i < n.children.size(); i++)
+		if (!still_allocated(n.children[i]))
+			return false;
+
+	n.allocated = true;
+	return true;
+}
+
+void
+verification_cache::count_(block_address b, block_counter &bc) const
+{
+	bool seen = bc.get_count(b);
+	bc.inc(b);
+	if (seen)
+		return;
+
+	node const &n = nodes_.find(b)->second;
+	for (size_t i = 0; i < n.children.size(); i++)
+		count_(n.children[i], bc);
+}
+
+void
+verification_cache::collect(block_address b, node_map &nodes) const
+{
+	if (nodes.count(b))
+		return;
+
+	node const &n = nodes_.find(b)->second;
+	nodes.insert(make_pair(b, n));
+
+	for (size_t i = 0; i < n.children.size(); i++)
+		collect(n.children[i], nodes);
+}
+
+//----------------------------------------------------------------
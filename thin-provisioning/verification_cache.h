@@ -0,0 +1,126 @@
+#ifndef THIN_VERIFICATION_CACHE_H
+#define THIN_VERIFICATION_CACHE_H
+
+#include "persistent-data/block_counter.h"
+#include "persistent-data/space_map.h"
+#include "thin-provisioning/mapping_tree.h"
+#include "thin-provisioning/superblock.h"
+
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------
+
+namespace thin_provisioning {
+	// Identifies the pool a cache was built for.
+	struct verification_cache_key {
+		verification_cache_key();
+		verification_cache_key(superblock_detail::superblock const &sb);
+
+		bool operator ==(verification_cache_key const &rhs) const;
+		bool operator !=(verification_cache_key const &rhs) const {
+			return !(*this == rhs);
+		}
+
+		unsigned char uuid[16];
+		uint64_t metadata_nr_blocks;
+		uint32_t data_block_size;
+	};
+
+	// The metadata is copy-on-write, so a mapping subtree whose root
+	// is still at the same address, with the same checksum, hasn't
+	// changed since it was checked.  This remembers the subtrees that
+	// passed a check, along with the shape of each one, so the next
+	// check can skip walking them, and count their blocks from memory.
+	//
+	// A subtree is only trusted if every node recorded for it is
+	// still allocated in the metadata space map.
+	class verification_cache : public mapping_tree_detail::subtree_observer {
+	public:
+		typedef boost::shared_ptr<verification_cache> ptr;
+
+		struct subtree {
+			subtree();
+
+			uint64_t thin_dev;
+			block_address root;
+			uint32_t csum;
+			uint64_t lowest_key;
+			uint64_t highest_key;
+			uint64_t nr_mappings;
+		};
+
+		verification_cache(verification_cache_key const &key,
+				   space_map::ptr metadata_sm);
+
+		virtual bool enter_subtree(uint64_t thin_dev, block_address root,
+					   uint32_t csum);
+		virtual void visit_internal(block_address b,
+					    std::vector<block_address> const &children);
+		virtual void visit_leaf(block_address b, unsigned nr_entries,
+					uint64_t lowest_key, uint64_t highest_key);
+
+		// Adds the references made by the subtree's nodes, just as
+		// count_btree_blocks() would.  Returns false, without
+		// counting anything, unless the subtree was either skipped
+		// or walked by the last check.
+		bool count_subtree(block_address root, block_counter &bc) const;
+
+		// How many subtrees enter_subtree() has skipped.
+		unsigned get_nr_skipped() const {
+			return nr_skipped_;
+		}
+
+		// Records the subtrees seen by the last check.
+		void write(std::string const &path) const;
+
+		// Returns a null pointer if the file is missing, unreadable,
+		// corrupt, or was built for a different pool.
+		static ptr read(std::string const &path,
+				verification_cache_key const &key,
+				space_map::ptr metadata_sm);
+
+	private:
+		// For a leaf, the summary is filled in when the node is
+		// recorded.  For an internal node it's worked out from the
+		// children when first needed.
+		struct node {
+			node();
+
+			std::vector<block_address> children;
+			mutable uint64_t nr_mappings;
+			mutable uint64_t lowest_key;
+			mutable uint64_t highest_key;
+			mutable bool summarised;
+			mutable bool allocated;
+		};
+
+		typedef std::map<block_address, node> node_map;
+
+		bool check_nodes() const;
+		bool check_node(block_address b, unsigned depth,
+				std::map<block_address, unsigned> &heights,
+				unsigned &height) const;
+		bool summarise(block_address root, subtree &s) const;
+		bool summarise_(block_address b) const;
+		bool still_allocated(block_address b) const;
+		void count_(block_address b, block_counter &bc) const;
+		void collect(block_address b, node_map &nodes) const;
+
+		verification_cache_key key_;
+		space_map::ptr metadata_sm_;
+
+		node_map nodes_;
+		std::map<block_address, subtree> verified_;
+		std::vector<subtree> seen_;
+		std::set<block_address> entered_;
+		unsigned nr_skipped_;
+	};
+}
+
+//----------------------------------------------------------------
+
+#endif
@@ -97,7 +97,7 @@ namespace {
 
 		void begin_named_mapping(string const &name) {
 			out_.indent();
-			out_ << "<named_mapping>" << endl;
+			out_ << "<named_mapping name=\"" << name << "\">" << endl;
 			out_.inc();
 		}
 
@@ -155,54 +155,104 @@ namespace {
 				get_attr<uint64_t>(attr, "snap_time"));
 	}
 
-	void parse_range_mapping(emitter *e, attributes const &attr) {
-		e->range_map(get_attr<uint64_t>(attr, "origin_begin"),
-			     get_attr<uint64_t>(attr, "data_begin"),
-			     get_attr<uint32_t>(attr, "time"),
-			     get_attr<uint64_t>(attr, "length"));
+	void parse_named_mapping(emitter *e, attributes const &attr) {
+		e->begin_named_mapping(get_attr<string>(attr, "name"));
 	}
 
-	void parse_single_mapping(emitter *e, attributes const &attr) {
-		e->single_map(get_attr<uint64_t>(attr, "origin_block"),
-			      get_attr<uint64_t>(attr, "data_block"),
-			      get_attr<uint32_t>(attr, "time"));
+	void parse_identifier(emitter *e, attributes const &attr) {
+		e->identifier(get_attr<string>(attr, "name"));
+	}
+
+	// The mappings make up the bulk of the input, so they take the
+	// attribute_slots fast path rather than building an attributes map.
+	char const * const range_mapping_keys[] = {
+		"origin_begin", "data_begin", "time", "length"
+	};
+
+	enum range_mapping_slot {
+		RM_ORIGIN_BEGIN,
+		RM_DATA_BEGIN,
+		RM_TIME,
+		RM_LENGTH,
+		RM_NR_SLOTS
+	};
+
+	void parse_range_mapping(emitter *e, char const **attr) {
+		attribute_slots a(range_mapping_keys, RM_NR_SLOTS, attr);
+		e->range_map(a.get_uint<uint64_t>(RM_ORIGIN_BEGIN),
+			     a.get_uint<uint64_t>(RM_DATA_BEGIN),
+			     a.get_uint<uint32_t>(RM_TIME),
+			     a.get_uint<uint64_t>(RM_LENGTH));
+	}
+
+	char const * const single_mapping_keys[] = {
+		"origin_block", "data_block", "time"
+	};
+
+	enum single_mapping_slot {
+		SM_ORIGIN_BLOCK,
+		SM_DATA_BLOCK,
+		SM_TIME,
+		SM_NR_SLOTS
+	};
+
+	void parse_single_mapping(emitter *e, char const **attr) {
+		attribute_slots a(single_mapping_keys, SM_NR_SLOTS, attr);
+		e->single_map(a.get_uint<uint64_t>(SM_ORIGIN_BLOCK),
+			      a.get_uint<uint64_t>(SM_DATA_BLOCK),
+			      a.get_uint<uint32_t>(SM_TIME));
 	}
 
 	void start_tag(void *data, char const *el, char const **attr) {
 		emitter *e = static_cast<emitter *>(data);
-		attributes a;
 
-		build_attributes(a, attr);
+		if (!strcmp(el, "range_mapping"))
+			parse_range_mapping(e, attr);
+
+		else if (!strcmp(el, "single_mapping"))
+			parse_single_mapping(e, attr);
 
-		if (!strcmp(el, "superblock"))
-			parse_superblock(e, a);
+		else {
+			attributes a;
 
-		else if (!strcmp(el, "device"))
-			parse_device(e, a);
+			build_attributes(a, attr);
 
-		else if (!strcmp(el, "range_mapping"))
-			parse_range_mapping(e, a);
+			if (!strcmp(el, "superblock"))
+				parse_superblock(e, a);
 
-		else if (!strcmp(el, "single_mapping"))
-			parse_single_mapping(e, a);
+			else if (!strcmp(el, "device"))
+				parse_device(e, a);
+
+			else if (!strcmp(el, "named_mapping"))
+				parse_named_mapping(e, a);
 
-		else
-			throw runtime_error("unknown tag type");
+			else if (!strcmp(el, "identifier"))
+				parse_identifier(e, a);
+
+			else
+				throw runtime_error("unknown tag type");
+		}
 	}
 
 	void end_tag(void *data, const char *el) {
 		emitter *e = static_cast<emitter *>(data);
 
-		if (!strcmp(el, "superblock"))
+		if (!strcmp(el, "range_mapping")) {
+			// do nothing
+
+		} else if (!strcmp(el, "single_mapping")) {
+			// do nothing
+
+		} else if (!strcmp(el, "superblock"))
 			e->end_superblock();
 
 		else if (!strcmp(el, "device"))
 			e->end_device();
 
-		else if (!strcmp(el, "range_mapping")) {
-			// do nothing
+		else if (!strcmp(el, "named_mapping"))
+			e->end_named_mapping();
 
-		} else if (!strcmp(el, "single_mapping")) {
+		else if (!strcmp(el, "identifier")) {
 			// do nothing
 
 		} else
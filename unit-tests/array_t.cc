@@ -92,6 +92,15 @@ namespace {
 		std::map<unsigned, uint64_t> m;
 	};
 
+	class disk_value_visitor {
+	public:
+		void visit(unsigned index, base::le64 const &value) {
+			m.insert(make_pair(index, base::to_cpu<uint64_t>(value)));
+		}
+
+		std::map<unsigned, uint64_t> m;
+	};
+
 	class damage_visitor {
 	public:
 		void visit(array_detail::damage const &d) {
@@ -230,3 +239,90 @@ TEST_F(ArrayTests, visit_values_with_too_few_entries)
 }
 
 //----------------------------------------------------------------
+
+TEST_F(ArrayTests, get_range)
+{
+	unsigned const COUNT = 10000;
+
+	create_array(COUNT, 123);
+	for (unsigned i = 0; i < COUNT; i += 3)
+		set(i, i);
+
+	vector<uint64_t> values;
+	a_->get_range(100, 2100, values);
+	ASSERT_THAT(values.size(), Eq(2000u));
+	for (unsigned i = 0; i < values.size(); i++)
+		ASSERT_THAT(values[i], Eq((i + 100) % 3 ? 123u : i + 100));
+
+	ASSERT_THROW(a_->get_range(0, COUNT + 1, values), runtime_error);
+}
+
+TEST_F(ArrayTests, set_range)
+{
+	unsigned const COUNT = 10000;
+
+	create_array(COUNT, 123);
+
+	vector<uint64_t> values;
+	for (unsigned i = 0; i < 3000; i++)
+		values.push_back(i);
+	a_->set_range(500, values);
+
+	reopen_array();
+	for (unsigned i = 0; i < COUNT; i++)
+		ASSERT_THAT(get(i), Eq(i >= 500 && i < 3500 ? i - 500 : 123u));
+
+	ASSERT_THROW(a_->set_range(COUNT - 10, values), runtime_error);
+}
+
+TEST_F(ArrayTests, visit_disk_values)
+{
+	unsigned const COUNT = 10000;
+
+	create_array(COUNT, 123);
+	for (unsigned i = 0; i < COUNT; i += 7)
+		set(i, i);
+
+	disk_value_visitor vv;
+	damage_visitor dv;
+	a_->visit_disk_values(vv, dv);
+
+	ASSERT_THAT(vv.m.size(), Eq(COUNT));
+	for (unsigned i = 0; i < COUNT; i++)
+		ASSERT_THAT(vv.m[i], Eq(i % 7 ? 123u : i));
+	ASSERT_THAT(dv.ds.size(), Eq(0ul));
+}
+
+TEST_F(ArrayTests, set_disk_range)
+{
+	unsigned const COUNT = 10000;
+
+	create_array(COUNT, 123);
+
+	vector<base::le64> values;
+	for (unsigned i = 0; i < 3000; i++)
+		values.push_back(base::to_disk<base::le64>(static_cast<uint64_t>(i)));
+	a_->set_disk_range(500, &values[0], values.size());
+
+	reopen_array();
+	for (unsigned i = 0; i < COUNT; i++)
+		ASSERT_THAT(get(i), Eq(i >= 500 && i < 3500 ? i - 500 : 123u));
+
+	ASSERT_THROW(a_->set_disk_range(COUNT - 10, &values[0], values.size()), runtime_error);
+}
+
+TEST_F(ArrayTests, set_root_reloads_directory)
+{
+	unsigned const COUNT = 10000;
+
+	create_array(COUNT, 234);
+	block_address other_root = a_->get_root();
+
+	create_array(COUNT, 123);
+	for (unsigned i = 0; i < COUNT; i++)
+		ASSERT_THAT(get(i), Eq(123u));
+
+	a_->set_root(other_root);
+	for (unsigned i = 0; i < COUNT; i++)
+		ASSERT_THAT(get(i), Eq(234u));
+}
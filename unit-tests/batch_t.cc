@@ -0,0 +1,123 @@
+#include "gmock/gmock.h"
+
+#include "base/batch.h"
+
+using namespace base;
+using namespace batch_detail;
+using namespace std;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+namespace {
+	set<string> disks(string const &a, string const &b = "") {
+		set<string> ds;
+		ds.insert(a);
+		if (!b.empty())
+			ds.insert(b);
+		return ds;
+	}
+
+	unsigned next(scheduler &s) {
+		boost::optional<unsigned> j = s.next();
+		if (!j)
+			throw runtime_error("no job ready");
+		return *j;
+	}
+}
+
+//----------------------------------------------------------------
+
+TEST(BatchTests, blank_lines_and_comments_are_skipped)
+{
+	job j;
+	ASSERT_FALSE(parse_job("", j));
+	ASSERT_FALSE(parse_job("   \t", j));
+	ASSERT_FALSE(parse_job("# thin_check /dev/sda", j));
+}
+
+TEST(BatchTests, device_comes_last)
+{
+	job j;
+	ASSERT_TRUE(parse_job("  thin_check -q\t/dev/vg/pool_tmeta ", j));
+	ASSERT_THAT(j.get_cmd(), Eq("thin_check"));
+	ASSERT_THAT(j.get_device(), Eq("/dev/vg/pool_tmeta"));
+	ASSERT_THAT(j.args.size(), Eq(3u));
+}
+
+TEST(BatchTests, job_must_have_a_device)
+{
+	job j;
+	ASSERT_THROW(parse_job("thin_check", j), runtime_error);
+}
+
+TEST(BatchTests, missing_device_has_a_disk_of_its_own)
+{
+	ASSERT_THAT(underlying_disks("/no/such/device"), ElementsAre("/no/such/device"));
+}
+
+TEST(BatchTests, file_has_a_disk)
+{
+	ASSERT_THAT(underlying_disks(".").size(), Ge(1u));
+}
+
+TEST(BatchTests, jobs_start_in_order)
+{
+	scheduler s(2, 1);
+	s.add_job(disks("a"));
+	s.add_job(disks("b"));
+	s.add_job(disks("c"));
+
+	ASSERT_THAT(next(s), Eq(0u));
+	ASSERT_THAT(next(s), Eq(1u));
+	ASSERT_FALSE(s.next());
+
+	s.finished(0);
+	ASSERT_THAT(next(s), Eq(2u));
+}
+
+TEST(BatchTests, busy_disk_doesnt_hold_up_other_jobs)
+{
+	scheduler s(4, 1);
+	s.add_job(disks("a"));
+	s.add_job(disks("a"));
+	s.add_job(disks("b"));
+
+	ASSERT_THAT(next(s), Eq(0u));
+	ASSERT_THAT(next(s), Eq(2u));
+	ASSERT_FALSE(s.next());
+
+	s.finished(0);
+	ASSERT_THAT(next(s), Eq(1u));
+}
+
+TEST(BatchTests, job_on_several_disks_needs_them_all)
+{
+	scheduler s(4, 2);
+	s.add_job(disks("a"));
+	s.add_job(disks("a"));
+	s.add_job(disks("a", "b"));
+
+	ASSERT_THAT(next(s), Eq(0u));
+	ASSERT_THAT(next(s), Eq(1u));
+	ASSERT_FALSE(s.next());
+
+	s.finished(1);
+	ASSERT_THAT(next(s), Eq(2u));
+}
+
+TEST(BatchTests, done_when_every_job_has_finished)
+{
+	scheduler s(1, 1);
+	s.add_job(disks("a"));
+	ASSERT_FALSE(s.done());
+
+	unsigned j = next(s);
+	ASSERT_FALSE(s.done());
+
+	s.finished(j);
+	ASSERT_TRUE(s.done());
+	ASSERT_THROW(s.finished(j), runtime_error);
+}
+
+//----------------------------------------------------------------
@@ -52,6 +52,19 @@ namespace {
 		unsigned size_, m_;
 	};
 
+	class run_collector : public bitset_detail::bitset_run_visitor {
+	public:
+		void visit_run(uint32_t begin, uint32_t end) {
+			runs.push_back(make_pair(begin, end));
+		}
+
+		void visit(bitset_detail::missing_bits const &d) {
+			FAIL();
+		}
+
+		vector<pair<uint32_t, uint32_t> > runs;
+	};
+
 	class BitsetTests : public Test {
 	public:
 		BitsetTests()
@@ -217,4 +230,99 @@ TEST_F(BitsetTests, walk_bitset)
 	}
 }
 
+TEST_F(BitsetTests, set_and_clear_ranges)
+{
+	unsigned const COUNT = 100000;
+	bitset::ptr bs = create_bitset();
+	bs->grow(COUNT, false);
+
+	bs->set_range(37, 70000);
+	bs->clear_range(100, 164);
+	bs->clear_range(500, 501);
+
+	for (unsigned i = 0; i < COUNT; i++) {
+		bool expected = i >= 37 && i < 70000 &&
+			!(i >= 100 && i < 164) && i != 500;
+		ASSERT_THAT(bs->get(i), Eq(expected));
+	}
+
+	ASSERT_THROW(bs->set_range(0, COUNT + 1), runtime_error);
+}
+
+TEST_F(BitsetTests, count)
+{
+	unsigned const COUNT = 100001;
+	bitset::ptr bs = create_bitset();
+
+	bs->grow(COUNT, true);
+	ASSERT_THAT(bs->count(), Eq(COUNT));
+
+	for (unsigned i = 0; i < COUNT; i += 7)
+		bs->set(i, false);
+	ASSERT_THAT(bs->count(), Eq(COUNT - (COUNT + 6) / 7));
+}
+
+TEST_F(BitsetTests, or_and_and)
+{
+	unsigned const COUNT = 100000;
+	bitset::ptr lhs = create_bitset();
+	bitset::ptr rhs = create_bitset();
+
+	lhs->grow(COUNT, false);
+	rhs->grow(COUNT, false);
+	lhs->set_range(0, 60000);
+	rhs->set_range(40000, COUNT);
+
+	bitset::ptr both = create_bitset();
+	both->grow(COUNT, false);
+	both->or_with(*lhs);
+	both->and_with(*rhs);
+	ASSERT_THAT(both->count(), Eq(20000u));
+	ASSERT_TRUE(both->get(40000));
+	ASSERT_FALSE(both->get(39999));
+
+	lhs->or_with(*rhs);
+	ASSERT_THAT(lhs->count(), Eq(COUNT));
+
+	bitset::ptr small = create_bitset();
+	small->grow(COUNT / 2, false);
+	ASSERT_THROW(lhs->or_with(*small), runtime_error);
+}
+
+TEST_F(BitsetTests, walk_set_runs)
+{
+	unsigned const COUNT = 100003;
+	bitset::ptr bs = create_bitset();
+	bs->grow(COUNT, false);
+
+	bs->set(5, true);
+	bs->set_range(63, 129);
+	bs->set_range(1000, 50000);
+	bs->set_range(COUNT - 3, COUNT);
+
+	run_collector rc;
+	bs->walk_set_runs(rc);
+
+	ASSERT_THAT(rc.runs.size(), Eq(4u));
+	ASSERT_THAT(rc.runs[0], Eq(make_pair(5u, 6u)));
+	ASSERT_THAT(rc.runs[1], Eq(make_pair(63u, 129u)));
+	ASSERT_THAT(rc.runs[2], Eq(make_pair(1000u, 50000u)));
+	ASSERT_THAT(rc.runs[3], Eq(make_pair(COUNT - 3, COUNT)));
+}
+
+TEST_F(BitsetTests, walk_set_runs_ignores_padding)
+{
+	unsigned const COUNT = 100;
+	bitset::ptr bs = create_bitset();
+
+	// the tail of the last word is padded with ones
+	bs->grow(COUNT, true);
+
+	run_collector rc;
+	bs->walk_set_runs(rc);
+
+	ASSERT_THAT(rc.runs.size(), Eq(1u));
+	ASSERT_THAT(rc.runs[0], Eq(make_pair(0u, COUNT)));
+}
+
 //----------------------------------------------------------------
@@ -20,6 +20,7 @@
 #include "persistent-data/block.h"
 #include "test_utils.h"
 #include <stdlib.h>
+#include <string.h>
 
 using namespace std;
 using namespace test;
@@ -238,6 +239,30 @@ TEST(BlockTests, write_then_read)
 	bm->read_lock(0);
 }
 
+TEST(BlockTests, preloaded_block_is_read_from_the_cache)
+{
+	bm4096::ptr bm = create_bm<4096>();
+
+	unsigned char data[4096];
+	memset(data, 23, sizeof(data));
+	bm->preload(0, data);
+
+	// The disk still holds zeroes.
+	check_all_bytes<4096>(bm->read_lock(0), 23);
+}
+
+TEST(BlockTests, preload_doesnt_replace_a_cached_block)
+{
+	bm4096::ptr bm = create_bm<4096>();
+	bm->read_lock(0);
+
+	unsigned char data[4096];
+	memset(data, 23, sizeof(data));
+	bm->preload(0, data);
+
+	check_all_bytes<4096>(bm->read_lock(0), 0);
+}
+
 //----------------------------------------------------------------
 
 namespace {
@@ -435,6 +460,16 @@ TEST_F(ValidatorTests, validator_can_be_changed_by_superblock_zero)
 
 //--------------------------------
 
+TEST_F(ValidatorTests, check_on_read_lock_of_preloaded_block)
+{
+	unsigned char data[4096];
+	memset(data, 0, sizeof(data));
+	bm->preload(0, data);
+
+	expect_check(vmock);
+	bm->read_lock(0, vmock);
+}
+
 TEST_F(ValidatorTests, validator_check_failure_gets_passed_up)
 {
 	validator_mock::ptr v(new validator_mock);
@@ -447,3 +482,63 @@ TEST_F(ValidatorTests, validator_check_failure_gets_passed_up)
 }
 
 //----------------------------------------------------------------
+
+namespace {
+	class CacheLimitTests : public Test {
+	public:
+		CacheLimitTests() {
+			create_bm<4096>(NR_BLOCKS);
+		}
+
+		~CacheLimitTests() {
+			bcache::block_cache::set_limits(0, 0);
+		}
+
+		block_manager<>::ptr open(size_t cache_mem) {
+			return block_manager<>::ptr(
+				new block_manager<>("./test.data", NR_BLOCKS, MAX_HELD_LOCKS,
+						    block_manager<>::READ_ONLY, false, cache_mem));
+		}
+
+		static block_address const NR_BLOCKS = 1024;
+	};
+}
+
+// Like cache_check, which has a cache per stage.
+TEST_F(CacheLimitTests, limits_are_shared_by_every_cache_in_the_process)
+{
+	size_t const MEM = 4 * 1024 * 1024;
+	unsigned const IO = 32;
+	unsigned const NR_CACHES = 8;
+
+	// Every cache gets at least 16 blocks and one io.
+	size_t const MIN_MEM = 16 * 2 * 4096;
+
+	bcache::block_cache::set_limits(MEM, IO);
+	{
+		vector<block_manager<>::ptr> bms;
+		for (unsigned i = 0; i < NR_CACHES; i++)
+			bms.push_back(open(MEM / 2));
+
+		ASSERT_THAT(bcache::block_cache::get_mem_in_use(), Le(MEM + NR_CACHES * MIN_MEM));
+		ASSERT_THAT(bcache::block_cache::get_io_in_use(), Le(IO + NR_CACHES));
+	}
+
+	ASSERT_THAT(bcache::block_cache::get_mem_in_use(), Eq(0u));
+	ASSERT_THAT(bcache::block_cache::get_io_in_use(), Eq(0u));
+}
+
+TEST_F(CacheLimitTests, released_memory_is_reused)
+{
+	size_t const MEM = 4 * 1024 * 1024;
+
+	bcache::block_cache::set_limits(MEM, 0);
+	open(MEM);
+
+	// The first cache has gone, so this one gets all the memory
+	// too.
+	block_manager<>::ptr bm = open(MEM);
+	ASSERT_THAT(bcache::block_cache::get_mem_in_use(), Gt(MEM / 2));
+}
+
+//----------------------------------------------------------------
@@ -146,6 +146,78 @@ TEST_F(BloomFilterTests, reload_works)
 	}
 }
 
+TEST_F(BloomFilterTests, blocked_filter_needs_a_whole_line)
+{
+	ASSERT_THROW(blocked_bloom_filter f(tm_, 1023, 3), runtime_error);
+	ASSERT_THROW(blocked_bloom_filter f(tm_, 256, 3), runtime_error);
+	ASSERT_THROW(blocked_bloom_filter f(tm_, 4096, blocked_bloom_filter::MAX_PROBES + 1),
+		     runtime_error);
+}
+
+TEST_F(BloomFilterTests, blocked_filter_no_false_negatives)
+{
+	// big enough that the lines span several array blocks
+	blocked_bloom_filter f(tm_, 1 << 20, 6);
+	set<block_address> bs = generate_random_blocks(20000);
+
+	set<block_address>::const_iterator it;
+	for (it = bs.begin(); it != bs.end(); ++it)
+		f.set(*it);
+
+	for (it = bs.begin(); it != bs.end(); ++it)
+		ASSERT_THAT(f.test(*it), Eq(true));
+}
+
+TEST_F(BloomFilterTests, blocked_filter_reload_works)
+{
+	block_address root;
+	set<block_address> bs = generate_random_blocks(1000);
+
+	{
+		blocked_bloom_filter f(tm_, 1 << 16, 6);
+
+		set<block_address>::const_iterator it;
+		for (it = bs.begin(); it != bs.end(); ++it)
+			f.set(*it);
+
+		f.flush();
+		root = f.get_root();
+		commit();
+	}
+
+	{
+		blocked_bloom_filter f(tm_, root, 1 << 16, 6);
+
+		set<block_address>::const_iterator it;
+		for (it = bs.begin(); it != bs.end(); ++it)
+			ASSERT_THAT(f.test(*it), Eq(true));
+	}
+}
+
+TEST_F(BloomFilterTests, blocked_filter_test_many_matches_test)
+{
+	blocked_bloom_filter f(tm_, 1 << 16, 6);
+	set<block_address> bs = generate_random_blocks(5000, 100000);
+
+	set<block_address>::const_iterator it;
+	for (it = bs.begin(); it != bs.end(); ++it)
+		f.set(*it);
+
+	vector<uint64_t> keys;
+	for (uint64_t k = 0; k < 100000; k++)
+		keys.push_back(k);
+
+	vector<bool> results;
+	f.test_many(keys, results);
+
+	ASSERT_THAT(results.size(), Eq(keys.size()));
+	for (unsigned i = 0; i < keys.size(); i++) {
+		ASSERT_THAT(results[i], Eq(f.test(keys[i])));
+		if (bs.count(keys[i]))
+			ASSERT_TRUE(results[i]);
+	}
+}
+
 unsigned next_power(unsigned n)
 {
 	unsigned r = 1;
@@ -0,0 +1,273 @@
+#include "gmock/gmock.h"
+
+#include "test_utils.h"
+
+#include "persistent-data/data-structures/btree.h"
+#include "persistent-data/data-structures/btree_builder.h"
+#include "persistent-data/data-structures/btree_damage_visitor.h"
+#include "persistent-data/space-maps/core.h"
+#include "persistent-data/data-structures/simple_traits.h"
+
+using namespace base;
+using namespace std;
+using namespace persistent_data;
+using namespace test;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_address const BLOCK_SIZE = 4096;
+	block_address const NR_BLOCKS = 102400;
+	block_address const SUPERBLOCK = 0;
+
+	typedef btree<1, uint64_traits> tree;
+	typedef btree_builder<uint64_traits> builder;
+
+	struct value_counter {
+		value_counter()
+			: nr_values_(0) {
+		}
+
+		void visit(btree_path const &path, uint64_t v) {
+			nr_values_++;
+		}
+
+		unsigned nr_values_;
+	};
+
+	struct damage_counter {
+		damage_counter()
+			: nr_damage_(0) {
+		}
+
+		void visit(btree_path const &path, btree_detail::damage const &d) {
+			nr_damage_++;
+		}
+
+		unsigned nr_damage_;
+	};
+
+	class BTreeBuilderTests : public Test {
+	public:
+		BTreeBuilderTests()
+			: bm_(create_bm<BLOCK_SIZE>(NR_BLOCKS)),
+			  sm_(setup_core_map()),
+			  tm_(bm_, sm_) {
+		}
+
+		// Values are three times the key, so lookups can be
+		// checked.
+		block_address build(uint64_t begin, uint64_t end) {
+			builder b(tm_, rc_);
+			for (uint64_t k = begin; k < end; k++)
+				b.push_value(k, k * 3);
+			return b.get_root();
+		}
+
+		void check_lookups(block_address root, uint64_t begin, uint64_t end) {
+			tree t(tm_, root, rc_);
+			for (uint64_t k = begin; k < end; k++) {
+				uint64_t key[1] = {k};
+				tree::maybe_value v = t.lookup(key);
+				ASSERT_TRUE(!!v);
+				ASSERT_THAT(*v, Eq(k * 3));
+			}
+		}
+
+		void check_well_formed(block_address root, unsigned nr_values) {
+			tree t(tm_, root, rc_);
+			value_counter vc;
+			damage_counter dc;
+			btree_visit_values(t, vc, dc);
+
+			ASSERT_THAT(dc.nr_damage_, Eq(0u));
+			ASSERT_THAT(vc.nr_values_, Eq(nr_values));
+		}
+
+		block_address nr_allocated() {
+			return sm_->get_nr_blocks() - sm_->get_nr_free();
+		}
+
+		with_temp_directory dir_;
+		block_manager<>::ptr bm_;
+		space_map::ptr sm_;
+		transaction_manager tm_;
+		uint64_traits::ref_counter rc_;
+
+	private:
+		space_map::ptr setup_core_map() {
+			space_map::ptr sm(new core_map(NR_BLOCKS));
+			sm->inc(SUPERBLOCK);
+			return sm;
+		}
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(BTreeBuilderTests, empty_tree)
+{
+	block_address root = build(0, 0);
+	check_well_formed(root, 0);
+}
+
+TEST_F(BTreeBuilderTests, single_leaf)
+{
+	block_address root = build(0, 10);
+	check_well_formed(root, 10);
+	check_lookups(root, 0, 10);
+}
+
+TEST_F(BTreeBuilderTests, large_tree)
+{
+	block_address root = build(0, 100000);
+	check_well_formed(root, 100000);
+	check_lookups(root, 0, 100000);
+}
+
+TEST_F(BTreeBuilderTests, built_tree_is_smaller_than_inserted_tree)
+{
+	block_address before = nr_allocated();
+	build(0, 100000);
+	block_address built = nr_allocated() - before;
+
+	tree t(tm_, rc_);
+	for (uint64_t k = 0; k < 100000; k++) {
+		uint64_t key[1] = {k};
+		t.insert(key, k * 3);
+	}
+	block_address inserted = nr_allocated() - before - built;
+
+	ASSERT_THAT(built, Lt(inserted));
+}
+
+TEST_F(BTreeBuilderTests, subtree_is_shared)
+{
+	block_address shared = build(30000, 80000);
+	block_address before = nr_allocated();
+
+	builder b(tm_, rc_);
+	for (uint64_t k = 0; k < 30000; k++)
+		b.push_value(k, k * 3);
+	b.push_subtree(shared);
+	for (uint64_t k = 80000; k < 110000; k++)
+		b.push_value(k, k * 3);
+	block_address root = b.get_root();
+
+	check_well_formed(root, 110000);
+	check_lookups(root, 0, 110000);
+	ASSERT_THAT(sm_->get_count(shared), Eq(2u));
+
+	// only the unshared values, and a spine, should have been written
+	ASSERT_THAT(nr_allocated() - before, Lt(260u));
+}
+
+TEST_F(BTreeBuilderTests, whole_tree_can_be_shared)
+{
+	block_address shared = build(0, 50000);
+
+	builder b(tm_, rc_);
+	b.push_subtree(shared);
+	ASSERT_THAT(b.get_root(), Eq(shared));
+	ASSERT_THAT(sm_->get_count(shared), Eq(2u));
+}
+
+TEST_F(BTreeBuilderTests, short_runs_between_subtrees_are_fixed_up)
+{
+	block_address left = build(0, 50000);
+	block_address right = build(50001, 100000);
+
+	builder b(tm_, rc_);
+	b.push_subtree(left);
+	b.push_value(50000, 50000 * 3);
+	b.push_subtree(right);
+	block_address root = b.get_root();
+
+	check_well_formed(root, 100000);
+	check_lookups(root, 0, 100000);
+}
+
+TEST_F(BTreeBuilderTests, short_tail_is_fixed_up)
+{
+	block_address shared = build(0, 50000);
+
+	builder b(tm_, rc_);
+	b.push_subtree(shared);
+	b.push_value(50000, 50000 * 3);
+	block_address root = b.get_root();
+
+	check_well_formed(root, 50001);
+	check_lookups(root, 0, 50001);
+}
+
+TEST_F(BTreeBuilderTests, underfull_subtree_is_copied)
+{
+	block_address small = build(1000, 1003);
+
+	builder b(tm_, rc_);
+	for (uint64_t k = 0; k < 1000; k++)
+		b.push_value(k, k * 3);
+	b.push_subtree(small);
+	for (uint64_t k = 1003; k < 2003; k++)
+		b.push_value(k, k * 3);
+	block_address root = b.get_root();
+
+	check_well_formed(root, 2003);
+	check_lookups(root, 0, 2003);
+	ASSERT_THAT(sm_->get_count(small), Eq(1u));
+}
+
+TEST_F(BTreeBuilderTests, underfull_subtree_pushed_first_is_copied)
+{
+	block_address small = build(0, 3);
+
+	builder b(tm_, rc_);
+	b.push_subtree(small);
+	for (uint64_t k = 3; k < 2003; k++)
+		b.push_value(k, k * 3);
+	block_address root = b.get_root();
+
+	check_well_formed(root, 2003);
+	check_lookups(root, 0, 2003);
+	ASSERT_THAT(sm_->get_count(small), Eq(1u));
+}
+
+TEST_F(BTreeBuilderTests, underfull_subtree_can_be_the_whole_tree)
+{
+	block_address small = build(1000, 1003);
+
+	builder b(tm_, rc_);
+	b.push_subtree(small);
+	ASSERT_THAT(b.get_root(), Eq(small));
+	ASSERT_THAT(sm_->get_count(small), Eq(2u));
+}
+
+TEST_F(BTreeBuilderTests, keys_must_ascend)
+{
+	builder b(tm_, rc_);
+	b.push_value(10, 0);
+	ASSERT_THROW(b.push_value(10, 0), runtime_error);
+	ASSERT_THROW(b.push_value(5, 0), runtime_error);
+}
+
+TEST_F(BTreeBuilderTests, release_frees_everything)
+{
+	block_address before = nr_allocated();
+	block_address shared = build(1000, 50000);
+	block_address after_shared = nr_allocated();
+
+	builder b(tm_, rc_);
+	for (uint64_t k = 0; k < 1000; k++)
+		b.push_value(k, k * 3);
+	b.push_subtree(shared);
+	block_address root = b.get_root();
+
+	b.release_subtree(root);
+	ASSERT_THAT(nr_allocated(), Eq(after_shared));
+
+	b.release_subtree(shared);
+	ASSERT_THAT(nr_allocated(), Eq(before));
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,116 @@
+#include "gmock/gmock.h"
+#include "base/compression.h"
+
+#include <sstream>
+
+using namespace base;
+using namespace std;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+namespace {
+	string compress(string const &data) {
+		ostringstream out;
+		compressing_ostream zout(out);
+
+		zout.write(data.data(), data.length());
+		zout.close();
+
+		return out.str();
+	}
+
+	string decompress(string const &data) {
+		istringstream in(data);
+		decompressing_istream zin(in);
+		ostringstream out;
+
+		char buffer[4096];
+		while (zin) {
+			zin.read(buffer, sizeof(buffer));
+			out.write(buffer, zin.gcount());
+		}
+
+		return out.str();
+	}
+
+	// Several compression buffers worth, so the hand over between
+	// threads gets exercised.
+	string make_data() {
+		ostringstream out;
+
+		for (unsigned i = 0; i < 200000; i++)
+			out << "<single_mapping origin_block=\"" << i
+			    << "\" data_block=\"" << i * 7 << "\" time=\"0\"/>\n";
+
+		return out.str();
+	}
+}
+
+//----------------------------------------------------------------
+
+TEST(CompressionTests, empty_stream_round_trips)
+{
+	string compressed = compress("");
+
+	ASSERT_THAT(compressed.length(), Gt(0u));
+	ASSERT_THAT(decompress(compressed), Eq(string()));
+}
+
+TEST(CompressionTests, output_is_gzip)
+{
+	string compressed = compress("hello");
+
+	ASSERT_THAT(static_cast<unsigned char>(compressed[0]), Eq(0x1fu));
+	ASSERT_THAT(static_cast<unsigned char>(compressed[1]), Eq(0x8bu));
+}
+
+TEST(CompressionTests, large_stream_round_trips)
+{
+	string data = make_data();
+	string compressed = compress(data);
+
+	ASSERT_THAT(compressed.length(), Lt(data.length() / 4));
+	ASSERT_THAT(decompress(compressed), Eq(data));
+}
+
+TEST(CompressionTests, stream_operators_round_trip)
+{
+	ostringstream out;
+	{
+		compressing_ostream zout(out);
+		for (unsigned i = 0; i < 100000; i++)
+			zout << i << "\n";
+	}
+
+	ostringstream expected;
+	for (unsigned i = 0; i < 100000; i++)
+		expected << i << "\n";
+
+	ASSERT_THAT(decompress(out.str()), Eq(expected.str()));
+}
+
+TEST(CompressionTests, concatenated_members_are_read)
+{
+	string compressed = compress("one ") + compress("two");
+	ASSERT_THAT(decompress(compressed), Eq(string("one two")));
+}
+
+TEST(CompressionTests, truncated_input_throws)
+{
+	string compressed = compress(make_data());
+	compressed.resize(compressed.length() / 2);
+
+	ASSERT_THROW(decompress(compressed), runtime_error);
+}
+
+TEST(CompressionTests, corrupt_input_throws)
+{
+	string compressed = compress(make_data());
+	for (size_t i = 100; i < 200; i++)
+		compressed[i] = ~compressed[i];
+
+	ASSERT_THROW(decompress(compressed), runtime_error);
+}
+
+//----------------------------------------------------------------
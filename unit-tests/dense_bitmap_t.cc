@@ -0,0 +1,108 @@
+#include "gmock/gmock.h"
+#include "base/dense_bitmap.h"
+
+#include <sstream>
+#include <vector>
+
+using namespace base;
+using namespace std;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+namespace {
+	typedef pair<uint64_t, uint64_t> range;
+
+	vector<range> get_runs(dense_bitmap const &bm) {
+		vector<range> runs;
+		uint64_t b, e;
+
+		for (uint64_t from = 0; bm.next_run(from, b, e); from = e)
+			runs.push_back(range(b, e));
+
+		return runs;
+	}
+}
+
+//----------------------------------------------------------------
+
+TEST(DenseBitmapTests, starts_empty)
+{
+	dense_bitmap bm(1000);
+
+	ASSERT_THAT(bm.count(), Eq(0u));
+	ASSERT_THAT(get_runs(bm).size(), Eq(0u));
+}
+
+TEST(DenseBitmapTests, set_and_test)
+{
+	dense_bitmap bm(1000);
+
+	bm.set(0);
+	bm.set(63);
+	bm.set(64);
+	bm.set(999);
+
+	ASSERT_TRUE(bm.test(0));
+	ASSERT_FALSE(bm.test(1));
+	ASSERT_TRUE(bm.test(63));
+	ASSERT_TRUE(bm.test(64));
+	ASSERT_TRUE(bm.test(999));
+	ASSERT_THAT(bm.count(), Eq(4u));
+
+	ASSERT_THROW(bm.set(1000), runtime_error);
+	ASSERT_THROW(bm.test(1000), runtime_error);
+}
+
+TEST(DenseBitmapTests, runs_cross_words)
+{
+	dense_bitmap bm(1000);
+
+	bm.set(5);
+	bm.set_range(60, 200);
+	bm.set_range(300, 301);
+	bm.set_range(990, 1000);
+
+	vector<range> runs = get_runs(bm);
+	ASSERT_THAT(runs.size(), Eq(4u));
+	ASSERT_THAT(runs[0], Eq(range(5, 6)));
+	ASSERT_THAT(runs[1], Eq(range(60, 200)));
+	ASSERT_THAT(runs[2], Eq(range(300, 301)));
+	ASSERT_THAT(runs[3], Eq(range(990, 1000)));
+	ASSERT_THAT(bm.count(), Eq(1u + 140u + 1u + 10u));
+}
+
+TEST(DenseBitmapTests, or_word_drops_bits_past_the_end)
+{
+	dense_bitmap bm(100);
+
+	bm.or_word(0, 0xf0ull);
+	bm.or_word(1, ~0ull);
+	bm.or_word(2, ~0ull);
+
+	vector<range> runs = get_runs(bm);
+	ASSERT_THAT(runs.size(), Eq(2u));
+	ASSERT_THAT(runs[0], Eq(range(4, 8)));
+	ASSERT_THAT(runs[1], Eq(range(64, 100)));
+}
+
+TEST(DenseBitmapTests, write_is_little_endian_words)
+{
+	dense_bitmap bm(72);
+
+	bm.set(0);
+	bm.set(9);
+	bm.set(71);
+
+	ostringstream out;
+	bm.write(out);
+	string data = out.str();
+
+	ASSERT_THAT(data.size(), Eq(16u));
+	ASSERT_THAT(static_cast<unsigned char>(data[0]), Eq(0x01u));
+	ASSERT_THAT(static_cast<unsigned char>(data[1]), Eq(0x02u));
+	ASSERT_THAT(static_cast<unsigned char>(data[8]), Eq(0x80u));
+	ASSERT_THAT(static_cast<unsigned char>(data[15]), Eq(0x00u));
+}
+
+//----------------------------------------------------------------
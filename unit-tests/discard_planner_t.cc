@@ -0,0 +1,131 @@
+#include "gmock/gmock.h"
+
+#include "thin-provisioning/discard_engine.h"
+
+#include <vector>
+
+using namespace std;
+using namespace testing;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	typedef pair<uint64_t, uint64_t> range;
+
+	class range_recorder : public discard_sink {
+	public:
+		virtual void discard(uint64_t begin, uint64_t len) {
+			ranges_.push_back(make_pair(begin, len));
+		}
+
+		vector<range> ranges_;
+	};
+
+	class DiscardPlannerTests : public Test {
+	public:
+		discard_limits limits(uint64_t granularity, uint64_t alignment, uint64_t max_bytes) {
+			discard_limits l;
+			l.granularity = granularity;
+			l.alignment = alignment;
+			l.max_bytes = max_bytes;
+			return l;
+		}
+
+		void expect(unsigned index, uint64_t begin, uint64_t len) {
+			ASSERT_THAT(sink_.ranges_.size(), Gt(index));
+			ASSERT_THAT(sink_.ranges_[index].first, Eq(begin));
+			ASSERT_THAT(sink_.ranges_[index].second, Eq(len));
+		}
+
+		range_recorder sink_;
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(DiscardPlannerTests, nothing_added)
+{
+	discard_planner p(limits(512, 0, 0), sink_);
+	p.complete();
+	ASSERT_THAT(sink_.ranges_.size(), Eq(0u));
+}
+
+TEST_F(DiscardPlannerTests, adjacent_ranges_are_merged)
+{
+	discard_planner p(limits(512, 0, 0), sink_);
+	p.add(0, 4096);
+	p.add(4096, 8192);
+	p.add(8192, 65536);
+	p.complete();
+
+	ASSERT_THAT(sink_.ranges_.size(), Eq(1u));
+	expect(0, 0, 65536);
+}
+
+TEST_F(DiscardPlannerTests, gaps_are_not_merged)
+{
+	discard_planner p(limits(512, 0, 0), sink_);
+	p.add(0, 4096);
+	p.add(8192, 12288);
+	p.complete();
+
+	ASSERT_THAT(sink_.ranges_.size(), Eq(2u));
+	expect(0, 0, 4096);
+	expect(1, 8192, 4096);
+}
+
+TEST_F(DiscardPlannerTests, ranges_are_trimmed_to_the_granularity)
+{
+	discard_planner p(limits(1 << 20, 0, 0), sink_);
+	p.add(65536, (3 << 20) + 65536);
+	p.complete();
+
+	ASSERT_THAT(sink_.ranges_.size(), Eq(1u));
+	expect(0, 1 << 20, 2 << 20);
+}
+
+TEST_F(DiscardPlannerTests, small_ranges_are_dropped)
+{
+	discard_planner p(limits(1 << 20, 0, 0), sink_);
+	p.add(65536, 1 << 20);
+	p.add((1 << 20) + 65536, 2 << 20);
+	p.complete();
+
+	ASSERT_THAT(sink_.ranges_.size(), Eq(0u));
+}
+
+TEST_F(DiscardPlannerTests, merging_happens_before_trimming)
+{
+	discard_planner p(limits(1 << 20, 0, 0), sink_);
+	p.add(0, 65536);
+	p.add(65536, 1 << 20);
+	p.complete();
+
+	ASSERT_THAT(sink_.ranges_.size(), Eq(1u));
+	expect(0, 0, 1 << 20);
+}
+
+TEST_F(DiscardPlannerTests, alignment_offset_is_honoured)
+{
+	discard_planner p(limits(4096, 1024, 0), sink_);
+	p.add(0, 16384);
+	p.complete();
+
+	ASSERT_THAT(sink_.ranges_.size(), Eq(1u));
+	expect(0, 1024, 12288);
+}
+
+TEST_F(DiscardPlannerTests, large_ranges_are_split)
+{
+	discard_planner p(limits(4096, 0, 10000), sink_);
+	p.add(0, 20480);
+	p.complete();
+
+	ASSERT_THAT(sink_.ranges_.size(), Eq(3u));
+	expect(0, 0, 8192);
+	expect(1, 8192, 8192);
+	expect(2, 16384, 4096);
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,112 @@
+#include "gmock/gmock.h"
+
+#include "test_utils.h"
+
+#include "era/era_index.h"
+#include "persistent-data/space-maps/core.h"
+
+using namespace era;
+using namespace persistent_data;
+using namespace std;
+using namespace test;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_address const NR_BLOCKS = 102400;
+	uint32_t const NR_ENTRIES = 20000;
+	uint32_t const CHUNK_SIZE = 1000;
+
+	class EraIndexTests : public Test {
+	public:
+		EraIndexTests()
+			: bm_(create_bm<4096>(NR_BLOCKS)),
+			  sm_(new core_map(NR_BLOCKS)),
+			  tm_(bm_, sm_) {
+			uint32_traits::ref_counter rc;
+			array_.reset(new era_array(tm_, rc));
+			array_->grow(NR_ENTRIES, 0);
+
+			// eras climb by one per chunk, with a single newer
+			// block in chunk 7
+			for (uint32_t b = 0; b < NR_ENTRIES; b++)
+				array_->set(b, b / CHUNK_SIZE);
+			array_->set(7500, 100);
+
+			key_.nr_blocks = NR_ENTRIES;
+			key_.current_era = 101;
+			key_.era_array_root = array_->get_root();
+		}
+
+		era_index::ptr build() {
+			era_index::ptr index(new era_index(key_, CHUNK_SIZE));
+			index->build(*array_);
+			return index;
+		}
+
+		with_temp_directory dir_;
+		block_manager<>::ptr bm_;
+		space_map::ptr sm_;
+		transaction_manager tm_;
+		era_array::ptr array_;
+		era_index_key key_;
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(EraIndexTests, chunks_hold_their_max_era)
+{
+	era_index::ptr index = build();
+
+	ASSERT_THAT(index->get_nr_chunks(), Eq(NR_ENTRIES / CHUNK_SIZE));
+	ASSERT_THAT(index->get_chunk_max_era(0), Eq(0u));
+	ASSERT_THAT(index->get_chunk_max_era(6), Eq(6u));
+	ASSERT_THAT(index->get_chunk_max_era(7), Eq(100u));
+	ASSERT_THAT(index->get_chunk_max_era(19), Eq(19u));
+}
+
+TEST_F(EraIndexTests, counts_blocks_since_an_era)
+{
+	era_index::ptr index = build();
+
+	ASSERT_THAT(index->count_blocks_since(0), Eq(NR_ENTRIES));
+	ASSERT_THAT(index->count_blocks_since(19), Eq(1000u + 1u));
+	ASSERT_THAT(index->count_blocks_since(20), Eq(1u));
+	ASSERT_THAT(index->count_blocks_since(101), Eq(0u));
+}
+
+TEST_F(EraIndexTests, round_trips_through_a_file)
+{
+	era_index::ptr index = build();
+	index->write("index");
+
+	era_index::ptr copy = era_index::read("index", key_);
+	ASSERT_TRUE(!!copy);
+	ASSERT_THAT(copy->get_chunk_size(), Eq(CHUNK_SIZE));
+	ASSERT_THAT(copy->get_nr_chunks(), Eq(index->get_nr_chunks()));
+	for (uint32_t c = 0; c < index->get_nr_chunks(); c++)
+		ASSERT_THAT(copy->get_chunk_max_era(c), Eq(index->get_chunk_max_era(c)));
+	ASSERT_THAT(copy->count_blocks_since(7), Eq(index->count_blocks_since(7)));
+}
+
+TEST_F(EraIndexTests, stale_index_is_not_read)
+{
+	build()->write("index");
+
+	era_index_key key = key_;
+	key.current_era++;
+	ASSERT_FALSE(era_index::read("index", key));
+
+	key = key_;
+	key.era_array_root++;
+	ASSERT_FALSE(era_index::read("index", key));
+}
+
+TEST_F(EraIndexTests, missing_index_is_not_read)
+{
+	ASSERT_FALSE(era_index::read("no-such-index", key_));
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,130 @@
+#include "gmock/gmock.h"
+
+#include "test_utils.h"
+
+#include "thin-provisioning/mapping_sampler.h"
+#include "thin-provisioning/metadata.h"
+
+using namespace persistent_data;
+using namespace std;
+using namespace test;
+using namespace testing;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_address const NR_BLOCKS = 1024;
+	block_address const NR_DATA_BLOCKS = 102400;
+
+	unsigned const NR_MAPPINGS = 2000;
+
+	class MappingSamplerTests : public Test {
+	public:
+		MappingSamplerTests()
+			: bm_(create_bm<MD_BLOCK_SIZE>(NR_BLOCKS)),
+			  md_(new metadata(bm_, metadata::CREATE, 128, NR_DATA_BLOCKS)) {
+
+			for (unsigned b = 0; b < NR_MAPPINGS; b++) {
+				uint64_t key[2] = {0, b};
+				mapping_tree_detail::block_time bt;
+				bt.block_ = b;
+				bt.time_ = 0;
+				md_->mappings_->insert(key, bt);
+			}
+
+			md_->commit();
+		}
+
+		block_address root() const {
+			uint64_t key[1] = {0};
+			return *md_->mappings_top_level_->lookup(key);
+		}
+
+		block_manager<>::ptr bm_;
+		metadata::ptr md_;
+	};
+
+	vector<uint64_t> mapped(uint64_t a, uint64_t b, uint64_t c) {
+		vector<uint64_t> v;
+		v.push_back(a);
+		v.push_back(b);
+		v.push_back(c);
+		return v;
+	}
+}
+
+//----------------------------------------------------------------
+
+TEST(SharePathsTests, every_device_gets_a_path)
+{
+	vector<unsigned> shares = share_paths(mapped(1000000, 0, 1), 3);
+	ASSERT_THAT(shares, ElementsAre(1u, 1u, 1u));
+}
+
+TEST(SharePathsTests, shares_are_proportional)
+{
+	vector<unsigned> shares = share_paths(mapped(600, 300, 100), 103);
+	ASSERT_THAT(shares, ElementsAre(61u, 31u, 11u));
+}
+
+TEST(SharePathsTests, shares_add_up)
+{
+	vector<unsigned> shares = share_paths(mapped(1, 1, 1), 100);
+
+	unsigned total = 0;
+	for (size_t i = 0; i < shares.size(); i++)
+		total += shares[i];
+
+	ASSERT_THAT(total, Eq(100u));
+}
+
+TEST(SharePathsTests, unknown_mapped_blocks_share_evenly)
+{
+	vector<unsigned> shares = share_paths(mapped(0, 0, 0), 30);
+	ASSERT_THAT(shares, ElementsAre(10u, 10u, 10u));
+}
+
+TEST_F(MappingSamplerTests, sound_tree_has_no_damage)
+{
+	mapping_sampler sampler(*md_->tm_, NR_DATA_BLOCKS, 1234);
+	sampler.sample(0, root(), 50);
+
+	ASSERT_THAT(sampler.get_damage().size(), Eq(0u));
+	ASSERT_THAT(sampler.get_nr_paths(), Eq(50u));
+	ASSERT_THAT(sampler.get_nr_leaves(), Gt(1u));
+	ASSERT_THAT(sampler.get_nr_mappings(), Le(NR_MAPPINGS));
+}
+
+TEST_F(MappingSamplerTests, leaves_are_only_counted_once)
+{
+	mapping_sampler sampler(*md_->tm_, NR_DATA_BLOCKS, 1234);
+	sampler.sample(0, root(), 1000);
+
+	// Every leaf is reached, given enough paths.
+	ASSERT_THAT(sampler.get_nr_mappings(), Eq(NR_MAPPINGS));
+}
+
+TEST_F(MappingSamplerTests, mappings_beyond_the_data_device_are_damage)
+{
+	mapping_sampler sampler(*md_->tm_, NR_MAPPINGS / 2, 1234);
+	sampler.sample(0, root(), 50);
+
+	ASSERT_THAT(sampler.get_damage().size(), Eq(1u));
+}
+
+TEST_F(MappingSamplerTests, corrupt_root_is_damage)
+{
+	block_address b = root();
+	md_.reset();
+	zero_block(bm_, b);
+
+	transaction_manager::ptr tm = open_temporary_tm(bm_);
+	mapping_sampler sampler(*tm, NR_DATA_BLOCKS, 1234);
+	sampler.sample(0, b, 10);
+
+	ASSERT_THAT(sampler.get_damage().size(), Eq(1u));
+	ASSERT_THAT(sampler.get_nr_leaves(), Eq(0u));
+}
+
+//----------------------------------------------------------------
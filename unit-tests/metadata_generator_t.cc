@@ -0,0 +1,186 @@
+#include "gmock/gmock.h"
+
+#include "test_utils.h"
+
+#include "caching/metadata_generator.h"
+#include "caching/xml_format.h"
+#include "era/metadata_generator.h"
+#include "era/xml_format.h"
+#include "thin-provisioning/metadata.h"
+#include "thin-provisioning/metadata_generator.h"
+#include "thin-provisioning/restore_emitter.h"
+#include "thin-provisioning/xml_format.h"
+
+#include <set>
+#include <sstream>
+
+using namespace persistent_data;
+using namespace std;
+using namespace test;
+using namespace testing;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_address const NR_METADATA_BLOCKS = 1024;
+	uint64_t const NR_MAPPINGS = 2000;
+
+	string thin_xml(generator_params const &p) {
+		ostringstream out;
+		generate_metadata(p, create_xml_emitter(out));
+		return out.str();
+	}
+
+	class ThinGeneratorTests : public Test {
+	public:
+		ThinGeneratorTests() {
+			p_.nr_thins = 2;
+			p_.snap_depth = 3;
+			p_.nr_mappings = NR_MAPPINGS;
+			p_.run_length = 8;
+		}
+
+		void restore() {
+			block_manager<>::ptr bm = create_bm<MD_BLOCK_SIZE>(NR_METADATA_BLOCKS);
+			md_.reset(new metadata(bm, metadata::CREATE, 128, 0));
+			generate_metadata(p_, create_restore_emitter(md_));
+		}
+
+		unsigned nr_devices() const {
+			return p_.nr_thins * (p_.snap_depth + 1);
+		}
+
+		uint64_t lookup(uint64_t dev, uint64_t b) const {
+			uint64_t key[2] = {dev, b};
+			mapping_tree::maybe_value v = md_->mappings_->lookup(key);
+			if (!v)
+				throw runtime_error("block not mapped");
+
+			return v->block_;
+		}
+
+		generator_params p_;
+		metadata::ptr md_;
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(ThinGeneratorTests, same_seed_gives_same_metadata)
+{
+	ASSERT_THAT(thin_xml(p_), Eq(thin_xml(p_)));
+}
+
+TEST_F(ThinGeneratorTests, different_seeds_give_different_metadata)
+{
+	string xml = thin_xml(p_);
+
+	p_.seed = 1;
+	ASSERT_THAT(thin_xml(p_), Ne(xml));
+}
+
+TEST_F(ThinGeneratorTests, every_device_maps_every_block)
+{
+	restore();
+
+	for (uint64_t dev = 0; dev < nr_devices(); dev++)
+		for (uint64_t b = 0; b < NR_MAPPINGS; b++)
+			ASSERT_THAT(lookup(dev, b), Lt(md_->data_sm_->get_nr_blocks()));
+}
+
+TEST_F(ThinGeneratorTests, fully_shared_snapshots_match_their_origin)
+{
+	p_.sharing = 100;
+	restore();
+
+	for (uint64_t dev = 0; dev < nr_devices(); dev++) {
+		uint64_t origin = dev - dev % (p_.snap_depth + 1);
+		for (uint64_t b = 0; b < NR_MAPPINGS; b++)
+			ASSERT_THAT(lookup(dev, b), Eq(lookup(origin, b)));
+	}
+
+	ASSERT_THAT(md_->data_sm_->get_nr_free(),
+		    Eq(md_->data_sm_->get_nr_blocks() - p_.nr_thins * NR_MAPPINGS));
+}
+
+TEST_F(ThinGeneratorTests, unshared_leaves_have_new_data)
+{
+	p_.sharing = 0;
+	restore();
+
+	set<uint64_t> origin_blocks;
+	for (uint64_t b = 0; b < NR_MAPPINGS; b++)
+		origin_blocks.insert(lookup(0, b));
+
+	uint64_t nr_leaves = (NR_MAPPINGS + 251) / 252;
+	uint64_t nr_new = 0;
+	for (uint64_t b = 0; b < NR_MAPPINGS; b++)
+		if (!origin_blocks.count(lookup(1, b)))
+			nr_new++;
+
+	// One run in every leaf is overwritten.
+	ASSERT_THAT(nr_new, Ge(nr_leaves));
+	ASSERT_THAT(nr_new, Le(nr_leaves * (2 * p_.run_length - 1)));
+}
+
+TEST_F(ThinGeneratorTests, data_counts_cover_every_mapping)
+{
+	restore();
+
+	set<uint64_t> blocks;
+	for (uint64_t dev = 0; dev < nr_devices(); dev++)
+		for (uint64_t b = 0; b < NR_MAPPINGS; b++)
+			blocks.insert(lookup(dev, b));
+
+	ASSERT_THAT(md_->data_sm_->get_nr_blocks() - md_->data_sm_->get_nr_free(),
+		    Eq(blocks.size()));
+	ASSERT_THAT(blocks.size(), Le(max_data_blocks_used(p_)));
+}
+
+TEST_F(ThinGeneratorTests, too_small_a_data_device_is_reported)
+{
+	p_.nr_data_blocks = NR_MAPPINGS;
+	ASSERT_THROW(thin_xml(p_), runtime_error);
+}
+
+//----------------------------------------------------------------
+
+TEST(CacheGeneratorTests, same_seed_gives_same_metadata)
+{
+	caching::generator_params p;
+	p.nr_cache_blocks = 4096;
+	p.nr_origin_blocks = 65536;
+	p.mapped = 75;
+
+	ostringstream out1, out2;
+	caching::generate_metadata(p, caching::create_xml_emitter(out1));
+	caching::generate_metadata(p, caching::create_xml_emitter(out2));
+	ASSERT_THAT(out1.str(), Eq(out2.str()));
+}
+
+TEST(CacheGeneratorTests, a_small_origin_is_reported)
+{
+	caching::generator_params p;
+	p.nr_cache_blocks = 4096;
+	p.nr_origin_blocks = 1024;
+
+	ostringstream out;
+	ASSERT_THROW(caching::generate_metadata(p, caching::create_xml_emitter(out)), runtime_error);
+}
+
+TEST(EraGeneratorTests, same_seed_gives_same_metadata)
+{
+	era::generator_params p;
+	p.nr_blocks = 4096;
+	p.current_era = 10;
+	p.nr_writesets = 3;
+	p.written = 20;
+
+	ostringstream out1, out2;
+	era::generate_metadata(p, era::create_xml_emitter(out1));
+	era::generate_metadata(p, era::create_xml_emitter(out2));
+	ASSERT_THAT(out1.str(), Eq(out2.str()));
+}
+
+//----------------------------------------------------------------
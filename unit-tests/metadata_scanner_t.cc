@@ -0,0 +1,163 @@
+#include "gmock/gmock.h"
+
+#include "test_utils.h"
+
+#include "persistent-data/space-maps/disk.h"
+#include "persistent-data/validators.h"
+#include "thin-provisioning/metadata.h"
+#include "thin-provisioning/metadata_scanner.h"
+
+#include <string.h>
+
+using namespace persistent_data;
+using namespace std;
+using namespace test;
+using namespace testing;
+using namespace thin_provisioning;
+using namespace scan_detail;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_address const NR_BLOCKS = 1024;
+	block_address const NR_DATA_BLOCKS = 102400;
+
+	unsigned const NR_MAPPINGS = 2000;
+
+	class MetadataScannerTests : public Test {
+	public:
+		MetadataScannerTests()
+			: bm_(create_bm<MD_BLOCK_SIZE>(NR_BLOCKS)),
+			  md_(new metadata(bm_, metadata::CREATE, 128, NR_DATA_BLOCKS)) {
+
+			for (unsigned b = 0; b < NR_MAPPINGS; b++) {
+				uint64_t key[2] = {0, b};
+				mapping_tree_detail::block_time bt;
+				bt.block_ = b;
+				bt.time_ = 0;
+				md_->mappings_->insert(key, bt);
+			}
+
+			md_->commit();
+		}
+
+		node_index scan(block_address chunk_blocks = metadata_scanner::DEFAULT_CHUNK_BLOCKS) {
+			node_index index;
+			metadata_scanner scanner(path(), NR_BLOCKS, chunk_blocks);
+			scanner.scan(index);
+			return index;
+		}
+
+		string path() const {
+			return "./test.data";
+		}
+
+		void prepare(bcache::validator::ptr v, unsigned char *data, block_address location) {
+			v->prepare(data, location);
+		}
+
+		block_manager<>::ptr bm_;
+		metadata::ptr md_;
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(MetadataScannerTests, zeroes_are_unknown)
+{
+	unsigned char data[MD_BLOCK_SIZE];
+	memset(data, 0, sizeof(data));
+	ASSERT_THAT(classify_block(data, 0), Eq(UNKNOWN));
+}
+
+TEST_F(MetadataScannerTests, space_map_blocks_are_recognised)
+{
+	unsigned char data[MD_BLOCK_SIZE];
+
+	memset(data, 0, sizeof(data));
+	prepare(bitmap_validator(), data, 17);
+	ASSERT_THAT(classify_block(data, 17), Eq(BITMAP));
+
+	memset(data, 0, sizeof(data));
+	prepare(index_validator(), data, 17);
+	ASSERT_THAT(classify_block(data, 17), Eq(INDEX));
+}
+
+TEST_F(MetadataScannerTests, blocks_in_the_wrong_place_are_unknown)
+{
+	unsigned char data[MD_BLOCK_SIZE];
+	memset(data, 0, sizeof(data));
+	prepare(bitmap_validator(), data, 17);
+	ASSERT_THAT(classify_block(data, 18), Eq(UNKNOWN));
+}
+
+TEST_F(MetadataScannerTests, corrupt_blocks_are_unknown)
+{
+	unsigned char data[MD_BLOCK_SIZE];
+	memset(data, 0, sizeof(data));
+	prepare(bitmap_validator(), data, 17);
+	data[100] = 1;
+	ASSERT_THAT(classify_block(data, 17), Eq(UNKNOWN));
+}
+
+TEST_F(MetadataScannerTests, scan_finds_every_kind_of_block)
+{
+	node_index index = scan();
+
+	ASSERT_THAT(index.get_nr_blocks(SUPERBLOCK), Eq(1u));
+	ASSERT_THAT(index.get_nr_blocks(INDEX), Eq(1u));
+	ASSERT_THAT(index.get_nr_blocks(BITMAP), Gt(0u));
+	ASSERT_THAT(index.get_nr_blocks(BTREE_INTERNAL), Gt(0u));
+	ASSERT_THAT(index.get_nr_blocks(BTREE_LEAF), Gt(0u));
+
+	block_info const *sb = index.find(superblock_detail::SUPERBLOCK_LOCATION);
+	ASSERT_TRUE(sb);
+	ASSERT_THAT(sb->type, Eq(SUPERBLOCK));
+}
+
+TEST_F(MetadataScannerTests, leaves_are_summarised)
+{
+	node_index index = scan();
+
+	// There's only one device, so the top level of the mapping
+	// tree is a single leaf.
+	block_address top_level = md_->sb_.data_mapping_root_;
+
+	block_address nr_mappings = 0;
+	for (block_address b = 0; b < NR_BLOCKS; b++) {
+		block_info const *info = index.find(b);
+		if (info && b != top_level &&
+		    info->type == BTREE_LEAF && info->value_size == sizeof(uint64_t)) {
+			ASSERT_THAT(info->lowest_key, Le(info->highest_key));
+			nr_mappings += info->nr_entries;
+		}
+	}
+
+	ASSERT_THAT(nr_mappings, Eq(NR_MAPPINGS));
+}
+
+TEST_F(MetadataScannerTests, chunk_size_doesnt_change_the_result)
+{
+	node_index big = scan();
+	node_index small = scan(3);
+
+	for (unsigned t = 0; t < NR_BLOCK_TYPES; t++)
+		ASSERT_THAT(small.get_nr_blocks(block_type(t)),
+			    Eq(big.get_nr_blocks(block_type(t))));
+}
+
+TEST_F(MetadataScannerTests, only_allocated_blocks_are_read)
+{
+	// With single block chunks, nothing is read through.
+	node_index index;
+	metadata_scanner scanner(path(), NR_BLOCKS, 1);
+	scanner.scan(*md_->metadata_sm_, index);
+
+	block_address nr_allocated = NR_BLOCKS - md_->metadata_sm_->get_nr_free();
+	ASSERT_THAT(scanner.get_nr_read(), Eq(nr_allocated));
+	ASSERT_THAT(index.get_nr_blocks(UNKNOWN), Eq(0u));
+	ASSERT_THAT(index.get_nr_blocks(SUPERBLOCK), Eq(1u));
+	ASSERT_THAT(index.get_nr_blocks(BTREE_LEAF), Gt(0u));
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,176 @@
+#include "gmock/gmock.h"
+
+#include "test_utils.h"
+
+#include "thin-provisioning/libthin_metadata.h"
+#include "thin-provisioning/metadata.h"
+#include "thin-provisioning/restore_emitter.h"
+
+#include <stdlib.h>
+
+using namespace persistent_data;
+using namespace std;
+using namespace test;
+using namespace testing;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_address const NR_BLOCKS = 1024;
+	block_address const NR_DATA_BLOCKS = 1024;
+
+	// Device 1 is a snapshot of device 0 that has had its second
+	// half overwritten, and has been written past the end of the
+	// origin.
+	void build_metadata() {
+		block_manager<>::ptr bm = create_bm<MD_BLOCK_SIZE>(NR_BLOCKS);
+		metadata::ptr md(new metadata(bm, metadata::CREATE, 128, 0));
+		emitter::ptr e = create_restore_emitter(md);
+
+		e->begin_superblock("", 1, 1, 128, NR_DATA_BLOCKS, boost::optional<uint64_t>());
+
+		e->begin_device(0, 100, 1, 0, 0);
+		e->range_map(0, 0, 0, 100);
+		e->end_device();
+
+		e->begin_device(1, 110, 1, 0, 0);
+		e->range_map(0, 0, 0, 50);
+		e->range_map(50, 200, 0, 50);
+		e->range_map(100, 300, 0, 10);
+		e->end_device();
+
+		e->end_superblock();
+	}
+
+	int record_mapping(void *context, uint64_t thin_begin,
+			   uint64_t data_begin, uint64_t len) {
+		vector<uint64_t> *v = static_cast<vector<uint64_t> *>(context);
+		v->push_back(thin_begin);
+		v->push_back(data_begin);
+		v->push_back(len);
+		return 0;
+	}
+
+	int record_delta(void *context, thin_md_delta_type type,
+			 uint64_t thin_begin, uint64_t data_begin,
+			 uint64_t right_data_begin, uint64_t len) {
+		vector<uint64_t> *v = static_cast<vector<uint64_t> *>(context);
+		v->push_back(type);
+		v->push_back(thin_begin);
+		v->push_back(data_begin);
+		v->push_back(right_data_begin);
+		v->push_back(len);
+		return 0;
+	}
+
+	int stop_at_once(void *context, uint64_t, uint64_t, uint64_t) {
+		++*static_cast<unsigned *>(context);
+		return 1;
+	}
+
+	class MetadataSessionTests : public Test {
+	public:
+		MetadataSessionTests()
+			: s_(NULL) {
+			build_metadata();
+
+			char *err;
+			s_ = thin_md_open("./test.data", 0, 0, &err);
+			if (!s_) {
+				string msg(err);
+				free(err);
+				throw runtime_error(msg);
+			}
+		}
+
+		~MetadataSessionTests() {
+			thin_md_close(s_);
+		}
+
+		thin_md_session *s_;
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST(MetadataSessionOpenTests, missing_file_sets_error)
+{
+	char *err = NULL;
+	ASSERT_THAT(thin_md_open("./no-such-metadata", 0, 0, &err), IsNull());
+	ASSERT_THAT(err, NotNull());
+	free(err);
+}
+
+TEST_F(MetadataSessionTests, superblock_fields)
+{
+	ASSERT_THAT(thin_md_data_block_size(s_), Eq(128u));
+	ASSERT_THAT(thin_md_nr_data_blocks(s_), Eq(NR_DATA_BLOCKS));
+}
+
+TEST_F(MetadataSessionTests, list_devices)
+{
+	thin_md_device devs[4];
+	ASSERT_THAT(thin_md_list_devices(s_, devs, 4), Eq(2));
+	ASSERT_THAT(devs[0].dev_id, Eq(0u));
+	ASSERT_THAT(devs[1].dev_id, Eq(1u));
+	ASSERT_THAT(devs[1].mapped_blocks, Eq(110u));
+}
+
+TEST_F(MetadataSessionTests, list_devices_stops_at_max)
+{
+	thin_md_device devs[1];
+	ASSERT_THAT(thin_md_list_devices(s_, devs, 1), Eq(2));
+	ASSERT_THAT(devs[0].dev_id, Eq(0u));
+}
+
+TEST_F(MetadataSessionTests, missing_device_sets_error)
+{
+	thin_md_device dev;
+	ASSERT_THAT(thin_md_get_device(s_, 7, &dev), Eq(-1));
+	ASSERT_THAT(string(thin_md_error(s_)), HasSubstr("no such thin device"));
+}
+
+TEST_F(MetadataSessionTests, exclusive_blocks)
+{
+	uint64_t nr_blocks;
+	ASSERT_THAT(thin_md_exclusive_blocks(s_, 0, &nr_blocks), Eq(0));
+	ASSERT_THAT(nr_blocks, Eq(50u));
+	ASSERT_THAT(thin_md_exclusive_blocks(s_, 1, &nr_blocks), Eq(0));
+	ASSERT_THAT(nr_blocks, Eq(60u));
+}
+
+TEST_F(MetadataSessionTests, lookup_range_is_clipped)
+{
+	vector<uint64_t> runs;
+	ASSERT_THAT(thin_md_lookup_range(s_, 1, 40, 105, record_mapping, &runs), Eq(0));
+	ASSERT_THAT(runs, ElementsAre(40u, 40u, 10u,
+				      50u, 200u, 50u,
+				      100u, 300u, 5u));
+}
+
+TEST_F(MetadataSessionTests, lookup_range_past_the_end_is_empty)
+{
+	vector<uint64_t> runs;
+	ASSERT_THAT(thin_md_lookup_range(s_, 0, 500, 600, record_mapping, &runs), Eq(0));
+	ASSERT_TRUE(runs.empty());
+}
+
+TEST_F(MetadataSessionTests, callback_can_stop_a_query)
+{
+	unsigned calls = 0;
+	ASSERT_THAT(thin_md_lookup_range(s_, 1, 0, 110, stop_at_once, &calls), Eq(0));
+	ASSERT_THAT(calls, Eq(1u));
+}
+
+TEST_F(MetadataSessionTests, delta)
+{
+	vector<uint64_t> diffs;
+	ASSERT_THAT(thin_md_delta(s_, 0, 1, record_delta, &diffs), Eq(0));
+	ASSERT_THAT(diffs, ElementsAre(
+			    THIN_MD_SAME, 0u, 0u, 0u, 50u,
+			    THIN_MD_DIFFERENT, 50u, 50u, 200u, 50u,
+			    THIN_MD_RIGHT_ONLY, 100u, 300u, 0u, 10u));
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,159 @@
+#include "gmock/gmock.h"
+#include "base/metrics.h"
+
+#include <sstream>
+#include <string.h>
+
+using namespace base;
+using namespace std;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+namespace {
+	class args {
+	public:
+		args(char const *a0, char const *a1 = NULL, char const *a2 = NULL,
+		     char const *a3 = NULL, char const *a4 = NULL) {
+			char const *as[] = {a0, a1, a2, a3, a4};
+			for (unsigned i = 0; i < 5 && as[i]; i++)
+				strs_.push_back(as[i]);
+
+			for (unsigned i = 0; i < strs_.size(); i++)
+				argv_.push_back(const_cast<char *>(strs_[i].c_str()));
+			argv_.push_back(NULL);
+
+			argc_ = strs_.size();
+		}
+
+		int &argc() {
+			return argc_;
+		}
+
+		char **argv() {
+			return &argv_[0];
+		}
+
+		vector<string> remaining() const {
+			vector<string> r;
+			for (int i = 0; i < argc_; i++)
+				r.push_back(argv_[i]);
+			return r;
+		}
+
+	private:
+		vector<string> strs_;
+		vector<char *> argv_;
+		int argc_;
+	};
+
+	string to_json(metrics_registry const &m) {
+		ostringstream out;
+		m.write_json(out);
+		return out.str();
+	}
+}
+
+//----------------------------------------------------------------
+
+TEST(MetricsTests, counters_are_found_by_name)
+{
+	metrics_registry m;
+
+	m.get_counter("a.b").add(3);
+	m.get_counter("a.b").inc();
+	m.get_counter("a.c").inc();
+
+	ASSERT_THAT(m.get_counter("a.b").get(), Eq(4u));
+	ASSERT_THAT(&m.get_counter("a.b"), Eq(&m.get_counter("a.b")));
+	ASSERT_THAT(m.get_counter("a.c").get(), Eq(1u));
+}
+
+TEST(MetricsTests, histogram_buckets_by_bit_length)
+{
+	histogram h("us");
+
+	h.record(0);
+	h.record(1);
+	h.record(2);
+	h.record(3);
+	h.record(4);
+	h.record(1000);
+
+	ASSERT_THAT(h.get_count(), Eq(6u));
+	ASSERT_THAT(h.get_sum(), Eq(1010u));
+	ASSERT_THAT(h.get_max(), Eq(1000u));
+
+	ASSERT_THAT(h.get_bucket(0), Eq(1u));
+	ASSERT_THAT(h.get_bucket(1), Eq(1u));
+	ASSERT_THAT(h.get_bucket(2), Eq(2u));
+	ASSERT_THAT(h.get_bucket(3), Eq(1u));
+	ASSERT_THAT(h.get_bucket(10), Eq(1u));
+}
+
+TEST(MetricsTests, phases_accumulate_in_first_run_order)
+{
+	metrics_registry m;
+
+	m.add_phase("superblock", 1.0);
+	m.add_phase("mapping tree", 2.0);
+	m.add_phase("superblock", 0.5);
+
+	string json = to_json(m);
+	ASSERT_THAT(json, HasSubstr("{\"name\": \"superblock\", \"seconds\": 1.500000, \"count\": 2}"));
+	ASSERT_THAT(json.find("superblock"), Lt(json.find("mapping tree")));
+}
+
+TEST(MetricsTests, json_lists_everything)
+{
+	metrics_registry m;
+
+	m.get_counter("block_cache.read_hits").add(7);
+	m.get_histogram("block_cache.read_latency", "us").record(5);
+
+	string json = to_json(m);
+	ASSERT_THAT(json, HasSubstr("\"block_cache.read_hits\": 7"));
+	ASSERT_THAT(json, HasSubstr("\"block_cache.read_latency\": {\"unit\": \"us\", \"count\": 1, "
+				    "\"sum\": 5, \"max\": 5, \"buckets\": [{\"ge\": 4, \"count\": 1}]}"));
+}
+
+TEST(MetricsTests, empty_registry_is_valid_json)
+{
+	metrics_registry m;
+
+	ASSERT_THAT(to_json(m), Eq("  \"phases\": [],\n  \"counters\": {},\n  \"histograms\": {}\n"));
+}
+
+TEST(MetricsTests, arguments_without_stats_are_untouched)
+{
+	args a("thin_check", "-q", "/dev/md");
+
+	ASSERT_TRUE(parse_stats_option("thin_check", a.argc(), a.argv()));
+	ASSERT_THAT(a.remaining(), ElementsAre("thin_check", "-q", "/dev/md"));
+	ASSERT_FALSE(metrics_enabled());
+}
+
+TEST(MetricsTests, stats_after_double_dash_is_an_argument)
+{
+	args a("thin_check", "--", "--stats", "3");
+
+	ASSERT_TRUE(parse_stats_option("thin_check", a.argc(), a.argv()));
+	ASSERT_THAT(a.remaining(), ElementsAre("thin_check", "--", "--stats", "3"));
+	ASSERT_FALSE(metrics_enabled());
+}
+
+TEST(MetricsTests, stats_needs_an_open_fd)
+{
+	args a1("thin_check", "/dev/md", "--stats");
+	ASSERT_FALSE(parse_stats_option("thin_check", a1.argc(), a1.argv()));
+
+	args a2("thin_check", "--stats=x", "/dev/md");
+	ASSERT_FALSE(parse_stats_option("thin_check", a2.argc(), a2.argv()));
+
+	args a3("thin_check", "--stats", "100000", "/dev/md");
+	ASSERT_FALSE(parse_stats_option("thin_check", a3.argc(), a3.argv()));
+
+	ASSERT_FALSE(metrics_enabled());
+}
+
+//----------------------------------------------------------------
@@ -0,0 +1,62 @@
+#include "gmock/gmock.h"
+
+#include "caching/oblock_tracker.h"
+
+using namespace caching;
+using namespace std;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+TEST(OblockTrackerTests, dense_blocks_are_tracked)
+{
+	oblock_tracker t(1000);
+
+	ASSERT_FALSE(t.test_and_set(0));
+	ASSERT_FALSE(t.test_and_set(999));
+	ASSERT_FALSE(t.test_and_set(500));
+	ASSERT_TRUE(t.test_and_set(0));
+	ASSERT_TRUE(t.test_and_set(999));
+	ASSERT_TRUE(t.test_and_set(500));
+	ASSERT_FALSE(t.test_and_set(501));
+}
+
+TEST(OblockTrackerTests, blocks_past_the_estimate_are_tracked)
+{
+	oblock_tracker t(1000);
+
+	ASSERT_FALSE(t.test_and_set(1000));
+	ASSERT_FALSE(t.test_and_set(1ull << 40));
+	ASSERT_FALSE(t.test_and_set((1ull << 48) - 1));
+	ASSERT_FALSE(t.test_and_set(1001));
+
+	ASSERT_TRUE(t.test_and_set(1000));
+	ASSERT_TRUE(t.test_and_set(1ull << 40));
+	ASSERT_TRUE(t.test_and_set((1ull << 48) - 1));
+	ASSERT_TRUE(t.test_and_set(1001));
+	ASSERT_FALSE(t.test_and_set((1ull << 40) + 1));
+}
+
+TEST(OblockTrackerTests, unknown_origin_size)
+{
+	oblock_tracker t(0);
+
+	for (uint64_t b = 0; b < 100000; b += 3)
+		ASSERT_FALSE(t.test_and_set(b));
+
+	for (uint64_t b = 0; b < 100000; b++)
+		ASSERT_THAT(t.test_and_set(b), Eq(b % 3 == 0));
+}
+
+TEST(OblockTrackerTests, memory_is_a_bit_per_block)
+{
+	oblock_tracker t(1 << 20);
+	ASSERT_THAT(t.get_memory_usage(), Eq((1u << 20) / 8));
+
+	for (uint64_t b = 0; b < (1 << 20); b++)
+		t.test_and_set((1ull << 22) + b);
+
+	ASSERT_THAT(t.get_memory_usage(), Lt((1u << 20) / 8 * 2 + 16384));
+}
+
+//----------------------------------------------------------------
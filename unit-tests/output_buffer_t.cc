@@ -0,0 +1,104 @@
+#include "gmock/gmock.h"
+#include "base/output_buffer.h"
+
+#include <limits>
+#include <sstream>
+
+using namespace base;
+using namespace std;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+namespace {
+	template <typename T>
+	void check_same_as_ostream(T const &v) {
+		ostringstream expected, actual;
+
+		expected << v;
+		{
+			output_buffer out(actual);
+			out << v;
+		}
+
+		ASSERT_THAT(actual.str(), Eq(expected.str()));
+	}
+}
+
+//----------------------------------------------------------------
+
+TEST(OutputBufferTests, empty_buffer_writes_nothing)
+{
+	ostringstream actual;
+	{
+		output_buffer out(actual);
+	}
+
+	ASSERT_THAT(actual.str(), Eq(string()));
+}
+
+TEST(OutputBufferTests, unsigned_integers_format_like_ostream)
+{
+	uint64_t v = 1;
+	for (unsigned i = 0; i < 64; i++, v = v * 2 + 1) {
+		check_same_as_ostream(v);
+		check_same_as_ostream(v - 1);
+		check_same_as_ostream(v / 10);
+		check_same_as_ostream(v / 10 * 10);
+	}
+
+	check_same_as_ostream(numeric_limits<uint64_t>::max());
+	check_same_as_ostream(numeric_limits<uint32_t>::max());
+	check_same_as_ostream(static_cast<unsigned short>(65535));
+}
+
+TEST(OutputBufferTests, signed_integers_format_like_ostream)
+{
+	check_same_as_ostream(0);
+	check_same_as_ostream(-1);
+	check_same_as_ostream(-100);
+	check_same_as_ostream(numeric_limits<int>::min());
+	check_same_as_ostream(numeric_limits<int64_t>::min());
+	check_same_as_ostream(numeric_limits<int64_t>::max());
+}
+
+TEST(OutputBufferTests, strings_chars_and_bools)
+{
+	check_same_as_ostream("foo");
+	check_same_as_ostream(string("bar"));
+	check_same_as_ostream('x');
+	check_same_as_ostream(true);
+	check_same_as_ostream(false);
+}
+
+TEST(OutputBufferTests, endl_is_a_newline)
+{
+	ostringstream actual;
+	{
+		output_buffer out(actual);
+		out << "a" << endl << 1u << endl;
+	}
+
+	ASSERT_THAT(actual.str(), Eq(string("a\n1\n")));
+}
+
+TEST(OutputBufferTests, output_larger_than_the_buffer)
+{
+	ostringstream expected, actual;
+	{
+		output_buffer out(actual, 16);
+		for (unsigned i = 0; i < 1000; i++) {
+			out << "<line nr=\"" << i << "\"/>" << endl;
+			out.spaces(i % 200);
+			expected << "<line nr=\"" << i << "\"/>" << endl
+				 << string(i % 200, ' ');
+		}
+
+		out << string(100, 'x');
+		expected << string(100, 'x');
+	}
+
+	ASSERT_THAT(actual.str(), Eq(expected.str()));
+}
+
+//----------------------------------------------------------------
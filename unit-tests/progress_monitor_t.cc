@@ -0,0 +1,131 @@
+#include "gmock/gmock.h"
+#include "base/progress_monitor.h"
+
+#include <string.h>
+#include <unistd.h>
+
+using namespace base;
+using namespace std;
+using namespace testing;
+
+//----------------------------------------------------------------
+
+namespace {
+	uint64_t const AN_HOUR = 3600ull * 1000000000ull;
+
+	class progress_monitor_mock : public progress_monitor {
+	public:
+		MOCK_METHOD1(update_percent, void(unsigned));
+	};
+
+	class WalkProgressTests : public Test {
+	public:
+		WalkProgressTests()
+			: monitor_(new StrictMock<progress_monitor_mock>()) {
+		}
+
+		~WalkProgressTests() {
+			disable_walk_progress();
+		}
+
+		void enable(uint64_t interval_ns = 0) {
+			enable_walk_progress(auto_ptr<progress_monitor>(monitor_), interval_ns);
+		}
+
+		void walk(unsigned nr_nodes) {
+			for (unsigned i = 0; i < nr_nodes; i++)
+				walk_progress_node();
+		}
+
+		// Owned by the walk progress once it's enabled.
+		progress_monitor_mock *monitor_;
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(WalkProgressTests, nothing_is_reported_unless_enabled)
+{
+	walk(4096);
+	delete monitor_;
+}
+
+TEST_F(WalkProgressTests, nothing_is_reported_without_a_total)
+{
+	enable();
+	walk(4096);
+}
+
+TEST_F(WalkProgressTests, percentages_are_of_the_total)
+{
+	InSequence dummy;
+	EXPECT_CALL(*monitor_, update_percent(25));
+	EXPECT_CALL(*monitor_, update_percent(50));
+	EXPECT_CALL(*monitor_, update_percent(75));
+
+	enable();
+	set_walk_progress_total(1024);
+	walk(1000);
+}
+
+TEST_F(WalkProgressTests, estimate_is_capped)
+{
+	InSequence dummy;
+	EXPECT_CALL(*monitor_, update_percent(50));
+	EXPECT_CALL(*monitor_, update_percent(99));
+
+	enable();
+	set_walk_progress_total(512);
+	walk(2048);
+}
+
+TEST_F(WalkProgressTests, updates_are_throttled)
+{
+	EXPECT_CALL(*monitor_, update_percent(25));
+
+	enable(AN_HOUR);
+	set_walk_progress_total(1024);
+	walk(1024);
+}
+
+TEST_F(WalkProgressTests, completion_reports_the_whole_walk)
+{
+	InSequence dummy;
+	EXPECT_CALL(*monitor_, update_percent(50));
+	EXPECT_CALL(*monitor_, update_percent(99));
+	EXPECT_CALL(*monitor_, update_percent(100));
+
+	enable();
+	set_walk_progress_total(512);
+	walk(2048);
+	complete_walk_progress();
+	complete_walk_progress();
+}
+
+TEST_F(WalkProgressTests, completion_needs_a_total)
+{
+	enable();
+	walk(4096);
+	complete_walk_progress();
+}
+
+TEST(ProgressMonitorTests, fd_monitor_writes_a_line_per_update)
+{
+	int fds[2];
+	ASSERT_THAT(::pipe(fds), Eq(0));
+
+	{
+		auto_ptr<progress_monitor> m = create_fd_progress_monitor(fds[1], "thin_check");
+		m->update_percent(3);
+		m->update_percent(42);
+	}
+	::close(fds[1]);
+
+	char buffer[64];
+	ssize_t n = ::read(fds[0], buffer, sizeof(buffer));
+	::close(fds[0]);
+
+	ASSERT_THAT(string(buffer, n > 0 ? n : 0), Eq("thin_check: 3%\nthin_check: 42%\n"));
+}
+
+//----------------------------------------------------------------
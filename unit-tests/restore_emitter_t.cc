@@ -0,0 +1,156 @@
+#include "gmock/gmock.h"
+
+#include "test_utils.h"
+
+#include "thin-provisioning/metadata.h"
+#include "thin-provisioning/restore_emitter.h"
+
+using namespace persistent_data;
+using namespace std;
+using namespace test;
+using namespace testing;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_address const NR_METADATA_BLOCKS = 1024;
+	uint64_t const NR_DATA_BLOCKS = 10000;
+
+	class damage_counter : public mapping_tree_detail::damage_visitor {
+	public:
+		damage_counter()
+			: nr_damage_(0) {
+		}
+
+		virtual void visit(mapping_tree_detail::missing_devices const &d) {
+			nr_damage_++;
+		}
+
+		virtual void visit(mapping_tree_detail::missing_mappings const &d) {
+			nr_damage_++;
+		}
+
+		unsigned nr_damage_;
+	};
+
+	class RestoreEmitterTests : public Test {
+	public:
+		RestoreEmitterTests()
+			: md_(new metadata(create_bm<MD_BLOCK_SIZE>(NR_METADATA_BLOCKS),
+					   metadata::CREATE, 128, 0)),
+			  e_(create_restore_emitter(md_)) {
+			e_->begin_superblock("", 0, 1, 128, NR_DATA_BLOCKS,
+					     boost::optional<uint64_t>());
+		}
+
+		void begin_device(uint32_t dev) {
+			e_->begin_device(dev, 0, 0, 0, 0);
+		}
+
+		void map(uint64_t begin, uint64_t end) {
+			e_->range_map(begin, begin, 0, end - begin);
+		}
+
+		// The btree checks include every node apart from the
+		// root being at least a third full.
+		unsigned nr_damage() const {
+			damage_counter dc;
+			check_mapping_tree(*md_->mappings_, dc);
+			return dc.nr_damage_;
+		}
+
+		void check_lookups(uint32_t dev, uint64_t begin, uint64_t end) const {
+			for (uint64_t b = begin; b < end; b++) {
+				uint64_t key[2] = {dev, b};
+				mapping_tree::maybe_value v = md_->mappings_->lookup(key);
+				ASSERT_TRUE(!!v);
+				ASSERT_THAT(v->block_, Eq(b));
+			}
+		}
+
+		metadata::ptr md_;
+		emitter::ptr e_;
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(RestoreEmitterTests, small_named_mapping_within_a_device)
+{
+	begin_device(0);
+	map(0, 1000);
+	e_->begin_named_mapping("small");
+	map(1000, 1003);
+	e_->end_named_mapping();
+	map(1003, 2003);
+	e_->end_device();
+
+	begin_device(1);
+	e_->identifier("small");
+	e_->end_device();
+
+	e_->end_superblock();
+
+	ASSERT_THAT(nr_damage(), Eq(0u));
+	check_lookups(0, 0, 2003);
+	check_lookups(1, 1000, 1003);
+}
+
+TEST_F(RestoreEmitterTests, mappings_below_a_reference_are_inserted)
+{
+	begin_device(0);
+	e_->begin_named_mapping("big");
+	map(0, 5000);
+	e_->end_named_mapping();
+	e_->end_device();
+
+	begin_device(1);
+	e_->identifier("big");
+	e_->range_map(100, 6000, 0, 10);
+	e_->end_device();
+
+	e_->end_superblock();
+
+	ASSERT_THAT(nr_damage(), Eq(0u));
+	check_lookups(0, 0, 5000);
+	check_lookups(1, 0, 100);
+	check_lookups(1, 110, 5000);
+
+	for (uint64_t b = 100; b < 110; b++) {
+		uint64_t key[2] = {1, b};
+		mapping_tree::maybe_value v = md_->mappings_->lookup(key);
+		ASSERT_TRUE(!!v);
+		ASSERT_THAT(v->block_, Eq(b + 5900));
+	}
+}
+
+TEST_F(RestoreEmitterTests, named_mapping_is_shared)
+{
+	begin_device(0);
+	e_->begin_named_mapping("big");
+	map(0, 5000);
+	e_->end_named_mapping();
+	e_->end_device();
+
+	begin_device(1);
+	map(5000, 5010);
+	e_->end_device();
+
+	begin_device(2);
+	e_->identifier("big");
+	e_->end_device();
+
+	e_->end_superblock();
+
+	ASSERT_THAT(nr_damage(), Eq(0u));
+	check_lookups(0, 0, 5000);
+	check_lookups(2, 0, 5000);
+
+	uint64_t key[1] = {0};
+	block_address root0 = *md_->mappings_top_level_->lookup(key);
+	key[0] = 2;
+	ASSERT_THAT(*md_->mappings_top_level_->lookup(key), Eq(root0));
+}
+
+//----------------------------------------------------------------
@@ -176,4 +176,58 @@ TEST_F(RMapVisitorTests, rmap_is_sorted)
 	check_rmap_at(3, 400, 450, 5, 0);
 }
 
+TEST_F(RMapVisitorTests, many_regions)
+{
+	for (block_address b = 0; b < 1000; b += 2)
+		add_data_region(b, b + 1);
+	linear_thins(10, 100);
+
+	run();
+
+	check_rmap_size(500);
+	check_rmap_at(0, 0, 1, 0, 0);
+	check_rmap_at(1, 2, 3, 0, 2);
+	check_rmap_at(499, 998, 999, 9, 98);
+}
+
+TEST_F(RMapVisitorTests, regions_outside_the_data_are_ignored)
+{
+	add_data_region(2000, 3000);
+	add_data_region(90, 110);
+	add_data_region(100, 105);
+	linear_thins(10, 100);
+
+	run();
+
+	check_rmap_size(2);
+	check_rmap_at(0, 90, 100, 0, 90);
+	check_rmap_at(1, 100, 110, 1, 0);
+}
+
+TEST_F(RMapVisitorTests, merged_visitors_are_sorted)
+{
+	rmap_visitor other;
+	other.add_data_region(rmap_visitor::region(0, 1000));
+	add_data_region(0, 1000);
+
+	mapping_tree_detail::block_time bt;
+	bt.time_ = 0;
+	for (uint32_t thin_dev = 0; thin_dev < 10; thin_dev++)
+		for (block_address b = 0; b < 100; b++) {
+			bt.block_ = thin_dev * 100 + b;
+			if (thin_dev % 2)
+				other.visit_mapping(thin_dev, b, bt);
+			else
+				visit(thin_dev, b, bt.block_);
+		}
+
+	other.complete();
+	run();
+	rmap_v_.merge(other);
+
+	check_rmap_size(10);
+	for (uint32_t thin_dev = 0; thin_dev < 10; thin_dev++)
+		check_rmap_at(thin_dev, thin_dev * 100, (thin_dev + 1) * 100, thin_dev, 0);
+}
+
 //----------------------------------------------------------------
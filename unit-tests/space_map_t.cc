@@ -196,6 +196,25 @@ namespace {
 				ASSERT_THAT(sm->get_count(i), Eq((rand() % 6789u) + 1u));
 		}
 
+		void test_inc_range(space_map::ptr sm) {
+			for (unsigned i = 0; i < 100; i++)
+				sm->set_count(i, i % 5);
+
+			sm->inc_range(50, 150);
+
+			for (unsigned i = 0; i < 50; i++)
+				ASSERT_THAT(sm->get_count(i), Eq(i % 5));
+
+			for (unsigned i = 50; i < 100; i++)
+				ASSERT_THAT(sm->get_count(i), Eq(i % 5 + 1));
+
+			for (unsigned i = 100; i < 150; i++)
+				ASSERT_THAT(sm->get_count(i), Eq(1u));
+
+			// 80 of the first 100 blocks were already in use
+			ASSERT_THAT(sm->get_nr_free(), Eq(NR_BLOCKS - 80 - 50 - 10));
+		}
+
 		template <typename SMCreator>
 		void test_sm_reopen() {
 			unsigned char buffer[128];
@@ -228,6 +247,7 @@ namespace {
 			test_set_count(SMCreator::create(tm_));
 			test_set_affects_nr_allocated(SMCreator::create(tm_));
 			test_high_ref_counts(SMCreator::create(tm_));
+			test_inc_range(SMCreator::create(tm_));
 		}
 
 		void
@@ -287,4 +307,38 @@ TEST_F(SpaceMapTests, test_metadata_and_disk)
 	persistent_space_map::ptr data_sm_ = create_disk_sm(*tm, NR_BLOCKS * 2);
 }
 
+TEST_F(SpaceMapTests, test_metadata_sm_can_be_updated_after_reopen)
+{
+	unsigned char buffer[128];
+
+	{
+		space_map::ptr core_sm(new core_map(NR_BLOCKS));
+		core_sm->inc(SUPERBLOCK);
+		transaction_manager::ptr tm(new transaction_manager(bm_, core_sm));
+		persistent_space_map::ptr sm = create_metadata_sm(*tm, NR_BLOCKS);
+		copy_space_maps(sm, core_sm);
+		tm->set_sm(sm);
+		sm->commit();
+		sm->copy_root(buffer, sizeof(buffer));
+	}
+
+	// The first change in a new transaction shadows the bitmaps,
+	// which allocates from the space map being changed.
+	{
+		space_map::ptr core_sm(new core_map(NR_BLOCKS));
+		core_sm->inc(SUPERBLOCK);
+		transaction_manager::ptr tm(new transaction_manager(bm_, core_sm));
+		persistent_space_map::ptr sm = open_metadata_sm(*tm, buffer);
+		tm->set_sm(sm);
+
+		block_address nr_free = sm->get_nr_free();
+		boost::optional<block_address> b = sm->new_block();
+		ASSERT_TRUE(b);
+		ASSERT_NO_THROW(sm->commit());
+		ASSERT_THAT(sm->get_count(*b), Eq(1u));
+		ASSERT_THAT(sm->get_count(SUPERBLOCK), Eq(1u));
+		ASSERT_THAT(sm->get_nr_free(), Lt(nr_free));
+	}
+}
+
 //----------------------------------------------------------------
@@ -0,0 +1,265 @@
+#include "gmock/gmock.h"
+#include "thin-provisioning/stream_format.h"
+
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace testing;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	class emitter_mock : public emitter {
+	public:
+		MOCK_METHOD6(begin_superblock, void(string const &, uint64_t, uint64_t,
+						    uint32_t, uint64_t,
+						    boost::optional<uint64_t>));
+		MOCK_METHOD0(end_superblock, void());
+		MOCK_METHOD5(begin_device, void(uint32_t, uint64_t, uint64_t,
+						uint64_t, uint64_t));
+		MOCK_METHOD0(end_device, void());
+		MOCK_METHOD1(begin_named_mapping, void(string const &));
+		MOCK_METHOD0(end_named_mapping, void());
+		MOCK_METHOD1(identifier, void(string const &));
+		MOCK_METHOD4(range_map, void(uint64_t, uint64_t, uint32_t, uint64_t));
+		MOCK_METHOD3(single_map, void(uint64_t, uint64_t, uint32_t));
+	};
+
+	class mapping_recorder : public emitter {
+	public:
+		struct mapping {
+			uint64_t origin_;
+			uint64_t data_;
+			uint32_t time_;
+		};
+
+		void begin_superblock(string const &uuid, uint64_t time,
+				      uint64_t trans_id, uint32_t data_block_size,
+				      uint64_t nr_data_blocks,
+				      boost::optional<uint64_t> metadata_snap) {}
+		void end_superblock() {}
+		void begin_device(uint32_t dev_id, uint64_t mapped_blocks,
+				  uint64_t trans_id, uint64_t creation_time,
+				  uint64_t snap_time) {}
+		void end_device() {}
+		void begin_named_mapping(string const &name) {}
+		void end_named_mapping() {}
+		void identifier(string const &name) {}
+
+		void range_map(uint64_t origin_begin, uint64_t data_begin,
+			       uint32_t time, uint64_t len) {
+			for (uint64_t i = 0; i < len; i++)
+				single_map(origin_begin + i, data_begin + i, time);
+		}
+
+		void single_map(uint64_t origin_block, uint64_t data_block,
+				uint32_t time) {
+			mapping m = {origin_block, data_block, time};
+			mappings_.push_back(m);
+		}
+
+		vector<mapping> mappings_;
+	};
+
+	class StreamFormatTests : public Test {
+	public:
+		StreamFormatTests()
+			: mock_(new StrictMock<emitter_mock>()),
+			  monitor_(base::create_quiet_progress_monitor()) {
+		}
+
+		emitter::ptr encoder() {
+			return create_stream_emitter(buffer_);
+		}
+
+		void parse() {
+			istringstream in(buffer_.str());
+			parse_stream(in, mock_, in.str().length(), *monitor_);
+		}
+
+		void corrupt(size_t offset) {
+			string s = buffer_.str();
+			s[offset] ^= 0x55;
+			buffer_.str(s);
+		}
+
+		stringstream buffer_;
+		boost::shared_ptr<StrictMock<emitter_mock> > mock_;
+		auto_ptr<base::progress_monitor> monitor_;
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(StreamFormatTests, superblock_round_trips)
+{
+	{
+		emitter::ptr e = encoder();
+		e->begin_superblock("a uuid", 5, 1234, 128, 1ull << 40,
+				    boost::optional<uint64_t>(97));
+		e->end_superblock();
+	}
+
+	InSequence dummy;
+	EXPECT_CALL(*mock_, begin_superblock("a uuid", 5, 1234, 128, 1ull << 40,
+					     boost::optional<uint64_t>(97)));
+	EXPECT_CALL(*mock_, end_superblock());
+
+	parse();
+}
+
+TEST_F(StreamFormatTests, missing_metadata_snap_round_trips)
+{
+	{
+		emitter::ptr e = encoder();
+		e->begin_superblock("", 0, 0, 64, 1000, boost::optional<uint64_t>());
+		e->end_superblock();
+	}
+
+	InSequence dummy;
+	EXPECT_CALL(*mock_, begin_superblock("", 0, 0, 64, 1000,
+					     boost::optional<uint64_t>()));
+	EXPECT_CALL(*mock_, end_superblock());
+
+	parse();
+}
+
+TEST_F(StreamFormatTests, mappings_round_trip)
+{
+	{
+		emitter::ptr e = encoder();
+		e->begin_superblock("", 1, 2, 128, 1000000, boost::optional<uint64_t>());
+		e->begin_device(3, 100, 4, 5, 6);
+		e->range_map(10, 5000, 2, 20);
+		e->single_map(31, 100, 0);
+		e->single_map(32, 99, 7);
+		e->range_map(1ull << 40, 0, 0xffffffff, 1ull << 32);
+		e->end_device();
+		e->begin_device(4, 0, 0, 0, 0);
+		e->end_device();
+		e->end_superblock();
+	}
+
+	InSequence dummy;
+	EXPECT_CALL(*mock_, begin_superblock("", 1, 2, 128, 1000000, boost::optional<uint64_t>()));
+	EXPECT_CALL(*mock_, begin_device(3, 100, 4, 5, 6));
+	EXPECT_CALL(*mock_, range_map(10, 5000, 2, 20));
+	EXPECT_CALL(*mock_, single_map(31, 100, 0));
+	EXPECT_CALL(*mock_, single_map(32, 99, 7));
+	EXPECT_CALL(*mock_, range_map(1ull << 40, 0, 0xffffffff, 1ull << 32));
+	EXPECT_CALL(*mock_, end_device());
+	EXPECT_CALL(*mock_, begin_device(4, 0, 0, 0, 0));
+	EXPECT_CALL(*mock_, end_device());
+	EXPECT_CALL(*mock_, end_superblock());
+
+	parse();
+}
+
+TEST_F(StreamFormatTests, named_mappings_round_trip)
+{
+	{
+		emitter::ptr e = encoder();
+		e->begin_superblock("", 1, 2, 128, 1000000, boost::optional<uint64_t>());
+		e->begin_device(0, 30, 0, 0, 0);
+		e->single_map(1, 100, 0);
+		e->begin_named_mapping("1234");
+		e->range_map(10, 5000, 2, 20);
+		e->end_named_mapping();
+		e->end_device();
+		e->begin_device(1, 20, 0, 0, 0);
+		e->identifier("1234");
+		e->single_map(31, 100, 0);
+		e->end_device();
+		e->end_superblock();
+	}
+
+	InSequence dummy;
+	EXPECT_CALL(*mock_, begin_superblock("", 1, 2, 128, 1000000, boost::optional<uint64_t>()));
+	EXPECT_CALL(*mock_, begin_device(0, 30, 0, 0, 0));
+	EXPECT_CALL(*mock_, single_map(1, 100, 0));
+	EXPECT_CALL(*mock_, begin_named_mapping("1234"));
+	EXPECT_CALL(*mock_, range_map(10, 5000, 2, 20));
+	EXPECT_CALL(*mock_, end_named_mapping());
+	EXPECT_CALL(*mock_, end_device());
+	EXPECT_CALL(*mock_, begin_device(1, 20, 0, 0, 0));
+	EXPECT_CALL(*mock_, identifier("1234"));
+	EXPECT_CALL(*mock_, single_map(31, 100, 0));
+	EXPECT_CALL(*mock_, end_device());
+	EXPECT_CALL(*mock_, end_superblock());
+
+	parse();
+}
+
+TEST_F(StreamFormatTests, mappings_span_many_chunks)
+{
+	unsigned const nr_mappings = 100000;
+
+	{
+		emitter::ptr e = encoder();
+		e->begin_superblock("", 1, 2, 128, 10 * nr_mappings, boost::optional<uint64_t>());
+		e->begin_device(0, nr_mappings, 0, 0, 0);
+		for (unsigned i = 0; i < nr_mappings; i++)
+			e->single_map(i * 2, (i * 7919) % (10 * nr_mappings), i % 3);
+		e->end_device();
+		e->end_superblock();
+	}
+
+	// Setting up an expectation per mapping makes gmock quadratic,
+	// so just check they come back in order.
+	boost::shared_ptr<mapping_recorder> recorder(new mapping_recorder);
+	istringstream in(buffer_.str());
+	parse_stream(in, recorder, in.str().length(), *monitor_);
+
+	ASSERT_THAT(recorder->mappings_.size(), Eq(nr_mappings));
+	for (unsigned i = 0; i < nr_mappings; i++) {
+		ASSERT_THAT(recorder->mappings_[i].origin_, Eq(i * 2));
+		ASSERT_THAT(recorder->mappings_[i].data_, Eq((i * 7919) % (10 * nr_mappings)));
+		ASSERT_THAT(recorder->mappings_[i].time_, Eq(i % 3));
+	}
+}
+
+TEST_F(StreamFormatTests, partial_dump_is_written)
+{
+	{
+		emitter::ptr e = encoder();
+		e->begin_superblock("", 1, 2, 128, 1000, boost::optional<uint64_t>());
+		e->begin_device(3, 100, 4, 5, 6);
+		e->range_map(10, 500, 2, 20);
+	}
+
+	InSequence dummy;
+	EXPECT_CALL(*mock_, begin_superblock("", 1, 2, 128, 1000, boost::optional<uint64_t>()));
+	EXPECT_CALL(*mock_, begin_device(3, 100, 4, 5, 6));
+	EXPECT_CALL(*mock_, range_map(10, 500, 2, 20));
+
+	parse();
+}
+
+TEST_F(StreamFormatTests, bad_magic_is_rejected)
+{
+	{
+		emitter::ptr e = encoder();
+		e->begin_superblock("", 0, 0, 64, 1000, boost::optional<uint64_t>());
+		e->end_superblock();
+	}
+
+	corrupt(0);
+	ASSERT_THROW(parse(), runtime_error);
+}
+
+TEST_F(StreamFormatTests, corrupt_chunk_is_rejected)
+{
+	{
+		emitter::ptr e = encoder();
+		e->begin_superblock("some uuid", 0, 0, 64, 1000, boost::optional<uint64_t>());
+		e->end_superblock();
+	}
+
+	// first byte of the payload, after the file and chunk headers
+	corrupt(24);
+	ASSERT_THROW(parse(), runtime_error);
+}
+
+//----------------------------------------------------------------
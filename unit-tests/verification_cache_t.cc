@@ -0,0 +1,342 @@
+#include "gmock/gmock.h"
+
+#include "test_utils.h"
+
+#include "base/endian_utils.h"
+#include "persistent-data/checksum.h"
+#include "persistent-data/data-structures/btree_counter.h"
+#include "persistent-data/space-maps/core.h"
+#include "thin-provisioning/verification_cache.h"
+
+#include <fstream>
+#include <sstream>
+
+using namespace persistent_data;
+using namespace std;
+using namespace test;
+using namespace testing;
+using namespace thin_provisioning;
+
+//----------------------------------------------------------------
+
+namespace {
+	block_address const BLOCK_SIZE = 4096;
+	block_address const NR_BLOCKS = 10240;
+	block_address const SUPERBLOCK = 0;
+
+	unsigned const NR_DEVS = 4;
+	unsigned const NR_MAPPINGS = 5000;
+
+	class damage_counter : public mapping_tree_detail::damage_visitor {
+	public:
+		damage_counter()
+			: nr_damage_(0) {
+		}
+
+		virtual void visit(mapping_tree_detail::missing_devices const &d) {
+			nr_damage_++;
+		}
+
+		virtual void visit(mapping_tree_detail::missing_mappings const &d) {
+			nr_damage_++;
+		}
+
+		unsigned nr_damage_;
+	};
+
+	// Writes a cache file by hand, for the shapes of node graph
+	// that write() never produces.
+	class raw_cache {
+	public:
+		void add_internal(block_address b, block_address child1, block_address child2) {
+			nodes_.push_back(make_pair(b, vector<block_address>()));
+			nodes_.back().second.push_back(child1);
+			nodes_.back().second.push_back(child2);
+		}
+
+		void add_leaf(block_address b) {
+			nodes_.push_back(make_pair(b, vector<block_address>()));
+		}
+
+		void write(string const &path) const {
+			ostringstream out;
+
+			put_u64(out, 0x796672766e696874ULL);
+			put_u32(out, 2);
+			out.write(string(16, '\0').data(), 16);
+			put_u64(out, 0);
+			put_u32(out, 0);
+
+			put_u32(out, 0);
+			put_u64(out, nodes_.size());
+			for (size_t i = 0; i < nodes_.size(); i++) {
+				vector<block_address> const &children = nodes_[i].second;
+
+				put_u64(out, nodes_[i].first);
+				put_u32(out, children.size());
+				if (children.empty()) {
+					put_u64(out, 1);
+					put_u64(out, nodes_[i].first);
+					put_u64(out, nodes_[i].first);
+				} else
+					for (size_t c = 0; c < children.size(); c++)
+						put_u64(out, children[c]);
+			}
+
+			string data = out.str();
+			base::crc32c sum(0x3c8e51a9);
+			sum.append(data.data(), data.length());
+
+			ofstream file(path.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+			file.write(data.data(), data.length());
+			put_u32(file, sum.get_sum());
+		}
+
+	private:
+		static void put_u32(ostream &out, uint32_t v) {
+			base::le32 d = base::to_disk<base::le32>(v);
+			out.write(reinterpret_cast<char const *>(&d), sizeof(d));
+		}
+
+		static void put_u64(ostream &out, uint64_t v) {
+			base::le64 d = base::to_disk<base::le64>(v);
+			out.write(reinterpret_cast<char const *>(&d), sizeof(d));
+		}
+
+		vector<pair<block_address, vector<block_address> > > nodes_;
+	};
+
+	class VerificationCacheTests : public Test {
+	public:
+		VerificationCacheTests()
+			: bm_(create_bm<BLOCK_SIZE>(NR_BLOCKS)),
+			  sm_(setup_core_map()),
+			  data_sm_(new core_map(NR_DEVS * NR_MAPPINGS * 2)),
+			  tm_(new transaction_manager(bm_, sm_)),
+			  mappings_(*tm_, mapping_tree_detail::block_traits::ref_counter(data_sm_)) {
+
+			for (unsigned dev = 0; dev < NR_DEVS; dev++)
+				for (unsigned b = 0; b < NR_MAPPINGS; b++)
+					insert(dev, b * 2);
+
+			commit();
+		}
+
+		void insert(uint64_t dev, uint64_t b) {
+			uint64_t key[2] = {dev, b};
+			mapping_tree_detail::block_time bt;
+			bt.block_ = dev * NR_MAPPINGS * 2 + b;
+			bt.time_ = 0;
+			mappings_.insert(key, bt);
+		}
+
+		// Nodes are only given their final checksum and block
+		// number when they're written back.  Nodes written before
+		// this will be shadowed by the next change.
+		void commit() {
+			bm_->flush();
+			tm_->begin(SUPERBLOCK, bcache::validator::ptr(new bcache::noop_validator()));
+		}
+
+		verification_cache::ptr new_cache() {
+			return verification_cache::ptr(
+				new verification_cache(verification_cache_key(), sm_));
+		}
+
+		verification_cache::ptr read_cache() {
+			return verification_cache::read(path(), verification_cache_key(), sm_);
+		}
+
+		unsigned check(verification_cache &cache) {
+			damage_counter dc;
+			check_mapping_tree(mappings_, dc, cache);
+			return dc.nr_damage_;
+		}
+
+		block_address dev_root(uint64_t dev) {
+			dev_tree dtree(*tm_, mappings_.get_root(),
+				       mapping_tree_detail::mtree_traits::ref_counter(tm_));
+			uint64_t key[1] = {dev};
+			dev_tree::maybe_value root = dtree.lookup(key);
+			if (!root)
+				throw runtime_error("missing device");
+			return *root;
+		}
+
+		string path() const {
+			return "./verification.cache";
+		}
+
+		void corrupt(size_t offset) {
+			string data;
+			{
+				ifstream in(path().c_str(), ios_base::in | ios_base::binary);
+				data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+			}
+
+			data[offset] ^= 1;
+			ofstream out(path().c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+			out.write(data.data(), data.length());
+		}
+
+		with_temp_directory dir_;
+		block_manager<>::ptr bm_;
+		space_map::ptr sm_;
+		space_map::ptr data_sm_;
+		transaction_manager::ptr tm_;
+		mapping_tree mappings_;
+
+	private:
+		space_map::ptr setup_core_map() {
+			space_map::ptr sm(new core_map(NR_BLOCKS));
+			sm->inc(SUPERBLOCK);
+			return sm;
+		}
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST_F(VerificationCacheTests, nothing_is_skipped_the_first_time)
+{
+	verification_cache::ptr cache = new_cache();
+	ASSERT_THAT(check(*cache), Eq(0u));
+	ASSERT_THAT(cache->get_nr_skipped(), Eq(0u));
+}
+
+TEST_F(VerificationCacheTests, unchanged_subtrees_are_skipped)
+{
+	verification_cache::ptr cache = new_cache();
+	check(*cache);
+	cache->write(path());
+
+	cache = read_cache();
+	ASSERT_TRUE(cache);
+	ASSERT_THAT(check(*cache), Eq(0u));
+	ASSERT_THAT(cache->get_nr_skipped(), Eq(NR_DEVS));
+}
+
+TEST_F(VerificationCacheTests, changed_subtree_is_walked)
+{
+	verification_cache::ptr cache = new_cache();
+	check(*cache);
+	cache->write(path());
+
+	insert(1, 1);
+	commit();
+
+	cache = read_cache();
+	ASSERT_THAT(check(*cache), Eq(0u));
+	ASSERT_THAT(cache->get_nr_skipped(), Eq(NR_DEVS - 1));
+}
+
+TEST_F(VerificationCacheTests, freed_subtree_is_walked)
+{
+	verification_cache::ptr cache = new_cache();
+	check(*cache);
+	cache->write(path());
+
+	sm_->set_count(dev_root(2), 0);
+
+	cache = read_cache();
+	check(*cache);
+	ASSERT_THAT(cache->get_nr_skipped(), Eq(NR_DEVS - 1));
+}
+
+TEST_F(VerificationCacheTests, counts_match_a_walk)
+{
+	verification_cache::ptr cache = new_cache();
+	check(*cache);
+	cache->write(path());
+	cache = read_cache();
+	check(*cache);
+
+	block_counter walked, cached;
+	noop_value_counter<mapping_tree_detail::block_time> vc;
+
+	for (unsigned dev = 0; dev < NR_DEVS; dev++) {
+		single_mapping_tree tree(*tm_, dev_root(dev),
+					 mapping_tree_detail::block_traits::ref_counter(data_sm_));
+		count_btree_blocks(tree, walked, vc);
+		ASSERT_TRUE(cache->count_subtree(dev_root(dev), cached));
+	}
+
+	ASSERT_THAT(cached.get_counts().size(), Gt(NR_DEVS));
+	ASSERT_TRUE(cached.get_counts() == walked.get_counts());
+}
+
+TEST_F(VerificationCacheTests, unknown_subtrees_are_not_counted)
+{
+	verification_cache::ptr cache = new_cache();
+	block_counter bc;
+
+	ASSERT_FALSE(cache->count_subtree(dev_root(0), bc));
+	ASSERT_THAT(bc.get_counts().size(), Eq(0u));
+}
+
+TEST_F(VerificationCacheTests, cache_for_another_pool_is_ignored)
+{
+	verification_cache::ptr cache = new_cache();
+	check(*cache);
+	cache->write(path());
+
+	verification_cache_key key;
+	key.metadata_nr_blocks = NR_BLOCKS;
+	ASSERT_FALSE(verification_cache::read(path(), key, sm_));
+}
+
+TEST_F(VerificationCacheTests, corrupt_cache_is_ignored)
+{
+	verification_cache::ptr cache = new_cache();
+	check(*cache);
+	cache->write(path());
+
+	corrupt(100);
+	ASSERT_FALSE(read_cache());
+}
+
+TEST_F(VerificationCacheTests, hand_written_cache_is_read)
+{
+	raw_cache raw;
+	raw.add_internal(10, 11, 12);
+	raw.add_leaf(11);
+	raw.add_leaf(12);
+	raw.write(path());
+
+	ASSERT_TRUE(read_cache());
+}
+
+TEST_F(VerificationCacheTests, cache_with_a_cycle_is_ignored)
+{
+	raw_cache raw;
+	raw.add_internal(10, 11, 12);
+	raw.add_internal(11, 13, 10);
+	raw.add_leaf(12);
+	raw.add_leaf(13);
+	raw.write(path());
+
+	ASSERT_FALSE(read_cache());
+}
+
+TEST_F(VerificationCacheTests, cache_with_a_missing_child_is_ignored)
+{
+	raw_cache raw;
+	raw.add_internal(10, 11, 12);
+	raw.add_leaf(11);
+	raw.write(path());
+
+	ASSERT_FALSE(read_cache());
+}
+
+TEST_F(VerificationCacheTests, cache_with_a_node_beyond_the_metadata_is_ignored)
+{
+	raw_cache raw;
+	raw.add_internal(10, 11, NR_BLOCKS);
+	raw.add_leaf(11);
+	raw.add_leaf(NR_BLOCKS);
+	raw.write(path());
+
+	ASSERT_FALSE(read_cache());
+}
+
+//----------------------------------------------------------------
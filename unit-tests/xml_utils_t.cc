@@ -0,0 +1,88 @@
+#include "gmock/gmock.h"
+#include "base/xml_utils.h"
+
+#include <stdexcept>
+
+using namespace std;
+using namespace testing;
+using namespace xml_utils;
+
+//----------------------------------------------------------------
+
+namespace {
+	char const * const keys[] = {
+		"origin", "data", "time"
+	};
+
+	enum {
+		ORIGIN,
+		DATA,
+		TIME,
+		NR_SLOTS
+	};
+}
+
+//----------------------------------------------------------------
+
+TEST(XMLUtilsTests, parse_uint64_small_values)
+{
+	ASSERT_THAT(parse_uint64("0", "k"), Eq(0ull));
+	ASSERT_THAT(parse_uint64("7", "k"), Eq(7ull));
+	ASSERT_THAT(parse_uint64("1234567", "k"), Eq(1234567ull));
+}
+
+TEST(XMLUtilsTests, parse_uint64_max_value)
+{
+	ASSERT_THAT(parse_uint64("18446744073709551615", "k"),
+		    Eq(18446744073709551615ull));
+}
+
+TEST(XMLUtilsTests, parse_uint64_overflow_throws)
+{
+	ASSERT_THROW(parse_uint64("18446744073709551616", "k"), runtime_error);
+	ASSERT_THROW(parse_uint64("100000000000000000000", "k"), runtime_error);
+}
+
+TEST(XMLUtilsTests, parse_uint64_garbage_throws)
+{
+	ASSERT_THROW(parse_uint64("", "k"), runtime_error);
+	ASSERT_THROW(parse_uint64("12a", "k"), runtime_error);
+	ASSERT_THROW(parse_uint64("-1", "k"), runtime_error);
+	ASSERT_THROW(parse_uint64(" 1", "k"), runtime_error);
+}
+
+TEST(XMLUtilsTests, attribute_slots_ignore_order_and_unknown_keys)
+{
+	char const *attr[] = {
+		"time", "3", "unknown", "x", "data", "200", "origin", "100", NULL
+	};
+
+	attribute_slots a(keys, NR_SLOTS, attr);
+	ASSERT_THAT(a.get_uint<uint64_t>(ORIGIN), Eq(100ull));
+	ASSERT_THAT(a.get_uint<uint64_t>(DATA), Eq(200ull));
+	ASSERT_THAT(a.get_uint<uint32_t>(TIME), Eq(3u));
+}
+
+TEST(XMLUtilsTests, attribute_slots_missing_attribute_throws)
+{
+	char const *attr[] = {
+		"origin", "100", "data", "200", NULL
+	};
+
+	attribute_slots a(keys, NR_SLOTS, attr);
+	ASSERT_FALSE(a.present(TIME));
+	ASSERT_THROW(a.get(TIME), runtime_error);
+}
+
+TEST(XMLUtilsTests, attribute_slots_range_check)
+{
+	char const *attr[] = {
+		"origin", "100", "data", "200", "time", "4294967296", NULL
+	};
+
+	attribute_slots a(keys, NR_SLOTS, attr);
+	ASSERT_THAT(a.get_uint<uint64_t>(TIME), Eq(4294967296ull));
+	ASSERT_THROW(a.get_uint<uint32_t>(TIME), runtime_error);
+}
+
+//----------------------------------------------------------------